@@ -0,0 +1,245 @@
+// End-to-end load generator: logs in N clients, spreads them over R rooms,
+// and has every client /broadcast at a fixed rate. Each message carries its
+// send time, so receivers measure delivery latency; the report compares
+// deliveries against what the room memberships imply. Point it at a single
+// server or at a cluster sharing the port to exercise cross-node routing.
+// run: $ ./bench/chatbench <host> <port> [clients] [rooms] [seconds] [rate]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define READ_BUFFER 8192
+#define JOIN_TIMEOUT_MS 5000
+#define SETTLE_MS 1000
+
+typedef struct {
+    int fd;
+    int room;
+    int joined;
+    uint64_t next_send_us;
+    char buf[READ_BUFFER];
+    size_t len;
+} Conn;
+
+static Conn* conns;
+static int conn_count;
+static uint32_t* latencies;     // microseconds
+static size_t latency_count, latency_cap;
+static unsigned long sent, received;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void record_latency(uint64_t us) {
+    if (latency_count == latency_cap) {
+        latency_cap = latency_cap ? latency_cap * 2 : 65536;
+        latencies = realloc(latencies, latency_cap * sizeof(uint32_t));
+        if (!latencies) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    latencies[latency_count++] = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static void send_line(Conn* conn, const char* line) {
+    // Short lines on a local socket; a full buffer only drops load
+    if (send(conn->fd, line, strlen(line), MSG_NOSIGNAL | MSG_DONTWAIT) < 0 &&
+        errno != EAGAIN && errno != EWOULDBLOCK) {
+        conn->joined = -1;
+    }
+}
+
+static void handle_line(Conn* conn, const char* line) {
+    const char* stamp = strstr(line, ": t=");
+    if (stamp) {
+        uint64_t sent_at = strtoull(stamp + 4, NULL, 10);
+        uint64_t now = now_us();
+        record_latency(now > sent_at ? now - sent_at : 0);
+        received++;
+    } else if (strstr(line, "[PING]")) {
+        send_line(conn, "/pong\n");
+    } else if (strstr(line, "Joined room") && conn->joined == 0) {
+        conn->joined = 1;
+    } else if (strstr(line, "[ERROR]") && conn->joined == 0) {
+        fprintf(stderr, "client %ld: %s\n", (long)(conn - conns), line);
+        conn->joined = -1;
+    }
+}
+
+static void read_conn(Conn* conn) {
+    while (1) {
+        ssize_t n = recv(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len, 0);
+        if (n == 0) {
+            conn->joined = -1;
+            return;
+        }
+        if (n < 0) return;
+        conn->len += n;
+
+        size_t start = 0;
+        char* newline;
+        while ((newline = memchr(conn->buf + start, '\n', conn->len - start))) {
+            *newline = '\0';
+            handle_line(conn, conn->buf + start);
+            start = newline - conn->buf + 1;
+        }
+        if (start == 0 && conn->len == sizeof(conn->buf)) start = conn->len;
+        memmove(conn->buf, conn->buf + start, conn->len - start);
+        conn->len -= start;
+    }
+}
+
+static void pump(int epfd, int timeout_ms) {
+    struct epoll_event events[64];
+    int n = epoll_wait(epfd, events, 64, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        read_conn(&conns[events[i].data.u32]);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <host> <port> [clients] [rooms] [seconds] [rate]\n", argv[0]);
+        return 1;
+    }
+    conn_count = argc > 3 ? atoi(argv[3]) : 12;
+    int room_count = argc > 4 ? atoi(argv[4]) : 4;
+    int seconds = argc > 5 ? atoi(argv[5]) : 10;
+    int rate = argc > 6 ? atoi(argv[6]) : 20;
+    if (conn_count <= 0 || room_count <= 0 || seconds <= 0 || rate <= 0) {
+        fprintf(stderr, "Usage: %s <host> <port> [clients] [rooms] [seconds] [rate]\n", argv[0]);
+        return 1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[2]));
+    if (inet_pton(AF_INET, argv[1], &addr.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid address: %s\n", argv[1]);
+        return 1;
+    }
+
+    conns = calloc(conn_count, sizeof(Conn));
+    int epfd = epoll_create1(0);
+    if (!conns || epfd == -1) {
+        perror("setup");
+        return 1;
+    }
+
+    // Log in and join; the username and /join are pipelined
+    for (int i = 0; i < conn_count; i++) {
+        Conn* conn = &conns[i];
+        conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (conn->fd == -1 || connect(conn->fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror("connect");
+            return 1;
+        }
+        fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+        int one = 1;
+        setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn->room = i % room_count;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+
+        char login[96];
+        snprintf(login, sizeof(login), "bench%d\n/join benchroom%d\n", i, conn->room);
+        send_line(conn, login);
+    }
+
+    uint64_t deadline = now_us() + JOIN_TIMEOUT_MS * 1000ULL;
+    int joined = 0;
+    while (joined < conn_count && now_us() < deadline) {
+        pump(epfd, 10);
+        joined = 0;
+        for (int i = 0; i < conn_count; i++) {
+            if (conns[i].joined != 0) joined++;
+        }
+    }
+
+    int* members = calloc(room_count, sizeof(int));
+    int active = 0;
+    for (int i = 0; i < conn_count; i++) {
+        if (conns[i].joined == 1) {
+            members[conns[i].room]++;
+            active++;
+        }
+    }
+    printf("clients:      %d joined of %d, %d rooms\n", active, conn_count, room_count);
+    if (active == 0) return 1;
+
+    // Load phase: staggered sends at `rate` per client
+    uint64_t interval = 1000000 / rate;
+    uint64_t start = now_us();
+    for (int i = 0; i < conn_count; i++) {
+        conns[i].next_send_us = start + (interval * i) / conn_count;
+    }
+
+    unsigned long expected = 0;
+    uint64_t end = start + seconds * 1000000ULL;
+    while (now_us() < end) {
+        uint64_t now = now_us();
+        for (int i = 0; i < conn_count; i++) {
+            Conn* conn = &conns[i];
+            // Catch up on every send that fell due while pump() waited
+            while (conn->joined == 1 && conn->next_send_us <= now) {
+                char line[64];
+                snprintf(line, sizeof(line), "/broadcast t=%llu\n", (unsigned long long)now_us());
+                send_line(conn, line);
+                conn->next_send_us += interval;
+                sent++;
+                expected += members[conn->room] - 1;
+            }
+        }
+        pump(epfd, 1);
+    }
+    uint64_t load_us = now_us() - start;
+
+    // Let in-flight messages arrive
+    uint64_t settle = now_us() + SETTLE_MS * 1000ULL;
+    while (now_us() < settle) {
+        pump(epfd, 10);
+    }
+
+    printf("sent:         %lu messages in %.1f s (%.0f msg/s)\n", sent, load_us / 1e6, sent * 1e6 / load_us);
+    printf("delivered:    %lu of %lu expected (%.0f deliveries/s)\n", received, expected,
+        received * 1e6 / load_us);
+    if (latency_count > 0) {
+        qsort(latencies, latency_count, sizeof(uint32_t), compare_u32);
+        printf("latency (us): p50 %u  p90 %u  p99 %u  max %u\n",
+            latencies[latency_count / 2], latencies[latency_count * 9 / 10],
+            latencies[latency_count * 99 / 100], latencies[latency_count - 1]);
+    }
+
+    for (int i = 0; i < conn_count; i++) {
+        close(conns[i].fd);
+    }
+    free(members);
+    free(latencies);
+    free(conns);
+    return 0;
+}
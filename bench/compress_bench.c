@@ -0,0 +1,141 @@
+// Stream compression benchmark. Generates the output a client in a busy room
+// receives (room lines from a handful of users, confirmations, the odd
+// whisper) and compresses it one message at a time: with the Compressor
+// the server uses, and with the alternatives it was chosen over. Reports
+// wire bytes against raw bytes and the deflate time per message, and checks
+// that the shipped stream inflates back to the input. Exits non-zero if it
+// does not.
+// run: $ ./bench/compress_bench [messages]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compress.h"
+
+#define MAX_LINE 256
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const char* const users[] = { "alice", "bob", "carol", "dave", "erin", "mallory" };
+static const char* const words[] = {
+    "the", "build", "is", "green", "again", "who", "broke", "staging", "deploy", "at", "noon",
+    "lunch", "anyone", "coffee", "review", "my", "PR", "please", "looks", "good", "to", "me",
+    "ship", "it", "rollback", "latency", "spike", "on", "node", "three", "thanks", "ok", "lol"
+};
+
+static size_t make_line(char* line, unsigned* seed) {
+    int kind = rand_r(seed) % 10;
+    const char* user = users[rand_r(seed) % 6];
+    if (kind == 0) return (size_t)snprintf(line, MAX_LINE, "[SUCCESS] Message broadcasted.\n");
+    int pos = kind == 1 ? snprintf(line, MAX_LINE, "[WHISPER from %s]: ", user)
+                        : snprintf(line, MAX_LINE, "[general] %s: ", user);
+    int count = 2 + rand_r(seed) % 10;
+    for (int i = 0; i < count; i++) {
+        pos += snprintf(line + pos, MAX_LINE - pos, "%s%s", i ? " " : "", words[rand_r(seed) % 33]);
+    }
+    pos += snprintf(line + pos, MAX_LINE - pos, "\n");
+    return (size_t)pos;
+}
+
+// One variant: a raw deflate stream, optionally reset for every message
+typedef struct {
+    const char* name;
+    int level;
+    int flush;
+    int dictionary;
+    int persistent;
+} Variant;
+
+static const char sample_dictionary[] = "[SUCCESS] Message broadcasted.\n[WHISPER from ]: [general] : ";
+
+static void run_variant(const Variant* v, char** lines, size_t* lens, int messages, size_t raw) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, v->level, Z_DEFLATED, -14, 8, Z_DEFAULT_STRATEGY);
+    if (v->dictionary) deflateSetDictionary(&zs, (const Bytef*)sample_dictionary, sizeof(sample_dictionary) - 1);
+
+    unsigned char out[COMPRESS_BOUND(MAX_LINE)];
+    size_t wire = 0;
+    uint64_t start = now_ns();
+    for (int i = 0; i < messages; i++) {
+        if (!v->persistent && i > 0) {
+            deflateReset(&zs);
+            if (v->dictionary) deflateSetDictionary(&zs, (const Bytef*)sample_dictionary, sizeof(sample_dictionary) - 1);
+        }
+        zs.next_in = (Bytef*)lines[i];
+        zs.avail_in = lens[i];
+        zs.next_out = out;
+        zs.avail_out = sizeof(out);
+        deflate(&zs, v->flush);
+        wire += sizeof(out) - zs.avail_out;
+    }
+    uint64_t elapsed = now_ns() - start;
+    deflateEnd(&zs);
+    printf("%-34s %10zu %7.3f %9.0f\n", v->name, wire, (double)wire / raw, (double)elapsed / messages);
+}
+
+int main(int argc, char* argv[]) {
+    int messages = argc > 1 ? atoi(argv[1]) : 100000;
+    if (messages <= 0) messages = 100000;
+
+    char** lines = malloc(sizeof(char*) * messages);
+    size_t* lens = malloc(sizeof(size_t) * messages);
+    unsigned seed = 7;
+    size_t raw = 0;
+    for (int i = 0; i < messages; i++) {
+        lines[i] = malloc(MAX_LINE);
+        lens[i] = make_line(lines[i], &seed);
+        raw += lens[i];
+    }
+    printf("%d messages, %zu raw bytes (%.1f per message)\n\n", messages, raw, (double)raw / messages);
+    printf("%-34s %10s %7s %9s\n", "", "wire", "ratio", "ns/msg");
+
+    // The shipped path, round-tripped through a second Compressor
+    static Compressor sender, receiver;
+    compressor_init(&sender);
+    compressor_init(&receiver);
+    char out[COMPRESS_BOUND(MAX_LINE)];
+    char back[MAX_LINE * 2];
+    for (int i = 0; i < messages; i++) {
+        ssize_t n = compressor_deflate(&sender, lines[i], lens[i], out, sizeof(out));
+        if (n < 0 || (size_t)n > sizeof(receiver.pending) - receiver.pending_len) {
+            printf("FAIL: deflate of message %d\n", i);
+            return 1;
+        }
+        memcpy(receiver.pending + receiver.pending_len, out, n);
+        receiver.pending_len += n;
+        ssize_t got = compressor_inflate(&receiver, back, sizeof(back));
+        if (got != (ssize_t)lens[i] || memcmp(back, lines[i], lens[i]) != 0) {
+            printf("FAIL: message %d did not come back whole (%zd of %zu bytes)\n", i, got, lens[i]);
+            return 1;
+        }
+    }
+    printf("%-34s %10llu %7.3f %9.0f\n", "Compressor (shipped)", (unsigned long long)sender.stats.wire_out,
+        (double)sender.stats.wire_out / sender.stats.raw_out, (double)sender.stats.deflate_ns / sender.stats.messages_out);
+    printf("%-34s %10s %7s %9.0f\n", "  inflate on the receiving side", "", "",
+        (double)receiver.stats.inflate_ns / messages);
+    compressor_free(&sender);
+    compressor_free(&receiver);
+
+    static const Variant variants[] = {
+        { "partial flush, dictionary",        6, Z_PARTIAL_FLUSH, 1, 1 },
+        { "partial flush, dictionary, level 1", 1, Z_PARTIAL_FLUSH, 1, 1 },
+        { "sync flush, dictionary",           6, Z_SYNC_FLUSH,    1, 1 },
+        { "partial flush, no dictionary",     6, Z_PARTIAL_FLUSH, 0, 1 },
+        { "fresh stream per message",         6, Z_FINISH,        1, 0 },
+    };
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+        run_variant(&variants[i], lines, lens, messages, raw);
+    }
+
+    for (int i = 0; i < messages; i++) free(lines[i]);
+    free(lines);
+    free(lens);
+    return 0;
+}
@@ -0,0 +1,129 @@
+// Username directory benchmark. Runs several Directory instances in one
+// process over a stand-in transport that hands each frame straight to the
+// addressed instance, registers users spread across the nodes, and times
+// lookups the way whispers issue them, reporting how many never left the
+// node. The correctness checks live in tests/directory_test.c.
+// run: $ ./bench/directory_bench [nodes] [users] [lookups]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "directory.h"
+
+#define MAX_BENCH_NODES 16
+
+static Directory dirs[MAX_BENCH_NODES];
+static int node_ids[MAX_BENCH_NODES];
+static int node_count;
+static int last_claim_result;
+static uint64_t frames_sent;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Delivered synchronously; replies recurse back into the sender
+static int stand_in_send(void* ctx, int node, const char* frame) {
+    char copy[DIR_FRAME_LEN];
+    snprintf(copy, sizeof(copy), "%s", frame);
+    frames_sent++;
+    return directory_handle_frame(&dirs[node], *(int*)ctx, copy) ? 0 : -1;
+}
+
+static int stand_in_owner(void* ctx, const char* name) {
+    (void)ctx;
+    uint32_t hash = 2166136261u;
+    for (; *name; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash % node_count;
+}
+
+static void stand_in_claim_done(void* ctx, uint64_t token, const char* name, int result) {
+    (void)ctx;
+    (void)token;
+    (void)name;
+    last_claim_result = result;
+}
+
+static int claim(int node, const char* name) {
+    int result = directory_claim(&dirs[node], name, 1);
+    return result == DIR_PENDING ? last_claim_result : result;
+}
+
+int main(int argc, char* argv[]) {
+    node_count = argc > 1 ? atoi(argv[1]) : 4;
+    int users = argc > 2 ? atoi(argv[2]) : 10000;
+    int lookups = argc > 3 ? atoi(argv[3]) : 1000000;
+    if (node_count < 2 || node_count > MAX_BENCH_NODES || users <= 0 || lookups <= 0) {
+        fprintf(stderr, "Usage: %s [nodes 2-%d] [users] [lookups]\n", argv[0], MAX_BENCH_NODES);
+        return 1;
+    }
+
+    for (int i = 0; i < node_count; i++) {
+        node_ids[i] = i;
+        DirectoryTransport transport = { stand_in_send, stand_in_owner, stand_in_claim_done, &node_ids[i] };
+        if (directory_init(&dirs[i], i, users, &transport) == -1) {
+            perror("directory_init");
+            return 1;
+        }
+    }
+
+    int failures = 0;
+    char name[DIR_NAME_LEN + 1];
+
+    // Every user logs in on node (i % nodes)
+    for (int i = 0; i < users; i++) {
+        snprintf(name, sizeof(name), "user%d", i);
+        if (claim(i % node_count, name) != DIR_GRANTED) failures++;
+    }
+    printf("claims:      %d users on %d nodes\n", users, node_count);
+
+    // Whole-cluster sweep: the first pass asks the owners, the second is cached
+    uint64_t before = frames_sent;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int node = 0; node < node_count; node++) {
+            for (int i = 0; i < users; i++) {
+                snprintf(name, sizeof(name), "user%d", i);
+                if (directory_lookup(&dirs[node], name, 100) < 0) failures++;
+            }
+        }
+        printf("sweep %d:     %llu frames for %d lookups\n", pass + 1,
+            (unsigned long long)(frames_sent - before), users * node_count);
+        before = frames_sent;
+    }
+
+    // Whisper traffic: random sender node, random online target
+    for (int i = 0; i < node_count; i++) {
+        dirs[i].local_hits = 0;
+        dirs[i].remote_lookups = 0;
+    }
+    srand(42);
+    uint64_t start = now_ns();
+    for (int i = 0; i < lookups; i++) {
+        snprintf(name, sizeof(name), "user%d", rand() % users);
+        if (directory_lookup(&dirs[rand() % node_count], name, 100) < 0) failures++;
+    }
+    double per_lookup = (double)(now_ns() - start) / lookups;
+
+    uint64_t hits = 0, remote = 0;
+    for (int i = 0; i < node_count; i++) {
+        hits += dirs[i].local_hits;
+        remote += dirs[i].remote_lookups;
+    }
+    printf("lookups:     %d in %.1f ns each, %.2f%% answered locally (%llu round trips)\n",
+        lookups, per_lookup, 100.0 * hits / (hits + remote), (unsigned long long)remote);
+
+    for (int i = 0; i < node_count; i++) {
+        directory_destroy(&dirs[i]);
+    }
+    if (failures) {
+        printf("FAILED:      %d claims or lookups went unanswered\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+// Room fan-out benchmark. Delivers room lines to synthetic members through
+// the FanoutPool the server uses (--fanout-workers), for a range of room
+// sizes and worker counts. A member stands in for a Client's output path:
+// it takes the member's lock and copies the shared message into the
+// member's queue, as client_send_raw() does for a socket that is not
+// taking writes. Reports the median and 99th percentile time for one
+// broadcast to reach every member, and checks that every member got every
+// line. Exits non-zero if not.
+// run: $ ./bench/fanout_bench [broadcasts] [shard]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fanout.h"
+
+#define QUEUE_BYTES 2048
+
+typedef struct {
+    pthread_mutex_t mutex;
+    char queue[QUEUE_BYTES];
+    size_t used;
+    uint64_t received;
+} Member;
+
+typedef struct {
+    Member* members;
+    const char* message;
+    size_t len;
+} Broadcast;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void deliver(void* arg, int begin, int end) {
+    Broadcast* b = arg;
+    for (int i = begin; i < end; i++) {
+        Member* m = &b->members[i];
+        pthread_mutex_lock(&m->mutex);
+        // A full queue starts over: the bytes are never read
+        if (m->used + b->len > QUEUE_BYTES) m->used = 0;
+        memcpy(m->queue + m->used, b->message, b->len);
+        m->used += b->len;
+        m->received++;
+        pthread_mutex_unlock(&m->mutex);
+    }
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Returns 0 if every member received every line
+static int run(int room_size, int workers, int shard, int broadcasts, uint64_t* samples) {
+    Member* members = calloc(room_size, sizeof(Member));
+    for (int i = 0; i < room_size; i++) pthread_mutex_init(&members[i].mutex, NULL);
+
+    FanoutPool pool;
+    if (fanout_pool_init(&pool, workers) != 0) {
+        printf("FAIL: could not start %d workers\n", workers);
+        return 1;
+    }
+    char message[128];
+    int len = snprintf(message, sizeof(message), "[general] alice: the build is green again, ship it\n");
+    Broadcast b = { members, message, (size_t)len };
+    int shards = 1;
+    for (int i = 0; i < broadcasts; i++) {
+        uint64_t start = now_ns();
+        shards = fanout_run(&pool, room_size, shard, deliver, &b);
+        samples[i] = now_ns() - start;
+    }
+    fanout_pool_destroy(&pool);
+
+    int failed = 0;
+    for (int i = 0; i < room_size; i++) {
+        if (members[i].received != (uint64_t)broadcasts) failed = 1;
+        pthread_mutex_destroy(&members[i].mutex);
+    }
+    free(members);
+
+    qsort(samples, broadcasts, sizeof(uint64_t), compare_u64);
+    uint64_t median = samples[broadcasts / 2];
+    uint64_t p99 = samples[(size_t)broadcasts * 99 / 100];
+    printf("%8d %8d %7d %11.1f %11.1f %9.1f\n", room_size, workers, shards,
+        median / 1000.0, p99 / 1000.0, (double)median / room_size);
+    if (failed) printf("FAIL: %d members, %d workers: a member missed lines\n", room_size, workers);
+    return failed;
+}
+
+int main(int argc, char* argv[]) {
+    int broadcasts = argc > 1 ? atoi(argv[1]) : 200;
+    int shard = argc > 2 ? atoi(argv[2]) : 1024;
+    if (broadcasts <= 0) broadcasts = 200;
+    if (shard <= 0) shard = 1024;
+
+    static const int room_sizes[] = { 100, 1000, 10000, 50000 };
+    static const int worker_counts[] = { 0, 1, 3, 7 };
+    uint64_t* samples = malloc(sizeof(uint64_t) * broadcasts);
+
+    printf("%d broadcasts per run, shard %d members, %ld CPUs online\n\n", broadcasts, shard, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %8s %7s %11s %11s %9s\n", "members", "workers", "shards", "median us", "p99 us", "ns/member");
+    int failed = 0;
+    for (size_t r = 0; r < sizeof(room_sizes) / sizeof(room_sizes[0]); r++) {
+        for (size_t w = 0; w < sizeof(worker_counts) / sizeof(worker_counts[0]); w++) {
+            failed |= run(room_sizes[r], worker_counts[w], shard, broadcasts, samples);
+        }
+    }
+    free(samples);
+    return failed;
+}
@@ -0,0 +1,133 @@
+// Moderation filter benchmark. Compiles phrase lists of growing size into
+// the automaton the server uses (--filter) and runs chat lines through it,
+// about one in a hundred carrying a banned phrase. Reports compile time,
+// table size and throughput in MB/s, next to a strcasestr() loop over the
+// same phrases. The loop also checks the automaton's verdict on every line
+// it sees. Exits non-zero if they disagree.
+// run: $ ./bench/filter_bench [lines]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "filter.h"
+
+#define MAX_LINE 256
+#define VOCABULARY 4096
+#define NAIVE_BUDGET_NS 500000000ULL  // per list size; the loop stops early past this
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static char vocabulary[VOCABULARY][12];
+
+static void make_vocabulary(unsigned* seed) {
+    for (int i = 0; i < VOCABULARY; i++) {
+        int len = 3 + rand_r(seed) % 7;
+        for (int j = 0; j < len; j++) vocabulary[i][j] = 'a' + rand_r(seed) % 26;
+        vocabulary[i][len] = '\0';
+    }
+}
+
+// Two or three vocabulary words: "word word"
+static char* make_phrase(unsigned* seed) {
+    char phrase[64];
+    int words = 2 + rand_r(seed) % 2;
+    int pos = 0;
+    for (int i = 0; i < words; i++) {
+        pos += snprintf(phrase + pos, sizeof(phrase) - pos, "%s%s", i ? " " : "", vocabulary[rand_r(seed) % VOCABULARY]);
+    }
+    return strdup(phrase);
+}
+
+static size_t make_line(char* line, unsigned* seed, char** phrases, size_t count) {
+    int words = 4 + rand_r(seed) % 12;
+    int pos = 0;
+    for (int i = 0; i < words; i++) {
+        const char* word = vocabulary[rand_r(seed) % VOCABULARY];
+        // Some capitals, which the filter must see through
+        pos += snprintf(line + pos, MAX_LINE - pos, "%s%c%s", i ? " " : "", word[0] - (i == 0 ? 32 : 0), word + 1);
+    }
+    if (rand_r(seed) % 100 == 0) {
+        pos += snprintf(line + pos, MAX_LINE - pos, " %s", phrases[rand_r(seed) % count]);
+    }
+    return (size_t)pos;
+}
+
+int main(int argc, char* argv[]) {
+    int line_count = argc > 1 ? atoi(argv[1]) : 200000;
+    if (line_count <= 0) line_count = 200000;
+
+    unsigned seed = 11;
+    make_vocabulary(&seed);
+    static const size_t list_sizes[] = { 10, 100, 1000, 10000, 50000 };
+    size_t max_phrases = list_sizes[sizeof(list_sizes) / sizeof(list_sizes[0]) - 1];
+    char** phrases = malloc(sizeof(char*) * max_phrases);
+    for (size_t i = 0; i < max_phrases; i++) phrases[i] = make_phrase(&seed);
+
+    printf("%d lines per run\n\n", line_count);
+    printf("%8s %8s %9s %10s %9s %9s %12s %9s\n", "phrases", "states", "table KB", "compile ms",
+        "blocked", "MB/s", "strcasestr", "MB/s");
+    int failed = 0;
+    char* lines = malloc((size_t)line_count * MAX_LINE);
+    size_t* lens = malloc(sizeof(size_t) * line_count);
+    for (size_t r = 0; r < sizeof(list_sizes) / sizeof(list_sizes[0]); r++) {
+        size_t count = list_sizes[r];
+        size_t bytes = 0;
+        unsigned text_seed = 23;
+        for (int i = 0; i < line_count; i++) {
+            lens[i] = make_line(lines + (size_t)i * MAX_LINE, &text_seed, phrases, count);
+            bytes += lens[i];
+        }
+
+        uint64_t start = now_ns();
+        FilterAutomaton* filter = filter_compile((const char* const*)phrases, count);
+        uint64_t compile = now_ns() - start;
+        if (!filter) {
+            printf("FAIL: could not compile %zu phrases\n", count);
+            return 1;
+        }
+
+        int blocked = 0;
+        start = now_ns();
+        for (int i = 0; i < line_count; i++) {
+            blocked += filter_match(filter, lines + (size_t)i * MAX_LINE, lens[i]);
+        }
+        uint64_t elapsed = now_ns() - start;
+
+        // The loop it replaces, on as many lines as fit the time budget
+        int checked = 0;
+        size_t naive_bytes = 0;
+        start = now_ns();
+        while (checked < line_count && now_ns() - start < NAIVE_BUDGET_NS) {
+            const char* line = lines + (size_t)checked * MAX_LINE;
+            int hit = 0;
+            for (size_t p = 0; p < count && !hit; p++) hit = strcasestr(line, phrases[p]) != NULL;
+            if (hit != filter_match(filter, line, lens[checked])) {
+                printf("FAIL: %zu phrases, line %d: automaton says %d, strcasestr says %d\n",
+                    count, checked, !hit, hit);
+                failed = 1;
+            }
+            naive_bytes += lens[checked];
+            checked++;
+        }
+        uint64_t naive = now_ns() - start;
+
+        char naive_lines[24];
+        snprintf(naive_lines, sizeof(naive_lines), "%d lines", checked);
+        printf("%8zu %8u %9zu %10.2f %9d %9.0f %12s %9.1f\n", count, filter->state_count,
+            filter_memory(filter) / 1024, compile / 1e6, blocked, bytes * 1e3 / elapsed,
+            naive_lines, naive ? naive_bytes * 1e3 / naive : 0.0);
+        filter_free(filter);
+    }
+
+    for (size_t i = 0; i < max_phrases; i++) free(phrases[i]);
+    free(phrases);
+    free(lines);
+    free(lens);
+    return failed;
+}
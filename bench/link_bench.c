@@ -0,0 +1,205 @@
+// Inter-node link micro-benchmark. Streams DELIVER frames from one process
+// to another over TCP loopback using the batched link protocol, with the
+// receiver acknowledging every read and the sender honouring its window,
+// the same way cluster.c does. One run per batch size: 1 message per batch
+// is what an unbatched link costs, larger batches show what coalescing buys.
+// run: $ ./bench/link_bench [messages]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "link_proto.h"
+
+#define WINDOW 32
+#define MAX_FRAME 4224
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int send_all(int sock, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Receiver: checks sequence numbers and message order, ACKs every read.
+static int receive(int sock, long messages) {
+    static char buf[LINK_MAX_FRAME * 2];
+    size_t have = 0;
+    uint32_t expected = 1;
+    long seen = 0;
+
+    while (seen < messages) {
+        ssize_t n = recv(sock, buf + have, sizeof(buf) - have, 0);
+        if (n <= 0) return -1;
+        have += n;
+
+        size_t start = 0;
+        LinkHeader header;
+        int size;
+        while ((size = link_frame_parse(buf + start, have - start, &header)) > 0) {
+            if (header.type != LINK_BATCH || header.seq != expected++) return -1;
+            char* cursor = buf + start + LINK_HEADER_BYTES;
+            char* end = buf + start + size;
+            char* frame;
+            size_t len;
+            while ((frame = link_batch_next(&cursor, end, &len))) {
+                if (strtol(strrchr(frame, '=') + 1, NULL, 10) != seen++) return -1;
+            }
+            start += size;
+        }
+        if (size < 0) return -1;
+        memmove(buf, buf + start, have - start);
+        have -= start;
+
+        char ack[LINK_HEADER_BYTES];
+        link_ack_encode(ack, expected - 1, WINDOW);
+        if (send_all(sock, ack, sizeof(ack)) == -1) return -1;
+    }
+    // Hold the connection until the sender has read the last ACK
+    while (recv(sock, buf, sizeof(buf), 0) > 0) {
+    }
+    return 0;
+}
+
+typedef struct {
+    int sock;
+    uint32_t acked;
+    char ackbuf[LINK_HEADER_BYTES];
+    size_t ackbuf_len;
+    long writes;
+} Sender;
+
+static int read_acks(Sender* s, int block) {
+    do {
+        ssize_t n = recv(s->sock, s->ackbuf + s->ackbuf_len, sizeof(s->ackbuf) - s->ackbuf_len,
+                         block ? 0 : MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n <= 0) return -1;
+        s->ackbuf_len += n;
+        if (s->ackbuf_len == sizeof(s->ackbuf)) {
+            LinkHeader header;
+            if (link_frame_parse(s->ackbuf, sizeof(s->ackbuf), &header) <= 0) return -1;
+            s->acked = header.seq;
+            s->ackbuf_len = 0;
+            block = 0;
+        }
+    } while (1);
+}
+
+static int send_batch(Sender* s, LinkBatch* batch, uint32_t seq) {
+    size_t len = link_batch_seal(batch, seq);
+    while (seq - s->acked > WINDOW) {
+        if (read_acks(s, 1) == -1) return -1;
+    }
+    s->writes++;
+    if (send_all(s->sock, batch->data, len) == -1) return -1;
+    link_batch_reset(batch);
+    return read_acks(s, 0);
+}
+
+// Returns messages per second, or -1 on a protocol error.
+static double run(int listener, struct sockaddr_in* addr, long messages, int per_batch,
+                  double* writes_per_msg, double* bytes_per_msg) {
+    pid_t child = fork();
+    if (child == 0) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(sock, (struct sockaddr*)addr, sizeof(*addr)) == -1) _exit(1);
+        _exit(receive(sock, messages) == 0 ? 0 : 1);
+    }
+
+    Sender s;
+    memset(&s, 0, sizeof(s));
+    s.sock = accept(listener, NULL, NULL);
+    int one = 1;
+    setsockopt(s.sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    static LinkBatch batch;
+    link_batch_reset(&batch);
+    uint32_t seq = 1;
+    long bytes = 0;
+    uint64_t start = now_ns();
+    for (long i = 0; i < messages; i++) {
+        char* frame = link_batch_reserve(&batch, MAX_FRAME);
+        if (!frame || batch.count == per_batch) {
+            bytes += batch.len;
+            if (send_batch(&s, &batch, seq++) == -1) return -1;
+            frame = link_batch_reserve(&batch, MAX_FRAME);
+        }
+        int len = snprintf(frame, MAX_FRAME, "DELIVER benchroom bench7 the quick brown fox jumps over t=%ld", i);
+        link_batch_commit(&batch, frame, len + 1);
+    }
+    if (batch.count > 0) {
+        bytes += batch.len;
+        if (send_batch(&s, &batch, seq++) == -1) return -1;
+    }
+    while (s.acked != seq - 1) {
+        if (read_acks(&s, 1) == -1) return -1;
+    }
+    double seconds = (double)(now_ns() - start) / 1e9;
+
+    close(s.sock);
+    int status;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    *writes_per_msg = (double)s.writes / messages;
+    *bytes_per_msg = (double)bytes / messages;
+    return messages / seconds;
+}
+
+int main(int argc, char* argv[]) {
+    long messages = argc > 1 ? atol(argv[1]) : 500000;
+    if (messages <= 0) {
+        fprintf(stderr, "Usage: %s [messages]\n", argv[0]);
+        return 1;
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(listener, 1) == -1 ||
+        getsockname(listener, (struct sockaddr*)&addr, &addr_len) == -1) {
+        perror("listen");
+        return 1;
+    }
+
+    printf("%ld messages over TCP loopback, window %d batches\n", messages, WINDOW);
+    printf("%-12s %14s %14s %14s\n", "per batch", "msgs/s", "writes/msg", "bytes/msg");
+    static const int sizes[] = { 1, 8, 64, 0 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        double writes, bytes;
+        double rate = run(listener, &addr, messages, sizes[i] ? sizes[i] : -1, &writes, &bytes);
+        if (rate < 0) {
+            fprintf(stderr, "link stream failed at batch size %d\n", sizes[i]);
+            return 1;
+        }
+        char label[16];
+        if (sizes[i]) snprintf(label, sizeof(label), "%d", sizes[i]);
+        else snprintf(label, sizeof(label), "full (%dK)", LINK_BATCH_BYTES / 1024);
+        printf("%-12s %14.0f %14.3f %14.1f\n", label, rate, writes, bytes);
+    }
+    close(listener);
+    return 0;
+}
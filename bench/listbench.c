@@ -0,0 +1,251 @@
+// /who and /rooms under churn: C clients join and leave one room as fast as
+// the server answers them, while one more client, sitting alone in a quiet
+// room, asks in turn for the churning room's members, the quiet room's
+// members and the room list at a fixed rate. Replies come back in order, so
+// each one is matched to its request's send time for the latency report,
+// kept per request. The server's own "[STATS] listings" line at the end
+// shows how many were served from the cached listing and how many needed a
+// rebuild.
+// run: $ ./bench/listbench <host> <port> [churners] [seconds] [rate]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define READ_BUFFER 8192
+#define MAX_IN_FLIGHT 65536
+#define LOGIN_WAIT_MS 1000
+#define SETTLE_MS 1000
+
+// What the lister asks for, in turn
+enum { ASK_WHO_CHURN, ASK_WHO_QUIET, ASK_ROOMS, ASK_KINDS };
+
+static const char* const ask_lines[ASK_KINDS] = { "/who churnroom\n", "/who quietroom\n", "/rooms\n" };
+static const char* const ask_names[ASK_KINDS] = { "/who churn", "/who quiet", "/rooms" };
+
+typedef struct {
+    uint32_t* us;
+    size_t count, cap;
+} Latencies;
+
+typedef struct {
+    int fd;
+    int churner;
+    int in_room;                // churner: last request was /join
+    char buf[READ_BUFFER];
+    size_t len;
+} Conn;
+
+static Conn* conns;
+static int conn_count;
+static uint64_t sent_at[MAX_IN_FLIGHT];  // lister requests awaiting a reply, FIFO
+static int sent_kind[MAX_IN_FLIGHT];
+static size_t fifo_head, fifo_tail;
+static Latencies latencies[ASK_KINDS];
+static unsigned long churn_ops, replies, misses;
+static char stats_line[256];
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void record_latency(Latencies* lat, uint64_t us) {
+    if (lat->count == lat->cap) {
+        lat->cap = lat->cap ? lat->cap * 2 : 65536;
+        lat->us = realloc(lat->us, lat->cap * sizeof(uint32_t));
+        if (!lat->us) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    lat->us[lat->count++] = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static void send_line(Conn* conn, const char* line) {
+    if (send(conn->fd, line, strlen(line), MSG_NOSIGNAL | MSG_DONTWAIT) < 0 &&
+        errno != EAGAIN && errno != EWOULDBLOCK) {
+        conn->fd = -1;
+    }
+}
+
+// A churner flips between in and out of the room on every answer
+static void churn(Conn* conn) {
+    send_line(conn, conn->in_room ? "/leave churnroom\n" : "/join churnroom\n");
+    conn->in_room = !conn->in_room;
+    churn_ops++;
+}
+
+static void handle_line(Conn* conn, const char* line) {
+    if (strstr(line, "[PING]")) {
+        send_line(conn, "/pong\n");
+    } else if (conn->churner) {
+        if (strncmp(line, "[SUCCESS]", 9) == 0) churn(conn);
+    } else if (strncmp(line, "[WHO]", 5) == 0 || strncmp(line, "[ROOMS]", 7) == 0 ||
+               strncmp(line, "[ERROR] No room", 15) == 0) {
+        // The room is empty now and then; that is an answer too
+        if (line[1] == 'E') misses++;
+        if (fifo_head != fifo_tail) {
+            size_t at = fifo_head++ % MAX_IN_FLIGHT;
+            record_latency(&latencies[sent_kind[at]], now_us() - sent_at[at]);
+        }
+        replies++;
+    } else if (strncmp(line, "[STATS] listings", 16) == 0) {
+        snprintf(stats_line, sizeof(stats_line), "%s", line);
+    }
+}
+
+static void read_conn(Conn* conn) {
+    while (conn->fd != -1) {
+        ssize_t n = recv(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len, 0);
+        if (n == 0) {
+            conn->fd = -1;
+            return;
+        }
+        if (n < 0) return;
+        conn->len += n;
+
+        size_t start = 0;
+        char* newline;
+        while ((newline = memchr(conn->buf + start, '\n', conn->len - start))) {
+            *newline = '\0';
+            handle_line(conn, conn->buf + start);
+            start = newline - conn->buf + 1;
+        }
+        if (start == 0 && conn->len == sizeof(conn->buf)) start = conn->len;
+        memmove(conn->buf, conn->buf + start, conn->len - start);
+        conn->len -= start;
+    }
+}
+
+static void pump(int epfd, int timeout_ms) {
+    struct epoll_event events[64];
+    int n = epoll_wait(epfd, events, 64, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        read_conn(&conns[events[i].data.u32]);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <host> <port> [churners] [seconds] [rate]\n", argv[0]);
+        return 1;
+    }
+    int churners = argc > 3 ? atoi(argv[3]) : 10;
+    int seconds = argc > 4 ? atoi(argv[4]) : 10;
+    int rate = argc > 5 ? atoi(argv[5]) : 1000;
+    if (churners <= 0 || seconds <= 0 || rate <= 0) {
+        fprintf(stderr, "Usage: %s <host> <port> [churners] [seconds] [rate]\n", argv[0]);
+        return 1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[2]));
+    if (inet_pton(AF_INET, argv[1], &addr.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid address: %s\n", argv[1]);
+        return 1;
+    }
+
+    // conns[0] lists, the rest churn
+    conn_count = churners + 1;
+    conns = calloc(conn_count, sizeof(Conn));
+    int epfd = epoll_create1(0);
+    if (!conns || epfd == -1) {
+        perror("setup");
+        return 1;
+    }
+    for (int i = 0; i < conn_count; i++) {
+        Conn* conn = &conns[i];
+        conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (conn->fd == -1 || connect(conn->fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror("connect");
+            return 1;
+        }
+        fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+        int one = 1;
+        setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn->churner = i > 0;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+
+        char login[64];
+        snprintf(login, sizeof(login), i ? "churn%d\n" : "lister\n/join quietroom\n", i);
+        send_line(conn, login);
+    }
+
+    // Let the greetings pass before churning starts
+    uint64_t ready = now_us() + LOGIN_WAIT_MS * 1000ULL;
+    while (now_us() < ready) pump(epfd, 10);
+    for (int i = 1; i < conn_count; i++) churn(&conns[i]);
+    churn_ops = 0;
+
+    uint64_t interval = 1000000 / rate;
+    uint64_t start = now_us();
+    uint64_t next_send = start;
+    uint64_t end = start + seconds * 1000000ULL;
+    unsigned long requests = 0;
+    while (now_us() < end) {
+        uint64_t now = now_us();
+        while (next_send <= now && fifo_tail - fifo_head < MAX_IN_FLIGHT) {
+            int kind = requests % ASK_KINDS;
+            send_line(&conns[0], ask_lines[kind]);
+            sent_kind[fifo_tail % MAX_IN_FLIGHT] = kind;
+            sent_at[fifo_tail++ % MAX_IN_FLIGHT] = now;
+            next_send += interval;
+            requests++;
+        }
+        pump(epfd, 1);
+    }
+    uint64_t load_us = now_us() - start;
+    unsigned long churned = churn_ops;
+
+    // Stop churning, let the last replies arrive, then ask for the totals
+    for (int i = 1; i < conn_count; i++) conns[i].churner = 0;
+    uint64_t settle = now_us() + SETTLE_MS * 1000ULL;
+    while (now_us() < settle) pump(epfd, 10);
+    send_line(&conns[0], "/stats\n");
+    settle = now_us() + SETTLE_MS * 1000ULL;
+    while (now_us() < settle && stats_line[0] == '\0') pump(epfd, 10);
+
+    printf("churn:        %d clients, %lu joins and leaves (%.0f/s)\n", churners, churned, churned * 1e6 / load_us);
+    printf("listings:     %lu requested, %lu answered in %.1f s (%.0f/s), %lu while the room was empty\n",
+        requests, replies, load_us / 1e6, replies * 1e6 / load_us, misses);
+    for (int kind = 0; kind < ASK_KINDS; kind++) {
+        Latencies* lat = &latencies[kind];
+        if (lat->count == 0) continue;
+        qsort(lat->us, lat->count, sizeof(uint32_t), compare_u32);
+        printf("%-10s (us): p50 %u  p90 %u  p99 %u  max %u\n", ask_names[kind],
+            lat->us[lat->count / 2], lat->us[lat->count * 9 / 10],
+            lat->us[lat->count * 99 / 100], lat->us[lat->count - 1]);
+    }
+    if (stats_line[0]) printf("server:       %s\n", stats_line);
+
+    for (int i = 0; i < conn_count; i++) {
+        if (conns[i].fd != -1) close(conns[i].fd);
+    }
+    for (int kind = 0; kind < ASK_KINDS; kind++) free(latencies[kind].us);
+    free(conns);
+    return replies == requests ? 0 : 1;
+}
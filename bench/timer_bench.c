@@ -0,0 +1,97 @@
+// Timer wheel micro-benchmark: arms N idle + heartbeat timers (default 100k
+// connections), simulates several minutes of 100 ms ticks with a fraction of
+// connections resetting their idle timer every tick, and reports CPU cost.
+// run: $ ./bench/timer_bench [connections] [simulated_seconds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "timer_wheel.h"
+
+#define TICK_MS 100
+#define IDLE_MS 120000
+#define HEARTBEAT_MS 30000
+
+typedef struct {
+    Timer idle;
+    Timer heartbeat;
+} Conn;
+
+static TimerWheel wheel;
+static uint64_t now;
+static unsigned long fired_idle, fired_heartbeat;
+
+static double cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void on_idle(Timer* timer, void* arg) {
+    (void)timer;
+    (void)arg;
+    fired_idle++;
+}
+
+static void on_heartbeat(Timer* timer, void* arg) {
+    (void)arg;
+    fired_heartbeat++;
+    timer_arm(&wheel, timer, HEARTBEAT_MS, now);
+}
+
+int main(int argc, char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    int seconds = argc > 2 ? atoi(argv[2]) : 600;
+    if (count <= 0 || seconds <= 0) {
+        fprintf(stderr, "Usage: %s [connections] [simulated_seconds]\n", argv[0]);
+        return 1;
+    }
+
+    Conn* conns = calloc(count, sizeof(Conn));
+    if (!conns) {
+        perror("calloc");
+        return 1;
+    }
+    srand(42);
+
+    timer_wheel_init(&wheel, TICK_MS, now);
+
+    double start = cpu_seconds();
+    for (int i = 0; i < count; i++) {
+        timer_init(&conns[i].idle, on_idle, &conns[i]);
+        timer_init(&conns[i].heartbeat, on_heartbeat, &conns[i]);
+        timer_arm(&wheel, &conns[i].idle, IDLE_MS, now);
+        timer_arm(&wheel, &conns[i].heartbeat, HEARTBEAT_MS + rand() % HEARTBEAT_MS, now);
+    }
+    double arm_time = cpu_seconds() - start;
+
+    // Every tick 5% of connections show activity and push their idle deadline
+    // out; the last 10% never do and expire.
+    int resets_per_tick = count / 20;
+    unsigned long resets = 0;
+    int ticks = seconds * 1000 / TICK_MS;
+
+    start = cpu_seconds();
+    for (int t = 0; t < ticks; t++) {
+        now += TICK_MS;
+        for (int r = 0; r < resets_per_tick; r++) {
+            timer_arm(&wheel, &conns[rand() % (count - count / 10)].idle, IDLE_MS, now);
+        }
+        resets += resets_per_tick;
+        timer_wheel_advance(&wheel, now);
+    }
+    double run_time = cpu_seconds() - start;
+
+    printf("connections:        %d (%zu timers armed at end)\n", count, wheel.armed_count);
+    printf("initial arm:        %.1f ns/timer\n", arm_time * 1e9 / (2.0 * count));
+    printf("simulated:          %d s in %d ticks\n", seconds, ticks);
+    printf("idle resets:        %lu (%.1f ns/reset incl. tick processing)\n",
+        resets, run_time * 1e9 / (double)(resets ? resets : 1));
+    printf("fired:              %lu idle, %lu heartbeat\n", fired_idle, fired_heartbeat);
+    printf("cpu:                %.3f s for %d s simulated (%.3f%% of one core)\n",
+        run_time, seconds, run_time * 100.0 / seconds);
+
+    free(conns);
+    return 0;
+}
@@ -0,0 +1,188 @@
+// Local transport latency: TCP loopback versus the --unix listener. For each
+// transport a sender and a receiver log in and join the same room; the
+// sender then broadcasts one message at a time and waits until the receiver
+// has read it, so every sample is a full client -> server -> client trip
+// with nothing else queued. Start the server with both listeners, e.g.
+//   ./chatserver --unix /tmp/chat.sock 8080
+// run: $ ./bench/unix_bench <port> <unix path> [messages]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define READ_BUFFER 8192
+#define WARMUP_MESSAGES 100
+
+typedef struct {
+    int fd;
+    char buf[READ_BUFFER];
+    size_t len;
+} Conn;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int connect_tcp(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    // Chat clients send small writes; the comparison would otherwise be Nagle's
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    return fd;
+}
+
+static int connect_unix(const char* path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void send_line(Conn* conn, const char* line) {
+    size_t len = strlen(line);
+    if (send(conn->fd, line, len, MSG_NOSIGNAL) != (ssize_t)len) {
+        fprintf(stderr, "send failed: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+// Blocks until a received line contains `needle`; earlier lines are dropped.
+static void wait_for(Conn* conn, const char* needle) {
+    while (1) {
+        char* newline;
+        while ((newline = memchr(conn->buf, '\n', conn->len))) {
+            *newline = '\0';
+            int found = strstr(conn->buf, needle) != NULL;
+            size_t consumed = newline - conn->buf + 1;
+            memmove(conn->buf, conn->buf + consumed, conn->len - consumed);
+            conn->len -= consumed;
+            if (found) return;
+        }
+        if (conn->len == sizeof(conn->buf)) conn->len = 0;
+        ssize_t n = recv(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len, 0);
+        if (n <= 0) {
+            fprintf(stderr, "connection closed while waiting for '%s'\n", needle);
+            exit(1);
+        }
+        conn->len += n;
+    }
+}
+
+// The sender's own confirmations pile up unread otherwise
+static void drain(Conn* conn) {
+    char scratch[READ_BUFFER];
+    while (recv(conn->fd, scratch, sizeof(scratch), MSG_DONTWAIT) > 0) {}
+}
+
+static void login(Conn* conn, const char* name, const char* room) {
+    char line[128];
+    // The prompt has no newline; the server sends nothing else before it
+    conn->len = 0;
+    while (!memmem(conn->buf, conn->len, "username", 8)) {
+        ssize_t n = recv(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len, 0);
+        if (n <= 0) {
+            fprintf(stderr, "no login prompt\n");
+            exit(1);
+        }
+        conn->len += n;
+    }
+    conn->len = 0;
+
+    snprintf(line, sizeof(line), "%s\n", name);
+    send_line(conn, line);
+    wait_for(conn, "Commands:");
+    snprintf(line, sizeof(line), "/join %s\n", room);
+    send_line(conn, line);
+    wait_for(conn, "Joined room");
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run(const char* transport, int sender_fd, int receiver_fd, int messages) {
+    static Conn sender, receiver;
+    char name[32], room[32], line[64], needle[32];
+    sender.fd = sender_fd;
+    receiver.fd = receiver_fd;
+    snprintf(room, sizeof(room), "lat%s%d", transport, (int)getpid() % 10000);
+    snprintf(name, sizeof(name), "s%s%d", transport, (int)getpid() % 10000);
+    login(&sender, name, room);
+    snprintf(name, sizeof(name), "r%s%d", transport, (int)getpid() % 10000);
+    login(&receiver, name, room);
+
+    uint64_t* samples = malloc(sizeof(uint64_t) * messages);
+    for (int i = -WARMUP_MESSAGES; i < messages; i++) {
+        snprintf(line, sizeof(line), "/broadcast m%d\n", i);
+        snprintf(needle, sizeof(needle), ": m%d", i);
+        uint64_t start = now_ns();
+        send_line(&sender, line);
+        wait_for(&receiver, needle);
+        if (i >= 0) samples[i] = now_ns() - start;
+        drain(&sender);
+    }
+
+    qsort(samples, messages, sizeof(uint64_t), compare_u64);
+    uint64_t total = 0;
+    for (int i = 0; i < messages; i++) total += samples[i];
+    printf("%-6s %8.1f %8.1f %8.1f %8.1f %8.1f\n", transport,
+        total / 1000.0 / messages,
+        samples[messages / 2] / 1000.0,
+        samples[messages * 9 / 10] / 1000.0,
+        samples[messages * 99 / 100] / 1000.0,
+        samples[messages - 1] / 1000.0);
+    free(samples);
+    close(sender_fd);
+    close(receiver_fd);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <port> <unix path> [messages]\n", argv[0]);
+        return 1;
+    }
+    int port = atoi(argv[1]);
+    const char* path = argv[2];
+    int messages = argc > 3 ? atoi(argv[3]) : 5000;
+    if (messages <= 0) messages = 5000;
+
+    int tcp_sender = connect_tcp(port), tcp_receiver = connect_tcp(port);
+    int unix_sender = connect_unix(path), unix_receiver = connect_unix(path);
+    if (tcp_sender == -1 || tcp_receiver == -1 || unix_sender == -1 || unix_receiver == -1) {
+        fprintf(stderr, "connect failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    printf("%d messages per transport, round trip through the server (us)\n", messages);
+    printf("%-6s %8s %8s %8s %8s %8s\n", "", "mean", "p50", "p90", "p99", "max");
+    run("tcp", tcp_sender, tcp_receiver, messages);
+    run("unix", unix_sender, unix_receiver, messages);
+    return 0;
+}
@@ -0,0 +1,121 @@
+// WebSocket benchmark. Checks the handshake against the RFC 6455 example
+// key and the vectorized unmasking against a byte-at-a-time loop for every
+// length and alignment up to a few vectors, then times both over payload
+// sizes from a short chat line up to a large paste. Exits non-zero if any
+// check fails.
+// run: $ ./bench/ws_bench [megabytes per size]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "websocket.h"
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// The loop a straightforward implementation would have; kept scalar so the
+// comparison is not against whatever the compiler makes of it
+__attribute__((noinline, optimize("no-tree-vectorize")))
+static void mask_bytewise(char* data, size_t len, const uint8_t key[4]) {
+    for (size_t i = 0; i < len; i++) data[i] ^= key[i & 3];
+}
+
+static int check_handshake(void) {
+    const char* request =
+        "GET /chat HTTP/1.1\r\nHost: server.example.com\r\nUpgrade: websocket\r\n"
+        "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n";
+    char response[512];
+    size_t consumed = 0;
+    int len = ws_handshake(request, strlen(request), response, sizeof(response), &consumed);
+    if (len <= 0 || consumed != strlen(request) ||
+        !strstr(response, "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n")) {
+        printf("FAIL: handshake answer\n%s", len > 0 ? response : "(none)\n");
+        return 1;
+    }
+    if (ws_handshake(request, strlen(request) - 2, response, sizeof(response), &consumed) != 0) {
+        printf("FAIL: incomplete request accepted\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int check_mask(void) {
+    const uint8_t key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    char expected[256], actual[256 + 16];
+    for (size_t offset = 0; offset < 16; offset++) {
+        for (size_t len = 0; len <= 200; len++) {
+            for (size_t i = 0; i < len; i++) expected[i] = (char)(i * 7 + offset);
+            memcpy(actual + offset, expected, len);
+            mask_bytewise(expected, len, key);
+            ws_mask(actual + offset, len, key);
+            if (memcmp(expected, actual + offset, len) != 0) {
+                printf("FAIL: mask differs at length %zu, offset %zu\n", len, offset);
+                return 1;
+            }
+        }
+    }
+
+    // A masked client frame parses back to its text
+    char frame[64] = { (char)0x81, (char)(0x80 | 5) };
+    memcpy(frame + 2, key, 4);
+    memcpy(frame + 6, "hello", 5);
+    mask_bytewise(frame + 6, 5, key);
+    WsFrame parsed;
+    if (ws_frame_parse(frame, 11, &parsed) != 11 || parsed.opcode != WS_TEXT || !parsed.fin) {
+        printf("FAIL: frame parse\n");
+        return 1;
+    }
+    ws_mask(parsed.payload, parsed.len, parsed.key);
+    if (parsed.len != 5 || memcmp(parsed.payload, "hello", 5) != 0) {
+        printf("FAIL: frame payload\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? (size_t)atoi(argv[1]) : 256;
+    if (megabytes == 0) megabytes = 256;
+    if (check_handshake() || check_mask()) return 1;
+    printf("handshake and masking checks passed\n");
+
+    static const size_t sizes[] = { 16, 64, 256, 1024, 4096, 65536 };
+    const uint8_t key[4] = { 0x12, 0x34, 0x56, 0x78 };
+    char* buffer = malloc(65536 + 1);
+    for (size_t i = 0; i < 65536; i++) buffer[i] = (char)i;
+
+    printf("%8s %14s %14s %8s\n", "payload", "bytewise MB/s", "ws_mask MB/s", "speedup");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t len = sizes[s];
+        size_t rounds = megabytes * 1048576 / len;
+        // Misaligned on purpose, like a payload right behind its frame header
+        char* payload = buffer + 1;
+
+        uint64_t start = now_ns();
+        for (size_t r = 0; r < rounds; r++) {
+            mask_bytewise(payload, len, key);
+            __asm__ __volatile__("" : : "r"(payload) : "memory");
+        }
+        uint64_t bytewise_ns = now_ns() - start;
+
+        start = now_ns();
+        for (size_t r = 0; r < rounds; r++) {
+            ws_mask(payload, len, key);
+            __asm__ __volatile__("" : : "r"(payload) : "memory");
+        }
+        uint64_t vector_ns = now_ns() - start;
+
+        double total_mb = (double)rounds * len / 1048576.0;
+        printf("%8zu %14.0f %14.0f %7.1fx\n", len,
+            total_mb / (bytewise_ns / 1e9), total_mb / (vector_ns / 1e9),
+            (double)bytewise_ns / (vector_ns ? vector_ns : 1));
+    }
+    free(buffer);
+    return 0;
+}
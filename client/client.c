@@ -1,5 +1,6 @@
 // run: $ ./chatserver <port>
-// $ ./chatclient <server_ip> <port>
+// $ ./chatclient [--binary | --compress] [--sequenced] <server> <port>
+// A dropped connection is resumed automatically (see session_token).
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,11 +9,27 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <pthread.h>
 #include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#include "client_proto.h"
+#include "compress.h"
 
 #define BUFFER_SIZE 4096
 #define MAX_INPUT_LEN 1024
+#define HEARTBEAT_MESSAGE "[PING]\n"
+#define SEQ_ACK_EVERY 32        // numbered lines per /ack
+#define SEQ_ACK_DELAY_MS 200    // ...or this long after the last one arrived
+#define SEQ_ROOMS 64            // rooms tracked at once, as many as the server has
+#define ROOM_NAME_MAX 32
+#define RECONNECT_ATTEMPTS 5
+#define RECONNECT_DELAY_MS 1000
+#define SESSION_TOKEN_MAX 64
+#define INCOMING_FILES 8        // files being received at once
+#define INCOMING_MAX_BYTES (3 * 1024 * 1024)  // the server's file size limit
 
 // ANSI Color codes
 #define COLOR_RED     "\x1b[31m"
@@ -27,20 +44,115 @@ int client_socket;
 int running = 1;
 int connection_established = 0;
 
+// Binary protocol (--binary): requests are numbered, and a file transfer
+// waits for each chunk to be acknowledged before sending the next
+int binary_mode = 0;
+int logged_in = 0;
+uint32_t next_request_id = 1;
+pthread_mutex_t send_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t transfer_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t transfer_cond = PTHREAD_COND_INITIALIZER;
+uint32_t transfer_id = 0;       // request awaiting FILE_ACK
+int transfer_result = 0;        // 1 acknowledged, -1 refused
+
+// Files other clients are sending, told apart by sender and transfer
+// number. Chunks go to an anonymous temporary file; only once the user
+// has accepted (/accept) and the last chunk is in is it saved as
+// received_<sender>_<name>. A rejected file keeps its slot, without the
+// data, until its last chunk so the rest is not offered again.
+typedef struct {
+    int active;
+    char sender[64];
+    uint32_t transfer;
+    char name[256];
+    FILE* data;                 // NULL once rejected
+    size_t size;
+    int complete;
+    int accepted;
+} IncomingFile;
+IncomingFile incoming_files[INCOMING_FILES];
+pthread_mutex_t incoming_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Stream compression (--compress, or /compress once logged in). After
+// sending the request nothing else goes out until the server answers: the
+// server treats whatever follows the request as deflated.
+enum { COMPRESS_OFF, COMPRESS_REQUESTED, COMPRESS_ON };
+int compress_wanted = 0;
+int compress_state = COMPRESS_OFF;
+pthread_cond_t compress_cond = PTHREAD_COND_INITIALIZER;
+Compressor compressor;
+
+// Sequenced delivery (--sequenced): room lines arrive as "[room #n] ...";
+// the highest number in each room is acknowledged in batches, not line by
+// line
+typedef struct {
+    char name[ROOM_NAME_MAX + 1];
+    uint64_t last;              // last number seen
+    uint64_t acked;             // last number the server has an ACK for
+} SeqRoom;
+int sequenced_mode = 0;
+SeqRoom seq_rooms[SEQ_ROOMS];
+int seq_room_count = 0;
+
+// Session resumption: the server's latest "[SESSION] Token <hex>". When the
+// connection drops the client connects again and sends "/reconnect <token>"
+// in place of the username; if the server no longer knows the token it logs
+// in with the name typed at the start. Sends wait for the new connection.
+const char* server_host;
+int server_port;
+char session_token[SESSION_TOKEN_MAX] = "";
+char login_name[MAX_INPUT_LEN] = "";
+int reconnect_refusals = 0;     // "still open" answers to this /reconnect
+unsigned connection_generation = 0;
+pthread_cond_t connection_cond = PTHREAD_COND_INITIALIZER;
+
 void* receive_handler(void* arg);
 void signal_handler(int sig);
 void print_colored_message(const char* message);
 void print_menu();
 int connect_to_server(const char* server_ip, int port);
+void* binary_receive_handler(void* arg);
+int send_frame(int op, uint32_t id, int count, const char* const fields[], const size_t lens[]);
+int send_binary_command(char* input);
+void send_file(const char* path, const char* target);
+int send_text(const char* line);
+void request_compression(void);
+static void handle_text(char* buffer);
+static int inflate_received(const char* data, size_t len);
+static void set_compress_state(int state);
+static void track_sequence(const char* buffer);
+static void send_ack(SeqRoom* room);
+static int reconnect(void);
+static void track_session(char* buffer);
+static void answer_incoming(const char* sender, const char* transfer, int accept);
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <server_ip> <port>\n", argv[0]);
+    while (argc > 3 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--binary") == 0) {
+            binary_mode = 1;
+        } else if (strcmp(argv[1], "--compress") == 0) {
+            compress_wanted = 1;
+        } else if (strcmp(argv[1], "--sequenced") == 0) {
+            sequenced_mode = 1;
+        } else {
+            break;
+        }
+        argv++;
+        argc--;
+    }
+    if (argc != 3 || (binary_mode && (compress_wanted || sequenced_mode))) {
+        fprintf(stderr, "Usage: %s [--binary | --compress] [--sequenced] <server> <port>\n", argv[0]);
+        exit(1);
+    }
+    if (compressor_init(&compressor) == -1) {
+        fprintf(stderr, "Cannot set up compression\n");
         exit(1);
     }
 
     const char* server_ip = argv[1];
     int port = atoi(argv[2]);
+    server_host = server_ip;
+    server_port = port;
 
     if (port <= 0 || port > 10000) {
         fprintf(stderr, "Invalid port number\n");
@@ -59,8 +171,17 @@ int main(int argc, char* argv[]) {
     print_menu();
 
     // Create receive thread
+    if (binary_mode && send(client_socket, BIN_MAGIC, BIN_MAGIC_LEN, 0) == -1) {
+        perror("Send failed");
+        exit(1);
+    }
+    // Wake the receive thread now and then to send a pending /ack
+    if (sequenced_mode) {
+        struct timeval tv = { 0, SEQ_ACK_DELAY_MS * 1000 };
+        setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
     pthread_t receive_thread;
-    pthread_create(&receive_thread, NULL, receive_handler, NULL);
+    pthread_create(&receive_thread, NULL, binary_mode ? binary_receive_handler : receive_handler, NULL);
 
     // Main input loop
     char input[MAX_INPUT_LEN];
@@ -84,15 +205,31 @@ int main(int argc, char* argv[]) {
             running = 0;
         }
 
+        if (binary_mode) {
+            if (send_binary_command(input) == -1) {
+                perror("Send failed");
+                break;
+            }
+            if (!running) break;
+            continue;
+        }
+
+        if (strcmp(input, "/compress") == 0) {
+            request_compression();
+            continue;
+        }
+
+        // Until the server says we are in, every line is a username attempt
+        if (!logged_in) {
+            snprintf(login_name, sizeof(login_name), "%s", input);
+        }
+
         // Send command to server
-        if (send(client_socket, input, strlen(input), 0) == -1) {
+        if (send_text(input) == -1) {
             perror("Send failed");
             break;
         }
 
-        // Add newline for server processing
-        send(client_socket, "\n", 1, 0);
-
         if (!running) break;
     }
 
@@ -104,29 +241,33 @@ int main(int argc, char* argv[]) {
 }
 
 int connect_to_server(const char* server_ip, int port) {
-    // Create socket
-    client_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (client_socket == -1) {
-        perror("Socket creation failed");
+    // Resolve the server: an IPv4 or IPv6 address, or a host name
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    char port_text[8];
+    snprintf(port_text, sizeof(port_text), "%d", port);
+    int error = getaddrinfo(server_ip, port_text, &hints, &result);
+    if (error != 0) {
+        fprintf(stderr, "Invalid server address: %s\n", gai_strerror(error));
         return -1;
     }
 
-    // Set up server address
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    
-    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
-        fprintf(stderr, "Invalid IP address\n");
-        close(client_socket);
-        return -1;
-    }
-
-    // Connect to server
+    // Connect to server, trying each address in turn
     printf("Connecting to server %s:%d...\n", server_ip, port);
-    if (connect(client_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+    client_socket = -1;
+    for (struct addrinfo* ai = result; ai && client_socket == -1; ai = ai->ai_next) {
+        client_socket = socket(ai->ai_family, SOCK_STREAM, 0);
+        if (client_socket == -1) continue;
+        if (connect(client_socket, ai->ai_addr, ai->ai_addrlen) == -1) {
+            close(client_socket);
+            client_socket = -1;
+        }
+    }
+    freeaddrinfo(result);
+    if (client_socket == -1) {
         perror("Connection failed");
-        close(client_socket);
         return -1;
     }
 
@@ -134,13 +275,67 @@ int connect_to_server(const char* server_ip, int port) {
     return 0;
 }
 
+// The connection dropped and the server gave us a token: connect again and
+// present it. Holds send_mutex throughout, so nothing is sent on the old
+// socket meanwhile; send_text() retries a failed line on the new one.
+// Returns -1 if the server could not be reached.
+static int reconnect(void) {
+    printf(COLOR_YELLOW "\nConnection lost; reconnecting...\n" COLOR_RESET);
+    pthread_mutex_lock(&send_mutex);
+    close(client_socket);
+    int connected = -1;
+    for (int attempt = 0; attempt < RECONNECT_ATTEMPTS && running && connected == -1; attempt++) {
+        if (attempt > 0) usleep(RECONNECT_DELAY_MS * 1000);
+        connected = connect_to_server(server_host, server_port);
+    }
+    if (connected == -1) {
+        connection_generation++;
+        pthread_cond_broadcast(&connection_cond);
+        pthread_mutex_unlock(&send_mutex);
+        return -1;
+    }
+
+    // A new connection starts uncompressed; ask again once resumed
+    if (compress_state != COMPRESS_OFF) {
+        compressor_free(&compressor);
+        compressor_init(&compressor);
+        compress_state = COMPRESS_OFF;
+        compress_wanted = 1;
+        pthread_cond_broadcast(&compress_cond);
+    }
+    if (sequenced_mode) {
+        struct timeval tv = { 0, SEQ_ACK_DELAY_MS * 1000 };
+        setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    char line[SESSION_TOKEN_MAX + 16];
+    int len = snprintf(line, sizeof(line), "/reconnect %s\n", session_token);
+    send(client_socket, line, len, MSG_NOSIGNAL);
+    reconnect_refusals = 0;
+    logged_in = 0;
+    connection_generation++;
+    pthread_cond_broadcast(&connection_cond);
+    pthread_mutex_unlock(&send_mutex);
+    return 0;
+}
+
 void* receive_handler(void* arg) {
+    (void)arg;
     char buffer[BUFFER_SIZE];
     int bytes;
 
     while (running) {
         bytes = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Quiet for SEQ_ACK_DELAY_MS: acknowledge what did arrive
+            for (int i = 0; i < seq_room_count; i++) {
+                if (seq_rooms[i].last > seq_rooms[i].acked) send_ack(&seq_rooms[i]);
+            }
+            continue;
+        }
         if (bytes <= 0) {
+            if (running && session_token[0] != '\0' && reconnect() == 0) {
+                continue;
+            }
             if (running && connection_established) {
                 // Check if this is a username conflict
                 if (strstr(buffer, "Username already exists") != NULL || 
@@ -155,8 +350,7 @@ void* receive_handler(void* arg) {
                     if (fgets(new_username, sizeof(new_username), stdin) != NULL) {
                         new_username[strcspn(new_username, "\n")] = '\0';
                         if (strlen(new_username) > 0) {
-                            send(client_socket, new_username, strlen(new_username), 0);
-                            send(client_socket, "\n", 1, 0);
+                            send_text(new_username);
                             continue;
                         }
                     }
@@ -168,22 +362,567 @@ void* receive_handler(void* arg) {
             break;
         }
 
+        if (compress_state == COMPRESS_ON) {
+            if (inflate_received(buffer, bytes) == -1) break;
+            continue;
+        }
         buffer[bytes] = '\0';
-        
-        // Check for username conflict messages
-        if (strstr(buffer, "Username already exists") != NULL || 
-            strstr(buffer, "Name already taken") != NULL ||
-            strstr(buffer, "already in use") != NULL) {
-            
-            printf(COLOR_RED "%s" COLOR_RESET, buffer);
-            printf("Enter a new username: ");
-            fflush(stdout);
+
+        // The answer to /compress comes in clear; what follows it is deflated
+        char* enabled = compress_state == COMPRESS_REQUESTED ? strstr(buffer, COMPRESS_ENABLED) : NULL;
+        if (enabled) {
+            char* rest = enabled + strlen(COMPRESS_ENABLED);
+            size_t rest_len = bytes - (rest - buffer);
+            *enabled = '\0';
+            handle_text(buffer);
+            printf(COLOR_CYAN "[COMPRESS] Stream compression enabled.\n" COLOR_RESET);
+            set_compress_state(COMPRESS_ON);
+            if (inflate_received(rest, rest_len) == -1) break;
             continue;
         }
-        
-        print_colored_message(buffer);
+        if (compress_state == COMPRESS_REQUESTED && strstr(buffer, "[ERROR] Compression")) {
+            set_compress_state(COMPRESS_OFF);
+        }
+
+        handle_text(buffer);
+
+        // Logged in: ask for what the command line did. /compress goes last,
+        // as this thread may not send anything else until it is answered.
+        // A resumed session is still sequenced, but not compressed.
+        if (strstr(buffer, "[SESSION] Resumed")) {
+            if (compress_wanted) {
+                compress_wanted = 0;
+                request_compression();
+            }
+        } else if (strstr(buffer, "Commands:")) {
+            logged_in = 1;
+            if (sequenced_mode) {
+                send_text("/sequenced");
+            }
+            if (compress_wanted) {
+                compress_wanted = 0;
+                request_compression();
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// The tracking entry for a room, added on first sight. NULL for a name
+// that is not one or when the table is full.
+static SeqRoom* seq_room(const char* name, size_t len) {
+    if (len == 0 || len > ROOM_NAME_MAX) return NULL;
+    for (int i = 0; i < seq_room_count; i++) {
+        if (strlen(seq_rooms[i].name) == len && memcmp(seq_rooms[i].name, name, len) == 0) {
+            return &seq_rooms[i];
+        }
+    }
+    if (seq_room_count == SEQ_ROOMS) return NULL;
+    SeqRoom* room = &seq_rooms[seq_room_count++];
+    memcpy(room->name, name, len);
+    room->name[len] = '\0';
+    room->last = room->acked = 0;
+    return room;
+}
+
+// Picks sequence numbers out of a chunk of output: "[room #n] ..." lines,
+// and "[SEQ] ... 'room' ... #n" notices giving a room's position after a
+// join or resume. Only whole lines at the start of a line are considered.
+static void track_sequence(const char* buffer) {
+    const char* line = buffer;
+    while (line && *line) {
+        const char* end = strchr(line, '\n');
+        size_t len = end ? (size_t)(end - line) : strlen(line);
+        const char* close = memchr(line, ']', len);
+        const char* quote = memchr(line, '\'', len);
+        const char* unquote = quote ? memchr(quote + 1, '\'', len - (quote + 1 - line)) : NULL;
+        const char* mark;
+        SeqRoom* room;
+        if (strncmp(line, "[SEQ] ", 6) == 0) {
+            mark = memrchr(line, '#', len);
+            if (mark && unquote && (room = seq_room(quote + 1, unquote - quote - 1))) {
+                room->last = room->acked = strtoull(mark + 1, NULL, 10);
+            }
+        } else if (line[0] == '[' && close && (mark = memchr(line, '#', close - line)) && mark[-1] == ' ') {
+            uint64_t seq = strtoull(mark + 1, NULL, 10);
+            room = seq_room(line + 1, mark - 1 - (line + 1));
+            if (room && seq > room->last) room->last = seq;
+            if (room && room->last >= room->acked + SEQ_ACK_EVERY) send_ack(room);
+        }
+        line = end ? end + 1 : NULL;
+    }
+}
+
+// One cumulative ACK for everything up to room->last
+static void send_ack(SeqRoom* room) {
+    char line[64];
+    snprintf(line, sizeof(line), "/ack %s %llu", room->name, (unsigned long long)room->last);
+    if (send_text(line) == 0) room->acked = room->last;
+}
+
+// Keeps the session token from "[SESSION] Token <hex>" lines, which are not
+// shown, and answers a refused /reconnect: a session the server was still
+// closing is asked for again, an unknown one becomes a fresh login.
+static void track_session(char* buffer) {
+    char* line;
+    while ((line = strstr(buffer, "[SESSION] Token ")) != NULL) {
+        char* end = strchr(line, '\n');
+        size_t len = end ? (size_t)(end - line) - 16 : strlen(line + 16);
+        if (len < sizeof(session_token)) {
+            memcpy(session_token, line + 16, len);
+            session_token[len] = '\0';
+        }
+        if (!end) {
+            *line = '\0';
+            break;
+        }
+        memmove(line, end + 1, strlen(end + 1) + 1);
+    }
+    if (strstr(buffer, "[SESSION] Resumed")) {
+        logged_in = 1;
+    }
+    if (strstr(buffer, "[ERROR] Session still open") && reconnect_refusals++ < 2) {
+        char request[SESSION_TOKEN_MAX + 16];
+        usleep(100 * 1000);
+        snprintf(request, sizeof(request), "/reconnect %s", session_token);
+        send_text(request);
+    } else if (strstr(buffer, "[ERROR] Unknown or expired session") ||
+               strstr(buffer, "[ERROR] Session still open")) {
+        session_token[0] = '\0';
+        printf(COLOR_YELLOW "\nSession expired; logging in again as %s. Rejoin your room.\n" COLOR_RESET, login_name);
+        send_text(login_name);
+    }
+}
+
+// Prints a chunk of server output, answering and hiding heartbeats.
+static void handle_text(char* buffer) {
+    if (sequenced_mode) {
+        track_sequence(buffer);
+    }
+    track_session(buffer);
+
+    // Answer server heartbeats silently and strip them from the output
+    char* ping;
+    while ((ping = strstr(buffer, HEARTBEAT_MESSAGE)) != NULL) {
+        memmove(ping, ping + strlen(HEARTBEAT_MESSAGE), strlen(ping + strlen(HEARTBEAT_MESSAGE)) + 1);
+        send_text("/pong");
+    }
+    if (buffer[0] == '\0') {
+        return;
+    }
+
+    // Check for username conflict messages
+    if (strstr(buffer, "Username already exists") != NULL ||
+        strstr(buffer, "Name already taken") != NULL ||
+        strstr(buffer, "already in use") != NULL) {
+
+        printf(COLOR_RED "%s" COLOR_RESET, buffer);
+        printf("Enter a new username: ");
+        fflush(stdout);
+        return;
+    }
+
+    print_colored_message(buffer);
+}
+
+// Feeds received bytes to the inflater and prints what comes out. Returns
+// -1 if the stream is broken.
+static int inflate_received(const char* data, size_t len) {
+    if (len > sizeof(compressor.pending) - compressor.pending_len) {
+        printf(COLOR_RED "\nCompressed stream overflow.\n" COLOR_RESET);
+        running = 0;
+        return -1;
+    }
+    memcpy(compressor.pending + compressor.pending_len, data, len);
+    compressor.pending_len += len;
+
+    char text[BUFFER_SIZE];
+    ssize_t produced;
+    while ((produced = compressor_inflate(&compressor, text, sizeof(text) - 1)) > 0) {
+        text[produced] = '\0';
+        handle_text(text);
+    }
+    if (produced < 0) {
+        printf(COLOR_RED "\nCorrupt compressed stream.\n" COLOR_RESET);
+        running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static void set_compress_state(int state) {
+    pthread_mutex_lock(&send_mutex);
+    compress_state = state;
+    pthread_cond_broadcast(&compress_cond);
+    pthread_mutex_unlock(&send_mutex);
+}
+
+void request_compression(void) {
+    if (binary_mode) {
+        printf(COLOR_RED "[ERROR] Compression is not available with --binary.\n" COLOR_RESET);
+        return;
+    }
+    pthread_mutex_lock(&send_mutex);
+    if (compress_state == COMPRESS_OFF) {
+        send(client_socket, "/compress\n", 10, MSG_NOSIGNAL);
+        compress_state = COMPRESS_REQUESTED;
+    }
+    pthread_mutex_unlock(&send_mutex);
+}
+
+// Sends one line of the text protocol, deflated once compression is on.
+// The receive thread uses it too (pongs, ACKs), so it never waits on
+// itself: those are dropped while /compress is unanswered and it returns -1.
+int send_text(const char* line) {
+    char plain[MAX_INPUT_LEN + 1];
+    size_t len = snprintf(plain, sizeof(plain), "%s\n", line);
+    if (len >= sizeof(plain)) len = sizeof(plain) - 1;
+
+    int result = -1;
+    pthread_mutex_lock(&send_mutex);
+    int from_receiver = strcmp(line, "/pong") == 0 || strncmp(line, "/ack ", 5) == 0;
+    for (int tries = 0; tries < 2 && result == -1; tries++) {
+        while (compress_state == COMPRESS_REQUESTED && !from_receiver && running) {
+            pthread_cond_wait(&compress_cond, &send_mutex);
+        }
+        unsigned generation = connection_generation;
+        if (compress_state == COMPRESS_ON) {
+            char wire[COMPRESS_BOUND(MAX_INPUT_LEN + 1)];
+            ssize_t n = compressor_deflate(&compressor, plain, len, wire, sizeof(wire));
+            result = n < 0 || send(client_socket, wire, n, MSG_NOSIGNAL) != n ? -1 : 0;
+        } else if (compress_state == COMPRESS_OFF) {
+            result = send(client_socket, plain, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+        }
+        // The connection is gone: once the receive thread has a new one,
+        // this line goes there (pongs and ACKs are dropped)
+        if (result == -1 && tries == 0 && !from_receiver && session_token[0] != '\0') {
+            while (generation == connection_generation && running) {
+                pthread_cond_wait(&connection_cond, &send_mutex);
+            }
+        }
+    }
+    pthread_mutex_unlock(&send_mutex);
+    return result;
+}
+
+int send_frame(int op, uint32_t id, int count, const char* const fields[], const size_t lens[]) {
+    char frame[BIN_MAX_FRAME];
+    size_t len = bin_frame_encode(frame, sizeof(frame), op, id, count, fields, lens);
+    if (len == 0) {
+        printf(COLOR_RED "[ERROR] Input too long.\n" COLOR_RESET);
+        return 0;
+    }
+    // The receive thread answers pings on the same socket
+    pthread_mutex_lock(&send_mutex);
+    int result = send(client_socket, frame, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+    pthread_mutex_unlock(&send_mutex);
+    return result;
+}
+
+// Turns one input line into a request frame. The first line is the username.
+int send_binary_command(char* input) {
+    uint32_t id = next_request_id++;
+    const char* fields[2];
+    size_t lens[2];
+
+    if (!logged_in) {
+        fields[0] = input;
+        lens[0] = strlen(input);
+        return send_frame(BIN_LOGIN, id, 1, fields, lens);
+    }
+
+    char* arg = strchr(input, ' ');
+    if (arg) *arg++ = '\0';
+    if (strcmp(input, "/exit") == 0) return send_frame(BIN_EXIT, id, 0, NULL, NULL);
+    if (strcmp(input, "/leave") == 0) {
+        fields[0] = arg;
+        lens[0] = arg ? strlen(arg) : 0;
+        return send_frame(BIN_LEAVE, id, arg ? 1 : 0, fields, lens);
+    }
+    if (strcmp(input, "/join") == 0 && arg) {
+        fields[0] = arg;
+        lens[0] = strlen(arg);
+        return send_frame(BIN_JOIN, id, 1, fields, lens);
+    }
+    if (strcmp(input, "/broadcast") == 0 && arg) {
+        fields[0] = arg;
+        lens[0] = strlen(arg);
+        return send_frame(BIN_BROADCAST, id, 1, fields, lens);
+    }
+
+    char* rest = arg ? strchr(arg, ' ') : NULL;
+    if (rest) *rest++ = '\0';
+    if (strcmp(input, "/whisper") == 0 && rest) {
+        fields[0] = arg;
+        lens[0] = strlen(arg);
+        fields[1] = rest;
+        lens[1] = strlen(rest);
+        return send_frame(BIN_WHISPER, id, 2, fields, lens);
+    }
+    if (strcmp(input, "/sendfile") == 0 && rest) {
+        send_file(arg, rest);
+        return 0;
+    }
+    if ((strcmp(input, "/accept") == 0 || strcmp(input, "/reject") == 0) && rest) {
+        answer_incoming(arg, rest, input[1] == 'a');
+        return 0;
+    }
+    printf(COLOR_RED "[ERROR] Unknown command. Type a valid command.\n" COLOR_RESET);
+    return 0;
+}
+
+// Streams a local file to another binary client, one acknowledged chunk at
+// a time. An empty chunk marks the end.
+void send_file(const char* path, const char* target) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        printf(COLOR_RED "[ERROR] Cannot open %s\n" COLOR_RESET, path);
+        return;
+    }
+    const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    char chunk[BIN_CHUNK_BYTES];
+    char transfer[BIN_TRANSFER_LEN + 1] = "";
+    size_t total = 0;
+    int result = 1;
+
+    while (result == 1) {
+        size_t len = fread(chunk, 1, sizeof(chunk), file);
+
+        pthread_mutex_lock(&transfer_mutex);
+        transfer_id = next_request_id++;
+        transfer_result = 0;
+        pthread_mutex_unlock(&transfer_mutex);
+        // The first chunk's request number names the whole file
+        if (transfer[0] == '\0') snprintf(transfer, sizeof(transfer), "%u", transfer_id);
+
+        const char* fields[] = { target, name, chunk, transfer };
+        size_t lens[] = { strlen(target), strlen(name), len, strlen(transfer) };
+        if (send_frame(BIN_FILE_CHUNK, transfer_id, 4, fields, lens) == -1) break;
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 5;
+        pthread_mutex_lock(&transfer_mutex);
+        while (transfer_result == 0 && running) {
+            if (pthread_cond_timedwait(&transfer_cond, &transfer_mutex, &deadline) == ETIMEDOUT) break;
+        }
+        result = transfer_result;
+        transfer_id = 0;
+        pthread_mutex_unlock(&transfer_mutex);
+
+        total += len;
+        if (len == 0) break;
+    }
+    fclose(file);
+    if (result == 1) {
+        printf(COLOR_CYAN "[FILE] Sent %s to %s (%zu bytes)\n" COLOR_RESET, name, target, total);
+    } else if (result == 0) {
+        printf(COLOR_RED "[ERROR] File transfer timed out.\n" COLOR_RESET);
+    }
+}
+
+// Caller holds incoming_mutex.
+static IncomingFile* find_incoming(const char* sender, uint32_t transfer) {
+    for (int i = 0; i < INCOMING_FILES; i++) {
+        IncomingFile* file = &incoming_files[i];
+        if (file->active && file->transfer == transfer && strcmp(file->sender, sender) == 0) return file;
+    }
+    return NULL;
+}
+
+// Caller holds incoming_mutex.
+static void drop_incoming(IncomingFile* file) {
+    if (file->data) fclose(file->data);
+    file->data = NULL;
+    file->active = 0;
+}
+
+// Writes out an accepted, complete file, never over an existing one.
+// Caller holds incoming_mutex.
+static void save_incoming(IncomingFile* file) {
+    char path[384];
+    snprintf(path, sizeof(path), "received_%s_%s", file->sender, file->name);
+    FILE* out = fopen(path, "wbx");
+    if (!out) {
+        printf(COLOR_RED "\n[ERROR] Cannot save %s: %s\n" COLOR_RESET "> ", path, strerror(errno));
+    } else {
+        char buffer[BUFFER_SIZE];
+        size_t n;
+        rewind(file->data);
+        while ((n = fread(buffer, 1, sizeof(buffer), file->data)) > 0) fwrite(buffer, 1, n, out);
+        fclose(out);
+        printf(COLOR_CYAN "\n[FILE] Saved %s (%zu bytes)\n" COLOR_RESET "> ", path, file->size);
+    }
+    fflush(stdout);
+    drop_incoming(file);
+}
+
+// A new (sender, transfer) is a new offer. Caller holds incoming_mutex.
+static IncomingFile* open_incoming(const char* sender, uint32_t transfer, const char* name) {
+    IncomingFile* file = NULL;
+    for (int i = 0; i < INCOMING_FILES && !file; i++) {
+        if (!incoming_files[i].active) file = &incoming_files[i];
+    }
+    // Out of slots: forget a rejected file that never finished
+    for (int i = 0; i < INCOMING_FILES && !file; i++) {
+        if (!incoming_files[i].data) file = &incoming_files[i];
+    }
+    if (!file) return NULL;
+
+    file->data = tmpfile();
+    if (!file->data) return NULL;
+    file->active = 1;
+    snprintf(file->sender, sizeof(file->sender), "%s", sender);
+    file->transfer = transfer;
+    snprintf(file->name, sizeof(file->name), "%s", name);
+    file->size = 0;
+    file->complete = 0;
+    file->accepted = 0;
+    printf(COLOR_CYAN "\n[FILE] %s is sending you %s. /accept %s %u or /reject %s %u\n" COLOR_RESET "> ",
+        sender, name, sender, transfer, sender, transfer);
+    fflush(stdout);
+    return file;
+}
+
+static void receive_file_chunk(BinFrame* frame) {
+    const char* sender = frame->field[0];
+    const char* name = frame->field[1];
+    size_t len = frame->field_len[2];
+    uint32_t transfer = (uint32_t)strtoul(frame->field[3], NULL, 10);
+    if (strchr(name, '/') || strchr(sender, '/')) return;
+
+    pthread_mutex_lock(&incoming_mutex);
+    IncomingFile* file = find_incoming(sender, transfer);
+    if (!file) file = open_incoming(sender, transfer, name);
+    if (!file) {
+        if (len == 0) {
+            printf(COLOR_RED "\n[ERROR] Missed %s from %s: too many files arriving at once\n" COLOR_RESET "> ",
+                name, sender);
+            fflush(stdout);
+        }
+        pthread_mutex_unlock(&incoming_mutex);
+        return;
     }
 
+    if (file->data && file->size + len > INCOMING_MAX_BYTES) {
+        printf(COLOR_RED "\n[ERROR] %s from %s is over the size limit; dropped\n" COLOR_RESET "> ", name, sender);
+        fflush(stdout);
+        fclose(file->data);
+        file->data = NULL;
+    }
+    if (file->data && len > 0) {
+        fwrite(frame->field[2], 1, len, file->data);
+        file->size += len;
+    }
+    if (len == 0) {
+        file->complete = 1;
+        if (!file->data) {
+            drop_incoming(file);
+        } else if (file->accepted) {
+            save_incoming(file);
+        } else {
+            printf(COLOR_CYAN "\n[FILE] %s from %s is in (%zu bytes), waiting for /accept\n" COLOR_RESET "> ",
+                name, sender, file->size);
+            fflush(stdout);
+        }
+    }
+    pthread_mutex_unlock(&incoming_mutex);
+}
+
+// /accept and /reject <sender> <transfer>. Accepting a file that is still
+// arriving saves it once the last chunk is in.
+static void answer_incoming(const char* sender, const char* transfer, int accept) {
+    pthread_mutex_lock(&incoming_mutex);
+    IncomingFile* file = find_incoming(sender, (uint32_t)strtoul(transfer, NULL, 10));
+    if (!file || !file->data || file->accepted) {
+        printf(COLOR_RED "[ERROR] No file from %s waiting under %s\n" COLOR_RESET, sender, transfer);
+    } else if (!accept) {
+        printf(COLOR_CYAN "[FILE] Rejected %s from %s\n" COLOR_RESET, file->name, sender);
+        fclose(file->data);
+        file->data = NULL;
+        if (file->complete) drop_incoming(file);
+    } else if (file->complete) {
+        file->accepted = 1;
+        save_incoming(file);
+    } else {
+        file->accepted = 1;
+        printf(COLOR_CYAN "[FILE] Accepted %s from %s; saving it when it is in\n" COLOR_RESET, file->name, sender);
+    }
+    pthread_mutex_unlock(&incoming_mutex);
+}
+
+static void handle_frame(BinFrame* frame) {
+    if (frame->op == BIN_PING) {
+        send_frame(BIN_PONG, 0, 0, NULL, NULL);
+    } else if (frame->op == BIN_LOGIN_OK) {
+        logged_in = 1;
+    } else if (frame->op == BIN_FILE_DATA && frame->count == 4) {
+        receive_file_chunk(frame);
+    } else if (frame->op == BIN_FILE_ACK || (frame->op == BIN_TEXT && frame->count == 1)) {
+        pthread_mutex_lock(&transfer_mutex);
+        if (transfer_id != 0 && frame->id == transfer_id) {
+            transfer_result = frame->op == BIN_FILE_ACK ? 1 : -1;
+            pthread_cond_signal(&transfer_cond);
+        }
+        pthread_mutex_unlock(&transfer_mutex);
+        if (frame->op == BIN_TEXT) {
+            print_colored_message(frame->field[0]);
+        }
+    }
+}
+
+// Text until the server echoes BIN_MAGIC (it may have prompted before it
+// saw ours), frames afterwards.
+void* binary_receive_handler(void* arg) {
+    (void)arg;
+    static char buffer[BIN_MAX_FRAME * 2];
+    size_t have = 0;
+    int framed = 0;
+
+    while (running) {
+        int bytes = recv(client_socket, buffer + have, sizeof(buffer) - have - 1, 0);
+        if (bytes <= 0) {
+            if (running && connection_established) {
+                printf(COLOR_RED "\nConnection lost.\n" COLOR_RESET);
+                running = 0;
+            }
+            break;
+        }
+        have += bytes;
+
+        size_t start = 0;
+        if (!framed) {
+            // Text never contains a NUL, so the first one starts the magic
+            char* nul = memchr(buffer, '\0', have);
+            start = nul ? (size_t)(nul - buffer) : have;
+            fwrite(buffer, 1, start, stdout);
+            fflush(stdout);
+            if (nul && have - start >= BIN_MAGIC_LEN) {
+                if (memcmp(nul, BIN_MAGIC, BIN_MAGIC_LEN) != 0) {
+                    printf(COLOR_RED "\nServer does not speak the binary protocol.\n" COLOR_RESET);
+                    running = 0;
+                    break;
+                }
+                framed = 1;
+                start += BIN_MAGIC_LEN;
+            }
+        }
+
+        BinFrame frame;
+        int size = 0;
+        while (framed && (size = bin_frame_parse(buffer + start, have - start, &frame)) > 0) {
+            handle_frame(&frame);
+            start += size;
+        }
+        if (framed && size < 0) {
+            printf(COLOR_RED "\nProtocol error.\n" COLOR_RESET);
+            running = 0;
+            break;
+        }
+        memmove(buffer, buffer + start, have - start);
+        have -= start;
+    }
     return NULL;
 }
 
@@ -231,11 +970,21 @@ void print_colored_message(const char* message) {
 
 void print_menu() {
     printf(COLOR_CYAN "\n=== Chat Client Commands ===\n" COLOR_RESET);
-    printf("/join <room_name>     - Join or create a room\n");
-    printf("/leave               - Leave current room\n");
+    printf("/join <room_name>     - Join or create a room; talk there\n");
+    printf("/leave [room_name]   - Leave a room (default: the one you talk in)\n");
     printf("/broadcast <message> - Send message to room\n");
     printf("/whisper <user> <msg>- Send private message\n");
     printf("/sendfile <file> <user> - Send file to user\n");
+    if (!binary_mode) {
+        printf("/who [room]          - List a room's members (default: yours)\n");
+        printf("/rooms               - List rooms and how many are in each\n");
+        printf("/compress            - Compress the connection\n");
+    }
     printf("/exit                - Disconnect from server\n");
+    if (binary_mode) {
+        printf("/accept <user> <n>   - Save the file <user> is sending as transfer <n>\n");
+        printf("/reject <user> <n>   - Refuse it\n");
+        printf("(binary protocol: /sendfile sends a local file to another binary client)\n");
+    }
     printf(COLOR_CYAN "============================\n\n" COLOR_RESET);
 }
\ No newline at end of file
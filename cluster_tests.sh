@@ -0,0 +1,172 @@
+#!/bin/bash
+set -e
+
+# Cluster tests: several nodes share the port, and room broadcasts and
+# whispers must reach users whichever node the kernel gave them, over the
+# socket links and over the shared-memory bus. Raw connections use bash's
+# /dev/tcp.
+# run: $ make check   (or: $ make all && bash cluster_tests.sh)
+
+# Configuration
+SERVER_PORT=5300
+NODES=3
+USERS=9
+TEST_DIR="test_cluster"
+rm -rf $TEST_DIR
+mkdir -p $TEST_DIR
+
+# Cleanup function
+cleanup() {
+    echo "Cleaning up..."
+    for pid in $READER_PIDS $NODE_PIDS; do
+        kill $pid 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    rm -rf $TEST_DIR
+}
+trap cleanup EXIT
+
+# Starts $NODES nodes on $SERVER_PORT with the given options; node i
+# writes to $TEST_DIR/node<i>.log, line buffered
+start_cluster() {
+    echo "Starting $NODES nodes on port $SERVER_PORT $*..."
+    rm -f $TEST_DIR/node*.log
+    NODE_PIDS=
+    for id in $(seq 0 $((NODES - 1))); do
+        stdbuf -oL ./chatserver --cluster-size $NODES --cluster-id $id --cluster-dir $TEST_DIR "$@" \
+            $SERVER_PORT > $TEST_DIR/node$id.log 2>&1 &
+        NODE_PIDS="$NODE_PIDS $!"
+    done
+    sleep 1.5 # Wait for the nodes to link up
+}
+
+stop_cluster() {
+    for pid in $NODE_PIDS; do
+        kill -TERM $pid
+    done
+    for pid in $NODE_PIDS; do
+        wait $pid 2>/dev/null || true
+    done
+    NODE_PIDS=
+}
+
+# Opens a raw connection on descriptor $1 to port $2; what the server sends
+# is copied to $TEST_DIR/$3.log. Descriptors 3 and up are used, one per
+# user, so the reader closes every other one.
+open_conn() {
+    local fd=$1 port=$2 name=$3
+    eval "exec $fd<>/dev/tcp/127.0.0.1/$port"
+    (
+        for other in $(seq 3 $((USERS + 4))); do
+            [ $other -ne $fd ] && eval "exec $other>&-"
+        done
+        exec cat <&$fd
+    ) > $TEST_DIR/$name.log &
+    READER_PIDS="$READER_PIDS $!"
+}
+
+# Sends each argument as a line on descriptor $1
+send_lines() {
+    local fd=$1
+    shift
+    for line in "$@"; do
+        printf '%s\n' "$line" >&$fd
+    done
+}
+
+expect() {
+    local file=$1 pattern=$2 message=$3
+    if grep -aqF -- "$pattern" $TEST_DIR/$file.log; then
+        echo "PASS: $message"
+    else
+        echo "FAIL: $message (no \"$pattern\" in $file.log)"
+        exit 1
+    fi
+}
+
+# Node user $1 logged in on
+node_of() {
+    grep -l "New client connected: $1 from" $TEST_DIR/node*.log | sed 's/.*node\([0-9]*\)\.log/\1/'
+}
+
+# Logs $USERS users in (user<i> on descriptor i + 3), all in room $1, and
+# checks that a broadcast and whispers cross between nodes
+check_cross_node() {
+    local room=$1 label=$2
+    for i in $(seq 1 $USERS); do
+        open_conn $((i + 3)) $SERVER_PORT ${room}u$i
+        send_lines $((i + 3)) "${room}u$i" "/join $room"
+    done
+    sleep 1
+
+    # Pick a sender and a target that the kernel put on different nodes
+    local sender=${room}u1 target=
+    local sender_node=$(node_of $sender)
+    for i in $(seq 2 $USERS); do
+        if [ "$(node_of ${room}u$i)" != "$sender_node" ]; then
+            target=${room}u$i
+            break
+        fi
+    done
+    local used=$(for i in $(seq 1 $USERS); do node_of ${room}u$i; done | sort -u | wc -l)
+    if [ -n "$target" ]; then
+        echo "PASS: $USERS users spread over $used nodes ($label)"
+    else
+        echo "FAIL: Every connection landed on node $sender_node ($label)"
+        exit 1
+    fi
+
+    send_lines 4 "/broadcast hello from node $sender_node"
+    sleep 0.5
+    local missing=0
+    for i in $(seq 2 $USERS); do
+        grep -aqF "$sender: hello from node $sender_node" $TEST_DIR/${room}u$i.log || missing=$((missing + 1))
+    done
+    if [ $missing -eq 0 ]; then
+        echo "PASS: Broadcast reached every member on every node ($label)"
+    else
+        echo "FAIL: Broadcast missing for $missing members ($label)"
+        exit 1
+    fi
+
+    local target_fd=$((${target#${room}u} + 3))
+    send_lines 4 "/whisper $target across the cluster"
+    send_lines $target_fd "/whisper $sender and back again"
+    sleep 0.5
+    expect $target "[WHISPER from $sender]: across the cluster" "Whisper to node $(node_of $target) ($label)"
+    expect $sender "[WHISPER from $target]: and back again" "Whisper to node $sender_node ($label)"
+
+    # Names are unique cluster-wide, whichever node the second login hits
+    open_conn $((USERS + 4)) $SERVER_PORT ${room}dup
+    send_lines $((USERS + 4)) "$target"
+    sleep 0.5
+    expect ${room}dup "[ERROR] Username already taken." "Duplicate login refused cluster-wide ($label)"
+
+    for i in $(seq 1 $((USERS + 1))); do
+        eval "exec $((i + 3))>&-"
+    done
+}
+
+# Test 1: Cluster links over the Unix sockets
+test_socket_links() {
+    echo "Running Test 1: Cross-node delivery over socket links"
+    start_cluster --no-shm-bus
+    check_cross_node sockrm "socket links"
+    stop_cluster
+}
+
+# Test 2: The same traffic over the shared-memory bus
+test_shm_bus() {
+    echo "Running Test 2: Cross-node delivery over the shared-memory bus"
+    start_cluster
+    check_cross_node shmrm "shared-memory bus"
+    stop_cluster
+}
+
+# Run all tests
+test_socket_links
+test_shm_bus
+
+echo ""
+echo "========================================"
+echo "All cluster tests passed successfully!"
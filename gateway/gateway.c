@@ -0,0 +1,763 @@
+// chatgateway: edge process in front of the chat server. It accepts the
+// client TCP connections, runs the username prompt, frames input into
+// validated lines and buffers output for slow readers, and multiplexes every
+// logged-in session over a few persistent links to the core (see
+// server/gateway_proto.h). The connection-heavy tier scales by adding
+// gateways; the core only sees their links. One thread, one epoll loop.
+// run: $ ./chatserver --gateway-port 9100 8080
+//      $ ./chatgateway [options] <port> <core_ip> <core_port>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "timer_wheel.h"
+#include "gateway_proto.h"
+
+#define MAX_LINKS 16
+#define DEFAULT_LINKS 2
+#define DEFAULT_MAX_SESSIONS 4096
+#define MAX_SESSIONS 65535         // session index lives in the id's low 16 bits
+#define MAX_USERNAME_LEN 16
+#define LINE_LEN GATEWAY_MAX_PAYLOAD
+#define LINK_INBUF_SIZE 65536
+#define DEFAULT_LOGIN_TIMEOUT_MS 30000
+#define DEFAULT_LOGIN_ATTEMPTS 3
+#define MAX_OUTBOUND_BYTES 262144  // per client; slower readers are dropped
+#define MAX_LINK_BYTES 4194304     // per core link
+#define RECONNECT_MS 1000
+#define TIMER_TICK_MS 100
+#define USERNAME_PROMPT "Enter username (max 16 chars, alphanumeric): "
+
+typedef enum {
+    SOURCE_LISTENER,
+    SOURCE_SIGNAL,
+    SOURCE_SESSION,
+    SOURCE_LINK
+} SourceKind;
+
+typedef struct {
+    SourceKind kind;
+} EventSource;
+
+typedef struct OutChunk {
+    struct OutChunk* next;
+    size_t len;
+    size_t offset;
+    char data[];
+} OutChunk;
+
+// A socket with an outbound queue; first member of Session and Link, so the
+// pointer registered with epoll is both.
+typedef struct {
+    EventSource source;
+    int socket;
+    OutChunk* out_head;
+    OutChunk* out_tail;
+    size_t out_bytes;
+    int out_watched;            // registered for EPOLLOUT as well
+    int in_paused;              // not reading: input buffer is full
+} Conn;
+
+typedef enum {
+    SESSION_FREE,
+    SESSION_LOGIN,              // waiting for a username line
+    SESSION_OPENING,            // OPEN sent, waiting for the core's answer
+    SESSION_ACTIVE,
+    SESSION_CLOSING             // flushing output, then hanging up
+} SessionState;
+
+typedef struct {
+    Conn conn;
+    uint32_t id;                // generation << 16 | index
+    SessionState state;
+    int link;
+    int attempts;
+    char ip[INET6_ADDRSTRLEN];
+    char inbuf[LINE_LEN];
+    size_t inbuf_len;
+    Timer deadline;
+} Session;
+
+typedef struct {
+    Conn conn;
+    char inbuf[LINK_INBUF_SIZE];
+    size_t inbuf_len;
+} Link;
+
+typedef struct {
+    int port;
+    const char* core_ip;
+    int core_port;
+    struct sockaddr_storage core_addr;  // core_ip resolved, IPv4 or IPv6
+    socklen_t core_addr_len;
+    int links;
+    int max_sessions;
+    int login_timeout_ms;
+    int max_login_attempts;
+} GatewayConfig;
+
+static GatewayConfig config = {
+    .links = DEFAULT_LINKS,
+    .max_sessions = DEFAULT_MAX_SESSIONS,
+    .login_timeout_ms = DEFAULT_LOGIN_TIMEOUT_MS,
+    .max_login_attempts = DEFAULT_LOGIN_ATTEMPTS,
+};
+
+static Session* sessions;
+static int* free_sessions;          // stack of free session indexes
+static int free_count;
+static Link links[MAX_LINKS];
+static int next_link = 0;
+static int epoll_fd = -1;
+static TimerWheel timer_wheel;
+static Timer reconnect_timer;
+static int reconnect_due = 0;
+static int running = 1;
+static EventSource listener_source = { SOURCE_LISTENER };
+static EventSource signal_source = { SOURCE_SIGNAL };
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void conn_watch(Conn* conn, int out) {
+    struct epoll_event ev;
+    ev.events = (conn->in_paused ? 0 : EPOLLIN) | (out ? EPOLLOUT : 0);
+    ev.data.ptr = conn;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->socket, &ev);
+    conn->out_watched = out;
+}
+
+// Writes what the socket takes right away and queues the rest. Returns -1 if
+// the connection is broken or more than `limit` bytes would be queued.
+static int conn_send(Conn* conn, const char* data, size_t len, size_t limit) {
+    if (conn->socket == -1) return -1;
+
+    size_t sent = 0;
+    if (!conn->out_head) {
+        ssize_t n = send(conn->socket, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            sent = n;
+        } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            return -1;
+        }
+    }
+    if (sent == len) return 0;
+    if (conn->out_bytes + (len - sent) > limit) return -1;
+
+    OutChunk* chunk = malloc(sizeof(OutChunk) + len - sent);
+    if (!chunk) return -1;
+    chunk->next = NULL;
+    chunk->len = len - sent;
+    chunk->offset = 0;
+    memcpy(chunk->data, data + sent, len - sent);
+    if (conn->out_tail) {
+        conn->out_tail->next = chunk;
+    } else {
+        conn->out_head = chunk;
+    }
+    conn->out_tail = chunk;
+    conn->out_bytes += chunk->len;
+    if (!conn->out_watched) conn_watch(conn, 1);
+    return 0;
+}
+
+// Returns 1 once the queue is empty, 0 if bytes remain, -1 on error.
+static int conn_flush(Conn* conn) {
+    while (conn->out_head) {
+        OutChunk* chunk = conn->out_head;
+        ssize_t n = send(conn->socket, chunk->data + chunk->offset, chunk->len - chunk->offset,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+            return -1;
+        }
+        chunk->offset += n;
+        conn->out_bytes -= n;
+        if (chunk->offset == chunk->len) {
+            conn->out_head = chunk->next;
+            if (!conn->out_head) conn->out_tail = NULL;
+            free(chunk);
+        }
+    }
+    if (conn->out_watched) conn_watch(conn, 0);
+    return 1;
+}
+
+static void conn_close(Conn* conn) {
+    if (conn->socket == -1) return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->socket, NULL);
+    close(conn->socket);
+    conn->socket = -1;
+    while (conn->out_head) {
+        OutChunk* chunk = conn->out_head;
+        conn->out_head = chunk->next;
+        free(chunk);
+    }
+    conn->out_tail = NULL;
+    conn->out_bytes = 0;
+    conn->out_watched = 0;
+    conn->in_paused = 0;
+}
+
+static void conn_pause_input(Conn* conn, int paused) {
+    if (conn->in_paused == paused) return;
+    conn->in_paused = paused;
+    conn_watch(conn, conn->out_watched);
+}
+
+static void send_text(Session* session, const char* text) {
+    conn_send(&session->conn, text, strlen(text), MAX_OUTBOUND_BYTES);
+}
+
+// A link that cannot take a frame is shut down; the loop sees the hangup
+// and takes its sessions down with it.
+static void send_frame(int link, uint32_t session, int type, const char* data, size_t len) {
+    char frame[sizeof(GatewayHeader) + GATEWAY_MAX_PAYLOAD];
+    GatewayHeader header;
+    header.session = htonl(session);
+    header.type = htons(type);
+    header.len = htons(len);
+    memcpy(frame, &header, sizeof(header));
+    if (len > 0) memcpy(frame + sizeof(header), data, len);
+
+    Conn* conn = &links[link].conn;
+    if (conn->socket != -1 && conn_send(conn, frame, sizeof(header) + len, MAX_LINK_BYTES) == -1) {
+        printf("[LINK] Link %d to the core is stalled or broken. Resetting.\n", link);
+        shutdown(conn->socket, SHUT_RDWR);
+    }
+}
+
+static Session* find_session(uint32_t id) {
+    uint32_t index = id & 0xffff;
+    if (index >= (uint32_t)config.max_sessions) return NULL;
+    Session* session = &sessions[index];
+    return session->state != SESSION_FREE && session->id == id ? session : NULL;
+}
+
+static void end_session(Session* session, int notify_core) {
+    if (session->state == SESSION_FREE) return;
+    if (notify_core && (session->state == SESSION_OPENING || session->state == SESSION_ACTIVE)) {
+        send_frame(session->link, session->id, GATEWAY_CLOSE, NULL, 0);
+    }
+    timer_cancel(&timer_wheel, &session->deadline);
+    conn_close(&session->conn);
+    session->state = SESSION_FREE;
+    free_sessions[free_count++] = session->id & 0xffff;
+}
+
+// Hangs up once the queued output has reached the client.
+static void close_after_flush(Session* session) {
+    if (session->state == SESSION_FREE) return;
+    timer_cancel(&timer_wheel, &session->deadline);
+    session->state = SESSION_CLOSING;
+    if (!session->conn.out_head) end_session(session, 0);
+}
+
+static int validate_username(const char* username) {
+    size_t len = strlen(username);
+    if (len == 0 || len > MAX_USERNAME_LEN) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)username[i])) return 0;
+    }
+    return 1;
+}
+
+// Next connected link, round robin.
+static int pick_link(void) {
+    for (int i = 0; i < config.links; i++) {
+        int link = (next_link + i) % config.links;
+        if (links[link].conn.socket != -1) {
+            next_link = link + 1;
+            return link;
+        }
+    }
+    return -1;
+}
+
+static void login_failed(Session* session) {
+    if (session->attempts >= config.max_login_attempts) {
+        send_text(session, "[ERROR] Too many failed login attempts.\n");
+        close_after_flush(session);
+        return;
+    }
+    session->state = SESSION_LOGIN;
+    send_text(session, USERNAME_PROMPT);
+}
+
+static void login_attempt(Session* session, const char* username) {
+    session->attempts++;
+    if (!validate_username(username)) {
+        send_text(session, "[ERROR] Invalid username. Use alphanumeric characters only.\n");
+        login_failed(session);
+        return;
+    }
+
+    int link = pick_link();
+    if (link == -1) {
+        send_text(session, "[ERROR] Chat server unavailable. Try again later.\n");
+        close_after_flush(session);
+        return;
+    }
+
+    char open[MAX_USERNAME_LEN + INET6_ADDRSTRLEN + 2];
+    int len = snprintf(open, sizeof(open), "%s %s", username, session->ip);
+    session->link = link;
+    session->state = SESSION_OPENING;
+    send_frame(link, session->id, GATEWAY_OPEN, open, len);
+}
+
+// Splits buffered input into lines: usernames while logging in, commands
+// (one DATA frame each) once the core has accepted the session. A line that
+// fills the whole buffer is passed on as it is, like the core does.
+static void process_lines(Session* session) {
+    while (session->state == SESSION_LOGIN || session->state == SESSION_ACTIVE) {
+        char* newline = memchr(session->inbuf, '\n', session->inbuf_len);
+        if (!newline && session->inbuf_len < sizeof(session->inbuf)) return;
+
+        char line[LINE_LEN];
+        size_t len = newline ? (size_t)(newline - session->inbuf) : session->inbuf_len;
+        size_t consumed = newline ? len + 1 : len;
+        if (len >= sizeof(line)) len = sizeof(line) - 1;
+        memcpy(line, session->inbuf, len);
+        line[len] = '\0';
+        if (len > 0 && line[len - 1] == '\r') line[--len] = '\0';
+        memmove(session->inbuf, session->inbuf + consumed, session->inbuf_len - consumed);
+        session->inbuf_len -= consumed;
+
+        if (session->state == SESSION_LOGIN) {
+            login_attempt(session, line);
+        } else if (len > 0) {
+            send_frame(session->link, session->id, GATEWAY_DATA, line, len);
+        }
+    }
+}
+
+static void handle_session_input(Session* session) {
+    if (session->state == SESSION_CLOSING) {
+        // Input no longer matters; only notice the hangup
+        char discard[512];
+        int bytes = recv(session->conn.socket, discard, sizeof(discard), 0);
+        if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            end_session(session, 0);
+        }
+        return;
+    }
+
+    int bytes = recv(session->conn.socket, session->inbuf + session->inbuf_len,
+                     sizeof(session->inbuf) - session->inbuf_len, 0);
+    if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        end_session(session, 1);
+        return;
+    }
+    if (bytes < 0) return;
+    session->inbuf_len += bytes;
+    process_lines(session);
+
+    // Input pipelined while the core decides on the username stays buffered;
+    // stop reading once that fills the buffer
+    if (session->state == SESSION_OPENING && session->inbuf_len == sizeof(session->inbuf)) {
+        conn_pause_input(&session->conn, 1);
+    }
+}
+
+static void handle_session_output(Session* session) {
+    int result = conn_flush(&session->conn);
+    if (result == -1) {
+        end_session(session, 1);
+    } else if (result == 1 && session->state == SESSION_CLOSING) {
+        end_session(session, 0);
+    }
+}
+
+// Runs from the wheel: no username within the deadline.
+static void login_deadline_expired(Timer* timer, void* arg) {
+    (void)timer;
+    Session* session = (Session*)arg;
+    send_text(session, "[ERROR] Login timed out.\n");
+    printf("[TIMEOUT] %s: no username within %d ms\n", session->ip, config.login_timeout_ms);
+    end_session(session, 1);
+}
+
+// Client address as the core logs it; IPv4 clients of the dual-stack
+// listener show up as plain IPv4.
+static void format_peer(const struct sockaddr_storage* addr, char* out, size_t size) {
+    const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)addr;
+    if (addr->ss_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+        inet_ntop(AF_INET, &in6->sin6_addr.s6_addr[12], out, size);
+    } else if (addr->ss_family == AF_INET6) {
+        inet_ntop(AF_INET6, &in6->sin6_addr, out, size);
+    } else {
+        inet_ntop(AF_INET, &((const struct sockaddr_in*)addr)->sin_addr, out, size);
+    }
+}
+
+static void accept_sessions(int listener) {
+    while (1) {
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        int sock = accept4(listener, (struct sockaddr*)&addr, &addr_len, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (sock == -1) return;
+
+        if (free_count == 0) {
+            send(sock, "[ERROR] Server full. Try again later.\n", 38, MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(sock);
+            continue;
+        }
+
+        int index = free_sessions[--free_count];
+        Session* session = &sessions[index];
+        session->id = (((session->id >> 16) + 1) << 16) | (uint32_t)index;
+        session->conn.source.kind = SOURCE_SESSION;
+        session->conn.socket = sock;
+        session->state = SESSION_LOGIN;
+        session->link = -1;
+        session->attempts = 0;
+        session->inbuf_len = 0;
+        format_peer(&addr, session->ip, sizeof(session->ip));
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = session;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev);
+
+        timer_init(&session->deadline, login_deadline_expired, session);
+        timer_arm(&timer_wheel, &session->deadline, config.login_timeout_ms, now_ms());
+        send_text(session, USERNAME_PROMPT);
+    }
+}
+
+static void handle_frame(int link, uint32_t id, int type, const char* payload, size_t len) {
+    Session* session = find_session(id);
+    if (!session || session->link != link) return;
+
+    if (type == GATEWAY_DATA) {
+        if (session->state == SESSION_FREE) return;
+        if (conn_send(&session->conn, payload, len, MAX_OUTBOUND_BYTES) == -1) {
+            printf("[SLOW] %s has %zu bytes queued. Disconnecting.\n", session->ip, session->conn.out_bytes);
+            end_session(session, 1);
+        }
+    } else if (type == GATEWAY_ACCEPT && session->state == SESSION_OPENING) {
+        timer_cancel(&timer_wheel, &session->deadline);
+        session->state = SESSION_ACTIVE;
+        conn_pause_input(&session->conn, 0);
+        process_lines(session);
+    } else if (type == GATEWAY_TAKEN && session->state == SESSION_OPENING) {
+        send_text(session, "[ERROR] Username already taken. Choose another.\n");
+        conn_pause_input(&session->conn, 0);
+        login_failed(session);
+        process_lines(session);
+    } else if (type == GATEWAY_FULL && session->state == SESSION_OPENING) {
+        send_text(session, "[ERROR] Server full. Try again later.\n");
+        close_after_flush(session);
+    } else if (type == GATEWAY_CLOSE) {
+        close_after_flush(session);
+    }
+}
+
+// The core went away: its sessions cannot continue.
+static void link_down(int link) {
+    conn_close(&links[link].conn);
+    links[link].inbuf_len = 0;
+    printf("[LINK] Lost link %d to the core\n", link);
+    for (int i = 0; i < config.max_sessions; i++) {
+        Session* session = &sessions[i];
+        if (session->link == link &&
+            (session->state == SESSION_OPENING || session->state == SESSION_ACTIVE)) {
+            send_text(session, "[ERROR] Lost connection to chat server.\n");
+            close_after_flush(session);
+        }
+    }
+}
+
+static void handle_link_input(int link) {
+    Link* l = &links[link];
+    int bytes = recv(l->conn.socket, l->inbuf + l->inbuf_len, sizeof(l->inbuf) - l->inbuf_len, 0);
+    if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        link_down(link);
+        return;
+    }
+    if (bytes < 0) return;
+    l->inbuf_len += bytes;
+
+    size_t start = 0;
+    while (l->inbuf_len - start >= sizeof(GatewayHeader)) {
+        GatewayHeader header;
+        memcpy(&header, l->inbuf + start, sizeof(header));
+        size_t len = ntohs(header.len);
+        if (len > GATEWAY_MAX_PAYLOAD) {
+            printf("[LINK] Malformed frame on link %d\n", link);
+            link_down(link);
+            return;
+        }
+        if (l->inbuf_len - start < sizeof(header) + len) break;
+        handle_frame(link, ntohl(header.session), ntohs(header.type), l->inbuf + start + sizeof(header), len);
+        start += sizeof(header) + len;
+    }
+    memmove(l->inbuf, l->inbuf + start, l->inbuf_len - start);
+    l->inbuf_len -= start;
+}
+
+static void handle_link_output(int link) {
+    if (conn_flush(&links[link].conn) == -1) {
+        link_down(link);
+    }
+}
+
+// Connects every link that is down; failures are retried on the next tick.
+static void connect_links(void) {
+    for (int i = 0; i < config.links; i++) {
+        Link* link = &links[i];
+        if (link->conn.socket != -1) continue;
+
+        int sock = socket(config.core_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock == -1) continue;
+        if (connect(sock, (struct sockaddr*)&config.core_addr, config.core_addr_len) == -1) {
+            close(sock);
+            continue;
+        }
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+        int opt = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        link->conn.source.kind = SOURCE_LINK;
+        link->conn.socket = sock;
+        link->inbuf_len = 0;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = link;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev);
+        printf("[LINK] Link %d connected to %s:%d\n", i, config.core_ip, config.core_port);
+    }
+}
+
+static void reconnect_timer_expired(Timer* timer, void* arg) {
+    (void)arg;
+    reconnect_due = 1;
+    timer_arm(&timer_wheel, timer, RECONNECT_MS, now_ms());
+}
+
+static void print_usage(const char* program) {
+    fprintf(stderr, "Usage: %s [options] <port> <core_ip> <core_port>\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --links <n>            Links to the core (default %d, max %d)\n", DEFAULT_LINKS, MAX_LINKS);
+    fprintf(stderr, "  --max-sessions <n>     Client connections held at once (default %d, max %d)\n",
+        DEFAULT_MAX_SESSIONS, MAX_SESSIONS);
+    fprintf(stderr, "  --login-timeout <ms>   Handshake deadline for the username prompt (default %d)\n",
+        DEFAULT_LOGIN_TIMEOUT_MS);
+    fprintf(stderr, "  --login-attempts <n>   Username attempts before disconnect (default %d)\n",
+        DEFAULT_LOGIN_ATTEMPTS);
+}
+
+static void parse_arguments(int argc, char* argv[]) {
+    static const struct option options[] = {
+        { "links", required_argument, NULL, 'k' },
+        { "max-sessions", required_argument, NULL, 'm' },
+        { "login-timeout", required_argument, NULL, 'l' },
+        { "login-attempts", required_argument, NULL, 'a' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        int value = optarg ? atoi(optarg) : 0;
+        if (optarg && value <= 0) {
+            fprintf(stderr, "Invalid value for option: %s\n", optarg);
+            exit(1);
+        }
+        switch (opt) {
+            case 'k': config.links = value; break;
+            case 'm': config.max_sessions = value; break;
+            case 'l': config.login_timeout_ms = value; break;
+            case 'a': config.max_login_attempts = value; break;
+            case 'h':
+                print_usage(argv[0]);
+                exit(0);
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
+    if (argc - optind != 3 || config.links > MAX_LINKS || config.max_sessions > MAX_SESSIONS) {
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+    config.port = atoi(argv[optind]);
+    config.core_ip = argv[optind + 1];
+    config.core_port = atoi(argv[optind + 2]);
+    if (config.port <= 0 || config.port > 10000 || config.core_port <= 0 || config.core_port > 65535) {
+        fprintf(stderr, "Invalid port number\n");
+        exit(1);
+    }
+
+    // Resolved once; an IPv4 or IPv6 literal, or a host name
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    char port_text[8];
+    snprintf(port_text, sizeof(port_text), "%d", config.core_port);
+    int error = getaddrinfo(config.core_ip, port_text, &hints, &result);
+    if (error != 0) {
+        fprintf(stderr, "Invalid core address %s: %s\n", config.core_ip, gai_strerror(error));
+        exit(1);
+    }
+    memcpy(&config.core_addr, result->ai_addr, result->ai_addrlen);
+    config.core_addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+}
+
+int main(int argc, char* argv[]) {
+    parse_arguments(argc, argv);
+
+    sessions = calloc(config.max_sessions, sizeof(Session));
+    free_sessions = malloc(config.max_sessions * sizeof(int));
+    if (!sessions || !free_sessions) {
+        perror("Failed to allocate sessions");
+        exit(1);
+    }
+    // Popped from the end, so low indexes go first
+    for (int i = 0; i < config.max_sessions; i++) {
+        free_sessions[i] = config.max_sessions - 1 - i;
+        sessions[i].conn.socket = -1;
+        sessions[i].link = -1;
+    }
+    free_count = config.max_sessions;
+    for (int i = 0; i < MAX_LINKS; i++) {
+        links[i].conn.socket = -1;
+    }
+
+    sigset_t signal_mask;
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGINT);
+    sigaddset(&signal_mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signal_mask, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    int signal_fd = signalfd(-1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1 || signal_fd == -1) {
+        perror("epoll_create1/signalfd failed");
+        exit(1);
+    }
+    timer_wheel_init(&timer_wheel, TIMER_TICK_MS, now_ms());
+
+    // Dual-stack: IPv4 clients arrive on the IPv6 socket as ::ffff:a.b.c.d.
+    // Hosts without IPv6 fall back to an IPv4 socket.
+    int listener = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    int v6 = listener != -1;
+    if (!v6) listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (listener == -1) {
+        perror("Socket creation failed");
+        exit(1);
+    }
+    int opt = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    memset(&addr, 0, sizeof(addr));
+    if (v6) {
+        int v6only = 0;
+        setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+        struct sockaddr_in6* in6 = (struct sockaddr_in6*)&addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_addr = in6addr_any;
+        in6->sin6_port = htons(config.port);
+        addr_len = sizeof(*in6);
+    } else {
+        struct sockaddr_in* in = (struct sockaddr_in*)&addr;
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = INADDR_ANY;
+        in->sin_port = htons(config.port);
+        addr_len = sizeof(*in);
+    }
+    if (bind(listener, (struct sockaddr*)&addr, addr_len) == -1 || listen(listener, SOMAXCONN) == -1) {
+        perror("Bind failed");
+        exit(1);
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listener_source;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener, &ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &signal_source;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+
+    printf("[INFO] Gateway listening on port %d, core at %s:%d over %d links\n",
+        config.port, config.core_ip, config.core_port, config.links);
+    connect_links();
+    timer_init(&reconnect_timer, reconnect_timer_expired, NULL);
+    timer_arm(&timer_wheel, &reconnect_timer, RECONNECT_MS, now_ms());
+
+    while (running) {
+        int timeout = timer_wheel_next_timeout(&timer_wheel, now_ms());
+        struct epoll_event events[64];
+        int n = epoll_wait(epoll_fd, events, 64, timeout);
+        if (n == -1 && errno != EINTR) {
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            EventSource* source = events[i].data.ptr;
+            uint32_t flags = events[i].events;
+            if (source->kind == SOURCE_LISTENER) {
+                accept_sessions(listener);
+            } else if (source->kind == SOURCE_SIGNAL) {
+                running = 0;
+            } else if (source->kind == SOURCE_SESSION) {
+                Session* session = (Session*)source;
+                if ((flags & EPOLLOUT) && session->state != SESSION_FREE) handle_session_output(session);
+                if ((flags & (EPOLLIN | EPOLLHUP | EPOLLERR)) && session->state != SESSION_FREE) {
+                    handle_session_input(session);
+                }
+            } else if (source->kind == SOURCE_LINK) {
+                int link = (int)((Link*)source - links);
+                if ((flags & EPOLLOUT) && links[link].conn.socket != -1) handle_link_output(link);
+                if ((flags & (EPOLLIN | EPOLLHUP | EPOLLERR)) && links[link].conn.socket != -1) {
+                    handle_link_input(link);
+                }
+            }
+        }
+
+        timer_wheel_advance(&timer_wheel, now_ms());
+        if (reconnect_due) {
+            reconnect_due = 0;
+            connect_links();
+        }
+    }
+
+    printf("\n[SHUTDOWN] Closing %d sessions and %d links\n", config.max_sessions - free_count, config.links);
+    for (int i = 0; i < config.max_sessions; i++) {
+        end_session(&sessions[i], 0);
+    }
+    for (int i = 0; i < config.links; i++) {
+        conn_close(&links[i].conn);
+    }
+    close(listener);
+    close(signal_fd);
+    close(epoll_fd);
+    free(sessions);
+    free(free_sessions);
+    return 0;
+}
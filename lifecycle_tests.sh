@@ -0,0 +1,394 @@
+#!/bin/bash
+set -e
+
+# Server lifecycle tests: the login handshake's deadline and caps, the
+# bounded drain on SIGTERM, hot restart, snapshot restore and the hot
+# standby. Each test starts its own server with the options it needs. Raw
+# connections use bash's /dev/tcp.
+# run: $ make check   (or: $ make all && bash lifecycle_tests.sh)
+
+# Configuration
+SERVER_PORT=5200
+TEST_DIR="test_lifecycle"
+SERVER_LOG="$TEST_DIR/server.log"
+rm -rf $TEST_DIR
+mkdir -p $TEST_DIR
+
+# Cleanup function
+cleanup() {
+    echo "Cleaning up..."
+    for pid in $READER_PIDS; do
+        kill $pid 2>/dev/null || true
+    done
+    if [ -n "$SERVER_PID" ]; then
+        kill $SERVER_PID 2>/dev/null || true
+        wait $SERVER_PID 2>/dev/null || true
+    fi
+    rm -rf $TEST_DIR
+}
+trap cleanup EXIT
+
+# Starts the server on $SERVER_PORT with the given options. Its output is
+# line buffered so tests can check it while the server runs.
+start_server() {
+    echo "Starting server on port $SERVER_PORT $*..."
+    stdbuf -oL ./chatserver "$@" $SERVER_PORT >> $SERVER_LOG 2>&1 &
+    SERVER_PID=$!
+    sleep 1 # Wait for server to start
+}
+
+# Stops the server with signal $1 (default TERM) and waits for it to exit
+stop_server() {
+    kill -${1:-TERM} $SERVER_PID
+    wait $SERVER_PID 2>/dev/null || true
+    SERVER_PID=
+}
+
+# Opens a raw connection on descriptor $1 (3-9) to port $2; what the
+# server sends is copied to $TEST_DIR/$3.log. The reader holds no other
+# connection open, so close_conn really drops them.
+open_conn() {
+    local fd=$1 port=$2 name=$3
+    eval "exec $fd<>/dev/tcp/127.0.0.1/$port"
+    (
+        for other in 3 4 5 6 7 8 9; do
+            [ $other -ne $fd ] && eval "exec $other>&-"
+        done
+        exec cat <&$fd
+    ) > $TEST_DIR/$name.log &
+    eval "READER_$fd=$!"
+    READER_PIDS="$READER_PIDS $!"
+}
+
+# Drops connection $1 without /exit
+close_conn() {
+    local fd=$1
+    eval "kill \$READER_$fd 2>/dev/null || true"
+    eval "exec $fd>&-"
+}
+
+# Succeeds once the server has closed connection $1 (its reader saw EOF)
+conn_closed() {
+    local fd=$1
+    eval "! kill -0 \$READER_$fd 2>/dev/null"
+}
+
+# Sends each argument as a line on descriptor $1
+send_lines() {
+    local fd=$1
+    shift
+    for line in "$@"; do
+        printf '%s\n' "$line" >&$fd
+    done
+}
+
+expect() {
+    local file=$1 pattern=$2 message=$3
+    if grep -aqF -- "$pattern" $TEST_DIR/$file.log; then
+        echo "PASS: $message"
+    else
+        echo "FAIL: $message (no \"$pattern\" in $file.log)"
+        exit 1
+    fi
+}
+
+expect_in_log() {
+    local pattern=$1 message=$2
+    if grep -aqF -- "$pattern" $SERVER_LOG; then
+        echo "PASS: $message"
+    else
+        echo "FAIL: $message (no \"$pattern\" in the server output)"
+        exit 1
+    fi
+}
+
+expect_closed() {
+    local fd=$1 message=$2
+    if conn_closed $fd; then
+        echo "PASS: $message"
+    else
+        echo "FAIL: $message (connection on fd $fd still open)"
+        exit 1
+    fi
+}
+
+# Test 1: Login deadline, slowloris trickle, attempt cap and pre-auth limit
+test_login_limits() {
+    echo "Running Test 1: Login deadline and attempt cap"
+    start_server --login-timeout 800 --login-attempts 2 --max-pending 3
+
+    open_conn 3 $SERVER_PORT silent
+    open_conn 4 $SERVER_PORT trickle
+    open_conn 5 $SERVER_PORT guesser
+    send_lines 5 "bad name!" "also bad!"
+
+    # Bytes keep arriving but never a whole line: the deadline still holds
+    for i in 1 2 3 4 5 6 7; do
+        (printf 'x' >&4) 2>/dev/null || true # EPIPE once it is closed
+        sleep 0.2
+    done
+    sleep 0.3
+
+    expect silent "[ERROR] Login timed out." "Silent connection hit the login deadline"
+    expect_closed 3 "Silent connection closed"
+    expect trickle "[ERROR] Login timed out." "Trickling connection hit the login deadline"
+    expect_closed 4 "Trickling connection closed"
+    expect guesser "[ERROR] Invalid username." "Invalid name refused"
+    expect guesser "[ERROR] Too many failed login attempts." "Attempt cap enforced"
+    expect_closed 5 "Guessing connection closed"
+    close_conn 3
+    close_conn 4
+    close_conn 5
+
+    # Only three handshakes at a time; a registered user does not count
+    open_conn 3 $SERVER_PORT pend1
+    open_conn 4 $SERVER_PORT pend2
+    open_conn 5 $SERVER_PORT pend3
+    sleep 0.3
+    open_conn 6 $SERVER_PORT pend4
+    sleep 0.3
+    expect pend4 "[ERROR] Server busy. Try again later." "Pre-auth limit refuses a fourth handshake"
+    expect_closed 6 "Refused connection closed"
+    send_lines 3 "limituser"
+    sleep 0.3
+    expect pend1 "[SUCCESS] Connected to chat server!" "Login within the deadline succeeds"
+    open_conn 7 $SERVER_PORT pend5
+    sleep 0.3
+    if ! grep -aqF "Server busy" $TEST_DIR/pend5.log; then
+        echo "PASS: A finished login frees its handshake slot"
+    else
+        echo "FAIL: Handshake slot not freed by a finished login"
+        exit 1
+    fi
+    for fd in 3 4 5 6 7; do
+        close_conn $fd
+    done
+    stop_server
+}
+
+# Largest Send-Q among the server's established connections: what the
+# kernel holds for the slowest reader
+server_send_queue() {
+    ss -tnH state established "( sport = :$SERVER_PORT )" | awk '$2 > max { max = $2 } END { print max + 0 }'
+}
+
+# Test 2: SIGTERM drains outbound queues, but only for --drain-timeout
+test_bounded_drain() {
+    echo "Running Test 2: Bounded drain on SIGTERM"
+    start_server --drain-timeout 700
+
+    # fd 3 never reads: once the kernel buffers are full, its output waits
+    # in the server's queue
+    exec 3<>/dev/tcp/127.0.0.1/$SERVER_PORT
+    open_conn 4 $SERVER_PORT talker
+    open_conn 5 $SERVER_PORT listener
+    send_lines 3 "stalled" "/join drainrm"
+    send_lines 4 "talker" "/join drainrm"
+    send_lines 5 "listener" "/join drainrm"
+    sleep 0.3
+
+    local line=$(head -c 900 /dev/zero | tr '\0' y)
+    local queued=-1 previous
+    for batch in $(seq 1 200); do
+        for i in $(seq 1 50); do
+            printf '/broadcast %s\n' "$line"
+        done >&4
+        sleep 0.1
+        previous=$queued
+        queued=$(server_send_queue)
+        [ "$queued" -gt 0 ] && [ "$queued" -eq "$previous" ] && break
+    done
+    if [ "$queued" -gt 0 ] && [ "$queued" -eq "$previous" ]; then
+        echo "PASS: Stalled reader filled its socket buffers"
+    else
+        echo "FAIL: Could not build up a queue for the stalled reader"
+        exit 1
+    fi
+
+    local start=$(date +%s%N)
+    stop_server TERM
+    local elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+    exec 3>&-
+
+    expect listener "[SERVER] Server shutting down. Goodbye!" "Reading client got the goodbye"
+    local drain=$(grep -ao 'Drain finished in [0-9]* ms, [0-9]* bytes undelivered' $SERVER_LOG | tail -1)
+    local drain_ms=$(echo "$drain" | awk '{print $4}')
+    local undelivered=$(echo "$drain" | awk '{print $6}')
+    if [ -n "$drain" ] && [ "$drain_ms" -ge 600 ] && [ "$drain_ms" -lt 1500 ] && [ "$undelivered" -gt 0 ]; then
+        echo "PASS: Drain gave up at the limit ($drain)"
+    else
+        echo "FAIL: Drain not bounded by --drain-timeout (${drain:-no drain report})"
+        exit 1
+    fi
+    if [ "$elapsed" -lt 3000 ]; then
+        echo "PASS: Server exited ${elapsed} ms after SIGTERM"
+    else
+        echo "FAIL: Server took ${elapsed} ms to exit after SIGTERM"
+        exit 1
+    fi
+    close_conn 4
+    close_conn 5
+}
+
+# Hot restart: starts a successor with --takeover and waits for the
+# current server to hand over and exit
+hot_restart() {
+    local predecessor=$SERVER_PID
+    start_server --takeover $TEST_DIR/handoff.sock
+    if wait $predecessor; then
+        echo "PASS: Predecessor exited after the handoff"
+    else
+        echo "FAIL: Predecessor did not exit cleanly"
+        exit 1
+    fi
+}
+
+# Test 3: Hot restart hands the listener, clients and handshakes over, twice
+test_handoff() {
+    echo "Running Test 3: Hot restart round trip"
+    start_server --handoff $TEST_DIR/handoff.sock
+
+    open_conn 3 $SERVER_PORT alice
+    open_conn 4 $SERVER_PORT bob
+    open_conn 5 $SERVER_PORT carol
+    send_lines 3 "alice" "/join hotrm"
+    send_lines 4 "bob" "/join hotrm"
+    sleep 0.5
+
+    # carol is still at the username prompt when the process changes
+    hot_restart
+    expect_in_log "Took over 2 clients from predecessor." "Successor adopted both clients"
+    send_lines 4 "/broadcast after the first restart"
+    send_lines 5 "carol" "/join hotrm"
+    sleep 0.5
+    expect alice "bob: after the first restart" "Adopted clients still share their room"
+    expect carol "[SUCCESS] Connected to chat server!" "Handshake finished on the successor"
+    open_conn 6 $SERVER_PORT dave
+    send_lines 6 "dave"
+    sleep 0.3
+    expect dave "[SUCCESS] Connected to chat server!" "Successor accepts on the inherited listener"
+
+    # ...and back again to a third process
+    hot_restart
+    expect_in_log "Took over 4 clients from predecessor." "Second successor adopted every client"
+    send_lines 3 "/broadcast after the second restart"
+    sleep 0.5
+    expect bob "alice: after the second restart" "Room survived two restarts"
+    expect carol "alice: after the second restart" "Client adopted mid-handshake survived too"
+    for fd in 3 4 5 6; do
+        close_conn $fd
+    done
+    stop_server
+}
+
+# Test 4: Snapshots bring sessions back to their rooms after a crash, and a
+# damaged snapshot is ignored
+test_snapshot_restore() {
+    echo "Running Test 4: Snapshot checksum and restore"
+    local snapshot=$TEST_DIR/state.snap
+    start_server --snapshot $snapshot --snapshot-interval 200
+
+    open_conn 3 $SERVER_PORT snapalice
+    send_lines 3 "snapalice" "/join snapred" "/join snapblue" "/join snapred"
+    sleep 0.6
+    stop_server KILL
+    close_conn 3
+
+    start_server --snapshot $snapshot --snapshot-interval 200
+    open_conn 3 $SERVER_PORT snapalice2
+    open_conn 4 $SERVER_PORT snapbob
+    send_lines 3 "snapalice"
+    send_lines 4 "snapbob" "/join snapblue"
+    sleep 0.5
+    expect snapalice2 "[INFO] Restoring your rooms from before the restart." "Session restored after a crash"
+    send_lines 4 "/broadcast blue after the crash"
+    send_lines 3 "/broadcast said in the current room"
+    sleep 0.5
+    expect snapalice2 "snapbob: blue after the crash" "Restored to a room she was not talking in"
+    if ! grep -aq "said in the current room" $TEST_DIR/snapbob.log; then
+        echo "PASS: Restored current room is still the one she talked in"
+    else
+        echo "FAIL: Restored session talks in the wrong room"
+        exit 1
+    fi
+    sleep 0.3
+    stop_server KILL
+    close_conn 3
+    close_conn 4
+
+    # Damage the other user's entries only: what is left of snapalice's is
+    # intact, but the checksum no longer matches
+    for offset in $(grep -boa snapbob $snapshot | cut -d: -f1); do
+        printf 'X' | dd of=$snapshot bs=1 seek=$offset conv=notrunc status=none
+    done
+    start_server --snapshot $snapshot --snapshot-interval 200
+    open_conn 3 $SERVER_PORT snapalice3
+    open_conn 4 $SERVER_PORT snapbob2
+    send_lines 3 "snapalice"
+    send_lines 4 "snapbob" "/join snapblue"
+    sleep 0.5
+    send_lines 4 "/broadcast blue after the damage"
+    sleep 0.3
+    expect snapalice3 "[SUCCESS] Connected to chat server!" "Server starts from a damaged snapshot"
+    if ! grep -aq "Restoring your rooms\|blue after the damage" $TEST_DIR/snapalice3.log; then
+        echo "PASS: Damaged snapshot not restored"
+    else
+        echo "FAIL: Session restored from a snapshot that failed its checksum"
+        exit 1
+    fi
+    close_conn 3
+    close_conn 4
+    stop_server
+}
+
+# Test 5: A standby started late catches up on history, then takes over
+test_standby_catch_up() {
+    echo "Running Test 5: Standby catch-up and takeover"
+    start_server --replicate $TEST_DIR/replica.sock
+
+    open_conn 3 $SERVER_PORT repalice
+    send_lines 3 "repalice" "/join reprm" "/broadcast before the standby" "/broadcast still before"
+    sleep 0.5
+
+    stdbuf -oL ./chatserver --standby $TEST_DIR/replica.sock $SERVER_PORT >> $SERVER_LOG 2>&1 &
+    local standby=$!
+    sleep 0.5
+    send_lines 3 "/broadcast after the standby"
+    sleep 0.5
+    expect_in_log "[INFO] Standby: following leader on $TEST_DIR/replica.sock" "Standby attached to the leader"
+    close_conn 3
+    stop_server
+
+    # The standby binds the port once the leader has been gone a while
+    SERVER_PID=$standby
+    for i in $(seq 1 50); do
+        grep -aqF "[INFO] Leader gone; taking over" $SERVER_LOG && break
+        sleep 0.1
+    done
+    sleep 0.5
+    expect_in_log "[INFO] Leader gone; taking over" "Standby took over after the leader exited"
+    open_conn 3 $SERVER_PORT repbob
+    send_lines 3 "repbob" "/join reprm"
+    sleep 0.5
+    expect repbob "[HISTORY] [reprm] repalice: before the standby" "History from before the standby attached"
+    expect repbob "[HISTORY] [reprm] repalice: after the standby" "History streamed while following"
+    if [ "$(grep -ac '\[HISTORY\] \[reprm\]' $TEST_DIR/repbob.log)" -eq 3 ]; then
+        echo "PASS: Each entry replayed once"
+    else
+        echo "FAIL: History replayed the wrong number of entries"
+        exit 1
+    fi
+    close_conn 3
+    stop_server
+}
+
+# Run all tests
+test_login_limits
+test_bounded_drain
+test_handoff
+test_snapshot_restore
+test_standby_catch_up
+
+echo ""
+echo "========================================"
+echo "All lifecycle tests passed successfully!"
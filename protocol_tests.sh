@@ -0,0 +1,414 @@
+#!/bin/bash
+set -e
+
+# Protocol tests against a running server: binary client protocol file
+# transfers, WebSocket clients, sequenced delivery with /resume, session
+# /reconnect, the --unix listener, IPv6 clients, stream compression and
+# operator announcements. Raw connections use bash's /dev/tcp, and
+# tests/unix_conn for the Unix socket.
+# run: $ make check   (or: $ make all && bash protocol_tests.sh)
+
+# Configuration
+SERVER_PORT=5100
+WS_PORT=5101
+SERVER_LOG="test_protocol_server.log"
+TEST_DIR="test_protocol"
+UNIX_PATH="$TEST_DIR/chat.sock"
+mkdir -p $TEST_DIR
+
+# Cleanup function
+cleanup() {
+    echo "Cleaning up..."
+    for pid in $READER_PIDS $UNIX_PIDS; do
+        kill $pid 2>/dev/null || true
+    done
+    if [ -n "$SERVER_PID" ]; then
+        kill $SERVER_PID 2>/dev/null || true
+        wait $SERVER_PID 2>/dev/null || true
+    fi
+    rm -f $SERVER_LOG
+    rm -rf $TEST_DIR
+}
+trap cleanup EXIT
+
+# Start the server
+start_server() {
+    echo "Starting server on port $SERVER_PORT (WebSocket on $WS_PORT, Unix socket $UNIX_PATH)..."
+    stdbuf -oL ./chatserver --ws-port $WS_PORT --unix $UNIX_PATH $SERVER_PORT > $SERVER_LOG 2>&1 &
+    SERVER_PID=$!
+    sleep 1 # Wait for server to start
+}
+
+# Opens a raw connection on descriptor $1 (3-9) to port $2 (on $4, by
+# default 127.0.0.1); what the server sends is copied to $TEST_DIR/$3.log.
+# The reader holds no other connection open, so close_conn really drops
+# them.
+open_conn() {
+    local fd=$1 port=$2 name=$3 host=${4:-127.0.0.1}
+    eval "exec $fd<>/dev/tcp/$host/$port"
+    (
+        for other in 3 4 5 6 7 8 9; do
+            [ $other -ne $fd ] && eval "exec $other>&-"
+        done
+        exec cat <&$fd
+    ) > $TEST_DIR/$name.log &
+    eval "READER_$fd=$!"
+    READER_PIDS="$READER_PIDS $!"
+}
+
+# Opens a connection to the --unix listener on descriptor $1; what the
+# server sends is copied to $TEST_DIR/$2.log. Closing the descriptor ends
+# the connection.
+open_unix() {
+    local fd=$1 name=$2
+    eval "exec $fd> >(exec ./tests/unix_conn $UNIX_PATH > $TEST_DIR/$name.log)"
+    UNIX_PIDS="$UNIX_PIDS $!"
+}
+
+# Drops connection $1 without /exit
+close_conn() {
+    local fd=$1
+    eval "kill \$READER_$fd 2>/dev/null || true"
+    eval "exec $fd>&-"
+}
+
+# Sends each argument as a line on descriptor $1
+send_lines() {
+    local fd=$1
+    shift
+    for line in "$@"; do
+        printf '%s\n' "$line" >&$fd
+    done
+}
+
+expect() {
+    local file=$1 pattern=$2 message=$3
+    if grep -aqF -- "$pattern" $TEST_DIR/$file.log; then
+        echo "PASS: $message"
+    else
+        echo "FAIL: $message (no \"$pattern\" in $file.log)"
+        exit 1
+    fi
+}
+
+expect_not() {
+    local file=$1 pattern=$2 message=$3
+    if grep -aqF -- "$pattern" $TEST_DIR/$file.log; then
+        echo "FAIL: $message (\"$pattern\" in $file.log)"
+        exit 1
+    else
+        echo "PASS: $message"
+    fi
+}
+
+# Test 1: Binary protocol file transfer needs the receiver's consent
+test_binary_transfer() {
+    echo "Running Test 1: Binary protocol file transfer"
+
+    mkdir -p $TEST_DIR/alice $TEST_DIR/bob $TEST_DIR/carol
+    head -c 6000 /dev/urandom | base64 > $TEST_DIR/alice/notes.txt
+    head -c 5000 /dev/urandom | base64 > $TEST_DIR/carol/notes.txt
+    local client=$PWD/chatclient
+
+    # A transfer is named by its first chunk's request number: the login is
+    # request 1 and the /sendfile line 2, so both senders use 3
+    (cd $TEST_DIR/bob && (echo bob; sleep 2.5; echo "/accept alice 3"; echo "/reject carol 3"; sleep 1; echo /exit) |
+        $client --binary 127.0.0.1 $SERVER_PORT > ../bob.log 2>&1) &
+    local bob=$!
+    sleep 0.5
+    for sender in alice carol; do
+        (cd $TEST_DIR/$sender && (echo $sender; sleep 0.3; echo "/sendfile notes.txt bob"; sleep 2.5; echo /exit) |
+            $client --binary 127.0.0.1 $SERVER_PORT > ../$sender.log 2>&1) &
+    done
+    wait $bob
+
+    expect bob "alice is sending you notes.txt" "Receiver asked about alice's file"
+    expect bob "carol is sending you notes.txt" "Receiver asked about carol's file"
+    if cmp -s $TEST_DIR/alice/notes.txt $TEST_DIR/bob/received_alice_notes.txt; then
+        echo "PASS: Accepted file saved intact"
+    else
+        echo "FAIL: Accepted file missing or corrupted"
+        exit 1
+    fi
+    if [ ! -e $TEST_DIR/bob/received_carol_notes.txt ]; then
+        echo "PASS: Rejected file not saved"
+    else
+        echo "FAIL: Rejected file was saved"
+        exit 1
+    fi
+}
+
+# Test 2: WebSocket upgrade and a login over masked frames
+test_websocket() {
+    echo "Running Test 2: WebSocket client"
+
+    open_conn 3 $WS_PORT ws
+    printf 'GET /chat HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n' >&3
+    printf 'Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n' >&3
+    # Text frames, FIN set, masked with a zero key so the payload reads as is
+    printf '\x81\x86\x00\x00\x00\x00wsuser' >&3
+    printf '\x81\x8a\x00\x00\x00\x00/join wsrm' >&3
+    sleep 1
+    close_conn 3
+
+    expect ws "HTTP/1.1 101 Switching Protocols" "Upgrade accepted"
+    expect ws "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=" "Accept key computed"
+    expect ws "[SUCCESS] Connected to chat server!" "Logged in over WebSocket frames"
+    expect ws "[SUCCESS] Joined room 'wsrm'" "Command sent over WebSocket frames"
+}
+
+# Test 3: Sequenced delivery, /resume, and resuming a dropped reader
+test_sequenced_resume() {
+    echo "Running Test 3: Sequenced delivery and resume"
+
+    open_conn 3 $SERVER_PORT seqa
+    open_conn 4 $SERVER_PORT seqb
+    send_lines 3 "seqa" "/sequenced" "/join seqroom"
+    send_lines 4 "seqb" "/join seqroom"
+    sleep 0.5
+    send_lines 4 "/broadcast one" "/broadcast two" "/broadcast three"
+    sleep 0.5
+    expect seqa "[seqroom #1] seqb: one" "Lines are numbered per room"
+    expect seqa "[seqroom #3] seqb: three" "Numbers follow delivery order"
+
+    # Nothing was acknowledged, so everything after #1 is still retained
+    send_lines 3 "/resume seqroom 1"
+    sleep 0.5
+    expect seqa "[SEQ] Resuming 'seqroom' after #1" "Resume acknowledged"
+    if [ "$(grep -ac 'seqroom #3\] seqb: three' $TEST_DIR/seqa.log)" -eq 2 ] &&
+       [ "$(grep -ac 'seqroom #1\] seqb: one' $TEST_DIR/seqa.log)" -eq 1 ]; then
+        echo "PASS: Resume replays only what came after #1"
+    else
+        echo "FAIL: Resume replayed the wrong lines"
+        exit 1
+    fi
+
+    # A dropped reader keeps its place; the next connection picks it up
+    send_lines 3 "/ack seqroom 3"
+    sleep 0.3
+    close_conn 3
+    sleep 0.5
+    send_lines 4 "/broadcast four"
+    sleep 0.3
+    open_conn 5 $SERVER_PORT seqa2
+    send_lines 5 "seqa" "/resume seqroom 3"
+    sleep 0.5
+    expect seqa2 "[seqroom #4] seqb: four" "Dropped reader resumed with what it missed"
+    if ! grep -aq "seqroom #3\]" $TEST_DIR/seqa2.log; then
+        echo "PASS: Acknowledged lines not sent again"
+    else
+        echo "FAIL: Acknowledged lines sent again"
+        exit 1
+    fi
+    send_lines 4 "/exit"
+    send_lines 5 "/exit"
+    sleep 0.3
+    close_conn 4
+    close_conn 5
+}
+
+# Test 4: Session reconnect with the token from the login
+test_session_reconnect() {
+    echo "Running Test 4: Session reconnect"
+
+    open_conn 3 $SERVER_PORT sess
+    open_conn 4 $SERVER_PORT sessb
+    send_lines 3 "sessa" "/join sessroom"
+    send_lines 4 "sessb" "/join sessroom"
+    sleep 0.5
+    local token=$(grep -ao '\[SESSION\] Token [0-9a-f]*' $TEST_DIR/sess.log | awk '{print $3}')
+    if [ -n "$token" ]; then
+        echo "PASS: Session token issued"
+    else
+        echo "FAIL: No session token"
+        exit 1
+    fi
+
+    # Drop without /exit; what is said meanwhile waits for the session
+    close_conn 3
+    sleep 0.5
+    send_lines 4 "/broadcast while you were away"
+    sleep 0.3
+    open_conn 5 $SERVER_PORT sess2
+    send_lines 5 "/reconnect $token"
+    sleep 0.5
+    expect sess2 "[SESSION] Resumed as 'sessa'" "Session resumed under its name"
+    expect sess2 "while you were away" "Missed room line delivered"
+    send_lines 4 "/broadcast welcome back"
+    sleep 0.3
+    expect sess2 "welcome back" "Resumed session is back in its room"
+
+    open_conn 6 $SERVER_PORT sess3
+    send_lines 6 "/reconnect $token"
+    sleep 0.5
+    expect sess3 "[ERROR] Unknown or expired session." "A used token is not accepted twice"
+    send_lines 4 "/exit"
+    send_lines 5 "/exit"
+    sleep 0.3
+    close_conn 4
+    close_conn 5
+    close_conn 6
+}
+
+# Test 5: Logins and chat over the --unix listener
+test_unix_login() {
+    echo "Running Test 5: Unix domain socket clients"
+
+    open_unix 3 unixbot
+    open_conn 4 $SERVER_PORT unixtcp
+    send_lines 3 "unixbot" "/join unixrm"
+    send_lines 4 "unixtcp" "/join unixrm"
+    sleep 0.5
+    expect unixbot "[SUCCESS] Connected to chat server!" "Logged in over the Unix socket"
+    send_lines 3 "/broadcast from the local socket"
+    send_lines 4 "/broadcast from tcp"
+    sleep 0.5
+    expect unixtcp "unixbot: from the local socket" "TCP client hears the Unix one"
+    expect unixbot "unixtcp: from tcp" "Unix client hears the TCP one"
+
+    open_unix 5 unixdup
+    send_lines 5 "unixtcp"
+    sleep 0.5
+    expect unixdup "[ERROR] Username already taken." "Names are shared with the TCP listener"
+    send_lines 3 "/exit"
+    send_lines 4 "/exit"
+    sleep 0.3
+    exec 3>&-
+    exec 5>&-
+    close_conn 4
+}
+
+# Test 6: IPv6 clients on the dual-stack listener, counted per family
+test_ipv6_login() {
+    echo "Running Test 6: IPv6 clients"
+
+    open_conn 3 $SERVER_PORT v6raw ::1
+    open_conn 4 $SERVER_PORT v4raw
+    send_lines 3 "v6raw" "/join v6rm"
+    send_lines 4 "v4raw" "/join v6rm"
+    (echo v6client; sleep 0.3; echo "/join v6rm"; sleep 0.6; echo "/broadcast from the ipv6 client"; sleep 0.5; echo /exit) |
+        ./chatclient ::1 $SERVER_PORT > $TEST_DIR/v6client.log 2>&1 &
+    local client=$!
+    sleep 0.5
+    expect v6raw "[SUCCESS] Connected to chat server!" "Raw client logged in over ::1"
+    send_lines 4 "/stats"
+    wait $client
+    expect v6raw "v6client: from the ipv6 client" "chatclient connected to ::1"
+    expect v4raw "v6client: from the ipv6 client" "IPv4 and IPv6 clients share rooms"
+    expect v4raw "[STATS] ipv6: 2 connected, 2 logins, 2 accepted" "IPv6 sessions counted as ipv6"
+    if grep -aq "\[STATS\] ipv4: [1-9]" $TEST_DIR/v4raw.log; then
+        echo "PASS: IPv4 sessions counted as ipv4, not as mapped ipv6"
+    else
+        echo "FAIL: No IPv4 sessions in /stats"
+        exit 1
+    fi
+    if grep -aq "New client connected: v6raw from ::1" $SERVER_LOG; then
+        echo "PASS: IPv6 address shown in the connect line"
+    else
+        echo "FAIL: IPv6 address missing from the connect line"
+        exit 1
+    fi
+    send_lines 3 "/exit"
+    send_lines 4 "/exit"
+    sleep 0.3
+    close_conn 3
+    close_conn 4
+}
+
+# Test 7: Stream compression, from the start and switched on mid-session
+test_compression() {
+    echo "Running Test 7: Stream compression"
+
+    local long=$(printf 'compressible %.0s' $(seq 1 60))
+    open_conn 3 $SERVER_PORT zipplain
+    send_lines 3 "zipplain" "/join ziprm"
+    (echo zipflag; sleep 0.3; echo "/join ziprm"; sleep 1; echo "/broadcast flag $long"; sleep 0.5; echo /stats;
+        sleep 0.5; echo /exit) |
+        ./chatclient --compress 127.0.0.1 $SERVER_PORT > $TEST_DIR/zipflag.log 2>&1 &
+    local flag=$!
+    (echo zipcmd; sleep 0.3; echo "/join ziprm"; sleep 0.3; echo /compress; sleep 0.7; echo "/broadcast cmd $long";
+        sleep 1; echo /exit) |
+        ./chatclient 127.0.0.1 $SERVER_PORT > $TEST_DIR/zipcmd.log 2>&1 &
+    local cmd=$!
+    sleep 1.5
+    send_lines 3 "/broadcast plain $long"
+    wait $flag
+    wait $cmd
+
+    expect zipflag "[COMPRESS] Stream compression enabled." "--compress negotiated after login"
+    expect zipcmd "[COMPRESS] Stream compression enabled." "/compress negotiated mid-session"
+    expect zipflag "zipplain: plain $long" "Compressed client reads a plain sender"
+    expect zipcmd "zipflag: flag $long" "Compressed clients read each other"
+    expect zipplain "zipflag: flag $long" "Plain client reads a compressed sender"
+    expect zipplain "zipcmd: cmd $long" "Plain client reads the mid-session switch"
+    local stats=$(grep -ao '\[STATS\] compression (this session): out [0-9]* -> [0-9]*' $TEST_DIR/zipflag.log)
+    local raw=$(echo "$stats" | awk '{print $6}') wire=$(echo "$stats" | awk '{print $8}')
+    if [ -n "$stats" ] && [ "$wire" -lt "$raw" ]; then
+        echo "PASS: Session output shrank ($raw -> $wire bytes)"
+    else
+        echo "FAIL: No compression in the session stats (${stats:-no stats})"
+        exit 1
+    fi
+    send_lines 3 "/exit"
+    sleep 0.3
+    close_conn 3
+}
+
+# Test 8: /announce from an operator on the Unix socket reaches every session
+test_announce() {
+    echo "Running Test 8: Operator announcements"
+
+    open_unix 3 annop
+    open_conn 4 $SERVER_PORT anntcp
+    open_conn 5 $SERVER_PORT annroom
+    open_unix 6 annlocal
+    open_conn 7 $SERVER_PORT annpending
+    send_lines 3 "annop"
+    send_lines 4 "anntcp"
+    send_lines 5 "annroom" "/join annrm"
+    send_lines 6 "annlocal" "/join annrm2"
+    sleep 0.5
+
+    send_lines 4 "/announce from tcp"
+    send_lines 3 "/announce" "/announce server going down at noon"
+    sleep 0.5
+    expect anntcp "[ERROR] Only operators (local socket sessions) can announce." "TCP session may not announce"
+    expect annop "[ERROR] Usage: /announce <message>" "Empty announcement refused"
+    if grep -aq '\[SUCCESS\] Announced to [4-9][0-9]* sessions\.' $TEST_DIR/annop.log; then
+        echo "PASS: Operator told how many sessions were reached"
+    else
+        echo "FAIL: No announcement count for the operator"
+        exit 1
+    fi
+    for name in anntcp annroom annlocal annop; do
+        expect $name "[ANNOUNCE] annop: server going down at noon" "Announcement reached $name"
+    done
+    expect_not anntcp "from tcp" "Refused announcement not sent"
+    expect_not annpending "[ANNOUNCE]" "Session still logging in not announced to"
+
+    send_lines 3 "/exit"
+    send_lines 6 "/exit"
+    send_lines 4 "/exit"
+    send_lines 5 "/exit"
+    sleep 0.3
+    exec 3>&-
+    exec 6>&-
+    close_conn 4
+    close_conn 5
+    close_conn 7
+}
+
+# Run all tests
+start_server
+test_binary_transfer
+test_websocket
+test_sequenced_resume
+test_session_reconnect
+test_unix_login
+test_ipv6_login
+test_compression
+test_announce
+
+echo ""
+echo "========================================"
+echo "All protocol tests passed successfully!"
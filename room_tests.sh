@@ -0,0 +1,389 @@
+#!/bin/bash
+set -e
+
+# Room delivery tests: output batching under --batch-window, sessions in
+# several rooms at once, fan-out across --fanout-workers threads and
+# presence updates coalesced per --presence-window, and /who and /rooms
+# across churn. Each test starts its own server with the options it needs.
+# Raw connections use bash's /dev/tcp.
+# run: $ make check   (or: $ make all && bash room_tests.sh)
+
+# Configuration
+SERVER_PORT=5400
+TEST_DIR="test_rooms"
+SERVER_LOG="$TEST_DIR/server.log"
+rm -rf $TEST_DIR
+mkdir -p $TEST_DIR
+
+# Cleanup function
+cleanup() {
+    echo "Cleaning up..."
+    for pid in $READER_PIDS; do
+        kill $pid 2>/dev/null || true
+    done
+    if [ -n "$SERVER_PID" ]; then
+        kill $SERVER_PID 2>/dev/null || true
+        wait $SERVER_PID 2>/dev/null || true
+    fi
+    rm -rf $TEST_DIR
+}
+trap cleanup EXIT
+
+# Starts the server on $SERVER_PORT with the given options
+start_server() {
+    echo "Starting server on port $SERVER_PORT $*..."
+    stdbuf -oL ./chatserver "$@" $SERVER_PORT >> $SERVER_LOG 2>&1 &
+    SERVER_PID=$!
+    sleep 1 # Wait for server to start
+}
+
+stop_server() {
+    kill -TERM $SERVER_PID
+    wait $SERVER_PID 2>/dev/null || true
+    SERVER_PID=
+}
+
+# Opens a raw connection on descriptor $1 (3-9) to port $2; what the
+# server sends is copied to $TEST_DIR/$3.log. The reader holds no other
+# connection open, so close_conn really drops them.
+open_conn() {
+    local fd=$1 port=$2 name=$3
+    eval "exec $fd<>/dev/tcp/127.0.0.1/$port"
+    (
+        for other in 3 4 5 6 7 8 9; do
+            [ $other -ne $fd ] && eval "exec $other>&-"
+        done
+        exec cat <&$fd
+    ) > $TEST_DIR/$name.log &
+    eval "READER_$fd=$!"
+    READER_PIDS="$READER_PIDS $!"
+}
+
+# Drops connection $1 without /exit
+close_conn() {
+    local fd=$1
+    eval "kill \$READER_$fd 2>/dev/null || true"
+    eval "exec $fd>&-"
+}
+
+# Sends each argument as a line on descriptor $1
+send_lines() {
+    local fd=$1
+    shift
+    for line in "$@"; do
+        printf '%s\n' "$line" >&$fd
+    done
+}
+
+expect() {
+    local file=$1 pattern=$2 message=$3
+    if grep -aqF -- "$pattern" $TEST_DIR/$file.log; then
+        echo "PASS: $message"
+    else
+        echo "FAIL: $message (no \"$pattern\" in $file.log)"
+        exit 1
+    fi
+}
+
+expect_not() {
+    local file=$1 pattern=$2 message=$3
+    if grep -aqF -- "$pattern" $TEST_DIR/$file.log; then
+        echo "FAIL: $message (\"$pattern\" in $file.log)"
+        exit 1
+    else
+        echo "PASS: $message"
+    fi
+}
+
+# Test 1: A burst is held for the window, or until the message cap
+test_batch_window() {
+    echo "Running Test 1: Output batching"
+    start_server --batch-window 1000000 --batch-messages 4
+
+    open_conn 3 $SERVER_PORT batchsend
+    open_conn 4 $SERVER_PORT batchread
+    send_lines 3 "batchsend" "/join batchrm"
+    send_lines 4 "batchread" "/join batchrm"
+    sleep 2.5 # Let the held login replies go out, and a window pass after
+
+    # The first line goes out at once, the next four fill a batch, the
+    # sixth waits for the window
+    send_lines 3 "/broadcast burst1" "/broadcast burst2" "/broadcast burst3" \
+        "/broadcast burst4" "/broadcast burst5" "/broadcast burst6"
+    sleep 0.4
+    expect batchread "batchsend: burst1" "First line of a burst not held"
+    expect batchread "batchsend: burst5" "Full batch written at the message cap"
+    expect_not batchread "batchsend: burst6" "Rest of the burst held for the window"
+    sleep 1.2
+    expect batchread "batchsend: burst6" "Held line written when the window closed"
+
+    sleep 1.2
+    send_lines 4 "/stats"
+    sleep 0.5
+    if grep -aq '\[STATS\] batching: [1-9][0-9]* held messages in [1-9]' $TEST_DIR/batchread.log; then
+        echo "PASS: Batches counted in /stats"
+    else
+        echo "FAIL: No batching line in /stats"
+        exit 1
+    fi
+    close_conn 3
+    close_conn 4
+    stop_server
+}
+
+# Test 2: One session in several rooms, leaving one it is not talking in
+test_multi_room() {
+    echo "Running Test 2: Several rooms per session"
+    start_server
+
+    open_conn 3 $SERVER_PORT multia
+    open_conn 4 $SERVER_PORT multib
+    open_conn 5 $SERVER_PORT multic
+    open_conn 6 $SERVER_PORT multid
+    send_lines 4 "multib" "/join mroomx"
+    send_lines 5 "multic" "/join mroomy"
+    send_lines 6 "multid" "/join mroomz"
+    send_lines 3 "multia" "/join mroomx" "/join mroomy" "/join mroomz"
+    sleep 0.5
+
+    # Members of every room hear from every room
+    send_lines 4 "/broadcast from x"
+    send_lines 5 "/broadcast from y"
+    sleep 0.3
+    expect multia "[mroomx] multib: from x" "Message from a background room"
+    expect multia "[mroomy] multic: from y" "Message from a second background room"
+
+    # Leaving a room that is not the current one keeps the current one
+    send_lines 3 "/leave mroomx" "/broadcast still in z"
+    sleep 0.3
+    expect multia "[SUCCESS] Left room 'mroomx'" "Left a background room"
+    expect_not multia "[INFO] Now talking in room" "Current room unchanged"
+    expect multid "[mroomz] multia: still in z" "Broadcast still goes to the current room"
+    expect_not multib "still in z" "Nothing sent to the room left"
+    send_lines 4 "/broadcast after leaving"
+    send_lines 3 "/leave mroomx"
+    sleep 0.3
+    expect_not multia "multib: after leaving" "No messages from the room left"
+    expect multia "[ERROR] You are not in room 'mroomx'." "Second leave refused"
+
+    # Joining a room already joined switches to it; leaving the current
+    # room falls back to one still joined
+    send_lines 3 "/join mroomy" "/broadcast back in y" "/leave"
+    sleep 0.3
+    expect multia "[SUCCESS] Now talking in room 'mroomy'" "Switched to a joined room"
+    expect multic "[mroomy] multia: back in y" "Broadcast follows the switch"
+    expect multia "[INFO] Now talking in room 'mroomz'" "Fell back to the remaining room"
+    send_lines 3 "/who"
+    sleep 0.3
+    expect multia "[WHO] mroomz (2): " "Remaining room lists the session"
+
+    for fd in 3 4 5 6; do close_conn $fd; done
+    stop_server
+}
+
+# Test 3: Room delivery split across fan-out threads
+test_parallel_fanout() {
+    echo "Running Test 3: Parallel fan-out"
+    start_server --fanout-workers 3 --fanout-shard 2
+
+    for fd in 3 4 5 6 7 8 9; do
+        open_conn $fd $SERVER_PORT fan$fd
+        send_lines $fd "fan$fd" "/join fanrm"
+    done
+    sleep 0.5
+
+    # Seven members in shards of two: every broadcast runs on three threads
+    for i in $(seq 1 20); do
+        send_lines 3 "/broadcast line $i"
+        send_lines 9 "/broadcast other $i"
+    done
+    sleep 1
+    local wrong=0
+    for fd in 4 5 6 7 8; do
+        local got=$(grep -aF "[fanrm] fan3: line " $TEST_DIR/fan$fd.log | sed 's/.*line //' | tr '\n' ' ')
+        local other=$(grep -acF "[fanrm] fan9: other " $TEST_DIR/fan$fd.log)
+        [ "$got" = "$(seq 1 20 | tr '\n' ' ')" ] && [ "$other" -eq 20 ] || wrong=$((wrong + 1))
+    done
+    if [ $wrong -eq 0 ]; then
+        echo "PASS: Every member got every line once, in order"
+    else
+        echo "FAIL: $wrong members missed, repeated or reordered lines"
+        exit 1
+    fi
+    expect_not fan3 "fan3: line" "Sender not sent its own lines"
+    expect fan3 "[fanrm] fan9: other 20" "Sender still gets the room's other lines"
+
+    send_lines 4 "/stats"
+    sleep 0.3
+    if grep -aq '\[STATS\] fan-out: [1-9][0-9]* broadcasts split across threads (3.0 shards' $TEST_DIR/fan4.log; then
+        echo "PASS: Broadcasts split across threads"
+    else
+        echo "FAIL: No parallel fan-out in /stats"
+        exit 1
+    fi
+    for fd in 3 4 5 6 7 8 9; do close_conn $fd; done
+    stop_server
+}
+
+# Number of presence diff lines for room $2 in $1's log
+diff_lines() {
+    grep -ac "^\[PRESENCE\] $2 [-+~]" $TEST_DIR/$1.log || true
+}
+
+# Test 4: Joins, leaves and typing reach subscribers as one line per window
+test_presence_diffs() {
+    echo "Running Test 4: Coalesced presence"
+    start_server --presence-window 800
+
+    open_conn 3 $SERVER_PORT presa
+    open_conn 7 $SERVER_PORT prese
+    open_conn 8 $SERVER_PORT presf
+    send_lines 7 "prese" "/join presrm"
+    send_lines 8 "presf" "/join presrm"
+    send_lines 3 "presa" "/join presrm" "/presence"
+    sleep 1.2 # Let the window with those joins close
+    expect presa "[PRESENCE] presrm = " "Subscriber gets the member list"
+    local before=$(diff_lines presa presrm)
+
+    # Within one window: two joins, a join cancelled by a leave, typing
+    # (twice, the second over the rate cap) and a leave
+    open_conn 4 $SERVER_PORT presb
+    open_conn 5 $SERVER_PORT presc
+    open_conn 6 $SERVER_PORT presd
+    send_lines 4 "presb" "/join presrm"
+    send_lines 5 "presc" "/join presrm" "/leave"
+    send_lines 6 "presd" "/join presrm"
+    send_lines 7 "/typing" "/typing"
+    send_lines 8 "/leave"
+    sleep 1.2
+    if [ $(($(diff_lines presa presrm) - before)) -eq 1 ]; then
+        echo "PASS: Changes in one window coalesced"
+    else
+        echo "FAIL: Expected one presence line for the window, got $(($(diff_lines presa presrm) - before))"
+        exit 1
+    fi
+    # The sessions run on their own threads, so the order within the line
+    # is not fixed
+    local line=" $(grep -a "^\[PRESENCE\] presrm [-+~]" $TEST_DIR/presa.log | tail -1 | cut -d' ' -f3-) "
+    local change
+    for change in +presb +presd ~prese -presf; do
+        case "$line" in
+            *" $change "*) echo "PASS: $change in the window's line" ;;
+            *) echo "FAIL: $change missing from the window's line:$line"; exit 1 ;;
+        esac
+    done
+    expect_not presa "presc" "Join and leave in one window cancel out"
+    expect_not prese "[PRESENCE]" "Nothing sent to sessions not subscribed"
+
+    # Unsubscribed: later changes are not sent
+    send_lines 3 "/presence off"
+    sleep 0.3
+    before=$(diff_lines presa presrm)
+    send_lines 4 "/leave"
+    sleep 1.2
+    if [ "$(diff_lines presa presrm)" -eq "$before" ]; then
+        echo "PASS: No presence lines after /presence off"
+    else
+        echo "FAIL: Presence line sent after /presence off"
+        exit 1
+    fi
+
+    send_lines 3 "/stats"
+    sleep 0.3
+    if grep -aq '\[STATS\] presence: .* [1-9][0-9]* typing updates over the rate cap' $TEST_DIR/presa.log; then
+        echo "PASS: Rapid /typing capped"
+    else
+        echo "FAIL: No capped typing updates in /stats"
+        exit 1
+    fi
+    for fd in 3 4 5 6 7 8; do close_conn $fd; done
+    stop_server
+}
+
+# Sends $2 on connection 3 and checks the reply, the last line in $1's
+# log, is exactly $3
+expect_reply() {
+    local name=$1 query=$2 reply=$3
+    send_lines 3 "$query"
+    sleep 0.2
+    local got=$(tail -1 $TEST_DIR/$name.log)
+    if [ "$got" = "$reply" ]; then
+        echo "PASS: $query -> $reply"
+    else
+        echo "FAIL: $query answered \"$got\", expected \"$reply\""
+        exit 1
+    fi
+}
+
+# Test 5: /who and /rooms follow joins, leaves, drops and reused rooms
+test_listings() {
+    echo "Running Test 5: /who and /rooms across churn"
+    start_server
+
+    open_conn 3 $SERVER_PORT churnobs
+    open_conn 4 $SERVER_PORT churnb
+    open_conn 5 $SERVER_PORT churnc
+    send_lines 3 "churnobs" "/join listx"
+    send_lines 4 "churnb" "/join listx"
+    send_lines 5 "churnc" "/join listy"
+    sleep 0.3
+    expect_reply churnobs "/rooms" "[ROOMS] listx (2), listy (1)"
+    expect_reply churnobs "/who" "[WHO] listx (2): churnobs churnb"
+    expect_reply churnobs "/who" "[WHO] listx (2): churnobs churnb"
+    expect_reply churnobs "/who listy" "[WHO] listy (1): churnc"
+
+    # A member moves between rooms
+    send_lines 4 "/leave" "/join listy"
+    sleep 0.2
+    expect_reply churnobs "/who" "[WHO] listx (1): churnobs"
+    expect_reply churnobs "/who listy" "[WHO] listy (2): churnc churnb"
+    expect_reply churnobs "/rooms" "[ROOMS] listx (1), listy (2)"
+
+    # A session drops, then the last member leaves
+    close_conn 5
+    sleep 0.3
+    expect_reply churnobs "/who listy" "[WHO] listy (1): churnb"
+    send_lines 4 "/leave"
+    sleep 0.2
+    expect_reply churnobs "/rooms" "[ROOMS] listx (1)"
+    expect_reply churnobs "/who listy" "[ERROR] No room named 'listy'."
+
+    # A new room takes the freed slot; nothing of the old one shows
+    open_conn 5 $SERVER_PORT churnd
+    send_lines 5 "churnd" "/join listz"
+    sleep 0.2
+    expect_reply churnobs "/who listz" "[WHO] listz (1): churnd"
+    expect_reply churnobs "/rooms" "[ROOMS] listx (1), listz (1)"
+
+    # Rapid churn, queried while it runs, settles on the right answer
+    for i in $(seq 1 30); do
+        send_lines 4 "/join listx" "/leave listx"
+        send_lines 5 "/join listx" "/leave"
+        send_lines 3 "/who" "/rooms"
+    done
+    sleep 0.5
+    expect_reply churnobs "/who" "[WHO] listx (1): churnobs"
+    expect_reply churnobs "/rooms" "[ROOMS] listx (1), listz (1)"
+
+    send_lines 3 "/stats"
+    sleep 0.2
+    if grep -aq '\[STATS\] listings: [1-9][0-9]* served from cache' $TEST_DIR/churnobs.log; then
+        echo "PASS: Unchanged listings served from the cache"
+    else
+        echo "FAIL: No cached listings in /stats"
+        exit 1
+    fi
+    for fd in 3 4 5; do close_conn $fd; done
+    stop_server
+}
+
+# Run all tests
+test_batch_window
+test_multi_room
+test_parallel_fanout
+test_presence_diffs
+test_listings
+
+echo ""
+echo "========================================"
+echo "All room tests passed successfully!"
@@ -0,0 +1,148 @@
+#include "bus.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Records are a 32-bit length followed by the frame, padded to 8 bytes. A
+// frame never straddles the end of the ring: if it would not fit, the
+// producer leaves a wrap marker and starts again at offset 0.
+#define BUS_WRAP 0xffffffffu
+#define BUS_RECORD(len) (((len) + sizeof(uint32_t) + 7) & ~(size_t)7)
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+// Shared (not private) futex: the two sides are different processes
+static void futex_wait(uint32_t* word, uint32_t expected) {
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t* word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+BusRing* bus_ring_create(size_t capacity, int* fd_out) {
+    capacity = (capacity + 7) & ~(size_t)7;
+    int fd = memfd_create("chatserver-bus", MFD_CLOEXEC);
+    if (fd == -1) return NULL;
+    if (ftruncate(fd, sizeof(BusRing) + capacity) == -1) {
+        close(fd);
+        return NULL;
+    }
+    BusRing* ring = mmap(NULL, sizeof(BusRing) + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    ring->capacity = (uint32_t)capacity;
+    ring->magic = BUS_RING_MAGIC;
+    *fd_out = fd;
+    return ring;
+}
+
+BusRing* bus_ring_attach(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(BusRing)) return NULL;
+    BusRing* ring = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) return NULL;
+    if (ring->magic != BUS_RING_MAGIC || sizeof(BusRing) + ring->capacity != (size_t)st.st_size) {
+        munmap(ring, st.st_size);
+        return NULL;
+    }
+    return ring;
+}
+
+void bus_ring_unmap(BusRing* ring) {
+    munmap(ring, sizeof(BusRing) + ring->capacity);
+}
+
+// Producer: returns room for a frame of up to `max_frame` bytes, or NULL if
+// the consumer has fallen that far behind.
+char* bus_ring_reserve(BusRing* ring, size_t max_frame) {
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t need = BUS_RECORD(max_frame);
+    size_t offset = head % ring->capacity;
+    size_t contiguous = ring->capacity - offset;
+
+    if (contiguous < need) {
+        if (head + contiguous + need - tail > ring->capacity) return NULL;
+        *(uint32_t*)(ring->data + offset) = BUS_WRAP;
+        head += contiguous;
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+        offset = 0;
+    } else if (head + need - tail > ring->capacity) {
+        return NULL;
+    }
+    return ring->data + offset + sizeof(uint32_t);
+}
+
+// Producer: publishes a reserved frame of `len` bytes (terminator included).
+void bus_ring_commit(BusRing* ring, char* frame, size_t len) {
+    *(uint32_t*)(frame - sizeof(uint32_t)) = (uint32_t)len;
+    __atomic_store_n(&ring->head, ring->head + BUS_RECORD(len), __ATOMIC_RELEASE);
+    __atomic_fetch_add(&ring->signal, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST)) {
+        futex_wake(&ring->signal);
+    }
+}
+
+// Consumer: the oldest unreleased frame, or NULL if the ring is empty. The
+// frame stays valid (and writable) until it is released.
+char* bus_ring_peek(BusRing* ring, size_t* len) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    while (ring->tail != head) {
+        size_t offset = ring->tail % ring->capacity;
+        uint32_t record = *(uint32_t*)(ring->data + offset);
+        if (record == BUS_WRAP) {
+            __atomic_store_n(&ring->tail, ring->tail + (ring->capacity - offset), __ATOMIC_RELEASE);
+            continue;
+        }
+        *len = record;
+        return ring->data + offset + sizeof(uint32_t);
+    }
+    return NULL;
+}
+
+void bus_ring_release(BusRing* ring, size_t len) {
+    __atomic_store_n(&ring->tail, ring->tail + BUS_RECORD(len), __ATOMIC_RELEASE);
+}
+
+// Consumer: blocks until a frame is available (returns 1) or the ring has
+// been closed and drained (returns 0). Spins `spin` times before sleeping,
+// which keeps the hop off the futex while traffic is flowing.
+int bus_ring_wait(BusRing* ring, int spin) {
+    for (int i = 0; i < spin; i++) {
+        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail) return 1;
+        cpu_relax();
+    }
+    while (1) {
+        __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+        uint32_t signal = __atomic_load_n(&ring->signal, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail) {
+            __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+            return 1;
+        }
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+        futex_wait(&ring->signal, signal);
+    }
+}
+
+// Either side: no more frames will be produced; wakes the consumer.
+void bus_ring_close(BusRing* ring) {
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&ring->signal, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&ring->signal);
+}
@@ -0,0 +1,41 @@
+#ifndef BUS_H
+#define BUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Single-producer single-consumer ring in shared memory, for handing frames
+// between two processes on one host. The producer reserves space, writes the
+// frame straight into the ring and commits it; the consumer reads it in place
+// and releases it. No locks and no copies beyond the producer's write. An
+// idle consumer sleeps on a futex in the ring, and the producer only pays for
+// a wake-up syscall when the consumer is actually asleep.
+//
+// The ring lives in a memfd, so it can be handed to the other process over a
+// Unix socket (SCM_RIGHTS) and disappears once both sides have unmapped it.
+// Frames are NUL-terminated byte strings of at most `max_frame` bytes.
+
+#define BUS_RING_MAGIC 0x42555352  // "BUSR"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t capacity;          // bytes in data[], a multiple of 8
+    uint64_t head __attribute__((aligned(64)));  // producer: bytes written
+    uint32_t signal;            // futex word, bumped on every commit
+    uint64_t tail __attribute__((aligned(64)));  // consumer: bytes released
+    uint32_t waiting;           // consumer is (about to be) asleep
+    uint32_t closed;
+    char data[] __attribute__((aligned(64)));
+} BusRing;
+
+BusRing* bus_ring_create(size_t capacity, int* fd_out);
+BusRing* bus_ring_attach(int fd);
+void bus_ring_unmap(BusRing* ring);
+char* bus_ring_reserve(BusRing* ring, size_t max_frame);
+void bus_ring_commit(BusRing* ring, char* frame, size_t len);
+char* bus_ring_peek(BusRing* ring, size_t* len);
+void bus_ring_release(BusRing* ring, size_t len);
+int bus_ring_wait(BusRing* ring, int spin);
+void bus_ring_close(BusRing* ring);
+
+#endif
@@ -0,0 +1,62 @@
+#include "client_proto.h"
+
+#include <string.h>
+#include <arpa/inet.h>
+
+int bin_frame_parse(char* data, size_t avail, BinFrame* frame) {
+    if (avail < BIN_HEADER_BYTES) return 0;
+    uint32_t len_n, id_n;
+    uint16_t op_n, count_n;
+    memcpy(&len_n, data, 4);
+    memcpy(&id_n, data + 4, 4);
+    memcpy(&op_n, data + 8, 2);
+    memcpy(&count_n, data + 10, 2);
+    size_t len = ntohl(len_n);
+    int count = ntohs(count_n);
+    if (len > BIN_MAX_FRAME - BIN_HEADER_BYTES || count > BIN_MAX_FIELDS) return -1;
+    if (avail < BIN_HEADER_BYTES + len) return 0;
+
+    frame->id = ntohl(id_n);
+    frame->op = ntohs(op_n);
+    frame->count = count;
+    char* cursor = data + BIN_HEADER_BYTES;
+    char* end = cursor + len;
+    for (int i = 0; i < count; i++) {
+        uint16_t field_n;
+        if (end - cursor < 2) return -1;
+        memcpy(&field_n, cursor, 2);
+        size_t field = ntohs(field_n);
+        cursor += 2;
+        if (field == 0 || (size_t)(end - cursor) < field || cursor[field - 1] != '\0') return -1;
+        frame->field[i] = cursor;
+        frame->field_len[i] = field - 1;
+        cursor += field;
+    }
+    if (cursor != end) return -1;
+    return (int)(BIN_HEADER_BYTES + len);
+}
+
+size_t bin_frame_encode(char* out, size_t size, int op, uint32_t id, int count,
+                        const char* const fields[], const size_t lens[]) {
+    if (size > BIN_MAX_FRAME) size = BIN_MAX_FRAME;
+    if (count > BIN_MAX_FIELDS) return 0;
+    size_t pos = BIN_HEADER_BYTES;
+    for (int i = 0; i < count; i++) {
+        if (pos + 2 + lens[i] + 1 > size) return 0;
+        uint16_t field_n = htons((uint16_t)(lens[i] + 1));
+        memcpy(out + pos, &field_n, 2);
+        memcpy(out + pos + 2, fields[i], lens[i]);
+        out[pos + 2 + lens[i]] = '\0';
+        pos += 2 + lens[i] + 1;
+    }
+
+    uint32_t len_n = htonl((uint32_t)(pos - BIN_HEADER_BYTES));
+    uint32_t id_n = htonl(id);
+    uint16_t op_n = htons((uint16_t)op);
+    uint16_t count_n = htons((uint16_t)count);
+    memcpy(out, &len_n, 4);
+    memcpy(out + 4, &id_n, 4);
+    memcpy(out + 8, &op_n, 2);
+    memcpy(out + 10, &count_n, 2);
+    return pos;
+}
@@ -0,0 +1,77 @@
+#ifndef CLIENT_PROTO_H
+#define CLIENT_PROTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Binary client protocol, an alternative to the text lines. A client opts in
+// by sending BIN_MAGIC as its very first bytes; the server answers with the
+// same four bytes (after any text it had already sent, which never contains
+// a NUL) and from then on both sides exchange frames:
+//
+//   header   len:u32 id:u32 op:u16 count:u16         (network byte order)
+//   fields   `count` times len:u16 + bytes, a NUL included in len
+//
+// `len` counts the bytes after the header. The client numbers its requests
+// with `id`; everything the server sends while handling a request carries
+// the same id, anything unsolicited (room messages, pings) carries 0.
+// Fields are length-delimited, so file chunks travel without escaping; the
+// trailing NUL only lets text fields be used in place. A file's chunks all
+// carry the sender's `transfer` number (decimal), so a receiver can tell
+// files arriving at the same time apart.
+//
+//   client -> server                     server -> client
+//   LOGIN      username                  TEXT       output, as the text protocol prints it
+//   JOIN       room                      LOGIN_OK   username accepted
+//   LEAVE      [room]                    PING       heartbeat; answer with PONG
+//   BROADCAST  text                      FILE_DATA  sender, filename, chunk, transfer
+//   WHISPER    user, text                FILE_ACK   chunk forwarded; send the next
+//   SENDFILE   filename, user
+//   FILE_CHUNK user, filename, chunk, transfer (an empty chunk ends the file)
+//   PONG
+//   EXIT
+
+#define BIN_MAGIC "\0CB1"
+#define BIN_MAGIC_LEN 4
+#define BIN_HEADER_BYTES 12
+#define BIN_MAX_FRAME 4096        // header included, either direction
+#define BIN_MAX_FIELDS 4
+#define BIN_CHUNK_BYTES 2048      // data bytes per FILE_CHUNK
+#define BIN_TRANSFER_LEN 10       // digits in a transfer number
+
+enum {
+    BIN_LOGIN = 1,
+    BIN_JOIN,
+    BIN_LEAVE,
+    BIN_BROADCAST,
+    BIN_WHISPER,
+    BIN_SENDFILE,
+    BIN_FILE_CHUNK,
+    BIN_PONG,
+    BIN_EXIT,
+
+    BIN_TEXT = 64,
+    BIN_LOGIN_OK,
+    BIN_PING,
+    BIN_FILE_DATA,
+    BIN_FILE_ACK
+};
+
+typedef struct {
+    uint32_t id;
+    uint16_t op;
+    int count;
+    char* field[BIN_MAX_FIELDS];  // NUL-terminated, inside the parsed buffer
+    size_t field_len[BIN_MAX_FIELDS];  // without the NUL
+} BinFrame;
+
+// Returns the size of the complete frame at `data`, 0 if more bytes are
+// needed, or -1 if it is malformed or larger than BIN_MAX_FRAME.
+int bin_frame_parse(char* data, size_t avail, BinFrame* frame);
+
+// Encodes a frame into `out`. Returns its size, or 0 if it does not fit in
+// `size` or BIN_MAX_FRAME.
+size_t bin_frame_encode(char* out, size_t size, int op, uint32_t id, int count,
+                        const char* const fields[], const size_t lens[]);
+
+#endif
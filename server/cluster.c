@@ -0,0 +1,951 @@
+#include "server.h"
+
+#include <sys/un.h>
+#include <sys/timerfd.h>
+
+// Cluster mode. Several chatserver processes on one host share the TCP port
+// through SO_REUSEPORT, so the kernel spreads connections across them. Every
+// room has exactly one owner, picked by a consistent-hash ring over the node
+// ids, and the owner serializes that room's traffic:
+//
+//   member node --MSG-->  owner  --DELIVER--> every node with members
+//
+// Nodes only tell the owner whether they have members at all (JOIN on the
+// first local member, LEAVE on the last), so the owner keeps one bitmask per
+// room. Links are one-way Unix stream sockets, one per ordered pair of
+// nodes; the receiving side of a pair is a PeerInbound, the sending side a
+// PeerLink with an outbound queue drained by the main loop like a client's.
+// Frames are NUL-terminated text:
+//
+//   HELLO <node>
+//   JOIN <room> <node>
+//   LEAVE <room> <node>
+//   MSG <room> <sender> <text>
+//   DELIVER <room> <sender> <text>
+//   WHISPER <sender> <target> <text>
+//   ANNOUNCE <sender> <text>
+//   D... (username directory, see directory.h)
+//
+// Usernames are unique cluster-wide. Each name has an owner on the same hash
+// ring, which grants it at login; whispers to users on other nodes ask the
+// owner (or the local cache) where the target is and go to that node only.
+//
+// On the sockets, frames travel in numbered batches (link_proto.h). A batch
+// is sealed when it fills up or when the coalescing timer (--link-coalesce)
+// fires, whichever comes first, so a burst of broadcasts costs one write.
+// The receiver acknowledges each read with the last batch it processed and
+// the sender keeps at most LINK_WINDOW_FRAMES batches unacknowledged; the
+// rest wait in the outbound queue, still bounded by MAX_LINK_BYTES.
+//
+// Unless --no-shm-bus is given, the socket only carries HELLO. The sender
+// attaches a shared-memory ring (bus.c) to it, and every later frame is
+// formatted straight into that ring and parsed in place by a reader thread
+// on the receiving node. The socket stays open so either side notices when
+// the other goes away.
+
+typedef struct {
+    uint64_t hash;
+    int node;
+} RingPoint;
+
+typedef struct {
+    char name[MAX_ROOM_NAME_LEN + 1];
+    uint64_t node_mask;         // remote nodes with at least one member
+    int active;
+} ClusterRoom;
+
+// Directory answer for a parked login, handed from the thread that read it
+// to the main loop.
+typedef struct ClaimResult {
+    uint64_t token;
+    char username[MAX_USERNAME_LEN + 1];
+    int result;
+    struct ClaimResult* next;
+} ClaimResult;
+
+PeerLink peer_links[CLUSTER_MAX_NODES];
+PeerInbound peer_inbound[CLUSTER_MAX_NODES];
+EventSource cluster_listener_source = { SOURCE_CLUSTER_LISTENER };
+int cluster_reconnect_due = 0;
+
+static RingPoint ring[CLUSTER_MAX_NODES * CLUSTER_VNODES];
+static int ring_size = 0;
+static ClusterRoom owned_rooms[CLUSTER_MAX_ROOMS];
+static pthread_mutex_t cluster_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int cluster_socket = -1;
+static char cluster_path[108];
+static Timer reconnect_timer;
+static int bus_spin = 0;
+static Directory user_directory;
+static pthread_mutex_t claims_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ClaimResult* claims_head = NULL;
+static ClaimResult* claims_tail = NULL;
+static int claims_fd = -1;
+static EventSource claims_source = { SOURCE_CLAIM_RESULTS };
+static int flush_fd = -1;
+static int flush_armed = 0;
+static EventSource flush_source = { SOURCE_LINK_FLUSH };
+
+// FNV-1a with a 64-bit finalizer so similar room names land far apart
+static uint64_t cluster_hash(const char* s) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *s; s++) {
+        hash = (hash ^ (unsigned char)*s) * 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static int compare_points(const void* a, const void* b) {
+    const RingPoint* pa = a;
+    const RingPoint* pb = b;
+    if (pa->hash != pb->hash) return pa->hash < pb->hash ? -1 : 1;
+    return pa->node - pb->node;
+}
+
+static void build_ring(void) {
+    ring_size = 0;
+    for (int node = 0; node < config.cluster_size; node++) {
+        for (int v = 0; v < CLUSTER_VNODES; v++) {
+            char key[32];
+            snprintf(key, sizeof(key), "node-%d#%d", node, v);
+            ring[ring_size].hash = cluster_hash(key);
+            ring[ring_size].node = node;
+            ring_size++;
+        }
+    }
+    qsort(ring, ring_size, sizeof(RingPoint), compare_points);
+}
+
+static void peer_socket_path(int node, char* path, size_t size) {
+    snprintf(path, size, "%s/chatserver-%d-%d.sock", config.cluster_dir, config.port, node);
+}
+
+int cluster_enabled(void) {
+    return config.cluster_size > 1;
+}
+
+// First ring point at or after the room's hash, wrapping around.
+int cluster_room_owner(const char* room_name) {
+    if (!cluster_enabled()) return config.cluster_id;
+    uint64_t hash = cluster_hash(room_name);
+    int lo = 0, hi = ring_size;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (ring[mid].hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+    return ring[lo == ring_size ? 0 : lo].node;
+}
+
+// Caller holds link->out_mutex.
+static void close_link_locked(PeerLink* link) {
+    if (link->socket == -1) return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, link->socket, NULL);
+    link->out_watched = 0;
+    close(link->socket);
+    link->socket = -1;
+    if (link->ring) {
+        bus_ring_close(link->ring);
+        bus_ring_unmap(link->ring);
+        link->ring = NULL;
+    }
+    while (link->out_head) {
+        OutChunk* chunk = link->out_head;
+        link->out_head = chunk->next;
+        free(chunk);
+    }
+    link->out_tail = NULL;
+    link->out_bytes = 0;
+    link_batch_reset(&link->batch);
+    link->ackbuf_len = 0;
+    log_message("[CLUSTER] Lost link to node %d", link->node);
+}
+
+static uint32_t frame_seq(const OutChunk* chunk) {
+    uint32_t seq;
+    memcpy(&seq, chunk->data + 4, sizeof(seq));
+    return ntohl(seq);
+}
+
+// The outbound socket is always watched for input: besides ACKs, that is
+// how a peer that exited or restarted is noticed while nothing is being
+// sent to it. The reconnect then replays this node's memberships.
+static void watch_link_output(PeerLink* link, int watch) {
+    if (link->out_watched == watch) return;
+    struct epoll_event ev;
+    ev.events = watch ? EPOLLIN | EPOLLRDHUP | EPOLLOUT : EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = link;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, link->socket, &ev);
+    link->out_watched = watch;
+}
+
+// Writes queued batches while the peer has credit for them. A batch that
+// has started going out is always finished. Caller holds link->out_mutex.
+static void pump_link_locked(PeerLink* link) {
+    while (link->socket != -1 && link->out_head) {
+        OutChunk* chunk = link->out_head;
+        if (chunk->offset == 0 && frame_seq(chunk) - link->acked_seq > link->window) {
+            // Out of credit; the next ACK resumes sending
+            watch_link_output(link, 0);
+            return;
+        }
+        ssize_t n = send(link->socket, chunk->data + chunk->offset, chunk->len - chunk->offset,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                watch_link_output(link, 1);
+                return;
+            }
+            close_link_locked(link);
+            return;
+        }
+        chunk->offset += n;
+        link->out_bytes -= n;
+        if (chunk->offset == chunk->len) {
+            link->out_head = chunk->next;
+            if (!link->out_head) link->out_tail = NULL;
+            free(chunk);
+        }
+    }
+    if (link->socket != -1) watch_link_output(link, 0);
+}
+
+static void arm_link_flush(void);
+
+// Seals the open batch, queues it and sends what the window allows. A link
+// that falls too far behind is dropped and re-established (with a
+// membership resync) by the reconnect timer. Caller holds link->out_mutex.
+// Returns -1 if the link is down or the batch could not be queued.
+static int seal_batch_locked(PeerLink* link) {
+    if (link->socket == -1) return -1;
+    if (link->batch.count == 0) return 0;
+
+    size_t len = link->batch.len;
+    if (link->out_bytes + len > MAX_LINK_BYTES) {
+        log_message("[CLUSTER] Link to node %d has %zu bytes queued. Resetting.", link->node, link->out_bytes);
+        close_link_locked(link);
+        return -1;
+    }
+    // A sequence number is only spent on a batch that is queued: the peer
+    // rejects everything after a gap
+    OutChunk* chunk = malloc(sizeof(OutChunk) + len);
+    if (!chunk) {
+        // Keep the batch for the next flush. Frames that find it full are
+        // dropped meanwhile, so resend the memberships afterwards.
+        if (!link->resync) {
+            log_message("[CLUSTER] Out of memory queueing a batch to node %d; dropping frames", link->node);
+            link->resync = 1;
+        }
+        arm_link_flush();
+        return -1;
+    }
+    link_batch_seal(&link->batch, link->next_seq++);
+    chunk->next = NULL;
+    chunk->len = len;
+    chunk->offset = 0;
+    chunk->shared = NULL;
+    memcpy(chunk->data, link->batch.data, len);
+    if (link->out_tail) {
+        link->out_tail->next = chunk;
+    } else {
+        link->out_head = chunk;
+    }
+    link->out_tail = chunk;
+    link->out_bytes += len;
+    link_batch_reset(&link->batch);
+    pump_link_locked(link);
+    return link->socket == -1 ? -1 : 0;
+}
+
+// First frame into an empty batch starts the coalescing timer; the main loop
+// seals every open batch when it fires.
+static void arm_link_flush(void) {
+    if (__atomic_exchange_n(&flush_armed, 1, __ATOMIC_ACQ_REL)) return;
+    struct itimerspec when;
+    memset(&when, 0, sizeof(when));
+    when.it_value.tv_sec = config.link_coalesce_us / 1000000;
+    when.it_value.tv_nsec = (long)(config.link_coalesce_us % 1000000) * 1000;
+    timerfd_settime(flush_fd, 0, &when, NULL);
+}
+
+void cluster_flush_links(void) {
+    uint64_t expirations;
+    if (read(flush_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) return;
+    // Cleared first: a frame added from here on arms a fresh timer
+    __atomic_store_n(&flush_armed, 0, __ATOMIC_RELEASE);
+
+    for (int node = 0; node < config.cluster_size; node++) {
+        PeerLink* link = &peer_links[node];
+        pthread_mutex_lock(&link->out_mutex);
+        if (link->batch.count > 0) seal_batch_locked(link);
+        pthread_mutex_unlock(&link->out_mutex);
+    }
+}
+
+// Sends one frame to `node`, through its bus ring when it has one. Returns
+// -1 if the frame could not be handed off.
+static int link_printf(int node, const char* format, ...) {
+    PeerLink* link = &peer_links[node];
+    va_list args;
+    int result = -1;
+
+    pthread_mutex_lock(&link->out_mutex);
+    if (link->ring) {
+        // Formatted in place: this write is the only copy of the frame
+        char* frame = bus_ring_reserve(link->ring, CLUSTER_FRAME_LEN);
+        if (frame) {
+            va_start(args, format);
+            int len = vsnprintf(frame, CLUSTER_FRAME_LEN, format, args);
+            va_end(args);
+            if (len >= 0) {
+                if (len >= CLUSTER_FRAME_LEN) len = CLUSTER_FRAME_LEN - 1;
+                bus_ring_commit(link->ring, frame, len + 1);
+                result = 0;
+            }
+        } else if (!link->resync) {
+            // A lost JOIN would strand the room; resend them once it drains
+            log_message("[CLUSTER] Bus ring to node %d is full; dropping frames", node);
+            link->resync = 1;
+        }
+    } else if (link->socket != -1) {
+        // Formatted straight into the open batch, sealing it first if full
+        char* frame = link_batch_reserve(&link->batch, CLUSTER_FRAME_LEN);
+        if (!frame && seal_batch_locked(link) == 0) {
+            frame = link_batch_reserve(&link->batch, CLUSTER_FRAME_LEN);
+        }
+        if (frame) {
+            va_start(args, format);
+            int len = vsnprintf(frame, CLUSTER_FRAME_LEN, format, args);
+            va_end(args);
+            if (len >= 0) {
+                if (len >= CLUSTER_FRAME_LEN) len = CLUSTER_FRAME_LEN - 1;
+                link_batch_commit(&link->batch, frame, len + 1);
+                if (link->batch.count == 1) arm_link_flush();
+                result = 0;
+            }
+        }
+    }
+    pthread_mutex_unlock(&link->out_mutex);
+    return result;
+}
+
+// The peer only writes ACKs on this socket; each one returns credit. EOF
+// (EPOLLRDHUP) means the peer is gone and the link is closed right away.
+void handle_peer_output(PeerLink* link) {
+    pthread_mutex_lock(&link->out_mutex);
+    while (link->socket != -1) {
+        ssize_t n = recv(link->socket, link->ackbuf + link->ackbuf_len,
+                         sizeof(link->ackbuf) - link->ackbuf_len, MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            close_link_locked(link);
+            break;
+        }
+        if (n < 0) break;
+        link->ackbuf_len += n;
+        if (link->ackbuf_len < sizeof(link->ackbuf)) continue;
+        link->ackbuf_len = 0;
+
+        LinkHeader header;
+        if (link_frame_parse(link->ackbuf, sizeof(link->ackbuf), &header) <= 0 || header.type != LINK_ACK ||
+            header.seq - link->acked_seq > link->next_seq - 1 - link->acked_seq) {
+            log_message("[CLUSTER] Bad acknowledgement from node %d", link->node);
+            close_link_locked(link);
+            break;
+        }
+        link->acked_seq = header.seq;
+        link->window = header.count;
+    }
+    pump_link_locked(link);
+    pthread_mutex_unlock(&link->out_mutex);
+}
+
+// Tells a freshly linked owner which of its rooms have members here and
+// which of its usernames are logged in here.
+static void resync_memberships(int node) {
+    pthread_mutex_lock(&rooms_mutex);
+    for (int i = 0; i < MAX_ROOMS; i++) {
+        if (rooms[i].active && rooms[i].member_count > 0 && cluster_room_owner(rooms[i].name) == node) {
+            link_printf(node, "JOIN %s %d", rooms[i].name, config.cluster_id);
+        }
+    }
+    pthread_mutex_unlock(&rooms_mutex);
+
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].active && clients[i].username[0] != '\0' && cluster_room_owner(clients[i].username) == node) {
+            directory_assert(&user_directory, clients[i].username);
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+static void send_ack(PeerInbound* in);
+
+// Runs on the main loop: connects every peer link that is down. Peers that
+// are not up yet are retried on the next reconnect tick.
+void cluster_connect_peers(void) {
+    for (int node = 0; node < config.cluster_size; node++) {
+        PeerLink* link = &peer_links[node];
+        if (node == config.cluster_id || link->socket != -1) continue;
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        peer_socket_path(node, addr.sun_path, sizeof(addr.sun_path));
+
+        int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock == -1) continue;
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            close(sock);
+            continue;
+        }
+
+        // HELLO is batch 1 and carries the ring this node will write to the
+        // peer. No other thread touches the link while it is down.
+        LinkBatch* hello = &link->batch;
+        link_batch_reset(hello);
+        char* frame = link_batch_reserve(hello, 32);
+        link_batch_commit(hello, frame, snprintf(frame, 32, "HELLO %d", config.cluster_id) + 1);
+        size_t len = link_batch_seal(hello, 1);
+        BusRing* ring = NULL;
+        int ring_fd = -1;
+        if (config.cluster_shm_bus) {
+            ring = bus_ring_create(BUS_RING_BYTES, &ring_fd);
+        }
+        int sent = ring ? send_with_fd(sock, hello->data, len, ring_fd) : send_all(sock, hello->data, len);
+        link_batch_reset(hello);
+        if (ring_fd != -1) close(ring_fd);
+        if (sent == -1) {
+            if (ring) bus_ring_unmap(ring);
+            close(sock);
+            continue;
+        }
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+        pthread_mutex_lock(&link->out_mutex);
+        link->socket = sock;
+        link->ring = ring;
+        link->resync = 0;
+        link->next_seq = 2;
+        link->acked_seq = 0;
+        link->window = LINK_WINDOW_FRAMES;
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = link;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev);
+        pthread_mutex_unlock(&link->out_mutex);
+
+        resync_memberships(node);
+        log_message("[CLUSTER] Linked to node %d over %s", node, ring ? "shared-memory bus" : "socket");
+    }
+
+    for (int i = 0; i < CLUSTER_MAX_NODES; i++) {
+        if (peer_inbound[i].active && peer_inbound[i].ack_pending) send_ack(&peer_inbound[i]);
+    }
+
+    // Links that dropped frames (a full ring, no memory for a batch) resend
+    // their memberships
+    for (int node = 0; node < config.cluster_size; node++) {
+        PeerLink* link = &peer_links[node];
+        pthread_mutex_lock(&link->out_mutex);
+        int resync = link->resync;
+        link->resync = 0;
+        pthread_mutex_unlock(&link->out_mutex);
+        if (resync) resync_memberships(node);
+    }
+}
+
+// Runs on the main loop with timers_mutex held; connecting happens after the
+// wheel has been advanced.
+static void reconnect_timer_expired(Timer* timer, void* arg) {
+    (void)arg;
+    cluster_reconnect_due = 1;
+    timer_arm(&timer_wheel, timer, CLUSTER_RECONNECT_MS, now_ms());
+}
+
+static ClusterRoom* find_owned_room(const char* room_name, int create) {
+    ClusterRoom* free_slot = NULL;
+    for (int i = 0; i < CLUSTER_MAX_ROOMS; i++) {
+        if (owned_rooms[i].active) {
+            if (strcmp(owned_rooms[i].name, room_name) == 0) return &owned_rooms[i];
+        } else if (!free_slot) {
+            free_slot = &owned_rooms[i];
+        }
+    }
+    if (!create || !free_slot) return NULL;
+    strcpy(free_slot->name, room_name);
+    free_slot->node_mask = 0;
+    free_slot->active = 1;
+    return free_slot;
+}
+
+static void set_room_member_node(const char* room_name, int node, int present) {
+    if (cluster_room_owner(room_name) != config.cluster_id) {
+        log_message("[CLUSTER] Node %d sent membership for room '%s' owned elsewhere", node, room_name);
+        return;
+    }
+    pthread_mutex_lock(&cluster_mutex);
+    ClusterRoom* room = find_owned_room(room_name, present);
+    if (room) {
+        if (present) {
+            room->node_mask |= 1ULL << node;
+        } else {
+            room->node_mask &= ~(1ULL << node);
+            if (room->node_mask == 0) room->active = 0;
+        }
+    } else if (present) {
+        log_message("[CLUSTER] Owned room table full; '%s' not routed to node %d", room_name, node);
+    }
+    pthread_mutex_unlock(&cluster_mutex);
+}
+
+// Owner side: deliver to local members, then forward to every node with
+// members. The origin node is included so its other members see the message.
+static void fan_out(const char* room_name, const char* sender, const char* message) {
+    pthread_mutex_lock(&cluster_mutex);
+    ClusterRoom* room = find_owned_room(room_name, 0);
+    uint64_t mask = room ? room->node_mask : 0;
+    pthread_mutex_unlock(&cluster_mutex);
+
+    broadcast_to_room(room_name, message, sender);
+    for (int node = 0; mask; node++, mask >>= 1) {
+        if ((mask & 1) && node != config.cluster_id) {
+            link_printf(node, "DELIVER %s %s %s", room_name, sender, message);
+        }
+    }
+}
+
+// Entry point for /broadcast. Returns -1 if the room's owner is unreachable.
+int cluster_broadcast(const char* room_name, const char* sender, const char* message) {
+    if (!cluster_enabled()) {
+        broadcast_to_room(room_name, message, sender);
+        return 0;
+    }
+    int owner = cluster_room_owner(room_name);
+    if (owner == config.cluster_id) {
+        fan_out(room_name, sender, message);
+        return 0;
+    }
+    return link_printf(owner, "MSG %s %s %s", room_name, sender, message);
+}
+
+// Called with rooms_mutex held when a room gains its first local member or
+// loses its last one, which keeps JOIN/LEAVE for a room in order.
+void cluster_room_membership(const char* room_name, int present) {
+    if (!cluster_enabled()) return;
+    int owner = cluster_room_owner(room_name);
+    if (owner == config.cluster_id) return;
+    link_printf(owner, "%s %s %d", present ? "JOIN" : "LEAVE", room_name, config.cluster_id);
+}
+
+// Whisper to a user on another node. Blocks the calling client thread for
+// at most one directory round trip when the target is neither owned nor
+// cached here. Returns -1 if the user is not logged in anywhere else.
+int cluster_whisper(const char* sender, const char* target, const char* message) {
+    int node = directory_lookup(&user_directory, target, DIRECTORY_LOOKUP_TIMEOUT_MS);
+    if (node < 0 || node >= config.cluster_size || node == config.cluster_id) return -1;
+    return link_printf(node, "WHISPER %s %s %s", sender, target, message);
+}
+
+// /announce: every other node delivers it to its own sessions. Returns the
+// number of nodes it was sent to.
+int cluster_announce(const char* sender, const char* text) {
+    if (!cluster_enabled()) return 0;
+    int sent = 0;
+    for (int node = 0; node < config.cluster_size; node++) {
+        if (node != config.cluster_id && link_printf(node, "ANNOUNCE %s %s", sender, text) == 0) sent++;
+    }
+    return sent;
+}
+
+// Called at login. Returns DIR_GRANTED or DIR_DENIED when this node owns the
+// name; otherwise DIR_PENDING, and the answer arrives through
+// cluster_handle_claim_results() with the same token.
+int cluster_claim_username(const char* username, uint64_t token) {
+    return directory_claim(&user_directory, username, token);
+}
+
+void cluster_release_username(const char* username) {
+    directory_release(&user_directory, username);
+}
+
+// Any thread. Queues a claim answer for the main loop.
+void cluster_post_claim_result(uint64_t token, const char* username, int result) {
+    ClaimResult* claim = malloc(sizeof(ClaimResult));
+    if (!claim) return;
+    claim->token = token;
+    snprintf(claim->username, sizeof(claim->username), "%s", username);
+    claim->result = result;
+    claim->next = NULL;
+
+    pthread_mutex_lock(&claims_mutex);
+    if (claims_tail) claims_tail->next = claim;
+    else claims_head = claim;
+    claims_tail = claim;
+    pthread_mutex_unlock(&claims_mutex);
+
+    uint64_t one = 1;
+    if (write(claims_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        log_message("[CLUSTER] Failed to signal a claim result");
+    }
+}
+
+void cluster_handle_claim_results(void) {
+    uint64_t count;
+    if (read(claims_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) return;
+
+    pthread_mutex_lock(&claims_mutex);
+    ClaimResult* claim = claims_head;
+    claims_head = claims_tail = NULL;
+    pthread_mutex_unlock(&claims_mutex);
+
+    while (claim) {
+        ClaimResult* next = claim->next;
+        finish_username_claim(claim->token, claim->username, claim->result);
+        free(claim);
+        claim = next;
+    }
+}
+
+static int directory_send(void* ctx, int node, const char* frame) {
+    (void)ctx;
+    return link_printf(node, "%s", frame);
+}
+
+static int directory_owner(void* ctx, const char* name) {
+    (void)ctx;
+    return cluster_room_owner(name);
+}
+
+static void directory_claim_done(void* ctx, uint64_t token, const char* name, int result) {
+    (void)ctx;
+    cluster_post_claim_result(token, name, result);
+}
+
+static void deliver_whisper(const char* sender, const char* target, const char* message) {
+    Client* target_client = find_client_by_username(target);
+    if (!target_client || !target_client->active) return;
+
+    char whisper_msg[BUFFER_SIZE];
+    snprintf(whisper_msg, sizeof(whisper_msg), "[WHISPER from %s]: %s\n", sender, message);
+    client_send(target_client, whisper_msg);
+    log_message("[WHISPER] %s to %s (via cluster): %s", sender, target, message);
+}
+
+// Splits "<a> <b> <text>" in place; returns 0 if the frame is malformed.
+static int split_frame(char* args, char** first, char** second, char** text) {
+    *first = args;
+    *second = strchr(args, ' ');
+    if (!*second) return 0;
+    *(*second)++ = '\0';
+    *text = strchr(*second, ' ');
+    if (!*text) return 0;
+    *(*text)++ = '\0';
+    return 1;
+}
+
+static int parse_room_frame(char* args, char** room, char** sender, char** text) {
+    return split_frame(args, room, sender, text) && validate_room_name(*room) && validate_username(*sender);
+}
+
+static void* bus_reader(void* arg);
+
+// Maps the ring that came with the peer's HELLO and starts reading it.
+static void attach_bus(PeerInbound* in) {
+    if (in->ring_fd == -1) return;
+    in->ring = bus_ring_attach(in->ring_fd);
+    close(in->ring_fd);
+    in->ring_fd = -1;
+    if (in->ring && pthread_create(&in->reader, NULL, bus_reader, in) != 0) {
+        bus_ring_unmap(in->ring);
+        in->ring = NULL;
+    }
+}
+
+static void dispatch_frame(PeerInbound* in, char* frame) {
+    char* room;
+    char* sender;
+    char* text;
+    char room_name[MAX_ROOM_NAME_LEN + 1];
+    int node;
+
+    if (sscanf(frame, "HELLO %d", &node) == 1) {
+        if (in->node == -1 && node >= 0 && node < config.cluster_size && node != config.cluster_id) {
+            in->node = node;
+            attach_bus(in);
+            log_message("[CLUSTER] Node %d connected over %s", node, in->ring ? "shared-memory bus" : "socket");
+        }
+    } else if (in->node == -1) {
+        return;
+    } else if (directory_handle_frame(&user_directory, in->node, frame)) {
+        return;
+    } else if (sscanf(frame, "JOIN %32s %d", room_name, &node) == 2 && node == in->node) {
+        set_room_member_node(room_name, node, 1);
+    } else if (sscanf(frame, "LEAVE %32s %d", room_name, &node) == 2 && node == in->node) {
+        set_room_member_node(room_name, node, 0);
+    } else if (strncmp(frame, "MSG ", 4) == 0 && parse_room_frame(frame + 4, &room, &sender, &text)) {
+        fan_out(room, sender, text);
+    } else if (strncmp(frame, "DELIVER ", 8) == 0 && parse_room_frame(frame + 8, &room, &sender, &text)) {
+        broadcast_to_room(room, text, sender);
+    } else if (strncmp(frame, "WHISPER ", 8) == 0 && split_frame(frame + 8, &sender, &room, &text) &&
+               validate_username(sender) && validate_username(room)) {
+        deliver_whisper(sender, room, text);
+    } else if (strncmp(frame, "ANNOUNCE ", 9) == 0 && (text = strchr(frame + 9, ' ')) != NULL) {
+        *text++ = '\0';
+        if (validate_username(frame + 9)) announce_local(frame + 9, text);
+    }
+}
+
+// Reader thread for one inbound ring. Frames are parsed where the producer
+// wrote them and released afterwards.
+static void* bus_reader(void* arg) {
+    PeerInbound* in = (PeerInbound*)arg;
+    while (bus_ring_wait(in->ring, bus_spin)) {
+        size_t len;
+        char* frame;
+        while ((frame = bus_ring_peek(in->ring, &len))) {
+            if (len > 0 && len <= CLUSTER_FRAME_LEN) {
+                frame[len - 1] = '\0';
+                dispatch_frame(in, frame);
+            }
+            bus_ring_release(in->ring, len);
+        }
+    }
+    return NULL;
+}
+
+static void close_peer_inbound(PeerInbound* in) {
+    // Stop the reader first so no frame from this node lands after cleanup
+    if (in->ring) {
+        bus_ring_close(in->ring);
+        pthread_join(in->reader, NULL);
+        bus_ring_unmap(in->ring);
+        in->ring = NULL;
+    }
+    if (in->ring_fd != -1) {
+        close(in->ring_fd);
+        in->ring_fd = -1;
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, in->socket, NULL);
+    close(in->socket);
+    in->socket = -1;
+    in->active = 0;
+    if (in->node == -1) return;
+
+    // The node went away: it has no members anywhere until it rejoins
+    pthread_mutex_lock(&cluster_mutex);
+    for (int i = 0; i < CLUSTER_MAX_ROOMS; i++) {
+        if (owned_rooms[i].active) {
+            owned_rooms[i].node_mask &= ~(1ULL << in->node);
+            if (owned_rooms[i].node_mask == 0) owned_rooms[i].active = 0;
+        }
+    }
+    pthread_mutex_unlock(&cluster_mutex);
+    directory_node_down(&user_directory, in->node);
+    log_message("[CLUSTER] Node %d disconnected", in->node);
+    in->node = -1;
+}
+
+// Returns credit to the sender: everything up to the last batch processed
+// is done with. On a full socket the ACK is retried after the next read or
+// reconnect tick; a later one covers it anyway.
+static void send_ack(PeerInbound* in) {
+    char ack[LINK_HEADER_BYTES];
+    link_ack_encode(ack, in->expected_seq - 1, LINK_WINDOW_FRAMES);
+    ssize_t n = send(in->socket, ack, sizeof(ack), MSG_NOSIGNAL | MSG_DONTWAIT);
+    in->ack_pending = n != (ssize_t)sizeof(ack);
+    if (n > 0 && n < (ssize_t)sizeof(ack)) {
+        // A torn ACK would desynchronize the sender's parser
+        log_message("[CLUSTER] Short acknowledgement write to node %d", in->node);
+        close_peer_inbound(in);
+    }
+}
+
+void handle_peer_input(PeerInbound* in) {
+    // recvmsg() so the ring descriptor attached to HELLO is picked up
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov;
+    iov.iov_base = in->inbuf + in->inbuf_len;
+    iov.iov_len = sizeof(in->inbuf) - in->inbuf_len;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int bytes = recvmsg(in->socket, &msg, MSG_CMSG_CLOEXEC);
+    struct cmsghdr* cmsg = bytes > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        int fd;
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        if (in->ring_fd == -1 && in->node == -1) {
+            in->ring_fd = fd;
+        } else {
+            close(fd);
+        }
+    }
+    if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        close_peer_inbound(in);
+        return;
+    }
+    if (bytes < 0) return;
+    in->inbuf_len += bytes;
+
+    size_t start = 0;
+    uint32_t first_seq = in->expected_seq;
+    while (in->active) {
+        LinkHeader header;
+        int size = link_frame_parse(in->inbuf + start, in->inbuf_len - start, &header);
+        if (size == 0) break;
+        if (size < 0 || header.type != LINK_BATCH || header.seq != in->expected_seq) {
+            log_message("[CLUSTER] Malformed or out-of-order batch from node %d", in->node);
+            close_peer_inbound(in);
+            return;
+        }
+        in->expected_seq++;
+
+        char* cursor = in->inbuf + start + LINK_HEADER_BYTES;
+        char* end = in->inbuf + start + size;
+        char* frame;
+        size_t len;
+        while ((frame = link_batch_next(&cursor, end, &len))) {
+            dispatch_frame(in, frame);
+        }
+        start += size;
+    }
+    memmove(in->inbuf, in->inbuf + start, in->inbuf_len - start);
+    in->inbuf_len -= start;
+    if (in->expected_seq != first_seq || in->ack_pending) send_ack(in);
+}
+
+void cluster_accept_links(void) {
+    while (1) {
+        int sock = accept4(cluster_socket, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (sock == -1) return;
+
+        PeerInbound* in = NULL;
+        for (int i = 0; i < CLUSTER_MAX_NODES; i++) {
+            if (!peer_inbound[i].active) {
+                in = &peer_inbound[i];
+                break;
+            }
+        }
+        if (!in) {
+            close(sock);
+            continue;
+        }
+
+        in->source.kind = SOURCE_PEER_INPUT;
+        in->socket = sock;
+        in->node = -1;
+        in->inbuf_len = 0;
+        in->expected_seq = 1;
+        in->ack_pending = 0;
+        in->ring = NULL;
+        in->ring_fd = -1;
+        in->active = 1;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = in;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev);
+    }
+}
+
+// Builds the hash ring, opens this node's link socket and starts linking to
+// the other nodes. Returns -1 if the link socket cannot be opened.
+int cluster_start(void) {
+    build_ring();
+    // Spinning only helps when the producer runs on another CPU
+    bus_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? BUS_SPIN_ITERATIONS : 0;
+    for (int node = 0; node < CLUSTER_MAX_NODES; node++) {
+        peer_links[node].source.kind = SOURCE_PEER_OUTPUT;
+        peer_links[node].node = node;
+        peer_links[node].socket = -1;
+        pthread_mutex_init(&peer_links[node].out_mutex, NULL);
+        peer_inbound[node].socket = -1;
+        peer_inbound[node].ring_fd = -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    peer_socket_path(config.cluster_id, cluster_path, sizeof(cluster_path));
+    if (strlen(cluster_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Cluster socket path too long: %s\n", cluster_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, cluster_path);
+
+    cluster_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (cluster_socket == -1) {
+        perror("Cluster socket creation failed");
+        return -1;
+    }
+    unlink(cluster_path);
+    if (bind(cluster_socket, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(cluster_socket, CLUSTER_MAX_NODES) == -1) {
+        perror("Cluster bind failed");
+        close(cluster_socket);
+        cluster_socket = -1;
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &cluster_listener_source;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cluster_socket, &ev);
+
+    DirectoryTransport transport = { directory_send, directory_owner, directory_claim_done, NULL };
+    claims_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (claims_fd == -1 || directory_init(&user_directory, config.cluster_id, DIRECTORY_CAPACITY, &transport) == -1) {
+        perror("Username directory setup failed");
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &claims_source;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, claims_fd, &ev);
+
+    flush_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (flush_fd == -1) {
+        perror("Link flush timer setup failed");
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &flush_source;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, flush_fd, &ev);
+
+    cluster_connect_peers();
+    pthread_mutex_lock(&timers_mutex);
+    timer_init(&reconnect_timer, reconnect_timer_expired, NULL);
+    timer_arm(&timer_wheel, &reconnect_timer, CLUSTER_RECONNECT_MS, now_ms());
+    pthread_mutex_unlock(&timers_mutex);
+
+    log_message("[CLUSTER] Node %d of %d listening for peers on %s", config.cluster_id,
+        config.cluster_size, cluster_path);
+    printf("[INFO] Cluster node %d of %d\n", config.cluster_id, config.cluster_size);
+    return 0;
+}
+
+void cluster_stop(void) {
+    if (cluster_socket == -1) return;
+    for (int node = 0; node < CLUSTER_MAX_NODES; node++) {
+        pthread_mutex_lock(&peer_links[node].out_mutex);
+        close_link_locked(&peer_links[node]);
+        pthread_mutex_unlock(&peer_links[node].out_mutex);
+        if (peer_inbound[node].active) {
+            close_peer_inbound(&peer_inbound[node]);
+        }
+    }
+    close(cluster_socket);
+    cluster_socket = -1;
+    unlink(cluster_path);
+    // The directory stays: client threads still release their names on the
+    // way out, which now only updates the local table.
+}
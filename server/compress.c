@@ -0,0 +1,90 @@
+#include "compress.h"
+
+#include <string.h>
+#include <time.h>
+
+// Strings the server sends most, the likeliest last: deflate reaches the
+// end of the dictionary with the shortest distances.
+static const char dictionary[] =
+    "[ERROR] Unknown command. Type a valid command.\n"
+    "[ERROR] User not found or offline.\n"
+    "[ERROR] You are not in any room.\n"
+    "[INFO] Goodbye!\n"
+    "[HISTORY] "
+    "[SUCCESS] Left room '[SUCCESS] Joined room '"
+    "[SUCCESS] Whisper sent.\n"
+    "[WHISPER from ]: "
+    "[SUCCESS] Message broadcasted.\n"
+    "[general] [lobby] [random] : ";
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int compressor_init(Compressor* c) {
+    memset(c, 0, sizeof(*c));
+    // Raw deflate: no zlib header or checksum, the connection frames it.
+    // A 16 KB window keeps the per-connection state near 100 KB.
+    if (deflateInit2(&c->deflate, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -14, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    if (inflateInit2(&c->inflate, -14) != Z_OK) {
+        deflateEnd(&c->deflate);
+        return -1;
+    }
+    deflateSetDictionary(&c->deflate, (const Bytef*)dictionary, sizeof(dictionary) - 1);
+    inflateSetDictionary(&c->inflate, (const Bytef*)dictionary, sizeof(dictionary) - 1);
+    return 0;
+}
+
+void compressor_free(Compressor* c) {
+    deflateEnd(&c->deflate);
+    inflateEnd(&c->inflate);
+}
+
+// Z_PARTIAL_FLUSH ends a message with a 10-bit empty block instead of the
+// 4-byte marker of Z_SYNC_FLUSH; for one-line messages that is most of the
+// saving (see bench/compress_bench).
+ssize_t compressor_deflate(Compressor* c, const char* data, size_t len, char* out, size_t size) {
+    uint64_t start = now_ns();
+    c->deflate.next_in = (Bytef*)data;
+    c->deflate.avail_in = len;
+    c->deflate.next_out = (Bytef*)out;
+    c->deflate.avail_out = size;
+    int result = deflate(&c->deflate, Z_PARTIAL_FLUSH);
+    if ((result != Z_OK && result != Z_BUF_ERROR) || c->deflate.avail_in > 0 || c->deflate.avail_out == 0) {
+        return -1;
+    }
+    size_t written = size - c->deflate.avail_out;
+    c->stats.deflate_ns += now_ns() - start;
+    c->stats.messages_out++;
+    c->stats.raw_out += len;
+    c->stats.wire_out += written;
+    return (ssize_t)written;
+}
+
+ssize_t compressor_inflate(Compressor* c, char* out, size_t size) {
+    // Called even with nothing pending: output that did not fit last time
+    // is still inside zlib
+    if (size == 0) return 0;
+    uint64_t start = now_ns();
+    c->inflate.next_in = c->pending;
+    c->inflate.avail_in = c->pending_len;
+    c->inflate.next_out = (Bytef*)out;
+    c->inflate.avail_out = size;
+    int result = inflate(&c->inflate, Z_SYNC_FLUSH);
+    if (result != Z_OK && result != Z_BUF_ERROR) {
+        return -1;
+    }
+    size_t consumed = c->pending_len - c->inflate.avail_in;
+    size_t produced = size - c->inflate.avail_out;
+    memmove(c->pending, c->pending + consumed, c->inflate.avail_in);
+    c->pending_len = c->inflate.avail_in;
+    c->stats.inflate_ns += now_ns() - start;
+    if (produced > 0) c->stats.messages_in++;
+    c->stats.wire_in += consumed;
+    c->stats.raw_in += produced;
+    return (ssize_t)produced;
+}
@@ -0,0 +1,46 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+// Per-connection stream compression for the text protocol. A logged-in
+// client sends "/compress"; the server answers COMPRESS_ENABLED in clear
+// and from then on both directions are one raw deflate stream each. The
+// streams live as long as the connection, so the window built up by
+// earlier lines ("[room] user: ...") compresses the next ones, and both
+// sides start from the same preset dictionary of the server's usual
+// output. Every message is flushed so the peer can decode it at once.
+
+#define COMPRESS_ENABLED "[COMPRESS] Enabled\n"
+#define COMPRESS_PENDING_BYTES 4096     // received, not inflated yet
+#define COMPRESS_BOUND(len) ((len) + (len) / 8 + 64)
+
+typedef struct {
+    uint64_t messages_out, raw_out, wire_out, deflate_ns;
+    uint64_t messages_in, raw_in, wire_in, inflate_ns;
+} CompressStats;
+
+typedef struct {
+    z_stream deflate;
+    z_stream inflate;
+    unsigned char pending[COMPRESS_PENDING_BYTES];
+    size_t pending_len;
+    CompressStats stats;        // totals for this connection
+} Compressor;
+
+// Returns 0, or -1 if zlib could not allocate its state.
+int compressor_init(Compressor* c);
+void compressor_free(Compressor* c);
+
+// Compresses one message into `out` and flushes it. Returns the bytes
+// written, or -1 if `size` (use COMPRESS_BOUND) was too small.
+ssize_t compressor_deflate(Compressor* c, const char* data, size_t len, char* out, size_t size);
+
+// Inflates buffered input (pending) into `out`. Returns the bytes produced,
+// 0 if more input is needed, or -1 if the stream is corrupt.
+ssize_t compressor_inflate(Compressor* c, char* out, size_t size);
+
+#endif
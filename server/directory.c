@@ -0,0 +1,367 @@
+#include "directory.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+enum {
+    SLOT_EMPTY = 0,
+    SLOT_USED,
+    SLOT_DELETED
+};
+
+static uint64_t name_hash(const char* name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *name; name++) {
+        hash = (hash ^ (unsigned char)*name) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int valid_name(const char* name) {
+    size_t len = strlen(name);
+    return len > 0 && len <= DIR_NAME_LEN;
+}
+
+static int table_init(DirectoryTable* table, size_t capacity) {
+    size_t size = 16;
+    while (size < capacity) size <<= 1;
+    table->slots = calloc(size, sizeof(DirectorySlot));
+    table->capacity = size;
+    table->used = 0;
+    table->live = 0;
+    return table->slots ? 0 : -1;
+}
+
+static void table_clear(DirectoryTable* table) {
+    memset(table->slots, 0, table->capacity * sizeof(DirectorySlot));
+    table->used = 0;
+    table->live = 0;
+}
+
+// Linear probing. Returns the slot holding `name`, or NULL.
+static DirectorySlot* table_find(DirectoryTable* table, const char* name) {
+    size_t mask = table->capacity - 1;
+    for (size_t i = name_hash(name) & mask;; i = (i + 1) & mask) {
+        DirectorySlot* slot = &table->slots[i];
+        if (slot->state == SLOT_EMPTY) return NULL;
+        if (slot->state == SLOT_USED && strcmp(slot->name, name) == 0) return slot;
+    }
+}
+
+static DirectorySlot* table_place(DirectoryTable* table, const char* name) {
+    size_t mask = table->capacity - 1;
+    DirectorySlot* reuse = NULL;
+    for (size_t i = name_hash(name) & mask;; i = (i + 1) & mask) {
+        DirectorySlot* slot = &table->slots[i];
+        if (slot->state == SLOT_USED && strcmp(slot->name, name) == 0) return slot;
+        if (slot->state == SLOT_DELETED && !reuse) reuse = slot;
+        if (slot->state == SLOT_EMPTY) {
+            if (!reuse) {
+                reuse = slot;
+                table->used++;
+            }
+            break;
+        }
+    }
+    strcpy(reuse->name, name);
+    reuse->state = SLOT_USED;
+    reuse->node = -1;
+    reuse->cached_by = 0;
+    table->live++;
+    return reuse;
+}
+
+// Rebuilds into a table sized for the live entries, dropping tombstones.
+static int table_rehash(DirectoryTable* table) {
+    size_t capacity = table->capacity;
+    if ((table->live + 1) * 2 > capacity) capacity *= 2;
+    DirectorySlot* old = table->slots;
+    size_t old_capacity = table->capacity;
+    if (table_init(table, capacity) == -1) {
+        table->slots = old;
+        table->capacity = old_capacity;
+        return -1;
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].state == SLOT_USED) {
+            DirectorySlot* slot = table_place(table, old[i].name);
+            slot->node = old[i].node;
+            slot->cached_by = old[i].cached_by;
+        }
+    }
+    free(old);
+    return 0;
+}
+
+// Returns the existing or a new slot for `name`, or NULL if out of memory.
+static DirectorySlot* table_insert(DirectoryTable* table, const char* name) {
+    DirectorySlot* slot = table_find(table, name);
+    if (slot) return slot;
+    if ((table->used + 1) * 4 > table->capacity * 3 && table_rehash(table) == -1) {
+        return NULL;
+    }
+    return table_place(table, name);
+}
+
+static void table_remove(DirectoryTable* table, DirectorySlot* slot) {
+    slot->state = SLOT_DELETED;
+    table->live--;
+}
+
+static void send_frame(Directory* dir, int node, const char* format, ...) {
+    char frame[DIR_FRAME_LEN];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(frame, sizeof(frame), format, args);
+    va_end(args);
+    dir->transport.send(dir->transport.ctx, node, frame);
+}
+
+static void send_invalidations(Directory* dir, const char* name, uint64_t mask) {
+    for (int node = 0; mask; node++, mask >>= 1) {
+        if ((mask & 1) && node != dir->self) {
+            send_frame(dir, node, "DINVAL %s", name);
+        }
+    }
+}
+
+int directory_init(Directory* dir, int self, size_t capacity, const DirectoryTransport* transport) {
+    memset(dir, 0, sizeof(*dir));
+    dir->self = self;
+    dir->transport = *transport;
+    dir->cache_limit = capacity;
+    pthread_mutex_init(&dir->mutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&dir->answered, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (table_init(&dir->owned, capacity * 2) == -1 || table_init(&dir->cache, capacity * 2) == -1) {
+        directory_destroy(dir);
+        return -1;
+    }
+    return 0;
+}
+
+void directory_destroy(Directory* dir) {
+    free(dir->owned.slots);
+    free(dir->cache.slots);
+    dir->owned.slots = NULL;
+    dir->cache.slots = NULL;
+    pthread_cond_destroy(&dir->answered);
+    pthread_mutex_destroy(&dir->mutex);
+}
+
+// Owner side; caller holds dir->mutex.
+static int owned_claim(Directory* dir, const char* name, int node) {
+    if (table_find(&dir->owned, name)) return DIR_DENIED;
+    DirectorySlot* slot = table_insert(&dir->owned, name);
+    if (!slot) return DIR_DENIED;
+    slot->node = node;
+    return DIR_GRANTED;
+}
+
+// Owner side; caller holds dir->mutex. Returns the nodes to invalidate.
+static uint64_t owned_release(Directory* dir, const char* name, int node) {
+    DirectorySlot* slot = table_find(&dir->owned, name);
+    if (!slot || slot->node != node) return 0;
+    uint64_t mask = slot->cached_by;
+    table_remove(&dir->owned, slot);
+    return mask;
+}
+
+// Registers `name` for this node. Returns DIR_GRANTED or DIR_DENIED when this
+// node owns the name, otherwise DIR_PENDING (the owner's answer comes back
+// through claim_done with `token`) or DIR_UNREACHABLE.
+int directory_claim(Directory* dir, const char* name, uint64_t token) {
+    if (!valid_name(name)) return DIR_DENIED;
+    int owner = dir->transport.owner(dir->transport.ctx, name);
+    if (owner == dir->self) {
+        pthread_mutex_lock(&dir->mutex);
+        int result = owned_claim(dir, name, dir->self);
+        pthread_mutex_unlock(&dir->mutex);
+        return result;
+    }
+
+    char frame[DIR_FRAME_LEN];
+    snprintf(frame, sizeof(frame), "DCLAIM %s %llu", name, (unsigned long long)token);
+    return dir->transport.send(dir->transport.ctx, owner, frame) == -1 ? DIR_UNREACHABLE : DIR_PENDING;
+}
+
+// Re-registers a name this node already holds, e.g. after its owner restarted.
+void directory_assert(Directory* dir, const char* name) {
+    int owner = dir->transport.owner(dir->transport.ctx, name);
+    if (owner != dir->self) {
+        send_frame(dir, owner, "DASSERT %s", name);
+        return;
+    }
+    pthread_mutex_lock(&dir->mutex);
+    DirectorySlot* slot = table_insert(&dir->owned, name);
+    if (slot && slot->node == -1) slot->node = dir->self;
+    pthread_mutex_unlock(&dir->mutex);
+}
+
+void directory_release(Directory* dir, const char* name) {
+    int owner = dir->transport.owner(dir->transport.ctx, name);
+    if (owner != dir->self) {
+        send_frame(dir, owner, "DRELEASE %s", name);
+        return;
+    }
+    pthread_mutex_lock(&dir->mutex);
+    uint64_t mask = owned_release(dir, name, dir->self);
+    pthread_mutex_unlock(&dir->mutex);
+    send_invalidations(dir, name, mask);
+}
+
+// Node the user is logged in on, or -1. Names this node owns or has cached
+// are answered immediately; anything else asks the owner and waits up to
+// `timeout_ms` for the answer.
+int directory_lookup(Directory* dir, const char* name, int timeout_ms) {
+    if (!valid_name(name)) return -1;
+    int owner = dir->transport.owner(dir->transport.ctx, name);
+
+    pthread_mutex_lock(&dir->mutex);
+    DirectorySlot* slot = table_find(owner == dir->self ? &dir->owned : &dir->cache, name);
+    if (slot || owner == dir->self) {
+        int node = slot ? slot->node : -1;
+        dir->local_hits++;
+        pthread_mutex_unlock(&dir->mutex);
+        return node;
+    }
+
+    DirectoryLookup* lookup = NULL;
+    for (int i = 0; i < DIR_MAX_LOOKUPS; i++) {
+        if (!dir->lookups[i].active) {
+            lookup = &dir->lookups[i];
+            break;
+        }
+    }
+    if (!lookup) {
+        pthread_mutex_unlock(&dir->mutex);
+        return -1;
+    }
+    lookup->active = 1;
+    lookup->done = 0;
+    lookup->node = -1;
+    lookup->token = ++dir->next_token;
+    strcpy(lookup->name, name);
+    uint64_t token = lookup->token;
+    dir->remote_lookups++;
+    pthread_mutex_unlock(&dir->mutex);
+
+    char frame[DIR_FRAME_LEN];
+    snprintf(frame, sizeof(frame), "DLOOKUP %s %llu", name, (unsigned long long)token);
+    int sent = dir->transport.send(dir->transport.ctx, owner, frame);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&dir->mutex);
+    while (sent != -1 && !lookup->done) {
+        if (pthread_cond_timedwait(&dir->answered, &dir->mutex, &deadline) == ETIMEDOUT) break;
+    }
+    int node = lookup->node;
+    lookup->active = 0;
+    pthread_mutex_unlock(&dir->mutex);
+    return node;
+}
+
+// `node` left the cluster: forget its users and every answer pointing at it.
+void directory_node_down(Directory* dir, int node) {
+    pthread_mutex_lock(&dir->mutex);
+    for (size_t i = 0; i < dir->owned.capacity; i++) {
+        DirectorySlot* slot = &dir->owned.slots[i];
+        if (slot->state != SLOT_USED) continue;
+        if (slot->node == node) {
+            table_remove(&dir->owned, slot);
+        } else {
+            slot->cached_by &= ~(1ULL << node);
+        }
+    }
+    for (size_t i = 0; i < dir->cache.capacity; i++) {
+        DirectorySlot* slot = &dir->cache.slots[i];
+        if (slot->state == SLOT_USED && slot->node == node) {
+            table_remove(&dir->cache, slot);
+        }
+    }
+    pthread_mutex_unlock(&dir->mutex);
+}
+
+// Handles one frame from node `from`. Returns 0 if it is not a directory frame.
+int directory_handle_frame(Directory* dir, int from, char* frame) {
+    char verb[16];
+    char name[DIR_NAME_LEN + 1];
+    unsigned long long token = 0;
+    int node;
+
+    if (from < 0 || from >= DIR_MAX_NODES || frame[0] != 'D' ||
+        sscanf(frame, "%15s %16s", verb, name) != 2) {
+        return 0;
+    }
+
+    if (strcmp(verb, "DCLAIM") == 0 && sscanf(frame, "%*s %*s %llu", &token) == 1) {
+        pthread_mutex_lock(&dir->mutex);
+        int result = owned_claim(dir, name, from);
+        pthread_mutex_unlock(&dir->mutex);
+        send_frame(dir, from, "%s %s %llu", result == DIR_GRANTED ? "DGRANT" : "DDENY", name, token);
+    } else if (strcmp(verb, "DASSERT") == 0) {
+        pthread_mutex_lock(&dir->mutex);
+        DirectorySlot* slot = table_insert(&dir->owned, name);
+        if (slot && slot->node == -1) slot->node = from;
+        pthread_mutex_unlock(&dir->mutex);
+    } else if (strcmp(verb, "DRELEASE") == 0) {
+        pthread_mutex_lock(&dir->mutex);
+        uint64_t mask = owned_release(dir, name, from);
+        pthread_mutex_unlock(&dir->mutex);
+        send_invalidations(dir, name, mask);
+    } else if (strcmp(verb, "DLOOKUP") == 0 && sscanf(frame, "%*s %*s %llu", &token) == 1) {
+        pthread_mutex_lock(&dir->mutex);
+        DirectorySlot* slot = table_find(&dir->owned, name);
+        node = slot ? slot->node : -1;
+        if (slot) slot->cached_by |= 1ULL << from;
+        pthread_mutex_unlock(&dir->mutex);
+        send_frame(dir, from, "DFOUND %s %d %llu", name, node, token);
+    } else if ((strcmp(verb, "DGRANT") == 0 || strcmp(verb, "DDENY") == 0) &&
+               sscanf(frame, "%*s %*s %llu", &token) == 1) {
+        dir->transport.claim_done(dir->transport.ctx, token, name,
+            verb[1] == 'G' ? DIR_GRANTED : DIR_DENIED);
+    } else if (strcmp(verb, "DFOUND") == 0 && sscanf(frame, "%*s %*s %d %llu", &node, &token) == 2) {
+        pthread_mutex_lock(&dir->mutex);
+        if (node >= 0 && node < DIR_MAX_NODES) {
+            // Bounded cache: start over rather than track recency
+            if (dir->cache.live >= dir->cache_limit) table_clear(&dir->cache);
+            DirectorySlot* slot = table_insert(&dir->cache, name);
+            if (slot) slot->node = node;
+        }
+        for (int i = 0; i < DIR_MAX_LOOKUPS; i++) {
+            DirectoryLookup* lookup = &dir->lookups[i];
+            if (lookup->active && lookup->token == token) {
+                lookup->node = node;
+                lookup->done = 1;
+                pthread_cond_broadcast(&dir->answered);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&dir->mutex);
+    } else if (strcmp(verb, "DINVAL") == 0) {
+        pthread_mutex_lock(&dir->mutex);
+        DirectorySlot* slot = table_find(&dir->cache, name);
+        if (slot) table_remove(&dir->cache, slot);
+        pthread_mutex_unlock(&dir->mutex);
+    } else {
+        return 0;
+    }
+    return 1;
+}
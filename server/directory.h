@@ -0,0 +1,92 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Cluster-wide username directory. The name space is partitioned: every
+// username has one owner node (chosen by the transport's `owner` hook), and
+// only the owner knows which node the user is logged in on. Other nodes keep
+// a cache of the answers they have asked for; the owner remembers who asked
+// and sends an invalidation when the entry goes away. Lookups of local or
+// cached names never leave the process; both tables are open-addressing
+// hash tables, so a hit is O(1).
+//
+// The directory does no I/O of its own. Frames go out through the transport
+// and come back in through directory_handle_frame(), so the same code runs
+// over the cluster links or, for tests and benchmarks, over an in-process
+// stand-in that calls directory_handle_frame() on another instance directly.
+//
+// Frames (text, `from` is the sending node):
+//   DCLAIM <name> <token>       register name for `from`, reply DGRANT/DDENY
+//   DASSERT <name>              re-register after a link came back
+//   DRELEASE <name>             user logged out
+//   DLOOKUP <name> <token>      reply DFOUND <name> <node|-1> <token>
+//   DINVAL <name>               drop a cached answer
+
+#define DIR_NAME_LEN 16
+#define DIR_MAX_NODES 64
+#define DIR_MAX_LOOKUPS 64         // concurrent blocking lookups
+#define DIR_FRAME_LEN 96
+
+enum {
+    DIR_GRANTED = 0,
+    DIR_DENIED = 1,
+    DIR_PENDING = 2,               // answer arrives through claim_done
+    DIR_UNREACHABLE = 3            // owner could not be asked
+};
+
+typedef struct {
+    int (*send)(void* ctx, int node, const char* frame);   // -1 if unreachable
+    int (*owner)(void* ctx, const char* name);
+    void (*claim_done)(void* ctx, uint64_t token, const char* name, int result);
+    void* ctx;
+} DirectoryTransport;
+
+typedef struct {
+    char name[DIR_NAME_LEN + 1];
+    uint8_t state;                 // empty, used or deleted
+    int16_t node;
+    uint64_t cached_by;            // owner side: nodes holding a cached copy
+} DirectorySlot;
+
+typedef struct {
+    DirectorySlot* slots;
+    size_t capacity;               // power of two
+    size_t used;                   // live + deleted
+    size_t live;
+} DirectoryTable;
+
+typedef struct {
+    uint64_t token;
+    char name[DIR_NAME_LEN + 1];
+    int node;
+    int active;
+    int done;
+} DirectoryLookup;
+
+typedef struct {
+    int self;
+    DirectoryTransport transport;
+    pthread_mutex_t mutex;
+    pthread_cond_t answered;
+    DirectoryTable owned;          // names this node is the owner of
+    DirectoryTable cache;          // answers from other owners
+    size_t cache_limit;
+    DirectoryLookup lookups[DIR_MAX_LOOKUPS];
+    uint64_t next_token;
+    uint64_t local_hits;           // answered without a round trip
+    uint64_t remote_lookups;
+} Directory;
+
+int directory_init(Directory* dir, int self, size_t capacity, const DirectoryTransport* transport);
+void directory_destroy(Directory* dir);
+int directory_claim(Directory* dir, const char* name, uint64_t token);
+void directory_assert(Directory* dir, const char* name);
+void directory_release(Directory* dir, const char* name);
+int directory_lookup(Directory* dir, const char* name, int timeout_ms);
+void directory_node_down(Directory* dir, int node);
+int directory_handle_frame(Directory* dir, int from, char* frame);
+
+#endif
@@ -0,0 +1,112 @@
+#include "fanout.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Shard `shard` of `shards` over [0, count): sizes differ by at most one
+static void shard_range(int count, int shards, int shard, int* begin, int* end) {
+    *begin = (int)((int64_t)count * shard / shards);
+    *end = (int)((int64_t)count * (shard + 1) / shards);
+}
+
+static void* fanout_worker(void* arg) {
+    FanoutWorker* worker = arg;
+    FanoutPool* pool = worker->pool;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->stopping && pool->generation == seen) {
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+        if (pool->stopping) break;
+        seen = pool->generation;
+        // Runs with fewer shards than workers leave the rest idle
+        if (worker->index >= pool->shards - 1) continue;
+
+        FanoutFn fn = pool->fn;
+        void* fn_arg = pool->arg;
+        int begin, end;
+        shard_range(pool->count, pool->shards, worker->index, &begin, &end);
+        pthread_mutex_unlock(&pool->mutex);
+
+        fn(fn_arg, begin, end);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->pending == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+int fanout_pool_init(FanoutPool* pool, int workers) {
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    if (workers <= 0) return 0;
+
+    pool->workers = calloc(workers, sizeof(FanoutWorker));
+    if (!pool->workers) return -1;
+    for (int i = 0; i < workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->workers[i].thread, NULL, fanout_worker, &pool->workers[i]) != 0) {
+            fanout_pool_destroy(pool);
+            return -1;
+        }
+        pool->worker_count++;
+    }
+    return 0;
+}
+
+void fanout_pool_destroy(FanoutPool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->worker_count = 0;
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+// Returns the number of shards the items were walked in (1 = inline).
+int fanout_run(FanoutPool* pool, int count, int min_shard, FanoutFn fn, void* arg) {
+    if (min_shard < 1) min_shard = 1;
+    int shards = count / min_shard;
+    if (shards > pool->worker_count + 1) shards = pool->worker_count + 1;
+    if (shards < 2) {
+        fn(arg, 0, count);
+        return 1;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->count = count;
+    pool->shards = shards;
+    pool->pending = shards - 1;
+    pool->generation++;
+    pool->parallel_runs++;
+    pool->parallel_items += count;
+    pool->parallel_shards += shards;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    int begin, end;
+    shard_range(count, shards, shards - 1, &begin, &end);
+    fn(arg, begin, end);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return shards;
+}
@@ -0,0 +1,51 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// Runs one loop over many items on several threads at once, for delivering
+// a room line to a room too big for one thread to walk quickly. The items
+// are split into contiguous shards of at least `min_shard` items. Shard i
+// goes to worker i, and the calling thread takes the last shard itself.
+// fanout_run() returns once every shard is done, so the callback can read
+// whatever the caller built on its stack. This includes the one formatted
+// message all shards send. Lists shorter than two shards are walked inline,
+// with no wake-up cost.
+//
+// One run at a time: callers serialize among themselves (the server runs it
+// under rooms_mutex). A pool with no workers just calls the callback.
+
+typedef void (*FanoutFn)(void* arg, int begin, int end);
+
+typedef struct FanoutPool FanoutPool;
+
+typedef struct {
+    FanoutPool* pool;
+    int index;
+    pthread_t thread;
+} FanoutWorker;
+
+struct FanoutPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t start;       // workers: a new run, or stopping
+    pthread_cond_t done;        // caller: the last worker finished its shard
+    FanoutWorker* workers;
+    int worker_count;
+    uint64_t generation;        // bumped for every parallel run
+    int pending;                // worker shards of this run not yet done
+    int stopping;
+    FanoutFn fn;
+    void* arg;
+    int count;
+    int shards;
+    uint64_t parallel_runs;     // stats, under mutex
+    uint64_t parallel_items;
+    uint64_t parallel_shards;
+};
+
+int fanout_pool_init(FanoutPool* pool, int workers);
+void fanout_pool_destroy(FanoutPool* pool);
+int fanout_run(FanoutPool* pool, int count, int min_shard, FanoutFn fn, void* arg);
+
+#endif
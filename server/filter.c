@@ -0,0 +1,216 @@
+#include "filter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+static uint8_t fold(uint8_t c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Trie under construction: transitions are 0 where there is no edge yet
+// (state 0 is the root, which nothing points back to)
+typedef struct {
+    uint32_t* next;
+    uint8_t* terminal;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t class_count;
+} Trie;
+
+static uint32_t trie_add_state(Trie* trie) {
+    if (trie->count == trie->capacity) {
+        uint32_t capacity = trie->capacity ? trie->capacity * 2 : 256;
+        uint32_t* next = realloc(trie->next, (size_t)capacity * trie->class_count * sizeof(uint32_t));
+        uint8_t* terminal = realloc(trie->terminal, capacity);
+        if (!next || !terminal) {
+            // The larger of the two may have moved; keep both for the caller to free
+            if (next) trie->next = next;
+            if (terminal) trie->terminal = terminal;
+            return 0;
+        }
+        trie->next = next;
+        trie->terminal = terminal;
+        trie->capacity = capacity;
+    }
+    uint32_t state = trie->count++;
+    memset(trie->next + (size_t)state * trie->class_count, 0, trie->class_count * sizeof(uint32_t));
+    trie->terminal[state] = 0;
+    return state;
+}
+
+FilterAutomaton* filter_compile(const char* const* phrases, size_t count) {
+    FilterAutomaton* filter = calloc(1, sizeof(FilterAutomaton));
+    if (!filter) return NULL;
+
+    // Input classes: one per distinct (folded) byte that occurs in a phrase
+    uint32_t classes = 1;
+    for (size_t i = 0; i < count; i++) {
+        for (const uint8_t* p = (const uint8_t*)phrases[i]; *p; p++) {
+            uint8_t c = fold(*p);
+            if (!filter->classes[c]) filter->classes[c] = classes++;
+        }
+    }
+    for (int c = 'A'; c <= 'Z'; c++) {
+        filter->classes[c] = filter->classes[c + ('a' - 'A')];
+    }
+    filter->class_count = classes;
+
+    Trie trie = { NULL, NULL, 0, 0, classes };
+    trie_add_state(&trie);
+    int failed = trie.count == 0;
+    for (size_t i = 0; i < count && !failed; i++) {
+        if (phrases[i][0] == '\0') continue;
+        uint32_t state = 0;
+        for (const uint8_t* p = (const uint8_t*)phrases[i]; *p && !failed; p++) {
+            uint32_t cls = filter->classes[*p];
+            uint32_t next = trie.next[(size_t)state * classes + cls];
+            if (!next) {
+                next = trie_add_state(&trie);
+                if (!next) {
+                    failed = 1;
+                    break;
+                }
+                trie.next[(size_t)state * classes + cls] = next;
+            }
+            state = next;
+        }
+        trie.terminal[state] = 1;
+        filter->phrase_count++;
+    }
+
+    // Breadth first: a state's failure link is shallower, so its row is
+    // final by the time the state's own missing edges copy from it
+    uint32_t* fail = calloc(trie.count ? trie.count : 1, sizeof(uint32_t));
+    uint32_t* queue = malloc((trie.count ? trie.count : 1) * sizeof(uint32_t));
+    if (failed || !fail || !queue) {
+        free(fail);
+        free(queue);
+        free(trie.next);
+        free(trie.terminal);
+        free(filter);
+        return NULL;
+    }
+    uint32_t head = 0, tail = 0;
+    for (uint32_t cls = 0; cls < classes; cls++) {
+        uint32_t child = trie.next[cls];
+        if (child) {
+            fail[child] = 0;
+            queue[tail++] = child;
+        }
+    }
+    while (head < tail) {
+        uint32_t state = queue[head++];
+        // Anything that ends at the failure state ends here too
+        trie.terminal[state] |= trie.terminal[fail[state]];
+        uint32_t* row = trie.next + (size_t)state * classes;
+        const uint32_t* fallback = trie.next + (size_t)fail[state] * classes;
+        for (uint32_t cls = 0; cls < classes; cls++) {
+            if (row[cls]) {
+                fail[row[cls]] = fallback[cls];
+                queue[tail++] = row[cls];
+            } else {
+                row[cls] = fallback[cls];
+            }
+        }
+    }
+    free(fail);
+
+    // Renumber in breadth-first order, root first: the shallow states, where
+    // ordinary text spends most of its time, end up next to each other in
+    // the table. Every edge into a state that ends a phrase is marked.
+    uint32_t* renumber = malloc((size_t)trie.count * sizeof(uint32_t));
+    uint32_t* table = malloc((size_t)trie.count * classes * sizeof(uint32_t));
+    if (!renumber || !table) {
+        free(renumber);
+        free(table);
+        free(queue);
+        free(trie.next);
+        free(trie.terminal);
+        free(filter);
+        return NULL;
+    }
+    renumber[0] = 0;
+    for (uint32_t i = 0; i < tail; i++) renumber[queue[i]] = i + 1;
+    for (uint32_t n = 0; n < trie.count; n++) {
+        uint32_t old = n == 0 ? 0 : queue[n - 1];
+        const uint32_t* row = trie.next + (size_t)old * classes;
+        uint32_t* out = table + (size_t)n * classes;
+        for (uint32_t cls = 0; cls < classes; cls++) {
+            out[cls] = renumber[row[cls]] | (trie.terminal[row[cls]] ? FILTER_MATCH : 0);
+        }
+    }
+    free(renumber);
+    free(queue);
+    free(trie.next);
+    free(trie.terminal);
+    filter->next = table;
+    filter->state_count = trie.count;
+    return filter;
+}
+
+// One phrase per line. Blank lines and lines starting with '#' are skipped;
+// surrounding whitespace is not part of the phrase.
+FilterAutomaton* filter_load(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return NULL;
+    char** phrases = NULL;
+    size_t count = 0, capacity = 0;
+    char line[FILTER_MAX_PHRASE + 2];
+    int failed = 0;
+    while (!failed && fgets(line, sizeof(line), file)) {
+        // Longer than FILTER_MAX_PHRASE: skipped whole, not split into pieces
+        if (!strchr(line, '\n') && !feof(file)) {
+            int c;
+            while ((c = fgetc(file)) != EOF && c != '\n') {}
+            continue;
+        }
+        char* start = line;
+        while (isspace((unsigned char)*start)) start++;
+        size_t len = strlen(start);
+        while (len > 0 && isspace((unsigned char)start[len - 1])) start[--len] = '\0';
+        if (len == 0 || start[0] == '#') continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            char** grown = realloc(phrases, capacity * sizeof(char*));
+            if (!grown) {
+                failed = 1;
+                break;
+            }
+            phrases = grown;
+        }
+        phrases[count] = strdup(start);
+        if (!phrases[count]) failed = 1;
+        else count++;
+    }
+    fclose(file);
+
+    FilterAutomaton* filter = failed ? NULL : filter_compile((const char* const*)phrases, count);
+    for (size_t i = 0; i < count; i++) free(phrases[i]);
+    free(phrases);
+    return filter;
+}
+
+// Returns 1 if a phrase occurs in text.
+int filter_match(const FilterAutomaton* filter, const char* text, size_t len) {
+    const uint32_t* next = filter->next;
+    const uint8_t* classes = filter->classes;
+    uint32_t width = filter->class_count;
+    uint32_t state = 0;
+    for (size_t i = 0; i < len; i++) {
+        state = next[(size_t)state * width + classes[(uint8_t)text[i]]];
+        if (state & FILTER_MATCH) return 1;
+    }
+    return 0;
+}
+
+size_t filter_memory(const FilterAutomaton* filter) {
+    return sizeof(*filter) + (size_t)filter->state_count * filter->class_count * sizeof(uint32_t);
+}
+
+void filter_free(FilterAutomaton* filter) {
+    if (!filter) return;
+    free(filter->next);
+    free(filter);
+}
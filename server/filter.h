@@ -0,0 +1,34 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Multi-phrase matcher for the moderation filter. The phrases are compiled
+// into an Aho-Corasick automaton, flattened into a DFA: one table lookup per
+// input byte whatever the number of phrases, and no backtracking. Matching
+// ignores ASCII case; a phrase matches anywhere in the text.
+//
+// Bytes that occur in no phrase share one input class, so the table is
+// states x (distinct phrase bytes + 1) entries rather than states x 256.
+// A transition into a state that ends a phrase has FILTER_MATCH set.
+// An automaton never changes once built; swap in a new one to reload.
+
+#define FILTER_MATCH 0x80000000u
+#define FILTER_MAX_PHRASE 256
+
+typedef struct {
+    uint8_t classes[256];       // byte -> input class, 0 = in no phrase
+    uint32_t class_count;
+    uint32_t state_count;
+    uint32_t* next;             // state_count x class_count
+    uint32_t phrase_count;
+} FilterAutomaton;
+
+FilterAutomaton* filter_compile(const char* const* phrases, size_t count);
+FilterAutomaton* filter_load(const char* path);
+int filter_match(const FilterAutomaton* filter, const char* text, size_t len);
+size_t filter_memory(const FilterAutomaton* filter);
+void filter_free(FilterAutomaton* filter);
+
+#endif
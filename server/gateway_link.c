@@ -0,0 +1,493 @@
+#include "server.h"
+
+#include <netinet/tcp.h>
+
+// Core side of the gateway links (see gateway_proto.h). A chatgateway
+// process owns the client connections: it runs the username prompt, frames
+// input into lines and drops slow readers. The core sees one TCP link per
+// gateway connection instead of one socket per user, and a session that
+// arrives this way is an ordinary Client with no socket of its own, in one
+// of the slots past MAX_CLIENTS. The link's reader thread only queues each
+// session's lines. GATEWAY_WORKERS threads shared by every link run them:
+// each session always goes to the same worker, which runs its lines in
+// order, so the core's thread count stays fixed however many sessions the
+// gateways carry. A command that blocks holds up the sessions of one worker
+// only. Output is framed onto the link's queue.
+
+// A session with lines to run waits in its worker's queue, at most once
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;
+    Client* queue[MAX_GATEWAY_SESSIONS];
+    size_t head;
+    size_t count;
+} GatewayWorker;
+
+static GatewayLink gateway_links[MAX_GATEWAY_LINKS];
+static GatewayWorker gateway_workers[GATEWAY_WORKERS];
+static EventSource gateway_listener_source = { SOURCE_GATEWAY_LISTENER };
+static int gateway_socket = -1;
+
+// Same contract as client_send_bytes. Caller holds link->out_mutex. A link
+// that falls too far behind is shut down; its reader thread then ends every
+// session on it.
+static void gateway_write_locked(GatewayLink* link, const char* data, size_t len) {
+    if (link->socket == -1) return;
+
+    size_t sent = 0;
+    if (!link->out_head) {
+        ssize_t n = send(link->socket, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            sent = n;
+        } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            shutdown(link->socket, SHUT_RDWR);
+            return;
+        }
+    }
+
+    if (sent < len) {
+        if (link->out_bytes + (len - sent) > MAX_LINK_BYTES) {
+            log_message("[GATEWAY] Link has %zu bytes queued. Disconnecting it.", link->out_bytes);
+            shutdown(link->socket, SHUT_RDWR);
+            return;
+        }
+        OutChunk* chunk = malloc(sizeof(OutChunk) + len - sent);
+        if (chunk) {
+            chunk->next = NULL;
+            chunk->len = len - sent;
+            chunk->offset = 0;
+            chunk->shared = NULL;
+            memcpy(chunk->data, data + sent, len - sent);
+            if (link->out_tail) {
+                link->out_tail->next = chunk;
+            } else {
+                link->out_head = chunk;
+            }
+            link->out_tail = chunk;
+            link->out_bytes += chunk->len;
+
+            if (!link->out_watched) {
+                struct epoll_event ev;
+                ev.events = EPOLLOUT;
+                ev.data.ptr = link;
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, link->socket, &ev);
+                link->out_watched = 1;
+            }
+        }
+    }
+}
+
+// Any thread. Output longer than one frame is split; the gateway writes the
+// pieces to the client back to back.
+void gateway_send(GatewayLink* link, uint32_t session, int type, const char* data, size_t len) {
+    char frame[sizeof(GatewayHeader) + GATEWAY_MAX_PAYLOAD];
+
+    pthread_mutex_lock(&link->out_mutex);
+    do {
+        size_t chunk = len > GATEWAY_MAX_PAYLOAD ? GATEWAY_MAX_PAYLOAD : len;
+        GatewayHeader header;
+        header.session = htonl(session);
+        header.type = htons(type);
+        header.len = htons(chunk);
+        memcpy(frame, &header, sizeof(header));
+        if (chunk > 0) memcpy(frame + sizeof(header), data, chunk);
+        gateway_write_locked(link, frame, sizeof(header) + chunk);
+        data += chunk;
+        len -= chunk;
+    } while (len > 0);
+    pthread_mutex_unlock(&link->out_mutex);
+}
+
+void handle_gateway_output(GatewayLink* link) {
+    pthread_mutex_lock(&link->out_mutex);
+    while (link->socket != -1 && link->out_head) {
+        OutChunk* chunk = link->out_head;
+        ssize_t n = send(link->socket, chunk->data + chunk->offset, chunk->len - chunk->offset,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                pthread_mutex_unlock(&link->out_mutex);
+                return;
+            }
+            // The reader thread sees the shutdown and cleans up
+            shutdown(link->socket, SHUT_RDWR);
+            break;
+        }
+        chunk->offset += n;
+        link->out_bytes -= n;
+        if (chunk->offset == chunk->len) {
+            link->out_head = chunk->next;
+            if (!link->out_head) link->out_tail = NULL;
+            free(chunk);
+        }
+    }
+    if (link->socket != -1 && link->out_watched && !link->out_head) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, link->socket, NULL);
+        link->out_watched = 0;
+    }
+    pthread_mutex_unlock(&link->out_mutex);
+}
+
+// Caller holds clients_mutex, so the slot cannot be released or reused
+// while the frame is queued on it.
+static Client* find_gateway_session(GatewayLink* link, uint32_t session) {
+    for (int i = MAX_CLIENTS; i < MAX_SESSIONS; i++) {
+        if (clients[i].active && clients[i].gateway == link && clients[i].session == session) {
+            return &clients[i];
+        }
+    }
+    return NULL;
+}
+
+// Caller holds client->input_mutex. Puts a session with something to run
+// on its worker's queue, unless it is there already; the worker is woken
+// only when its queue was empty.
+static void schedule_session_locked(Client* client) {
+    if (client->input_queued) return;
+    client->input_queued = 1;
+    GatewayWorker* worker = &gateway_workers[(client - clients) % GATEWAY_WORKERS];
+    pthread_mutex_lock(&worker->mutex);
+    worker->queue[(worker->head + worker->count) % MAX_GATEWAY_SESSIONS] = client;
+    if (worker->count++ == 0) pthread_cond_signal(&worker->ready);
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+// Any thread: the session ends once its worker gets to it.
+void gateway_end_session(Client* client) {
+    pthread_mutex_lock(&client->input_mutex);
+    client->input_closed = 1;
+    schedule_session_locked(client);
+    pthread_mutex_unlock(&client->input_mutex);
+}
+
+// Runs up to GATEWAY_BURST of a session's lines, as client_handler does for
+// a direct connection. Returns 1 if the session has more to run and goes
+// back on the queue, 0 if it is done for now, or -1 once it has ended.
+static int run_gateway_session(Client* client) {
+    char line[BUFFER_SIZE];
+    for (int i = 0; i < GATEWAY_BURST; i++) {
+        pthread_mutex_lock(&client->input_mutex);
+        char* newline = memchr(client->inbuf, '\n', client->inbuf_len);
+        if (!newline) {
+            int closed = client->input_closed || !server_running;
+            if (!closed) client->input_queued = 0;
+            pthread_mutex_unlock(&client->input_mutex);
+            return closed ? -1 : 0;
+        }
+        size_t len = newline - client->inbuf;
+        memcpy(line, client->inbuf, len);
+        line[len] = '\0';
+        client->inbuf_len -= len + 1;
+        memmove(client->inbuf, newline + 1, client->inbuf_len);
+        pthread_mutex_unlock(&client->input_mutex);
+
+        if (!handle_command(client, line)) return -1;
+    }
+    return 1;
+}
+
+static void* gateway_worker(void* arg) {
+    GatewayWorker* worker = (GatewayWorker*)arg;
+    while (1) {
+        pthread_mutex_lock(&worker->mutex);
+        while (worker->count == 0) {
+            pthread_cond_wait(&worker->ready, &worker->mutex);
+        }
+        Client* client = worker->queue[worker->head];
+        worker->head = (worker->head + 1) % MAX_GATEWAY_SESSIONS;
+        worker->count--;
+        pthread_mutex_unlock(&worker->mutex);
+
+        int result = run_gateway_session(client);
+        if (result == 1) {
+            // Still input_queued: straight to the back of the queue
+            pthread_mutex_lock(&worker->mutex);
+            worker->queue[(worker->head + worker->count) % MAX_GATEWAY_SESSIONS] = client;
+            worker->count++;
+            pthread_mutex_unlock(&worker->mutex);
+        } else if (result == -1) {
+            // Sends CLOSE, which a gateway that already hung up ignores.
+            // input_queued stays set, so nothing queues the slot again
+            // until a new session claims it.
+            GatewayLink* link = client->gateway;
+            cleanup_client(client);
+            pthread_mutex_lock(&link->out_mutex);
+            if (--link->sessions == 0) pthread_cond_signal(&link->sessions_done);
+            pthread_mutex_unlock(&link->out_mutex);
+        }
+    }
+    return NULL;
+}
+
+// OPEN: same checks as a direct login; the gateway has already validated
+// the name's format and counts the attempts.
+static void open_gateway_session(GatewayLink* link, uint32_t session, const char* payload) {
+    char username[MAX_USERNAME_LEN + 1];
+    char client_ip[ADDRESS_STRLEN];
+    if (sscanf(payload, "%16s %45s", username, client_ip) != 2 || !validate_username(username)) {
+        gateway_send(link, session, GATEWAY_CLOSE, NULL, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&clients_mutex);
+    if (find_client_by_username(username)) {
+        pthread_mutex_unlock(&clients_mutex);
+        log_message("[REJECTED] Duplicate username attempted: %s", username);
+        gateway_send(link, session, GATEWAY_TAKEN, NULL, 0);
+        return;
+    }
+
+    Client* client = NULL;
+    for (int i = MAX_CLIENTS; i < MAX_SESSIONS; i++) {
+        if (!clients[i].active) {
+            client = &clients[i];
+            break;
+        }
+    }
+    if (!client) {
+        pthread_mutex_unlock(&clients_mutex);
+        gateway_send(link, session, GATEWAY_FULL, NULL, 0);
+        return;
+    }
+
+    client->socket = -1;
+    parse_address(client_ip, &client->addr);
+    client->active = 1;
+    client->current_room[0] = '\0';
+    client->room_mask = 0;
+    strcpy(client->username, username);
+    client->inbuf_len = 0;
+    client->last_activity_ms = now_ms();
+    client->resumed = 0;
+    client->binary = 0;
+    client->websocket = 0;
+    client->parked = 0;
+    client->gateway = link;
+    client->session = session;
+    client->input_queued = 0;
+    client->input_closed = 0;
+    pthread_mutex_lock(&link->out_mutex);
+    link->sessions++;
+    pthread_mutex_unlock(&link->out_mutex);
+    pthread_mutex_unlock(&clients_mutex);
+
+    gateway_send(link, session, GATEWAY_ACCEPT, NULL, 0);
+    count_login(&client->addr);
+    arm_client_timers(client);
+    // Before any of its lines: this reader dispatches them after the OPEN
+    greet_client(client);
+}
+
+static void dispatch_gateway_frame(GatewayLink* link, uint32_t session, int type, const char* payload, size_t len) {
+    char line[BUFFER_SIZE];
+    if (len >= sizeof(line)) len = sizeof(line) - 1;
+    memcpy(line, payload, len);
+    line[len] = '\0';
+
+    if (type == GATEWAY_OPEN) {
+        open_gateway_session(link, session, line);
+        return;
+    }
+
+    // Frames for a session this side already ended are dropped
+    pthread_mutex_lock(&clients_mutex);
+    Client* client = find_gateway_session(link, session);
+    if (client) {
+        pthread_mutex_lock(&client->input_mutex);
+        if (type == GATEWAY_DATA && !client->input_closed) {
+            touch_client(client);
+            // One command per frame; the reader never waits on a session,
+            // so one that falls a whole buffer behind is ended instead
+            len = strcspn(line, "\n");
+            if (client->inbuf_len + len + 1 > sizeof(client->inbuf)) {
+                log_message("[GATEWAY] user '%s' is %zu bytes behind on input. Closing the session.",
+                    client->username, client->inbuf_len);
+                client->input_closed = 1;
+            } else {
+                memcpy(client->inbuf + client->inbuf_len, line, len);
+                client->inbuf[client->inbuf_len + len] = '\n';
+                client->inbuf_len += len + 1;
+            }
+        } else if (type == GATEWAY_CLOSE) {
+            client->input_closed = 1;
+        }
+        schedule_session_locked(client);
+        pthread_mutex_unlock(&client->input_mutex);
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// Reader thread's exit path: every session on the link ends with it.
+static void close_gateway_link(GatewayLink* link) {
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = MAX_CLIENTS; i < MAX_SESSIONS; i++) {
+        Client* client = &clients[i];
+        if (!client->active || client->gateway != link) continue;
+        gateway_end_session(client);
+    }
+    pthread_mutex_unlock(&clients_mutex);
+
+    // Their workers may still write to the link while they finish; it is
+    // not handed to another gateway until the last one is done
+    pthread_mutex_lock(&link->out_mutex);
+    while (link->sessions > 0) {
+        pthread_cond_wait(&link->sessions_done, &link->out_mutex);
+    }
+    if (link->out_watched) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, link->socket, NULL);
+        link->out_watched = 0;
+    }
+    close(link->socket);
+    link->socket = -1;
+    while (link->out_head) {
+        OutChunk* chunk = link->out_head;
+        link->out_head = chunk->next;
+        free(chunk);
+    }
+    link->out_tail = NULL;
+    link->out_bytes = 0;
+    pthread_mutex_unlock(&link->out_mutex);
+
+    log_message("[GATEWAY] Link %d closed", (int)(link - gateway_links));
+    __atomic_store_n(&link->active, 0, __ATOMIC_RELEASE);
+}
+
+// One per link. Reads as much as the socket has, then runs every complete
+// frame in it, so a busy gateway costs one recv() for many sessions.
+static void* gateway_reader(void* arg) {
+    GatewayLink* link = (GatewayLink*)arg;
+
+    while (1) {
+        int bytes = recv(link->socket, link->inbuf + link->inbuf_len,
+                         sizeof(link->inbuf) - link->inbuf_len, 0);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0) break;
+        link->inbuf_len += bytes;
+
+        size_t start = 0;
+        int malformed = 0;
+        while (link->inbuf_len - start >= sizeof(GatewayHeader)) {
+            GatewayHeader header;
+            memcpy(&header, link->inbuf + start, sizeof(header));
+            size_t len = ntohs(header.len);
+            if (len > GATEWAY_MAX_PAYLOAD) {
+                malformed = 1;
+                break;
+            }
+            if (link->inbuf_len - start < sizeof(header) + len) break;
+            dispatch_gateway_frame(link, ntohl(header.session), ntohs(header.type),
+                link->inbuf + start + sizeof(header), len);
+            start += sizeof(header) + len;
+        }
+        if (malformed) {
+            log_message("[GATEWAY] Malformed frame on link %d", (int)(link - gateway_links));
+            break;
+        }
+        memmove(link->inbuf, link->inbuf + start, link->inbuf_len - start);
+        link->inbuf_len -= start;
+    }
+
+    close_gateway_link(link);
+    return NULL;
+}
+
+int gateway_listen(int port) {
+    for (int i = 0; i < MAX_GATEWAY_LINKS; i++) {
+        gateway_links[i].source.kind = SOURCE_GATEWAY_OUTPUT;
+        gateway_links[i].socket = -1;
+        pthread_mutex_init(&gateway_links[i].out_mutex, NULL);
+        pthread_cond_init(&gateway_links[i].sessions_done, NULL);
+    }
+    for (int i = 0; i < GATEWAY_WORKERS; i++) {
+        GatewayWorker* worker = &gateway_workers[i];
+        pthread_mutex_init(&worker->mutex, NULL);
+        pthread_cond_init(&worker->ready, NULL);
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, gateway_worker, worker) != 0) {
+            perror("Gateway worker failed");
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+
+    gateway_socket = open_tcp_listener(port, MAX_GATEWAY_LINKS, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (gateway_socket == -1) {
+        perror("Gateway bind failed");
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &gateway_listener_source;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, gateway_socket, &ev);
+
+    log_message("[GATEWAY] Accepting gateway links on port %d", port);
+    printf("[INFO] Gateway links on port %d\n", port);
+    return 0;
+}
+
+void gateway_accept_links(void) {
+    while (1) {
+        int sock = accept4(gateway_socket, NULL, NULL, SOCK_CLOEXEC);
+        if (sock == -1) return;
+
+        GatewayLink* link = NULL;
+        for (int i = 0; i < MAX_GATEWAY_LINKS; i++) {
+            if (!__atomic_load_n(&gateway_links[i].active, __ATOMIC_ACQUIRE)) {
+                link = &gateway_links[i];
+                break;
+            }
+        }
+        if (!link) {
+            log_message("[GATEWAY] Link limit (%d) reached", MAX_GATEWAY_LINKS);
+            close(sock);
+            continue;
+        }
+
+        // Frames are small and latency-sensitive
+        int opt = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        link->socket = sock;
+        link->inbuf_len = 0;
+        link->out_watched = 0;
+        link->sessions = 0;
+        link->active = 1;
+
+        pthread_t reader;
+        if (pthread_create(&reader, NULL, gateway_reader, link) != 0) {
+            close(sock);
+            link->socket = -1;
+            link->active = 0;
+            continue;
+        }
+        pthread_detach(reader);
+        log_message("[GATEWAY] Link %d connected", (int)(link - gateway_links));
+    }
+}
+
+size_t gateway_bytes_pending(void) {
+    if (!config.gateway_port) return 0;
+    size_t total = 0;
+    for (int i = 0; i < MAX_GATEWAY_LINKS; i++) {
+        pthread_mutex_lock(&gateway_links[i].out_mutex);
+        total += gateway_links[i].out_bytes;
+        pthread_mutex_unlock(&gateway_links[i].out_mutex);
+    }
+    return total;
+}
+
+// Shutdown, after the drain: reader threads see EOF and end their sessions.
+void gateway_stop(void) {
+    if (gateway_socket == -1) return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, gateway_socket, NULL);
+    close(gateway_socket);
+    gateway_socket = -1;
+    for (int i = 0; i < MAX_GATEWAY_LINKS; i++) {
+        pthread_mutex_lock(&gateway_links[i].out_mutex);
+        if (gateway_links[i].socket != -1) {
+            shutdown(gateway_links[i].socket, SHUT_RDWR);
+        }
+        pthread_mutex_unlock(&gateway_links[i].out_mutex);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef GATEWAY_PROTO_H
+#define GATEWAY_PROTO_H
+
+#include <stdint.h>
+
+// Wire format between chatgateway and the chatserver core. A gateway keeps a
+// few TCP links open to the core (chatserver --gateway-port) and multiplexes
+// its client sessions over them. Every frame is a header in network byte
+// order followed by `len` payload bytes:
+//
+//   OPEN    gateway -> core   "<username> <client ip>": log the session in
+//   ACCEPT  core -> gateway   login succeeded
+//   TAKEN   core -> gateway   username in use; the gateway prompts again
+//   FULL    core -> gateway   no session slot; the gateway disconnects
+//   DATA    gateway -> core   one validated command line, no newline
+//           core -> gateway   output for the client, passed through as-is
+//   CLOSE   either way        the session is over
+//
+// Session ids are picked by the gateway and never reused on a link.
+
+#define GATEWAY_MAX_PAYLOAD 4096
+
+enum {
+    GATEWAY_OPEN = 1,
+    GATEWAY_ACCEPT,
+    GATEWAY_TAKEN,
+    GATEWAY_FULL,
+    GATEWAY_DATA,
+    GATEWAY_CLOSE
+};
+
+typedef struct {
+    uint32_t session;
+    uint16_t type;
+    uint16_t len;
+} GatewayHeader;
+
+#endif
@@ -0,0 +1,562 @@
+#include "server.h"
+
+#include <sys/un.h>
+
+// Hot restart. A new chatserver started with --takeover connects to the
+// running server's --handoff socket. The old process parks every client
+// thread, then sends the listening socket and each connection (SCM_RIGHTS)
+// together with its session state: username, rooms, unread input and
+// undelivered output. Once the successor acknowledges, the old process exits
+// without closing any connection, so users never see a disconnect.
+
+#define HANDOFF_MAGIC 0x43484f46  // "CHOF"
+#define HANDOFF_VERSION 7
+#define HANDOFF_ACK "OK"
+#define HANDOFF_NAK "NO"  // successor could not adopt everything; predecessor resumes
+
+enum {
+    RECORD_CLIENT = 1,
+    RECORD_PENDING = 2
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t client_count;
+    uint32_t pending_count;
+} HandoffHeader;
+
+typedef struct {
+    uint32_t kind;
+    char username[MAX_USERNAME_LEN + 1];
+    char current_room[MAX_ROOM_NAME_LEN + 1];
+    struct sockaddr_storage addr;
+    uint32_t attempts;      // pending logins only
+    uint32_t binary;        // binary protocol session
+    uint32_t sequenced;     // numbered room lines (sequence.c)
+    uint32_t presence;      // presence lines (presence.c)
+    char session_token[SESSION_TOKEN_LEN + 1];  // for /reconnect (session.c)
+    uint32_t inbuf_len;     // followed by this many unread input bytes
+    uint32_t out_len;       // then this many undelivered output bytes
+    uint32_t room_count;    // then this many HandoffRooms
+} HandoffRecord;
+
+// One of a client's rooms
+typedef struct {
+    char name[MAX_ROOM_NAME_LEN + 1];
+    uint64_t acked_seq;
+    uint64_t room_seq;      // the room's number, which the successor continues
+} HandoffRoom;
+
+int send_all(int sock, const void* data, size_t len) {
+    const char* p = data;
+    while (len > 0) {
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int recv_all(int sock, void* data, size_t len) {
+    char* p = data;
+    while (len > 0) {
+        ssize_t n = recv(sock, p, len, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Reads and drops a record payload that could not be adopted, so the
+// next record is parsed from the right offset.
+static int discard_all(int sock, uint64_t len) {
+    char scratch[4096];
+    while (len > 0) {
+        size_t chunk = len < sizeof(scratch) ? (size_t)len : sizeof(scratch);
+        if (recv_all(sock, scratch, chunk) == -1) return -1;
+        len -= chunk;
+    }
+    return 0;
+}
+
+// Sends `data` with `fd` attached to its first byte.
+int send_with_fd(int sock, const void* data, size_t len, int fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    struct iovec iov;
+    iov.iov_base = (void*)data;
+    iov.iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return -1;
+    return send_all(sock, (const char*)data + n, len - n);
+}
+
+static int recv_with_fd(int sock, void* data, size_t len, int* fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return -1;
+
+    *fd = -1;
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    if (*fd == -1) return -1;
+    return recv_all(sock, (char*)data + n, len - n);
+}
+
+int open_handoff_listener(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Handoff path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sock == -1) {
+        perror("Handoff socket creation failed");
+        return -1;
+    }
+    // The predecessor (if any) has already handed over; its path is stale
+    unlink(path);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(sock, 1) == -1) {
+        perror("Handoff bind failed");
+        close(sock);
+        return -1;
+    }
+    log_message("[HANDOFF] Accepting hot-restart takeovers on %s", path);
+    return sock;
+}
+
+static int all_clients_parked(void) {
+    int parked = 1;
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].active && !__atomic_load_n(&clients[i].parked, __ATOMIC_ACQUIRE)) {
+            parked = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    return parked;
+}
+
+// Undo a handoff that did not complete: restart parked threads and resume
+// accepting. Connections were never closed, so clients notice nothing.
+static void resume_after_failed_handoff(void) {
+    eventfd_t value;
+    eventfd_read(wakeup_fd, &value);
+    __atomic_store_n(&handoff_in_progress, 0, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        Client* client = &clients[i];
+        if (client->active && client->parked) {
+            client->parked = 0;
+            client->resumed = 1;
+            start_client_session(client);
+        }
+    }
+    for (int i = 0; i < config.max_pending_logins; i++) {
+        PendingLogin* login = &pending_logins[i];
+        if (!login->active) continue;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = login;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, login->socket, &ev);
+        pthread_mutex_lock(&timers_mutex);
+        timer_arm(&timer_wheel, &login->deadline, config.login_timeout_ms, now_ms());
+        pthread_mutex_unlock(&timers_mutex);
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listener_source;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &ev);
+    log_message("[HANDOFF] Handoff aborted; resuming service");
+}
+
+// The client's rooms and their positions, read before its out_mutex is
+// taken: broadcasts hold rooms_mutex while they queue output, so nothing
+// may take rooms_mutex under out_mutex. Its thread is parked, so they stay
+// as they are.
+static uint32_t collect_rooms(Client* client, HandoffRoom* entries) {
+    uint32_t count = 0;
+    memset(entries, 0, sizeof(HandoffRoom) * MAX_ROOMS);
+    pthread_mutex_lock(&rooms_mutex);
+    for (uint64_t mask = client->room_mask; mask; mask &= mask - 1) {
+        int index = __builtin_ctzll(mask);
+        strcpy(entries[count].name, rooms[index].name);
+        entries[count].acked_seq = client->acked_seq[index];
+        entries[count].room_seq = rooms[index].seq;
+        count++;
+    }
+    pthread_mutex_unlock(&rooms_mutex);
+    return count;
+}
+
+static int send_client_record(int conn, Client* client, const HandoffRoom* entries, uint32_t room_count) {
+    HandoffRecord record;
+    memset(&record, 0, sizeof(record));
+    record.kind = RECORD_CLIENT;
+    strcpy(record.username, client->username);
+    strcpy(record.current_room, client->current_room);
+    record.addr = client->addr;
+    record.binary = client->binary;
+    record.sequenced = client->sequenced;
+    record.presence = client->presence;
+    strcpy(record.session_token, client->session_token);
+    record.inbuf_len = client->inbuf_len;
+    record.out_len = client->out_bytes;
+    record.room_count = room_count;
+
+    if (send_with_fd(conn, &record, sizeof(record), client->socket) == -1) return -1;
+    if (send_all(conn, client->inbuf, client->inbuf_len) == -1) return -1;
+    for (OutChunk* chunk = client->out_head; chunk; chunk = chunk->next) {
+        if (send_all(conn, out_chunk_bytes(chunk) + chunk->offset, chunk->len - chunk->offset) == -1) return -1;
+    }
+    return send_all(conn, entries, sizeof(HandoffRoom) * room_count);
+}
+
+static int send_pending_record(int conn, PendingLogin* login) {
+    HandoffRecord record;
+    memset(&record, 0, sizeof(record));
+    record.kind = RECORD_PENDING;
+    record.addr = login->addr;
+    record.attempts = login->attempts;
+    record.binary = login->binary;
+    record.inbuf_len = login->buffer_len;
+
+    if (send_with_fd(conn, &record, sizeof(record), login->socket) == -1) return -1;
+    return send_all(conn, login->buffer, login->buffer_len);
+}
+
+// Old process side. Returns 1 if a successor took over (the caller then
+// exits), 0 if the request failed and service continues here.
+int handle_handoff_request(int handoff_socket) {
+    int conn = accept4(handoff_socket, NULL, NULL, SOCK_CLOEXEC);
+    if (conn == -1) return 0;
+    fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) & ~O_NONBLOCK);
+    struct timeval timeout = { HANDOFF_ACK_TIMEOUT_MS / 1000, (HANDOFF_ACK_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    uint64_t start = now_ms();
+    log_message("[HANDOFF] Successor connected; starting handoff");
+
+    // Stop accepting and stop every client thread between two reads
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, server_socket, NULL);
+    __atomic_store_n(&handoff_in_progress, 1, __ATOMIC_RELEASE);
+    eventfd_write(wakeup_fd, 1);
+    while (!all_clients_parked()) {
+        if (now_ms() - start > HANDOFF_PARK_TIMEOUT_MS) {
+            log_message("[HANDOFF] Client threads did not park within %d ms", HANDOFF_PARK_TIMEOUT_MS);
+            close(conn);
+            resume_after_failed_handoff();
+            return 0;
+        }
+        usleep(1000);
+    }
+
+    // From here on nothing but this function touches the sessions
+    pthread_mutex_lock(&clients_mutex);
+    pthread_mutex_lock(&timers_mutex);
+    HandoffHeader header = { HANDOFF_MAGIC, HANDOFF_VERSION, 0, 0 };
+    // Parked client threads took their own timers off the wheel
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].active) header.client_count++;
+    }
+    for (int i = 0; i < config.max_pending_logins; i++) {
+        if (pending_logins[i].active) {
+            timer_cancel(&timer_wheel, &pending_logins[i].deadline);
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, pending_logins[i].socket, NULL);
+            header.pending_count++;
+        }
+    }
+    pthread_mutex_unlock(&timers_mutex);
+
+    int ok = send_with_fd(conn, &header, sizeof(header), server_socket) == 0;
+    for (int i = 0; ok && i < MAX_CLIENTS; i++) {
+        Client* client = &clients[i];
+        if (!client->active) continue;
+        HandoffRoom entries[MAX_ROOMS];
+        uint32_t room_count = collect_rooms(client, entries);
+        pthread_mutex_lock(&client->out_mutex);
+        ok = send_client_record(conn, client, entries, room_count) == 0;
+        pthread_mutex_unlock(&client->out_mutex);
+    }
+    for (int i = 0; ok && i < config.max_pending_logins; i++) {
+        if (pending_logins[i].active) {
+            ok = send_pending_record(conn, &pending_logins[i]) == 0;
+        }
+    }
+
+    char ack[sizeof(HANDOFF_ACK)];
+    if (ok) {
+        ok = recv_all(conn, ack, sizeof(ack)) == 0 && memcmp(ack, HANDOFF_ACK, sizeof(ack)) == 0;
+    }
+    close(conn);
+
+    if (!ok) {
+        pthread_mutex_unlock(&clients_mutex);
+        log_message("[HANDOFF] Successor failed to take over");
+        resume_after_failed_handoff();
+        return 0;
+    }
+
+    // The successor owns the connections now. Detach them here so late
+    // writers (e.g. the file transfer thread) cannot interleave output.
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        Client* client = &clients[i];
+        if (!client->active) continue;
+        pthread_mutex_lock(&client->out_mutex);
+        if (client->out_watched) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->socket, NULL);
+            client->out_watched = 0;
+        }
+        client->socket = -1;
+        pthread_mutex_unlock(&client->out_mutex);
+    }
+    pthread_mutex_unlock(&clients_mutex);
+
+    log_message("[HANDOFF] Handed %u clients and %u pending logins to successor in %llu ms",
+        header.client_count, header.pending_count, (unsigned long long)(now_ms() - start));
+    printf("[HANDOFF] Handed %u clients to successor.\n", header.client_count);
+    return 1;
+}
+
+static int adopt_client(int conn, const HandoffRecord* record, int fd) {
+    Client* client = NULL;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (!clients[i].active) {
+            client = &clients[i];
+            break;
+        }
+    }
+
+    char inbuf[BUFFER_SIZE];
+    HandoffRoom entries[MAX_ROOMS];
+    char* out = record->out_len ? malloc(record->out_len) : NULL;
+    if (!client || record->inbuf_len > sizeof(inbuf) || (record->out_len && !out) || record->room_count > MAX_ROOMS) {
+        free(out);
+        close(fd);
+        discard_all(conn, (uint64_t)record->inbuf_len + record->out_len +
+            (uint64_t)record->room_count * sizeof(HandoffRoom));
+        return -1;
+    }
+    if (recv_all(conn, inbuf, record->inbuf_len) == -1 ||
+        recv_all(conn, out, record->out_len) == -1 ||
+        recv_all(conn, entries, sizeof(HandoffRoom) * record->room_count) == -1) {
+        free(out);
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    client->socket = fd;
+    client->addr = record->addr;
+    strcpy(client->username, record->username);
+    client->current_room[0] = '\0';
+    client->room_mask = 0;
+    memcpy(client->inbuf, inbuf, record->inbuf_len);
+    client->inbuf_len = record->inbuf_len;
+    client->last_activity_ms = now_ms();
+    client->resumed = 1;
+    client->parked = 0;
+    client->gateway = NULL;
+    client->binary = record->binary;
+    client->websocket = 0;
+    strcpy(client->session_token, record->session_token);
+    client->reconnecting = 0;
+    client->active = 1;
+
+    for (uint32_t i = 0; i < record->room_count; i++) {
+        entries[i].name[MAX_ROOM_NAME_LEN] = '\0';
+        add_room_member(client, entries[i].name, 0);
+    }
+    if (record->current_room[0] != '\0') {
+        add_room_member(client, record->current_room, 0);
+    }
+    client->presence = record->presence;
+    if (record->sequenced) {
+        client->sequenced = 1;
+        for (uint32_t i = 0; i < record->room_count; i++) {
+            seq_adopt(client, entries[i].name, entries[i].acked_seq, entries[i].room_seq);
+        }
+    }
+    if (out) {
+        // Already framed for the session's protocol
+        client_send_raw(client, out, record->out_len);
+        free(out);
+    }
+    return 0;
+}
+
+static int adopt_pending(int conn, const HandoffRecord* record, int fd) {
+    PendingLogin* login = NULL;
+    for (int i = 0; i < config.max_pending_logins; i++) {
+        if (!pending_logins[i].active) {
+            login = &pending_logins[i];
+            break;
+        }
+    }
+    if (!login || record->inbuf_len > sizeof(login->buffer)) {
+        close(fd);
+        discard_all(conn, record->inbuf_len);
+        return -1;
+    }
+    if (recv_all(conn, login->buffer, record->inbuf_len) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    login->source.kind = SOURCE_PENDING_LOGIN;
+    login->socket = fd;
+    login->addr = record->addr;
+    login->buffer_len = record->inbuf_len;
+    login->attempts = record->attempts;
+    login->binary = record->binary;
+    login->websocket = 0;
+    login->active = 1;
+    pending_count++;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = login;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+
+    pthread_mutex_lock(&timers_mutex);
+    timer_init(&login->deadline, login_deadline_expired, login);
+    timer_arm(&timer_wheel, &login->deadline, config.login_timeout_ms, now_ms());
+    pthread_mutex_unlock(&timers_mutex);
+    return 0;
+}
+
+// New process side. Returns the inherited listening socket, or -1.
+int adopt_from_predecessor(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn == -1 || connect(conn, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("Connecting to predecessor failed");
+        if (conn != -1) close(conn);
+        return -1;
+    }
+
+    uint64_t start = now_ms();
+    HandoffHeader header;
+    int listener = -1;
+    if (recv_with_fd(conn, &header, sizeof(header), &listener) == -1 ||
+        header.magic != HANDOFF_MAGIC || header.version != HANDOFF_VERSION) {
+        fprintf(stderr, "Invalid handoff header from predecessor\n");
+        if (listener != -1) close(listener);
+        close(conn);
+        return -1;
+    }
+
+    uint32_t adopted = 0, adopted_pending = 0, failed = 0;
+    uint32_t total = header.client_count + header.pending_count;
+    for (uint32_t i = 0; i < total; i++) {
+        HandoffRecord record;
+        int fd = -1;
+        if (recv_with_fd(conn, &record, sizeof(record), &fd) == -1) {
+            fprintf(stderr, "Handoff stream ended early\n");
+            close(listener);
+            close(conn);
+            return -1;
+        }
+        record.username[MAX_USERNAME_LEN] = '\0';
+        record.current_room[MAX_ROOM_NAME_LEN] = '\0';
+        if (record.kind == RECORD_CLIENT) {
+            if (adopt_client(conn, &record, fd) == 0) adopted++;
+            else failed++;
+        } else if (adopt_pending(conn, &record, fd) == 0) {
+            adopted_pending++;
+        } else {
+            failed++;
+        }
+    }
+
+    if (failed) {
+        // Hand everything back: the predecessor still holds every connection
+        // and resumes service; this process exits without touching them.
+        fprintf(stderr, "Could not adopt %u of %u handed-over connections\n", failed, total);
+        send_all(conn, HANDOFF_NAK, sizeof(HANDOFF_NAK));
+        close(listener);
+        close(conn);
+        return -1;
+    }
+    send_all(conn, HANDOFF_ACK, sizeof(HANDOFF_ACK));
+    close(conn);
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].active) {
+            start_client_session(&clients[i]);
+        }
+    }
+
+    log_message("[HANDOFF] Took over %u clients and %u pending logins in %llu ms",
+        adopted, adopted_pending, (unsigned long long)(now_ms() - start));
+    printf("[HANDOFF] Took over %u clients from predecessor.\n", adopted);
+    return listener;
+}
+
+// Old process after a successful handoff: the connections belong to the
+// successor, so exit without the shutdown notice or closing any socket.
+void exit_after_handoff(void) {
+    log_message("[SHUTDOWN] Exiting after hot-restart handoff.");
+    pthread_mutex_lock(&log_mutex);
+    fflush(log_file);
+    fclose(log_file);
+    log_file = NULL;
+    pthread_mutex_unlock(&log_mutex);
+    exit(0);
+}
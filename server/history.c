@@ -0,0 +1,274 @@
+#include "server.h"
+
+#include <sys/un.h>
+
+// Room history and its replication to a hot standby. Every broadcast that is
+// delivered on this node is appended to one log shared by all rooms; a
+// client joining a room is shown that room's latest entries.
+//
+// With --replicate <path>, a standby started as `chatserver --standby <path>`
+// tails the log over a Unix socket. Appending never waits for it: the
+// replica thread wakes up after the fact and ships everything the standby
+// has not seen yet as one link_proto batch, so a burst of broadcasts goes
+// out in a few writes. The standby replays the stream into its own log. A
+// lost or garbled connection is not proof that the leader died, so the
+// standby reconnects; only once the leader has refused it for
+// STANDBY_TAKEOVER_MS does it bind the port and serve with its history
+// warm. Sessions are not carried over; clients reconnect.
+
+static HistoryEntry history_log[HISTORY_LOG_ENTRIES];
+static uint64_t history_seq = 0;           // last entry appended
+static pthread_mutex_t history_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t history_cond = PTHREAD_COND_INITIALIZER;
+static int replica_listener = -1;
+
+// Caller holds rooms_mutex (broadcast_to_room), so entries are in delivery
+// order. No syscall unless the replica thread is asleep.
+void history_append(const char* room_name, const char* sender, const char* message) {
+    pthread_mutex_lock(&history_mutex);
+    HistoryEntry* entry = &history_log[++history_seq % HISTORY_LOG_ENTRIES];
+    entry->seq = history_seq;
+    snprintf(entry->room, sizeof(entry->room), "%s", room_name);
+    snprintf(entry->sender, sizeof(entry->sender), "%s", sender);
+    snprintf(entry->text, sizeof(entry->text), "%s", message);
+    pthread_cond_signal(&history_cond);
+    pthread_mutex_unlock(&history_mutex);
+}
+
+// Sends the room's latest HISTORY_REPLAY_LEN entries, oldest first. Called
+// with rooms_mutex held right after the client joined, so nothing broadcast
+// since is shown twice.
+void history_replay(Client* client, const char* room_name) {
+    uint64_t picked[HISTORY_REPLAY_LEN];
+    int count = 0;
+
+    pthread_mutex_lock(&history_mutex);
+    uint64_t oldest = history_seq > HISTORY_LOG_ENTRIES ? history_seq - HISTORY_LOG_ENTRIES + 1 : 1;
+    for (uint64_t seq = history_seq; seq >= oldest && seq > 0 && count < HISTORY_REPLAY_LEN; seq--) {
+        if (strcmp(history_log[seq % HISTORY_LOG_ENTRIES].room, room_name) == 0) {
+            picked[count++] = seq;
+        }
+    }
+    while (count > 0) {
+        HistoryEntry* entry = &history_log[picked[--count] % HISTORY_LOG_ENTRIES];
+        char line[BUFFER_SIZE];
+        snprintf(line, sizeof(line), "[HISTORY] [%s] %s: %s\n", entry->room, entry->sender, entry->text);
+        client_send(client, line);
+    }
+    pthread_mutex_unlock(&history_mutex);
+}
+
+// Leader side: one standby at a time. Blocking writes only ever stall this
+// thread; if the standby falls a whole log behind it skips ahead.
+static void stream_to_standby(int sock) {
+    static LinkBatch batch;
+    uint32_t batch_seq = 1;
+
+    pthread_mutex_lock(&history_mutex);
+    uint64_t sent = history_seq > HISTORY_LOG_ENTRIES ? history_seq - HISTORY_LOG_ENTRIES : 0;
+    while (1) {
+        while (sent == history_seq) {
+            // Wake up now and then to notice a standby that went away
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 1;
+            if (pthread_cond_timedwait(&history_cond, &history_mutex, &deadline) == ETIMEDOUT) {
+                char probe;
+                if (recv(sock, &probe, 1, MSG_PEEK | MSG_DONTWAIT) != -1 || errno != EAGAIN) {
+                    pthread_mutex_unlock(&history_mutex);
+                    return;
+                }
+            }
+        }
+        if (history_seq - sent > HISTORY_LOG_ENTRIES) {
+            log_message("[REPLICA] Standby fell behind; skipping %llu entries",
+                (unsigned long long)(history_seq - sent - HISTORY_LOG_ENTRIES));
+            sent = history_seq - HISTORY_LOG_ENTRIES;
+        }
+
+        link_batch_reset(&batch);
+        while (sent < history_seq) {
+            HistoryEntry* entry = &history_log[(sent + 1) % HISTORY_LOG_ENTRIES];
+            char* record = link_batch_reserve(&batch, CLUSTER_FRAME_LEN);
+            if (!record) break;
+            int len = snprintf(record, CLUSTER_FRAME_LEN, "%s %s %s", entry->room, entry->sender, entry->text);
+            if (len >= CLUSTER_FRAME_LEN) len = CLUSTER_FRAME_LEN - 1;
+            link_batch_commit(&batch, record, len + 1);
+            sent++;
+        }
+        pthread_mutex_unlock(&history_mutex);
+
+        size_t len = link_batch_seal(&batch, batch_seq++);
+        if (send_all(sock, batch.data, len) == -1) return;
+
+        pthread_mutex_lock(&history_mutex);
+    }
+}
+
+static void* replica_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        int sock = accept4(replica_listener, NULL, NULL, SOCK_CLOEXEC);
+        if (sock == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return NULL;
+        }
+        log_message("[REPLICA] Standby attached");
+        stream_to_standby(sock);
+        close(sock);
+        log_message("[REPLICA] Standby detached");
+    }
+}
+
+// Opens the replication socket and starts the thread that serves it.
+// Returns -1 if the socket cannot be opened.
+int replica_listen(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Replication path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    replica_listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (replica_listener == -1) {
+        perror("Replication socket creation failed");
+        return -1;
+    }
+    unlink(path);
+    if (bind(replica_listener, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(replica_listener, 1) == -1) {
+        perror("Replication bind failed");
+        close(replica_listener);
+        replica_listener = -1;
+        return -1;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, replica_thread, NULL) != 0) {
+        perror("Failed to start replica thread");
+        return -1;
+    }
+    pthread_detach(thread);
+    log_message("[REPLICA] Serving room history to a standby on %s", path);
+    return 0;
+}
+
+// Applies one batch from the leader; returns -1 if it is malformed.
+static int apply_batch(char* frame, int size, uint32_t* expected) {
+    LinkHeader header;
+    link_frame_parse(frame, size, &header);
+    if (header.type != LINK_BATCH || header.seq != (*expected)++) return -1;
+
+    // A leader (re)attached to starts over with everything it still has;
+    // keep only its copy
+    if (header.seq == 1) {
+        pthread_mutex_lock(&history_mutex);
+        memset(history_log, 0, sizeof(history_log));
+        history_seq = 0;
+        pthread_mutex_unlock(&history_mutex);
+    }
+
+    char* cursor = frame + LINK_HEADER_BYTES;
+    char* end = frame + size;
+    char* record;
+    size_t len;
+    while ((record = link_batch_next(&cursor, end, &len))) {
+        char* sender = strchr(record, ' ');
+        char* text = sender ? strchr(sender + 1, ' ') : NULL;
+        if (!text) return -1;
+        *sender++ = '\0';
+        *text++ = '\0';
+        history_append(record, sender, text);
+    }
+    return 0;
+}
+
+static int standby_connect(const struct sockaddr_un* addr) {
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock != -1 && connect(sock, (const struct sockaddr*)addr, sizeof(*addr)) == -1) {
+        close(sock);
+        sock = -1;
+    }
+    return sock;
+}
+
+// Waits up to `ms` for a signal, which stops the standby
+static void standby_wait(int ms) {
+    struct pollfd pfd = { signal_fd, POLLIN, 0 };
+    if (poll(&pfd, 1, ms) > 0) {
+        printf("\n[SHUTDOWN] Standby stopped.\n");
+        exit(0);
+    }
+}
+
+// Replays one connection's stream until it ends. Returns 0 if the leader
+// closed it and -1 if the stream was malformed.
+static int standby_stream(int sock) {
+    static char inbuf[LINK_MAX_FRAME * 2];
+    size_t inbuf_len = 0;
+    uint32_t expected = 1;
+    while (1) {
+        struct pollfd fds[2] = { { sock, POLLIN, 0 }, { signal_fd, POLLIN, 0 } };
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        if (fds[1].revents & POLLIN) standby_wait(0);
+
+        ssize_t n = recv(sock, inbuf + inbuf_len, sizeof(inbuf) - inbuf_len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        inbuf_len += n;
+
+        size_t start = 0;
+        LinkHeader header;
+        int size;
+        while ((size = link_frame_parse(inbuf + start, inbuf_len - start, &header)) > 0 &&
+               apply_batch(inbuf + start, size, &expected) == 0) {
+            start += size;
+        }
+        if (size != 0) return -1;
+        memmove(inbuf, inbuf + start, inbuf_len - start);
+        inbuf_len -= start;
+    }
+}
+
+// Standby side: runs on the main thread before the port is bound and
+// returns once the leader is gone. A signal while waiting exits.
+void standby_follow(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    int sock = standby_connect(&addr);
+    if (sock == -1) {
+        perror("Standby connect failed");
+        exit(1);
+    }
+    log_message("[STANDBY] Following leader on %s", path);
+    printf("[INFO] Standby: following leader on %s\n", path);
+
+    while (sock != -1) {
+        if (standby_stream(sock) == -1) {
+            log_message("[STANDBY] Malformed replication stream; reconnecting");
+        }
+        close(sock);
+
+        // The leader may only have dropped this connection. It is gone
+        // once it has refused every attempt for STANDBY_TAKEOVER_MS.
+        for (int waited = 0; (sock = standby_connect(&addr)) == -1 && waited < STANDBY_TAKEOVER_MS;
+             waited += STANDBY_RETRY_MS) {
+            standby_wait(STANDBY_RETRY_MS);
+        }
+        if (sock != -1) log_message("[STANDBY] Reconnected to leader on %s", path);
+    }
+
+    pthread_mutex_lock(&history_mutex);
+    uint64_t entries = history_seq;
+    pthread_mutex_unlock(&history_mutex);
+    log_message("[STANDBY] Leader gone; taking over with %llu history entries", (unsigned long long)entries);
+    printf("[INFO] Leader gone; taking over\n");
+}
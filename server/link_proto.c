@@ -0,0 +1,88 @@
+#include "link_proto.h"
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#define RECORD_PREFIX 2
+
+static void put_header(char* out, uint32_t len, uint32_t seq, uint16_t type, uint16_t count) {
+    uint32_t len_n = htonl(len);
+    uint32_t seq_n = htonl(seq);
+    uint16_t type_n = htons(type);
+    uint16_t count_n = htons(count);
+    memcpy(out, &len_n, 4);
+    memcpy(out + 4, &seq_n, 4);
+    memcpy(out + 8, &type_n, 2);
+    memcpy(out + 10, &count_n, 2);
+}
+
+void link_batch_reset(LinkBatch* batch) {
+    batch->len = LINK_HEADER_BYTES;
+    batch->count = 0;
+}
+
+// Room for one message of up to `max_message` bytes (NUL included), or NULL
+// if the batch has to be sealed first.
+char* link_batch_reserve(LinkBatch* batch, size_t max_message) {
+    if (batch->count == UINT16_MAX || max_message > UINT16_MAX ||
+        batch->len + RECORD_PREFIX + max_message > sizeof(batch->data)) {
+        return NULL;
+    }
+    return batch->data + batch->len + RECORD_PREFIX;
+}
+
+// `len` counts the terminating NUL.
+void link_batch_commit(LinkBatch* batch, char* message, size_t len) {
+    uint16_t len_n = htons((uint16_t)len);
+    memcpy(message - RECORD_PREFIX, &len_n, RECORD_PREFIX);
+    batch->len += RECORD_PREFIX + len;
+    batch->count++;
+}
+
+// Writes the header; the frame is the first `returned` bytes of data[].
+size_t link_batch_seal(LinkBatch* batch, uint32_t seq) {
+    put_header(batch->data, batch->len - LINK_HEADER_BYTES, seq, LINK_BATCH, batch->count);
+    return batch->len;
+}
+
+void link_ack_encode(char* out, uint32_t seq, uint16_t window) {
+    put_header(out, 0, seq, LINK_ACK, window);
+}
+
+int link_frame_parse(const char* data, size_t avail, LinkHeader* header) {
+    if (avail < LINK_HEADER_BYTES) return 0;
+    uint32_t len_n, seq_n;
+    uint16_t type_n, count_n;
+    memcpy(&len_n, data, 4);
+    memcpy(&seq_n, data + 4, 4);
+    memcpy(&type_n, data + 8, 2);
+    memcpy(&count_n, data + 10, 2);
+    header->len = ntohl(len_n);
+    header->seq = ntohl(seq_n);
+    header->type = ntohs(type_n);
+    header->count = ntohs(count_n);
+
+    if (header->len > LINK_BATCH_BYTES || (header->type != LINK_BATCH && header->type != LINK_ACK) ||
+        (header->type == LINK_ACK && header->len != 0)) {
+        return -1;
+    }
+    if (avail < LINK_HEADER_BYTES + header->len) return 0;
+    return (int)(LINK_HEADER_BYTES + header->len);
+}
+
+// Returns the next message and advances `cursor`, or NULL at the end of the
+// body or on a malformed record (which also stops the walk).
+char* link_batch_next(char** cursor, char* end, size_t* len) {
+    if (end - *cursor < RECORD_PREFIX) return NULL;
+    uint16_t len_n;
+    memcpy(&len_n, *cursor, RECORD_PREFIX);
+    size_t record = ntohs(len_n);
+    char* message = *cursor + RECORD_PREFIX;
+    if (record == 0 || (size_t)(end - message) < record || message[record - 1] != '\0') {
+        *cursor = end;
+        return NULL;
+    }
+    *cursor = message + record;
+    *len = record;
+    return message;
+}
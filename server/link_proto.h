@@ -0,0 +1,56 @@
+#ifndef LINK_PROTO_H
+#define LINK_PROTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Binary framing for the socket links between cluster nodes. Messages (the
+// NUL-terminated text frames cluster.c formats) are packed into batches, so
+// one write and one read move many of them:
+//
+//   header   len:u32 seq:u32 type:u16 count:u16     (network byte order)
+//   BATCH    `count` records of len:u16 + bytes, NUL included
+//   ACK      no body; seq = last batch processed, count = window
+//
+// Batches are numbered per link from 1, and a gap means the stream is
+// broken. Flow control is credit based: the receiver acknowledges what it
+// has processed and advertises a window, and the sender never has more
+// than `window` batches beyond the last acknowledged one on the wire.
+
+#define LINK_HEADER_BYTES 12
+#define LINK_BATCH_BYTES 16384     // body limit; a batch is sealed before this
+#define LINK_MAX_FRAME (LINK_HEADER_BYTES + LINK_BATCH_BYTES)
+
+enum {
+    LINK_BATCH = 1,
+    LINK_ACK = 2
+};
+
+typedef struct {
+    uint32_t len;                  // body bytes after the header
+    uint32_t seq;
+    uint16_t type;
+    uint16_t count;
+} LinkHeader;
+
+// Sender side. Messages are formatted in place, like a BusRing frame.
+typedef struct {
+    char data[LINK_MAX_FRAME];
+    size_t len;                    // header space included
+    uint16_t count;
+} LinkBatch;
+
+void link_batch_reset(LinkBatch* batch);
+char* link_batch_reserve(LinkBatch* batch, size_t max_message);
+void link_batch_commit(LinkBatch* batch, char* message, size_t len);
+size_t link_batch_seal(LinkBatch* batch, uint32_t seq);
+void link_ack_encode(char* out, uint32_t seq, uint16_t window);
+
+// Receiver side. link_frame_parse() returns the size of the complete frame
+// at `data`, 0 if more bytes are needed, or -1 if it is malformed.
+// link_batch_next() walks a batch body; each message is NUL-terminated and
+// may be modified in place.
+int link_frame_parse(const char* data, size_t avail, LinkHeader* header);
+char* link_batch_next(char** cursor, char* end, size_t* len);
+
+#endif
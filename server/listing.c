@@ -0,0 +1,218 @@
+#include "server.h"
+
+#include <sched.h>
+
+// /rooms and /who. Both are answered from a Listing: every room's member
+// line and the room list, formatted ahead of time into SharedBuffers. A
+// listing is immutable once published. It is stamped with membership_clock,
+// which add_room_member() and remove_room_member() bump, and which also
+// stamps the room that changed. A request whose line is still current takes
+// a reference to its buffer and queues it (client_send_shared) without
+// taking any lock. For /who that means the room's own stamp has not moved
+// since its line was formatted, however busy other rooms are; /rooms needs
+// the whole listing to be current. Otherwise the request rebuilds the
+// listing under rooms_mutex, but only the member lines of rooms whose stamp
+// moved; the rest are shared with the previous listing.
+//
+// A reader counts itself in listing_readers while it holds the bare pointer.
+// A replaced listing is freed only once that count has been seen at zero
+// after the new one was published, so no reader can still be about to use
+// it.
+//
+// Listings cover this node's rooms only.
+
+typedef struct {
+    char name[MAX_ROOM_NAME_LEN + 1];   // empty: slot not in use
+    uint64_t version;                   // the room's stamp when formatted
+    SharedBuffer* who;
+} ListedRoom;
+
+typedef struct {
+    uint64_t version;           // membership_clock it was built at
+    SharedBuffer* rooms_line;
+    ListedRoom rooms[MAX_ROOMS];    // by rooms[] slot
+} Listing;
+
+static uint64_t membership_clock = 1;
+static Listing* current_listing = NULL;
+static int listing_readers = 0;
+static uint64_t listings_served;
+static uint64_t listings_built;
+static uint64_t lines_reused;
+static uint64_t lines_formatted;
+
+// Caller holds rooms_mutex: the room's members just changed. The stamp is
+// read without the lock by /who.
+void listing_invalidate(Room* room) {
+    __atomic_store_n(&room->version, __atomic_add_fetch(&membership_clock, 1, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+static void listing_free(Listing* listing) {
+    if (listing->rooms_line) shared_buffer_release(listing->rooms_line);
+    for (int i = 0; i < MAX_ROOMS; i++) {
+        if (listing->rooms[i].who) shared_buffer_release(listing->rooms[i].who);
+    }
+    free(listing);
+}
+
+// The rooms[] slot `room_name` was listed under, or -1
+static int listing_slot(const Listing* listing, const char* room_name) {
+    for (int i = 0; i < MAX_ROOMS; i++) {
+        if (listing->rooms[i].who && strcmp(listing->rooms[i].name, room_name) == 0) return i;
+    }
+    return -1;
+}
+
+// The buffer for `room_name`, or the room list for NULL
+static SharedBuffer* listing_find(Listing* listing, const char* room_name) {
+    if (!room_name) return listing->rooms_line;
+    int slot = listing_slot(listing, room_name);
+    return slot == -1 ? NULL : listing->rooms[slot].who;
+}
+
+// Whether `listing` can answer for `room_name` (the room list for NULL) as
+// things are now. A room's line is current while the room's stamp is the
+// one it was formatted at: a slot that was emptied or reused has been
+// stamped since. Anything else, including a room the listing does not
+// have, needs the listing to be current as a whole.
+static int listing_current(const Listing* listing, const char* room_name) {
+    int slot = room_name ? listing_slot(listing, room_name) : -1;
+    if (slot != -1) {
+        return listing->rooms[slot].version == __atomic_load_n(&rooms[slot].version, __ATOMIC_SEQ_CST);
+    }
+    return listing->version == __atomic_load_n(&membership_clock, __ATOMIC_SEQ_CST);
+}
+
+// Caller holds rooms_mutex.
+static SharedBuffer* format_who(Room* room) {
+    char line[BUFFER_SIZE];
+    int pos = snprintf(line, sizeof(line), "[WHO] %s (%d):", room->name, room->member_count);
+    for (int j = 0; j < room->member_count && pos < (int)sizeof(line) - MAX_USERNAME_LEN - 3; j++) {
+        pos += snprintf(line + pos, sizeof(line) - pos, " %s", room->members[j]->username);
+    }
+    pos += snprintf(line + pos, sizeof(line) - pos, "\n");
+    return shared_buffer_create(line, pos);
+}
+
+// Caller holds rooms_mutex and has checked the current listing is stale.
+static Listing* listing_build(const Listing* old) {
+    Listing* listing = calloc(1, sizeof(Listing));
+    if (!listing) return NULL;
+    listing->version = __atomic_load_n(&membership_clock, __ATOMIC_SEQ_CST);
+
+    char line[BUFFER_SIZE];
+    int count = 0;
+    int pos = snprintf(line, sizeof(line), "[ROOMS]");
+    for (int i = 0; i < MAX_ROOMS; i++) {
+        Room* room = &rooms[i];
+        if (!room->active || room->member_count == 0) continue;
+        ListedRoom* entry = &listing->rooms[i];
+        strcpy(entry->name, room->name);
+        entry->version = room->version;
+        const ListedRoom* before = old ? &old->rooms[i] : NULL;
+        if (before && before->who && before->version == room->version && strcmp(before->name, room->name) == 0) {
+            __atomic_add_fetch(&before->who->refs, 1, __ATOMIC_RELAXED);
+            entry->who = before->who;
+            lines_reused++;
+        } else {
+            entry->who = format_who(room);
+            lines_formatted++;
+        }
+        if (pos < (int)sizeof(line) - MAX_ROOM_NAME_LEN - 16) {
+            pos += snprintf(line + pos, sizeof(line) - pos, "%s %s (%d)", count ? "," : "", room->name, room->member_count);
+        }
+        count++;
+    }
+    if (count == 0) pos += snprintf(line + pos, sizeof(line) - pos, " none");
+    pos += snprintf(line + pos, sizeof(line) - pos, "\n");
+    listing->rooms_line = shared_buffer_create(line, pos);
+    listings_built++;
+    return listing;
+}
+
+// Returns a reference to the buffer for `room_name` (the room list for
+// NULL), or NULL if there is no such room. Lock-free while nothing changed.
+static SharedBuffer* listing_fetch(const char* room_name) {
+    SharedBuffer* buffer = NULL;
+    __atomic_add_fetch(&listing_readers, 1, __ATOMIC_SEQ_CST);
+    Listing* listing = __atomic_load_n(&current_listing, __ATOMIC_SEQ_CST);
+    int fresh = listing && listing_current(listing, room_name);
+    if (fresh) {
+        buffer = listing_find(listing, room_name);
+        if (buffer) __atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_sub_fetch(&listing_readers, 1, __ATOMIC_SEQ_CST);
+    if (fresh) {
+        __atomic_fetch_add(&listings_served, 1, __ATOMIC_RELAXED);
+        return buffer;
+    }
+
+    // Stale: rebuild, unless another request did while this one waited
+    Listing* old = NULL;
+    pthread_mutex_lock(&rooms_mutex);
+    listing = current_listing;
+    if (!listing || !listing_current(listing, room_name)) {
+        Listing* built = listing_build(listing);
+        if (built) {
+            old = listing;
+            __atomic_store_n(&current_listing, built, __ATOMIC_SEQ_CST);
+            listing = built;
+        }
+    }
+    if (listing) {
+        buffer = listing_find(listing, room_name);
+        if (buffer) __atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&rooms_mutex);
+
+    // Readers that came after the store see the new listing; wait out any
+    // that may still hold the old one
+    if (old) {
+        while (__atomic_load_n(&listing_readers, __ATOMIC_SEQ_CST) != 0) {
+            sched_yield();
+        }
+        listing_free(old);
+    }
+    return buffer;
+}
+
+// "/who" lists the current room's members, "/who <room>" another's.
+void handle_who(Client* client, const char* arg) {
+    char room_name[MAX_ROOM_NAME_LEN + 1];
+    snprintf(room_name, sizeof(room_name), "%s", arg[0] ? arg : client->current_room);
+    if (room_name[0] == '\0') {
+        client_send(client, "[ERROR] You are not in any room.\n");
+        return;
+    }
+    SharedBuffer* buffer = validate_room_name(room_name) ? listing_fetch(room_name) : NULL;
+    if (!buffer) {
+        char reply[96];
+        snprintf(reply, sizeof(reply), "[ERROR] No room named '%s'.\n", room_name);
+        client_send(client, reply);
+        return;
+    }
+    client_send_shared(client, buffer);
+    shared_buffer_release(buffer);
+}
+
+// "/rooms": every room with members on this node, and how many.
+void handle_rooms(Client* client) {
+    SharedBuffer* buffer = listing_fetch(NULL);
+    if (!buffer) {
+        client_send(client, "[ERROR] Room list unavailable.\n");
+        return;
+    }
+    client_send_shared(client, buffer);
+    shared_buffer_release(buffer);
+}
+
+void listing_format_stats(char* line, size_t size) {
+    pthread_mutex_lock(&rooms_mutex);
+    uint64_t built = listings_built;
+    uint64_t reused = lines_reused;
+    uint64_t formatted = lines_formatted;
+    pthread_mutex_unlock(&rooms_mutex);
+    snprintf(line, size, "[STATS] listings: %llu served from cache, %llu rebuilt (%llu room lines reused, %llu formatted)\n",
+        (unsigned long long)__atomic_load_n(&listings_served, __ATOMIC_RELAXED), (unsigned long long)built,
+        (unsigned long long)reused, (unsigned long long)formatted);
+}
@@ -0,0 +1,173 @@
+#include "server.h"
+
+// Moderation filter (--filter <file>): /broadcast and /whisper text that
+// contains any phrase from the file is refused. The phrases are compiled
+// into one automaton (filter.h), so checking a message costs the same
+// however long the list is.
+//
+// SIGHUP reloads the file without pausing the main loop: a helper thread
+// reads and compiles it while messages are still checked against the old
+// automaton, and hands the result back through reload_fd for the loop to
+// swap in. Checkers take no lock. They count themselves in filter_readers
+// while they use the automaton, and the old one is freed by a timer once
+// that count has been seen at zero after the swap (as for the cached
+// listings). One reload runs at a time, from compile to free; a SIGHUP
+// meanwhile reloads once more afterwards. A file that fails to load leaves
+// the current filter in place.
+
+#define FILTER_RETIRE_MS TIMER_TICK_MS
+
+static FilterAutomaton* active_filter = NULL;
+static int filter_readers = 0;
+static uint64_t messages_checked;
+static uint64_t messages_blocked;
+static uint64_t bytes_checked;
+static uint64_t check_ns;
+static int filter_reloads;
+
+// Reload state; main loop only, except what the helper hands back
+static int reload_fd = -1;
+static EventSource reload_source = { SOURCE_FILTER_RELOADED };
+static int reload_running;
+static int reload_again;
+static FilterAutomaton* reloaded_filter;    // written by the helper before it signals reload_fd
+static uint64_t reload_us;
+static FilterAutomaton* retired_filter;
+static Timer retire_timer;
+
+static void log_filter(const FilterAutomaton* filter, const char* path, uint64_t us) {
+    log_message("[FILTER] %u phrases from %s (%u states, %zu KB) in %llu us", filter->phrase_count, path,
+        filter->state_count, filter_memory(filter) / 1024, (unsigned long long)us);
+}
+
+// At startup, before any message is checked. Returns -1 if the file could
+// not be read or compiled, or the reload event could not be set up.
+int moderation_load(const char* path) {
+    uint64_t start = now_us();
+    FilterAutomaton* filter = filter_load(path);
+    if (!filter) {
+        log_message("[FILTER] Could not load %s", path);
+        fprintf(stderr, "[FILTER] Could not load %s\n", path);
+        return -1;
+    }
+    reload_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (reload_fd == -1) {
+        perror("eventfd failed");
+        filter_free(filter);
+        return -1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &reload_source;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, reload_fd, &ev);
+
+    __atomic_store_n(&active_filter, filter, __ATOMIC_SEQ_CST);
+    log_filter(filter, path, now_us() - start);
+    return 0;
+}
+
+static void* reload_worker(void* arg) {
+    const char* path = arg;
+    uint64_t start = now_us();
+    FilterAutomaton* filter = filter_load(path);
+    reload_us = now_us() - start;
+    __atomic_store_n(&reloaded_filter, filter, __ATOMIC_RELEASE);
+    eventfd_write(reload_fd, 1);
+    return NULL;
+}
+
+// Main loop, on SIGHUP.
+void moderation_reload(void) {
+    if (reload_fd == -1) return;
+    if (reload_running) {
+        reload_again = 1;
+        return;
+    }
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, reload_worker, (void*)config.filter_path) != 0) {
+        log_message("[FILTER] Could not start a reload of %s", config.filter_path);
+    } else {
+        reload_running = 1;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// The reload is over once nothing can still be reading the old automaton.
+static void finish_reload(void) {
+    reload_running = 0;
+    if (reload_again) {
+        reload_again = 0;
+        moderation_reload();
+    }
+}
+
+// Timer callback on the main loop (timers_mutex held).
+static void retire_timer_expired(Timer* timer, void* arg) {
+    (void)arg;
+    if (__atomic_load_n(&filter_readers, __ATOMIC_SEQ_CST) != 0) {
+        timer_arm(&timer_wheel, timer, FILTER_RETIRE_MS, now_ms());
+        return;
+    }
+    filter_free(retired_filter);
+    retired_filter = NULL;
+    finish_reload();
+}
+
+// Main loop: the helper thread is done with the file.
+void moderation_handle_reload(void) {
+    eventfd_t value;
+    eventfd_read(reload_fd, &value);
+    FilterAutomaton* filter = __atomic_exchange_n(&reloaded_filter, NULL, __ATOMIC_ACQUIRE);
+    if (!filter) {
+        log_message("[FILTER] Could not load %s; keeping the current filter", config.filter_path);
+        fprintf(stderr, "[FILTER] Could not load %s\n", config.filter_path);
+        finish_reload();
+        return;
+    }
+
+    retired_filter = __atomic_exchange_n(&active_filter, filter, __ATOMIC_SEQ_CST);
+    filter_reloads++;
+    log_filter(filter, config.filter_path, reload_us);
+    pthread_mutex_lock(&timers_mutex);
+    timer_init(&retire_timer, retire_timer_expired, NULL);
+    timer_arm(&timer_wheel, &retire_timer, FILTER_RETIRE_MS, now_ms());
+    pthread_mutex_unlock(&timers_mutex);
+}
+
+// Returns 1 if the text contains a banned phrase.
+int moderation_blocks(const char* text) {
+    if (!__atomic_load_n(&active_filter, __ATOMIC_RELAXED)) return 0;
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    size_t len = strlen(text);
+    __atomic_add_fetch(&filter_readers, 1, __ATOMIC_SEQ_CST);
+    FilterAutomaton* filter = __atomic_load_n(&active_filter, __ATOMIC_SEQ_CST);
+    int blocked = filter && filter_match(filter, text, len);
+    __atomic_sub_fetch(&filter_readers, 1, __ATOMIC_SEQ_CST);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    __atomic_fetch_add(&messages_checked, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&bytes_checked, len, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&check_ns, (uint64_t)(end.tv_sec - begin.tv_sec) * 1000000000ULL + end.tv_nsec - begin.tv_nsec,
+        __ATOMIC_RELAXED);
+    if (blocked) __atomic_fetch_add(&messages_blocked, 1, __ATOMIC_RELAXED);
+    return blocked;
+}
+
+void moderation_format_stats(char* line, size_t size) {
+    uint64_t checked = __atomic_load_n(&messages_checked, __ATOMIC_RELAXED);
+    uint64_t bytes = __atomic_load_n(&bytes_checked, __ATOMIC_RELAXED);
+    uint64_t ns = __atomic_load_n(&check_ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&filter_readers, 1, __ATOMIC_SEQ_CST);
+    FilterAutomaton* filter = __atomic_load_n(&active_filter, __ATOMIC_SEQ_CST);
+    unsigned phrases = filter ? filter->phrase_count : 0;
+    unsigned states = filter ? filter->state_count : 0;
+    __atomic_sub_fetch(&filter_readers, 1, __ATOMIC_SEQ_CST);
+    snprintf(line, size, "[STATS] filter: %u phrases (%u states), %llu messages checked, %llu blocked, %.0f ns/message (%.0f MB/s), %d reloads\n",
+        phrases, states, (unsigned long long)checked,
+        (unsigned long long)__atomic_load_n(&messages_blocked, __ATOMIC_RELAXED),
+        checked ? (double)ns / checked : 0.0, ns ? bytes * 1000.0 / ns : 0.0, filter_reloads);
+}
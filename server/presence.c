@@ -0,0 +1,236 @@
+#include "server.h"
+
+#include <sys/timerfd.h>
+
+// Presence (/presence): who joined and left a room, and who is typing.
+// Sending one line per change would multiply each join, leave and keystroke
+// by the room size. Instead, changes are collected per room for one window
+// (--presence-window). When it closes, each subscribed member gets one line
+// per room that changed:
+//
+//   [PRESENCE] <room> +alice -bob ~carol      joined, left, typing
+//   [PRESENCE] <room> = alice bob carol       everyone, on /presence or joining
+//
+// A user who joins and leaves within one window cancels out, as does a
+// session that drops and resumes. Each room's line holds at most
+// PRESENCE_MAX_CHANGES names; the rest are counted ("+3 more"). /typing is
+// taken from a client at most once per PRESENCE_TYPING_INTERVAL_MS. So a
+// subscriber gets at most one bounded line per room per window, however
+// fast the room churns.
+//
+// Presence covers this node's sessions only. Changes on other cluster
+// nodes are not relayed.
+
+typedef struct {
+    char username[MAX_USERNAME_LEN + 1];
+    int was_member;             // before its first change in this window
+    int is_member;
+    int typing;
+} PresenceChange;
+
+typedef struct {
+    char room[MAX_ROOM_NAME_LEN + 1];
+    int count;
+    int dropped;                // changes past PRESENCE_MAX_CHANGES
+    PresenceChange changes[PRESENCE_MAX_CHANGES];
+} PresenceRoom;
+
+EventSource presence_source = { SOURCE_PRESENCE_FLUSH };
+
+static pthread_mutex_t presence_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PresenceRoom pending[MAX_ROOMS];
+static int pending_rooms = 0;
+static PresenceRoom flushing[MAX_ROOMS];  // main loop only
+static int presence_fd = -1;
+static int presence_armed = 0;
+static uint64_t changes_noted;
+static uint64_t typing_capped;
+static uint64_t lines_sent;
+
+int presence_start(void) {
+    presence_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (presence_fd == -1) {
+        perror("timerfd_create failed");
+        return -1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &presence_source;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, presence_fd, &ev);
+    return 0;
+}
+
+// Caller holds presence_mutex. The first change opens the window.
+static void arm_presence_flush(void) {
+    if (presence_armed || presence_fd == -1) return;
+    presence_armed = 1;
+    struct itimerspec when;
+    memset(&when, 0, sizeof(when));
+    when.it_value.tv_sec = config.presence_window_ms / 1000;
+    when.it_value.tv_nsec = (long)(config.presence_window_ms % 1000) * 1000000;
+    timerfd_settime(presence_fd, 0, &when, NULL);
+}
+
+// Caller holds presence_mutex. NULL once the room's list is full.
+static PresenceChange* find_change(const char* room_name, const char* username, int was_member) {
+    PresenceRoom* room = NULL;
+    for (int i = 0; i < pending_rooms && !room; i++) {
+        if (strcmp(pending[i].room, room_name) == 0) room = &pending[i];
+    }
+    if (!room) {
+        if (pending_rooms == MAX_ROOMS) return NULL;
+        room = &pending[pending_rooms++];
+        strcpy(room->room, room_name);
+        room->count = 0;
+        room->dropped = 0;
+    }
+    for (int i = 0; i < room->count; i++) {
+        if (strcmp(room->changes[i].username, username) == 0) return &room->changes[i];
+    }
+    if (room->count == PRESENCE_MAX_CHANGES) {
+        room->dropped++;
+        return NULL;
+    }
+    PresenceChange* change = &room->changes[room->count++];
+    strcpy(change->username, username);
+    change->was_member = was_member;
+    change->is_member = was_member;
+    change->typing = 0;
+    return change;
+}
+
+// A user joined (or left) a room on this node.
+void presence_note(const char* room_name, const char* username, int joined) {
+    pthread_mutex_lock(&presence_mutex);
+    PresenceChange* change = find_change(room_name, username, !joined);
+    if (change) {
+        change->is_member = joined;
+        if (!joined) change->typing = 0;
+    }
+    changes_noted++;
+    arm_presence_flush();
+    pthread_mutex_unlock(&presence_mutex);
+}
+
+// /typing: the user is writing in their current room. No reply; a client
+// sending it faster than PRESENCE_TYPING_INTERVAL_MS is not heard.
+void handle_typing(Client* client) {
+    if (client->current_room[0] == '\0') return;
+    uint64_t now = now_ms();
+    if (client->last_typing_ms && now - client->last_typing_ms < PRESENCE_TYPING_INTERVAL_MS) {
+        __atomic_fetch_add(&typing_capped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    client->last_typing_ms = now;
+    pthread_mutex_lock(&presence_mutex);
+    PresenceChange* change = find_change(client->current_room, client->username, 1);
+    if (change && change->is_member) change->typing = 1;
+    changes_noted++;
+    arm_presence_flush();
+    pthread_mutex_unlock(&presence_mutex);
+}
+
+// Caller holds rooms_mutex. "[PRESENCE] <room> = <everyone>" to one client.
+static void send_room_members(Client* client, Room* room) {
+    char line[BUFFER_SIZE];
+    int pos = snprintf(line, sizeof(line), "[PRESENCE] %s =", room->name);
+    for (int j = 0; j < room->member_count && pos < (int)sizeof(line) - MAX_USERNAME_LEN - 3; j++) {
+        pos += snprintf(line + pos, sizeof(line) - pos, " %s", room->members[j]->username);
+    }
+    snprintf(line + pos, sizeof(line) - pos, "\n");
+    client_send(client, line);
+}
+
+// "/presence" subscribes, "/presence off" stops. On subscribing, the client
+// gets the members of each of its rooms to apply later changes to.
+void handle_presence(Client* client, const char* arg) {
+    if (strcmp(arg, "off") == 0) {
+        client->presence = 0;
+        client_send(client, "[PRESENCE] Updates off\n");
+        return;
+    }
+    char reply[128];
+    snprintf(reply, sizeof(reply), "[PRESENCE] Updates on, every %d ms\n", config.presence_window_ms);
+    client_send(client, reply);
+    pthread_mutex_lock(&rooms_mutex);
+    client->presence = 1;
+    for (uint64_t mask = client->room_mask; mask; mask &= mask - 1) {
+        send_room_members(client, &rooms[__builtin_ctzll(mask)]);
+    }
+    pthread_mutex_unlock(&rooms_mutex);
+}
+
+// A subscriber joined a room: its starting point there.
+void presence_joined_room(Client* client, const char* room_name) {
+    if (!client->presence) return;
+    pthread_mutex_lock(&rooms_mutex);
+    Room* room = find_room(room_name);
+    if (room) send_room_members(client, room);
+    pthread_mutex_unlock(&rooms_mutex);
+}
+
+// Formats one room's diff; returns 0 if nothing changed on balance.
+static int format_diff(const PresenceRoom* room, char* line, size_t size) {
+    int pos = snprintf(line, size, "[PRESENCE] %s", room->room);
+    int reported = 0;
+    for (int i = 0; i < room->count; i++) {
+        const PresenceChange* change = &room->changes[i];
+        char mark = 0;
+        if (change->is_member != change->was_member) {
+            mark = change->is_member ? '+' : '-';
+        } else if (change->typing) {
+            mark = '~';
+        }
+        if (!mark) continue;
+        pos += snprintf(line + pos, size - pos, " %c%s", mark, change->username);
+        reported++;
+    }
+    if (room->dropped > 0) {
+        pos += snprintf(line + pos, size - pos, " +%d more", room->dropped);
+        reported++;
+    }
+    snprintf(line + pos, size - pos, "\n");
+    return reported;
+}
+
+// Main loop: the window closed. The changes are taken out under
+// presence_mutex, then sent under rooms_mutex, so the two are never held
+// together here. presence_note() and handle_typing() take presence_mutex
+// on its own too; their callers have released rooms_mutex by then, so no
+// order between the two locks is relied on anywhere.
+void presence_flush(void) {
+    uint64_t expirations;
+    if (read(presence_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) return;
+
+    pthread_mutex_lock(&presence_mutex);
+    int count = pending_rooms;
+    memcpy(flushing, pending, sizeof(PresenceRoom) * count);
+    pending_rooms = 0;
+    presence_armed = 0;
+    pthread_mutex_unlock(&presence_mutex);
+
+    uint64_t sent = 0;
+    for (int i = 0; i < count; i++) {
+        char line[BUFFER_SIZE];
+        if (!format_diff(&flushing[i], line, sizeof(line))) continue;
+        pthread_mutex_lock(&rooms_mutex);
+        Room* room = find_room(flushing[i].room);
+        for (int j = 0; room && j < room->member_count; j++) {
+            if (room->members[j]->presence) {
+                client_send(room->members[j], line);
+                sent++;
+            }
+        }
+        pthread_mutex_unlock(&rooms_mutex);
+    }
+    __atomic_fetch_add(&lines_sent, sent, __ATOMIC_RELAXED);
+}
+
+void presence_format_stats(char* line, size_t size) {
+    pthread_mutex_lock(&presence_mutex);
+    uint64_t noted = changes_noted;
+    pthread_mutex_unlock(&presence_mutex);
+    snprintf(line, size, "[STATS] presence: %llu changes sent as %llu lines, %llu typing updates over the rate cap\n",
+        (unsigned long long)noted, (unsigned long long)__atomic_load_n(&lines_sent, __ATOMIC_RELAXED),
+        (unsigned long long)__atomic_load_n(&typing_capped, __ATOMIC_RELAXED));
+}
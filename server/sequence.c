@@ -0,0 +1,324 @@
+#include "server.h"
+
+// Sequenced delivery. Every room broadcast gets the next number of its room.
+// A client that sends /sequenced sees the numbers, "[room #n] sender: text",
+// and acknowledges what it has read in each room with a cumulative
+// "/ack <room> <n>" now and then ("/ack <n>" for its current room);
+// chatclient --sequenced sends one per SEQ_ACK_EVERY lines or after a short
+// pause. The room keeps the numbered lines until every sequenced reader has
+// acknowledged them, up to SEQ_RETAIN_BYTES. A sequenced session that drops
+// keeps its place for SEQ_RESUME_GRACE_MS, and "/resume <room> <n>" brings
+// it back with everything after n that is still retained. A session holding
+// a resumption token (session.c) keeps its place the same way, from the last
+// line it had queued, and gets the lines without numbers when it reconnects.
+//
+// An ACK only records a number and gets no reply. Released lines are freed
+// when the next broadcast is appended, so acknowledging costs one short
+// command per batch of lines, not a write per message.
+//
+// Numbers are per node: in cluster mode each node numbers the broadcasts it
+// delivers to its own members.
+
+typedef struct {
+    char username[MAX_USERNAME_LEN + 1];
+    char room[MAX_ROOM_NAME_LEN + 1];
+    uint64_t acked;
+    uint64_t expires_ms;
+    int active;
+} SeqResume;
+
+// All guarded by rooms_mutex
+static SeqResume resume_slots[SEQ_RESUME_SLOTS];
+static uint64_t retained_lines;
+static uint64_t unacked_dropped;
+static uint64_t acks_received;
+
+// Lowest ACK among the room's sequenced readers, present or recently
+// dropped. Returns 0 readers through `readers` when nobody needs the lines.
+static uint64_t ack_floor(Room* room, int* readers) {
+    uint64_t floor = room->seq;
+    *readers = 0;
+    int index = room - rooms;
+    for (int i = 0; i < room->member_count; i++) {
+        Client* member = room->members[i];
+        if (member->sequenced) {
+            if (member->acked_seq[index] < floor) floor = member->acked_seq[index];
+            (*readers)++;
+        }
+    }
+    uint64_t now = now_ms();
+    for (int i = 0; i < SEQ_RESUME_SLOTS; i++) {
+        SeqResume* slot = &resume_slots[i];
+        if (!slot->active) continue;
+        if (now >= slot->expires_ms) {
+            slot->active = 0;
+            continue;
+        }
+        if (strcmp(slot->room, room->name) == 0) {
+            if (slot->acked < floor) floor = slot->acked;
+            (*readers)++;
+        }
+    }
+    return floor;
+}
+
+static void drop_oldest(Room* room) {
+    RetainedLine* line = room->retained_head;
+    room->retained_head = line->next;
+    if (!room->retained_head) room->retained_tail = NULL;
+    room->retained_bytes -= line->len;
+    retained_lines--;
+    free(line);
+}
+
+// Caller holds rooms_mutex. Numbers the broadcast, formats the line its
+// sequenced members get into `line`, and keeps a copy if anyone may still
+// need it.
+void seq_append(Room* room, const char* sender, const char* message, char* line, size_t size) {
+    uint64_t seq = ++room->seq;
+    int len = snprintf(line, size, "[%s #%llu] %s: %s\n", room->name, (unsigned long long)seq, sender, message);
+    if (len < 0) return;
+    if ((size_t)len >= size) len = size - 1;
+
+    int readers;
+    uint64_t floor = ack_floor(room, &readers);
+    while (room->retained_head && (readers == 0 || room->retained_head->seq <= floor)) {
+        drop_oldest(room);
+    }
+    if (readers == 0) return;
+
+    RetainedLine* kept = malloc(sizeof(RetainedLine) + len);
+    if (!kept) return;
+    kept->next = NULL;
+    kept->seq = seq;
+    kept->len = len;
+    memcpy(kept->data, line, len);
+    if (room->retained_tail) {
+        room->retained_tail->next = kept;
+    } else {
+        room->retained_head = kept;
+    }
+    room->retained_tail = kept;
+    room->retained_bytes += len;
+    retained_lines++;
+
+    // Bounded: a reader that never acknowledges loses the oldest lines
+    while (room->retained_bytes > SEQ_RETAIN_BYTES) {
+        drop_oldest(room);
+        unacked_dropped++;
+    }
+}
+
+// Caller holds rooms_mutex. A slot about to serve another room name starts
+// over.
+void seq_room_reset(Room* room) {
+    while (room->retained_head) {
+        drop_oldest(room);
+    }
+    room->seq = 0;
+}
+
+// "[room #n] sender: text" as a plain member gets it: "[room] sender: text".
+// Room names are alphanumeric, so the first '#' is the number's.
+static void send_unnumbered(Client* client, const RetainedLine* line) {
+    const char* mark = memchr(line->data, '#', line->len);
+    const char* close = mark ? memchr(mark, ']', line->len - (mark - line->data)) : NULL;
+    if (!close || mark == line->data) {
+        client_send_bytes(client, line->data, line->len);
+        return;
+    }
+    char plain[BUFFER_SIZE];
+    size_t head = mark - 1 - line->data;
+    size_t tail = line->len - (close - line->data);
+    memcpy(plain, line->data, head);
+    memcpy(plain + head, close, tail);
+    client_send_bytes(client, plain, head + tail);
+}
+
+// Caller holds rooms_mutex; `client` was just added to `room`. A plain join
+// starts from the room's current number, which the client is told. A resume
+// first sends what was retained after the client's last ACK, so nothing
+// broadcast meanwhile can overtake it.
+void seq_member_joined(Client* client, Room* room) {
+    char notice[256];
+    int index = room - rooms;
+    if (!client->resuming) {
+        client->acked_seq[index] = room->seq;
+        snprintf(notice, sizeof(notice), "[SEQ] '%s' is at #%llu\n", room->name, (unsigned long long)room->seq);
+        client_send(client, notice);
+        return;
+    }
+    client->resuming = 0;
+
+    uint64_t from = client->resume_from;
+    client->acked_seq[index] = from;
+    if (from > room->seq) {
+        // The room was emptied and recreated since; its numbers started over
+        snprintf(notice, sizeof(notice), "[SEQ] Room '%s' restarted at #%llu\n",
+            room->name, (unsigned long long)room->seq);
+        client_send(client, notice);
+        client->acked_seq[index] = room->seq;
+        return;
+    }
+    uint64_t first = room->retained_head ? room->retained_head->seq : room->seq + 1;
+    if (first > from + 1) {
+        snprintf(notice, sizeof(notice), "[SEQ] Messages #%llu-#%llu in '%s' are no longer retained\n",
+            (unsigned long long)(from + 1), (unsigned long long)(first - 1), room->name);
+        client_send(client, notice);
+    }
+    snprintf(notice, sizeof(notice), "[SEQ] Resuming '%s' after #%llu\n", room->name, (unsigned long long)from);
+    client_send(client, notice);
+    for (RetainedLine* line = room->retained_head; line; line = line->next) {
+        if (line->seq <= from) continue;
+        if (client->sequenced) {
+            client_send_bytes(client, line->data, line->len);
+        } else {
+            send_unnumbered(client, line);
+        }
+    }
+}
+
+// Keeps a dropped session's place in `room` so the room retains what it
+// has not read: a sequenced reader's last ACK, or for a resumable plain
+// session the last line it was sent. Called from leave_all_rooms() for
+// each room before the session leaves it.
+void seq_remember(Client* client, Room* room) {
+    if ((!client->sequenced && client->session_token[0] == '\0') || client->username[0] == '\0') return;
+    pthread_mutex_lock(&rooms_mutex);
+    uint64_t acked = client->sequenced ? client->acked_seq[room - rooms] : room->seq;
+    SeqResume* slot = NULL;
+    for (int i = 0; i < SEQ_RESUME_SLOTS && !slot; i++) {
+        if (!resume_slots[i].active || (strcmp(resume_slots[i].username, client->username) == 0 &&
+                                        strcmp(resume_slots[i].room, room->name) == 0)) {
+            slot = &resume_slots[i];
+        }
+    }
+    // Full: the place closest to expiring goes
+    if (!slot) {
+        slot = &resume_slots[0];
+        for (int i = 1; i < SEQ_RESUME_SLOTS; i++) {
+            if (resume_slots[i].expires_ms < slot->expires_ms) slot = &resume_slots[i];
+        }
+    }
+    snprintf(slot->username, sizeof(slot->username), "%s", client->username);
+    snprintf(slot->room, sizeof(slot->room), "%s", room->name);
+    slot->acked = acked;
+    slot->expires_ms = now_ms() + SEQ_RESUME_GRACE_MS;
+    slot->active = 1;
+    pthread_mutex_unlock(&rooms_mutex);
+}
+
+// Turns numbering on for every room the client is in, telling it where
+// each one is.
+void handle_sequenced(Client* client) {
+    char reply[128];
+    client_send(client, "[SEQ] Sequenced delivery on\n");
+    pthread_mutex_lock(&rooms_mutex);
+    client->sequenced = 1;
+    for (uint64_t mask = client->room_mask; mask; mask &= mask - 1) {
+        Room* room = &rooms[__builtin_ctzll(mask)];
+        client->acked_seq[room - rooms] = room->seq;
+        snprintf(reply, sizeof(reply), "[SEQ] '%s' is at #%llu\n", room->name, (unsigned long long)room->seq);
+        client_send(client, reply);
+    }
+    pthread_mutex_unlock(&rooms_mutex);
+}
+
+// "/ack <room> <n>", or "/ack <n>" for the current room: everything up to n
+// there has been read. Stale or out-of-range numbers are ignored; there is
+// no reply either way.
+void handle_ack(Client* client, char* arg) {
+    const char* room_name = client->current_room;
+    char* number = strchr(arg, ' ');
+    if (number) {
+        *number++ = '\0';
+        room_name = arg;
+    } else {
+        number = arg;
+    }
+    char* end;
+    unsigned long long seq = strtoull(number, &end, 10);
+    if (!client->sequenced || end == number) {
+        client_send(client, "[ERROR] Usage: /ack [room] <n> (after /sequenced)\n");
+        return;
+    }
+    pthread_mutex_lock(&rooms_mutex);
+    Room* room = find_room(room_name);
+    if (room && (client->room_mask & (1ULL << (room - rooms)))) {
+        uint64_t* acked = &client->acked_seq[room - rooms];
+        if (seq > *acked && seq <= room->seq) *acked = seq;
+    }
+    acks_received++;
+    pthread_mutex_unlock(&rooms_mutex);
+}
+
+void handle_resume(Client* client, const char* room_name, uint64_t seq) {
+    if (!validate_room_name(room_name)) {
+        client_send(client, "[ERROR] Invalid room name. Use alphanumeric characters only.\n");
+        return;
+    }
+    // Already in it: rejoining is what replays
+    pthread_mutex_lock(&rooms_mutex);
+    Room* room = find_room(room_name);
+    int member = room && (client->room_mask & (1ULL << (room - rooms)));
+    pthread_mutex_unlock(&rooms_mutex);
+    if (member) {
+        handle_leave_room(client, room_name);
+    }
+
+    client->sequenced = 1;
+    int result = seq_rejoin(client, room_name, seq);
+    if (result != 0) {
+        client_send(client, result == -2 ? "[ERROR] Room is full.\n" : "[ERROR] Unable to join room.\n");
+        return;
+    }
+    log_message("[JOIN] user '%s' resumed room '%s' after #%llu", client->username, room_name, (unsigned long long)seq);
+}
+
+// Joins `room_name` and replays what is retained after `seq`, giving up the
+// place the user's dropped session kept. For /resume, and for a session back
+// through /reconnect. Returns add_room_member()'s result.
+int seq_rejoin(Client* client, const char* room_name, uint64_t seq) {
+    pthread_mutex_lock(&rooms_mutex);
+    for (int i = 0; i < SEQ_RESUME_SLOTS; i++) {
+        if (resume_slots[i].active && strcmp(resume_slots[i].username, client->username) == 0 &&
+            strcmp(resume_slots[i].room, room_name) == 0) {
+            resume_slots[i].active = 0;
+        }
+    }
+    client->resuming = 1;
+    client->resume_from = seq;
+    pthread_mutex_unlock(&rooms_mutex);
+
+    int result = add_room_member(client, room_name, 0);
+    client->resuming = 0;
+    return result;
+}
+
+// Hot restart: the successor's room starts at the predecessor's number so
+// the session's next line there continues where it left off.
+void seq_adopt(Client* client, const char* room_name, uint64_t acked, uint64_t room_seq) {
+    pthread_mutex_lock(&rooms_mutex);
+    Room* room = find_room(room_name);
+    if (room) {
+        if (room->seq < room_seq) room->seq = room_seq;
+        client->acked_seq[room - rooms] = acked;
+    }
+    pthread_mutex_unlock(&rooms_mutex);
+}
+
+void seq_format_stats(char* line, size_t size) {
+    int readers = 0;
+    size_t bytes = 0;
+    pthread_mutex_lock(&rooms_mutex);
+    for (int i = 0; i < MAX_ROOMS; i++) {
+        bytes += rooms[i].retained_bytes;
+        for (int j = 0; j < rooms[i].member_count; j++) {
+            if (rooms[i].members[j]->sequenced) readers++;
+        }
+    }
+    snprintf(line, size, "[STATS] sequenced: %d readers, %llu lines retained (%zu bytes), %llu acks, %llu dropped unacked\n",
+        readers, (unsigned long long)retained_lines, bytes, (unsigned long long)acks_received,
+        (unsigned long long)unacked_dropped);
+    pthread_mutex_unlock(&rooms_mutex);
+}
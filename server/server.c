@@ -1,102 +1,78 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <pthread.h>
-#include <semaphore.h>
-#include <signal.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <time.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <errno.h>
-#include <stdarg.h>
-
-#define MAX_CLIENTS 15
-#define MAX_ROOMS 10
-#define MAX_USERNAME_LEN 16
-#define MAX_ROOM_NAME_LEN 32
-#define MAX_MESSAGE_LEN 1024
-#define MAX_FILE_SIZE 3145728  // 3MB
-#define MAX_UPLOAD_QUEUE 5
-#define BUFFER_SIZE 4096
-
-// Structures
-typedef struct {
-    int socket;
-    char username[MAX_USERNAME_LEN + 1];
-    char current_room[MAX_ROOM_NAME_LEN + 1];
-    struct sockaddr_in addr;
-    int active;
-} Client;
-
-typedef struct {
-    char name[MAX_ROOM_NAME_LEN + 1];
-    Client* members[MAX_CLIENTS];
-    int member_count;
-    int active;
-} Room;
-
-typedef struct {
-    char filename[256];
-    char sender[MAX_USERNAME_LEN + 1];
-    char receiver[MAX_USERNAME_LEN + 1];
-    size_t file_size;
-    char* file_data;
-    time_t timestamp;
-} FileTransfer;
+#include "server.h"
 
-typedef struct {
-    FileTransfer queue[MAX_UPLOAD_QUEUE];
-    int front, rear, count;
-    pthread_mutex_t mutex;
-    sem_t slots;
-    sem_t items;
-} UploadQueue;
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
 
 // Global variables
-Client clients[MAX_CLIENTS];
+Client clients[MAX_SESSIONS];
 Room rooms[MAX_ROOMS];
 UploadQueue upload_queue;
 pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t clients_unpinned = PTHREAD_COND_INITIALIZER;
 pthread_mutex_t rooms_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t timers_mutex = PTHREAD_MUTEX_INITIALIZER;
+TimerWheel timer_wheel;
+FanoutPool fanout_pool;
+ServerConfig config = {
+    .login_timeout_ms = DEFAULT_LOGIN_TIMEOUT_MS,
+    .max_login_attempts = DEFAULT_LOGIN_ATTEMPTS,
+    .max_pending_logins = DEFAULT_MAX_PENDING,
+    .idle_timeout_ms = DEFAULT_IDLE_TIMEOUT_MS,
+    .heartbeat_interval_ms = DEFAULT_HEARTBEAT_MS,
+    .drain_timeout_ms = DEFAULT_DRAIN_TIMEOUT_MS,
+    .snapshot_interval_ms = DEFAULT_SNAPSHOT_INTERVAL_MS,
+    .cluster_size = 1,
+    .cluster_dir = DEFAULT_CLUSTER_DIR,
+    .cluster_shm_bus = 1,
+    .link_coalesce_us = DEFAULT_LINK_COALESCE_US,
+    .batch_messages = DEFAULT_BATCH_MESSAGES,
+    .fanout_shard = DEFAULT_FANOUT_SHARD,
+    .presence_window_ms = DEFAULT_PRESENCE_WINDOW_MS
+};
+PendingLogin* pending_logins;
+int pending_count = 0;
+int epoll_fd = -1;
+EventSource listener_source = { SOURCE_LISTENER };
+EventSource signal_source = { SOURCE_SIGNAL };
+EventSource handoff_source = { SOURCE_HANDOFF };
+EventSource unix_listener_source = { SOURCE_UNIX_LISTENER };
+int signal_fd = -1;
+// Binary sessions: the request this thread is answering, so the replies
+// carry its id (client_proto.h)
+static __thread Client* command_client = NULL;
+static __thread uint32_t command_id = 0;
+int wakeup_fd = -1;
+int handoff_in_progress = 0;
+Timer snapshot_timer;
+int snapshot_due = 0;
 int server_socket;
+int unix_socket = -1;
 int server_running = 1;
+int shutdown_signal = 0;
 FILE* log_file;
-
-// Function prototypes
-void* client_handler(void* arg);
-void* file_transfer_handler(void* arg);
-void log_message(const char* format, ...);
-void send_to_client(int socket, const char* message);
-void broadcast_to_room(const char* room_name, const char* message, const char* sender);
-void handle_join_room(Client* client, const char* room_name);
-void handle_leave_room(Client* client);
-void handle_whisper(Client* client, const char* target, const char* message);
-void handle_broadcast(Client* client, const char* message);
-void handle_file_send(Client* client, const char* filename, const char* target);
-void cleanup_client(Client* client);
-void signal_handler(int sig);
-int validate_username(const char* username);
-int validate_room_name(const char* room_name);
-int validate_filename(const char* filename);
-Client* find_client_by_username(const char* username);
-Room* find_or_create_room(const char* room_name);
+// Per address family, for /stats; connected sessions are counted on demand
+static uint64_t accepted_by_family[ADDR_FAMILY_COUNT];
+static uint64_t logins_by_family[ADDR_FAMILY_COUNT];
+static const char* const family_names[ADDR_FAMILY_COUNT] = { "ipv4", "ipv6", "local" };
+// Stream compression of sessions already closed; /stats adds the open ones
+static CompressStats compress_totals;
+static uint64_t compress_sessions;
+static pthread_mutex_t compress_totals_mutex = PTHREAD_MUTEX_INITIALIZER;
+// --batch-window: one timer closes every client's open batch
+static int batch_fd = -1;
+static int batch_armed = 0;
+static EventSource batch_source = { SOURCE_BATCH_FLUSH };
+static uint64_t batched_messages;
+static uint64_t batch_writes;
+// Timers armed off the main loop (gateway sessions) wake it to recompute its wait
+static int timers_fd = -1;
+static EventSource timers_source = { SOURCE_TIMERS_CHANGED };
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
-        exit(1);
-    }
-
-    int port = atoi(argv[1]);
-    if (port <= 0 || port > 10000) {
-        fprintf(stderr, "Invalid port number\n");
-        exit(1);
-    }
+    parse_arguments(argc, argv);
+    int port = config.port;
 
     // Initialize log file
     log_file = fopen("server.log", "a");
@@ -112,213 +88,1185 @@ int main(int argc, char* argv[]) {
     sem_init(&upload_queue.items, 0, 0);
 
     // Initialize clients and rooms
-    for (int i = 0; i < MAX_CLIENTS; i++) {
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        clients[i].source.kind = SOURCE_CLIENT_OUTPUT;
         clients[i].active = 0;
         clients[i].socket = -1;
+        pthread_mutex_init(&clients[i].out_mutex, NULL);
+        pthread_mutex_init(&clients[i].compress_mutex, NULL);
+        pthread_mutex_init(&clients[i].input_mutex, NULL);
     }
     for (int i = 0; i < MAX_ROOMS; i++) {
         rooms[i].active = 0;
         rooms[i].member_count = 0;
     }
+    pending_logins = calloc(config.max_pending_logins, sizeof(PendingLogin));
+    if (!pending_logins) {
+        perror("Failed to allocate pending logins");
+        exit(1);
+    }
 
-    // Set up signal handler
-    signal(SIGINT, signal_handler);
-
-    // Create server socket
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket == -1) {
-        perror("Socket creation failed");
+    // Signals are delivered to the main loop through a signalfd. Block them
+    // before any thread starts so every thread inherits the mask.
+    sigset_t signal_mask;
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGINT);
+    sigaddset(&signal_mask, SIGTERM);
+    sigaddset(&signal_mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signal_mask, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    signal_fd = signalfd(-1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        perror("signalfd failed");
         exit(1);
     }
 
-    int opt = 1;
-    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Written once to wake every client thread out of poll() for a handoff
+    wakeup_fd = eventfd(0, EFD_CLOEXEC);
 
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port);
+    timer_wheel_init(&timer_wheel, TIMER_TICK_MS, now_ms());
+    epoll_fd = epoll_create1(0);
+    timers_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epoll_fd == -1 || wakeup_fd == -1 || timers_fd == -1) {
+        perror("epoll_create1/eventfd failed");
+        exit(1);
+    }
+    struct epoll_event timers_ev;
+    timers_ev.events = EPOLLIN;
+    timers_ev.data.ptr = &timers_source;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timers_fd, &timers_ev);
+
+    // Before a takeover: adopted sessions may start holding output at once
+    if (config.batch_window_us) {
+        batch_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (batch_fd == -1) {
+            perror("timerfd_create failed");
+            exit(1);
+        }
+        struct epoll_event batch_ev;
+        batch_ev.events = EPOLLIN;
+        batch_ev.data.ptr = &batch_source;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, batch_fd, &batch_ev);
+    }
 
-    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
-        perror("Bind failed");
-        close(server_socket);
+    // Before a takeover too: adopted sessions may be in rooms big enough to shard
+    if (fanout_pool_init(&fanout_pool, config.fanout_workers) != 0) {
+        perror("fan-out workers failed");
         exit(1);
     }
 
-    if (listen(server_socket, MAX_CLIENTS) == -1) {
-        perror("Listen failed");
-        close(server_socket);
+    if (presence_start() != 0) {
+        exit(1);
+    }
+    if (config.filter_path && moderation_load(config.filter_path) != 0) {
         exit(1);
     }
 
+    // Map the last checkpoint before serving so returning users get their rooms back
+    if (config.snapshot_path && snapshot_open(config.snapshot_path) == 0) {
+        timer_init(&snapshot_timer, snapshot_timer_expired, NULL);
+        timer_arm(&timer_wheel, &snapshot_timer, config.snapshot_interval_ms, now_ms());
+    }
+
+    // A standby keeps history warm and only binds the port once its leader is gone
+    if (config.standby_path) {
+        standby_follow(config.standby_path);
+    }
+
+    if (config.takeover_path) {
+        // Hot restart: inherit the listener and every connection
+        server_socket = adopt_from_predecessor(config.takeover_path);
+        if (server_socket == -1) {
+            fprintf(stderr, "Takeover from %s failed\n", config.takeover_path);
+            exit(1);
+        }
+    } else {
+        // Create server socket: IPv6 and IPv4 clients on one dual-stack socket
+        server_socket = open_tcp_listener(port, MAX_CLIENTS, 0);
+        if (server_socket == -1) {
+            perror("Bind failed");
+            exit(1);
+        }
+    }
+
+    // Local bots and services skip the TCP stack
+    if (config.unix_path) {
+        unix_socket = open_unix_listener(config.unix_path);
+        if (unix_socket == -1) {
+            exit(1);
+        }
+    }
+
     log_message("[SERVER] Chat server started on port %d", port);
     printf("[INFO] Server listening on port %d...\n", port);
+    if (unix_socket != -1) {
+        printf("[INFO] Server listening on %s...\n", config.unix_path);
+    }
 
     // Start file transfer handler thread
     pthread_t file_thread;
     pthread_create(&file_thread, NULL, file_transfer_handler, NULL);
 
-    // Accept client connections
+    // Main loop: accept connections and drive connection timers
+    fcntl(server_socket, F_SETFL, fcntl(server_socket, F_GETFL) | O_NONBLOCK);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listener_source;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &ev);
+    if (unix_socket != -1) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &unix_listener_source;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, unix_socket, &ev);
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &signal_source;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+
+    if (cluster_enabled() && cluster_start() == -1) {
+        exit(1);
+    }
+    if (config.gateway_port && gateway_listen(config.gateway_port) == -1) {
+        exit(1);
+    }
+    if (config.replicate_path && replica_listen(config.replicate_path) == -1) {
+        exit(1);
+    }
+    if (config.ws_port && ws_listen(config.ws_port) == -1) {
+        exit(1);
+    }
+
+    int handoff_socket = -1;
+    if (config.handoff_path) {
+        handoff_socket = open_handoff_listener(config.handoff_path);
+        if (handoff_socket != -1) {
+            ev.events = EPOLLIN;
+            ev.data.ptr = &handoff_source;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, handoff_socket, &ev);
+        }
+    }
+
+    int handed_off = 0;
+    while (!shutdown_signal) {
+        pthread_mutex_lock(&timers_mutex);
+        int timeout = timer_wheel_next_timeout(&timer_wheel, now_ms());
+        pthread_mutex_unlock(&timers_mutex);
+
+        struct epoll_event events[16];
+        int n = epoll_wait(epoll_fd, events, 16, timeout);
+        if (n == -1 && errno != EINTR) {
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < n && !handed_off; i++) {
+            EventSource* source = events[i].data.ptr;
+            if (source->kind == SOURCE_LISTENER) {
+                accept_clients(server_socket, 0);
+            } else if (source->kind == SOURCE_UNIX_LISTENER) {
+                accept_clients(unix_socket, 0);
+            } else if (source->kind == SOURCE_PENDING_LOGIN) {
+                handle_pending_login((PendingLogin*)source);
+            } else if (source->kind == SOURCE_SIGNAL) {
+                handle_signal();
+            } else if (source->kind == SOURCE_CLIENT_OUTPUT) {
+                handle_client_output((Client*)source);
+            } else if (source->kind == SOURCE_HANDOFF) {
+                handed_off = handle_handoff_request(handoff_socket);
+            } else if (source->kind == SOURCE_CLUSTER_LISTENER) {
+                cluster_accept_links();
+            } else if (source->kind == SOURCE_PEER_INPUT) {
+                handle_peer_input((PeerInbound*)source);
+            } else if (source->kind == SOURCE_PEER_OUTPUT) {
+                handle_peer_output((PeerLink*)source);
+            } else if (source->kind == SOURCE_LINK_FLUSH) {
+                cluster_flush_links();
+            } else if (source->kind == SOURCE_CLAIM_RESULTS) {
+                cluster_handle_claim_results();
+            } else if (source->kind == SOURCE_GATEWAY_LISTENER) {
+                gateway_accept_links();
+            } else if (source->kind == SOURCE_GATEWAY_OUTPUT) {
+                handle_gateway_output((GatewayLink*)source);
+            } else if (source->kind == SOURCE_WS_LISTENER) {
+                ws_accept_clients();
+            } else if (source->kind == SOURCE_BATCH_FLUSH) {
+                flush_batched_output();
+            } else if (source->kind == SOURCE_PRESENCE_FLUSH) {
+                presence_flush();
+            } else if (source->kind == SOURCE_FILTER_RELOADED) {
+                moderation_handle_reload();
+            } else if (source->kind == SOURCE_TIMERS_CHANGED) {
+                eventfd_t value;
+                eventfd_read(timers_fd, &value);
+            }
+        }
+        if (handed_off) break;
+
+        pthread_mutex_lock(&timers_mutex);
+        timer_wheel_advance(&timer_wheel, now_ms());
+        pthread_mutex_unlock(&timers_mutex);
+
+        // Taken outside timers_mutex; only the registry locks are held, briefly
+        if (snapshot_due) {
+            snapshot_due = 0;
+            snapshot_take();
+        }
+        if (cluster_reconnect_due) {
+            cluster_reconnect_due = 0;
+            cluster_connect_peers();
+        }
+    }
+
+    if (handed_off) {
+        exit_after_handoff();
+    } else {
+        shutdown_server();
+    }
+    return 0;
+}
+
+// Listens on every local address. One IPv6 socket with IPV6_V6ONLY off also
+// takes IPv4 clients (as ::ffff:a.b.c.d); a host without IPv6 gets a plain
+// IPv4 socket. Cluster nodes all bind the port and the kernel balances
+// connections. Returns -1 with errno set on failure.
+int open_tcp_listener(int port, int backlog, int flags) {
+    int family = AF_INET6;
+    int sock = socket(AF_INET6, SOCK_STREAM | flags, 0);
+    if (sock == -1 && errno == EAFNOSUPPORT) {
+        family = AF_INET;
+        sock = socket(AF_INET, SOCK_STREAM | flags, 0);
+    }
+    if (sock == -1) return -1;
+
+    int opt = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (cluster_enabled()) {
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    memset(&addr, 0, sizeof(addr));
+    if (family == AF_INET6) {
+        int v6only = 0;
+        setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+        struct sockaddr_in6* in6 = (struct sockaddr_in6*)&addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_addr = in6addr_any;
+        in6->sin6_port = htons(port);
+        addr_len = sizeof(*in6);
+    } else {
+        struct sockaddr_in* in = (struct sockaddr_in*)&addr;
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = INADDR_ANY;
+        in->sin_port = htons(port);
+        addr_len = sizeof(*in);
+    }
+
+    if (bind(sock, (struct sockaddr*)&addr, addr_len) == -1 || listen(sock, backlog) == -1) {
+        int saved = errno;
+        close(sock);
+        errno = saved;
+        return -1;
+    }
+    return sock;
+}
+
+// Same contract as the TCP listener: non-blocking, accepted by the main loop.
+int open_unix_listener(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Unix socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sock == -1) {
+        perror("Unix socket creation failed");
+        return -1;
+    }
+    // Left behind by a previous run, or by the predecessor of a takeover
+    unlink(path);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(sock, MAX_CLIENTS) == -1) {
+        perror("Unix socket bind failed");
+        close(sock);
+        return -1;
+    }
+    log_message("[SERVER] Accepting local clients on %s", path);
+    return sock;
+}
+
+// Stores an accepted peer the way it is reported: an IPv4 client of the
+// dual-stack listener as AF_INET, a Unix peer as AF_UNIX with no path.
+static void normalize_address(struct sockaddr_storage* addr) {
+    if (addr->ss_family == AF_UNIX) {
+        memset(addr, 0, sizeof(*addr));
+        addr->ss_family = AF_UNIX;
+        return;
+    }
+    struct sockaddr_in6* in6 = (struct sockaddr_in6*)addr;
+    if (addr->ss_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+        struct sockaddr_in in;
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        in.sin_port = in6->sin6_port;
+        memcpy(&in.sin_addr, &in6->sin6_addr.s6_addr[12], 4);
+        memset(addr, 0, sizeof(*addr));
+        memcpy(addr, &in, sizeof(in));
+    }
+}
+
+int address_family(const struct sockaddr_storage* addr) {
+    if (addr->ss_family == AF_INET6) return ADDR_FAMILY_IPV6;
+    if (addr->ss_family == AF_UNIX) return ADDR_FAMILY_LOCAL;
+    return ADDR_FAMILY_IPV4;
+}
+
+void format_address(const struct sockaddr_storage* addr, char* out, size_t size) {
+    if (addr->ss_family == AF_INET6) {
+        inet_ntop(AF_INET6, &((const struct sockaddr_in6*)addr)->sin6_addr, out, size);
+    } else if (addr->ss_family == AF_INET) {
+        inet_ntop(AF_INET, &((const struct sockaddr_in*)addr)->sin_addr, out, size);
+    } else {
+        snprintf(out, size, "local socket");
+    }
+}
+
+// Address text as sent by a gateway. Returns 0, or -1 (left as 0.0.0.0).
+int parse_address(const char* text, struct sockaddr_storage* addr) {
+    memset(addr, 0, sizeof(*addr));
+    struct sockaddr_in6* in6 = (struct sockaddr_in6*)addr;
+    if (inet_pton(AF_INET6, text, &in6->sin6_addr) == 1) {
+        in6->sin6_family = AF_INET6;
+        return 0;
+    }
+    struct sockaddr_in* in = (struct sockaddr_in*)addr;
+    in->sin_family = AF_INET;
+    return inet_pton(AF_INET, text, &in->sin_addr) == 1 ? 0 : -1;
+}
+
+// Any thread: direct logins on the main loop, gateway sessions on theirs.
+void count_login(const struct sockaddr_storage* addr) {
+    __atomic_fetch_add(&logins_by_family[address_family(addr)], 1, __ATOMIC_RELAXED);
+}
+
+// Accepts from the TCP or Unix listener, or the WebSocket one (`websocket`
+// set).
+void accept_clients(int listener, int websocket) {
     while (server_running) {
-        struct sockaddr_in client_addr;
+        struct sockaddr_storage client_addr;
         socklen_t client_len = sizeof(client_addr);
-        int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_len);
+        int client_socket = accept(listener, (struct sockaddr*)&client_addr, &client_len);
+        if (client_socket != -1) {
+            normalize_address(&client_addr);
+            __atomic_fetch_add(&accepted_by_family[address_family(&client_addr)], 1, __ATOMIC_RELAXED);
+        }
 
         if (client_socket == -1) {
-            if (server_running) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && server_running) {
                 perror("Accept failed");
             }
+            return;
+        }
+
+        // Pre-auth capacity is separate from client slots, so a flood of
+        // idle handshakes cannot lock registered users out
+        if (pending_count >= config.max_pending_logins) {
+            send_to_client(client_socket, websocket ? "HTTP/1.1 503 Service Unavailable\r\n\r\n" :
+                                                      "[ERROR] Server busy. Try again later.\n");
+            close(client_socket);
+            log_message("[REJECTED] Pre-auth connection limit (%d) reached", config.max_pending_logins);
             continue;
         }
 
-        // Find available client slot
-        pthread_mutex_lock(&clients_mutex);
-        int slot = -1;
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (!clients[i].active) {
-                slot = i;
+        PendingLogin* login = NULL;
+        for (int i = 0; i < config.max_pending_logins; i++) {
+            if (!pending_logins[i].active) {
+                login = &pending_logins[i];
                 break;
             }
         }
 
-        if (slot == -1) {
-            pthread_mutex_unlock(&clients_mutex);
-            send_to_client(client_socket, "[ERROR] Server full. Try again later.\n");
-            close(client_socket);
+        // Accepted sockets inherit O_NONBLOCK, which the handshake relies on
+        login->source.kind = SOURCE_PENDING_LOGIN;
+        login->socket = client_socket;
+        login->addr = client_addr;
+        login->buffer_len = 0;
+        login->attempts = 0;
+        login->claiming = 0;
+        login->claim_granted = 0;
+        login->binary = 0;
+        login->websocket = websocket;
+        login->ws_upgraded = 0;
+        login->ws.raw_len = 0;
+        login->ws.closed = 0;
+        login->active = 1;
+        pending_count++;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = login;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &ev);
+
+        pthread_mutex_lock(&timers_mutex);
+        timer_init(&login->deadline, login_deadline_expired, login);
+        timer_init(&login->claim_timer, claim_timer_expired, login);
+        timer_arm(&timer_wheel, &login->deadline, config.login_timeout_ms, now_ms());
+        pthread_mutex_unlock(&timers_mutex);
+
+        // A WebSocket is prompted once the upgrade is through
+        if (!websocket) {
+            send_to_client(client_socket, "Enter username (max 16 chars, alphanumeric): ");
+        }
+    }
+}
+
+// Username registration, driven by the main loop on readable events. Every
+// complete line is one attempt; the connection is dropped once it has used
+// up its attempts or its deadline.
+void handle_pending_login(PendingLogin* login) {
+    if (login->websocket) {
+        ws_handle_pending_login(login);
+        return;
+    }
+    int bytes = recv(login->socket, login->buffer + login->buffer_len,
+                     sizeof(login->buffer) - login->buffer_len, 0);
+    if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        close_pending_login(login);
+        return;
+    }
+    if (bytes < 0) return;
+    login->buffer_len += bytes;
+    process_login_lines(login);
+}
+
+// Login output: plain text, a TEXT frame once the client chose binary, or a
+// WebSocket text frame (nothing before the upgrade).
+static void login_send(PendingLogin* login, const char* message) {
+    if (login->websocket) {
+        if (login->ws_upgraded) ws_send_text(login->socket, message);
+        return;
+    }
+    if (!login->binary) {
+        send_to_client(login->socket, message);
+        return;
+    }
+    char frame[BIN_MAX_FRAME];
+    size_t len = strlen(message);
+    size_t size = bin_frame_encode(frame, sizeof(frame), BIN_TEXT, login->request_id, 1, &message, &len);
+    send(login->socket, frame, size, MSG_NOSIGNAL);
+}
+
+// Takes the next username attempt off the login buffer: a line, or a LOGIN
+// frame for binary clients. Returns 1 with `consumed` set, 0 if more input
+// is needed, or -1 if the login was closed.
+static int next_login_attempt(PendingLogin* login, char* username, size_t* consumed) {
+    // A leading NUL can only be the start of the binary protocol's magic
+    if (!login->binary && !login->websocket && login->buffer_len > 0 && login->buffer[0] == '\0') {
+        if (login->buffer_len < BIN_MAGIC_LEN) return 0;
+        if (memcmp(login->buffer, BIN_MAGIC, BIN_MAGIC_LEN) == 0) {
+            login->binary = 1;
+            memmove(login->buffer, login->buffer + BIN_MAGIC_LEN, login->buffer_len - BIN_MAGIC_LEN);
+            login->buffer_len -= BIN_MAGIC_LEN;
+            send(login->socket, BIN_MAGIC, BIN_MAGIC_LEN, MSG_NOSIGNAL);
+        }
+    }
+
+    if (login->binary) {
+        BinFrame frame;
+        int size = bin_frame_parse(login->buffer, login->buffer_len, &frame);
+        if (size == 0 && login->buffer_len < sizeof(login->buffer)) return 0;
+        if (size <= 0 || frame.op != BIN_LOGIN || frame.count != 1 || frame.field_len[0] >= LOGIN_LINE_LEN) {
+            log_message("[REJECTED] Malformed binary login");
+            close_pending_login(login);
+            return -1;
+        }
+        login->request_id = frame.id;
+        memcpy(username, frame.field[0], frame.field_len[0] + 1);
+        *consumed = size;
+        return 1;
+    }
+
+    char* newline = memchr(login->buffer, '\n', login->buffer_len);
+    if (!newline) {
+        // A line longer than any valid username is a failed attempt
+        if (login->buffer_len < sizeof(login->buffer)) return 0;
+        newline = login->buffer + login->buffer_len - 1;
+    }
+    *consumed = newline - login->buffer + 1;
+    size_t len = newline - login->buffer;
+    memcpy(username, login->buffer, len);
+    username[len] = '\0';
+    if (len > 0 && username[len - 1] == '\r') username[len - 1] = '\0';
+    return 1;
+}
+
+// Works through the complete attempts buffered for a pending login. Stops
+// when the login succeeds, is closed, or waits for the cluster directory.
+void process_login_lines(PendingLogin* login) {
+    while (login->active && !login->claiming) {
+        char username[LOGIN_LINE_LEN];
+        size_t consumed;
+        if (next_login_attempt(login, username, &consumed) <= 0) return;
+
+        // Blank lines (e.g. a lone newline sent after the name) do not count
+        if (username[0] == '\0' && !login->binary) {
+            memmove(login->buffer, login->buffer + consumed, login->buffer_len - consumed);
+            login->buffer_len -= consumed;
             continue;
         }
 
-        // Initialize client
-        clients[slot].socket = client_socket;
-        clients[slot].addr = client_addr;
-        clients[slot].active = 1;
-        clients[slot].current_room[0] = '\0';
-        clients[slot].username[0] = '\0'; // Initialize username as empty
-        pthread_mutex_unlock(&clients_mutex);
+        login->attempts++;
+        int result;
+        if (strncmp(username, "/reconnect ", 11) == 0 && !login->binary) {
+            result = session_reconnect(login, username + 11, username, consumed);
+        } else {
+            result = validate_username(username) ? register_pending_login(login, username, consumed) : -3;
+        }
+        if (result == 1 || result == 2) return;
+        if (login_attempt_failed(login, username, consumed, result)) return;
+    }
+}
+
+// Reports a failed username attempt (a register_pending_login() result, -3
+// for an invalid name, or -4/-5 for a refused /reconnect) and re-prompts.
+// Returns 1 if the login was closed.
+int login_attempt_failed(PendingLogin* login, const char* username, size_t consumed, int result) {
+    login->reconnect_token[0] = '\0';
+    if (result == -4) {
+        login_send(login, "[ERROR] Unknown or expired session.\n");
+    } else if (result == -5) {
+        login_send(login, "[ERROR] Session still open; closing it. Reconnect again.\n");
+    } else if (result == -3) {
+        login_send(login, "[ERROR] Invalid username. Use alphanumeric characters only.\n");
+    } else if (result == 0) {
+        login_send(login, "[ERROR] Username already taken. Choose another.\n");
+        log_message("[REJECTED] Duplicate username attempted: %s", username);
+    } else if (result == -2) {
+        login_send(login, "[ERROR] Username directory unavailable. Try again.\n");
+        log_message("[REJECTED] Directory owner for '%s' did not answer", username);
+    } else {
+        login_send(login, "[ERROR] Server full. Try again later.\n");
+        close_pending_login(login);
+        return 1;
+    }
 
-        // Create client handler thread
-        pthread_t client_thread;
-        pthread_create(&client_thread, NULL, client_handler, &clients[slot]);
-        pthread_detach(client_thread);
+    if (login->attempts >= config.max_login_attempts) {
+        login_send(login, "[ERROR] Too many failed login attempts.\n");
+        log_message("[REJECTED] Login attempts exhausted (%d)", login->attempts);
+        close_pending_login(login);
+        return 1;
     }
 
+    memmove(login->buffer, login->buffer + consumed, login->buffer_len - consumed);
+    login->buffer_len -= consumed;
+    if (!login->binary) {
+        login_send(login, "Enter username (max 16 chars, alphanumeric): ");
+    }
     return 0;
 }
 
-void* client_handler(void* arg) {
-    Client* client = (Client*)arg;
-    char buffer[BUFFER_SIZE];
-    char username[MAX_USERNAME_LEN + 1];
+// In cluster mode the name must also be free on every other node. The
+// directory owner of the name decides; if that is another node, the login
+// parks (off epoll, input kept buffered) until finish_username_claim().
+// Returns DIR_GRANTED, DIR_DENIED, DIR_UNREACHABLE or DIR_PENDING.
+static int claim_username(PendingLogin* login, const char* username, size_t consumed) {
+    login->claim_seq++;
+    uint64_t token = ((uint64_t)(login - pending_logins) << 32) | login->claim_seq;
+    int result = cluster_claim_username(username, token);
+    if (result != DIR_PENDING) return result;
+
+    login->claiming = 1;
+    strcpy(login->claim_name, username);
+    login->claim_consumed = consumed;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, login->socket, NULL);
+
+    pthread_mutex_lock(&timers_mutex);
+    timer_init(&login->claim_timer, claim_timer_expired, login);
+    timer_arm(&timer_wheel, &login->claim_timer, DIRECTORY_CLAIM_TIMEOUT_MS, now_ms());
+    pthread_mutex_unlock(&timers_mutex);
+    return DIR_PENDING;
+}
 
-    // Get client IP
-    char client_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &client->addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+// Runs on the main loop with timers_mutex held: the owner never answered.
+void claim_timer_expired(Timer* timer, void* arg) {
+    (void)timer;
+    PendingLogin* login = (PendingLogin*)arg;
+    uint64_t token = ((uint64_t)(login - pending_logins) << 32) | login->claim_seq;
+    cluster_post_claim_result(token, login->claim_name, DIR_UNREACHABLE);
+}
 
-    // Username registration loop - keep trying until valid unique username
-    while (server_running && client->active) {
-        // Request username
-        send_to_client(client->socket, "Enter username (max 16 chars, alphanumeric): ");
-        
-        int bytes = recv(client->socket, username, MAX_USERNAME_LEN, 0);
-        if (bytes <= 0) {
-            cleanup_client(client);
-            return NULL;
-        }
-        username[bytes] = '\0';
-        
-        // Remove newline
-        char* newline = strchr(username, '\n');
-        if (newline) *newline = '\0';
+// Main loop: the directory answered (or timed out) for a parked login.
+void finish_username_claim(uint64_t token, const char* username, int result) {
+    size_t index = token >> 32;
+    PendingLogin* login = index < (size_t)config.max_pending_logins ? &pending_logins[index] : NULL;
+    if (!login || !login->active || !login->claiming || login->claim_seq != (uint32_t)token ||
+        strcmp(login->claim_name, username) != 0) {
+        // Nobody is waiting for this name any more; give it back
+        if (result == DIR_GRANTED) cluster_release_username(username);
+        return;
+    }
 
-        // Validate username format
-        if (!validate_username(username)) {
-            send_to_client(client->socket, "[ERROR] Invalid username. Use alphanumeric characters only.\n");
-            continue; // Try again instead of disconnecting
-        }
+    login->claiming = 0;
+    pthread_mutex_lock(&timers_mutex);
+    timer_cancel(&timer_wheel, &login->claim_timer);
+    pthread_mutex_unlock(&timers_mutex);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = login;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, login->socket, &ev);
+
+    int outcome = result == DIR_DENIED ? 0 : -2;
+    if (result == DIR_GRANTED) {
+        login->claim_granted = 1;
+        outcome = register_pending_login(login, login->claim_name, login->claim_consumed);
+        login->claim_granted = 0;
+        if (outcome == 1) return;
+        cluster_release_username(login->claim_name);
+    }
+    if (login_attempt_failed(login, login->claim_name, login->claim_consumed, outcome)) return;
+    process_login_lines(login);
+}
+
+// Moves a pending login into a client slot and starts its thread. Returns 1
+// on success, 0 if the username is taken, -1 if the server is full, -2 if
+// the cluster directory could not be asked, or 2 while it is being asked.
+int register_pending_login(PendingLogin* login, const char* username, size_t consumed) {
+    // A name granted here goes back to the directory if the login still
+    // fails below; finish_username_claim() returns the ones it was granted
+    int granted = 0;
 
-        // Check for duplicate username
+    // Local duplicates and capacity first: cheap, and no directory round trip
+    if (cluster_enabled() && !login->claim_granted) {
         pthread_mutex_lock(&clients_mutex);
-        if (find_client_by_username(username)) {
-            pthread_mutex_unlock(&clients_mutex);
-            send_to_client(client->socket, "[ERROR] Username already taken. Choose another.\n");
-            log_message("[REJECTED] Duplicate username attempted: %s", username);
-            continue; // Try again instead of disconnecting
+        int taken = find_client_by_username(username) != NULL;
+        int full = 1;
+        for (int i = 0; i < MAX_CLIENTS && full; i++) {
+            if (!clients[i].active) full = 0;
         }
+        pthread_mutex_unlock(&clients_mutex);
+        if (taken) return 0;
+        if (full) return -1;
+
+        int claim = claim_username(login, username, consumed);
+        if (claim == DIR_PENDING) return 2;
+        if (claim == DIR_DENIED) return 0;
+        if (claim == DIR_UNREACHABLE) return -2;
+        granted = 1;
+    }
 
-        // Username is valid and unique, register it
-        strcpy(client->username, username);
+    pthread_mutex_lock(&clients_mutex);
+    if (find_client_by_username(username)) {
         pthread_mutex_unlock(&clients_mutex);
-        break; // Exit the username registration loop
+        if (granted) cluster_release_username(username);
+        return 0;
     }
 
-    // If we got here but client is not active, it means server is shutting down or client disconnected
-    if (!client->active || !server_running) {
+    int slot = -1;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (!clients[i].active) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == -1) {
+        pthread_mutex_unlock(&clients_mutex);
+        if (granted) cluster_release_username(username);
+        return -1;
+    }
+
+    // Initialize client
+    Client* client = &clients[slot];
+    client->socket = login->socket;
+    client->addr = login->addr;
+    client->active = 1;
+    client->current_room[0] = '\0';
+    client->room_mask = 0;
+    strcpy(client->username, username);
+    // Anything pipelined after the username is the first command input
+    client->inbuf_len = login->buffer_len - consumed;
+    memcpy(client->inbuf, login->buffer + consumed, client->inbuf_len);
+    client->last_activity_ms = now_ms();
+    client->resumed = 0;
+    client->parked = 0;
+    client->gateway = NULL;
+    client->binary = login->binary;
+    client->websocket = login->websocket;
+    // Frames that arrived behind the username are decoded by the client thread
+    client->ws.raw_len = login->ws.raw_len;
+    client->ws.closed = 0;
+    memcpy(client->ws.raw, login->ws.raw, login->ws.raw_len);
+    strcpy(client->session_token, login->reconnect_token);
+    client->reconnecting = login->reconnect_token[0] != '\0';
+    login->reconnect_token[0] = '\0';
+    pthread_mutex_unlock(&clients_mutex);
+
+    // Hand the socket over: the client thread uses blocking I/O
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, login->socket, NULL);
+    fcntl(login->socket, F_SETFL, fcntl(login->socket, F_GETFL) & ~O_NONBLOCK);
+
+    pthread_mutex_lock(&timers_mutex);
+    timer_cancel(&timer_wheel, &login->deadline);
+    pthread_mutex_unlock(&timers_mutex);
+
+    login->active = 0;
+    login->socket = -1;
+    pending_count--;
+
+    if (client->binary) {
+        const char* name = client->username;
+        size_t len = strlen(name);
+        client_send_frame(client, BIN_LOGIN_OK, login->request_id, 1, &name, &len);
+    }
+    count_login(&client->addr);
+    start_client_session(client);
+    return 1;
+}
+
+void arm_client_timers(Client* client) {
+    pthread_mutex_lock(&timers_mutex);
+    timer_init(&client->idle_timer, idle_timer_expired, client);
+    timer_init(&client->heartbeat_timer, heartbeat_timer_expired, client);
+    timer_arm(&timer_wheel, &client->idle_timer, config.idle_timeout_ms, now_ms());
+    timer_arm(&timer_wheel, &client->heartbeat_timer, config.heartbeat_interval_ms, now_ms());
+    pthread_mutex_unlock(&timers_mutex);
+    // The main loop may be waiting with no deadline, if it was not the caller
+    eventfd_write(timers_fd, 1);
+}
+
+// Arms a registered client's timers and starts its thread.
+void start_client_session(Client* client) {
+    arm_client_timers(client);
+
+    // Create client handler thread
+    pthread_t client_thread;
+    pthread_create(&client_thread, NULL, client_handler, client);
+    pthread_detach(client_thread);
+}
+
+void close_pending_login(PendingLogin* login) {
+    if (!login->active) return;
+
+    pthread_mutex_lock(&timers_mutex);
+    timer_cancel(&timer_wheel, &login->deadline);
+    timer_cancel(&timer_wheel, &login->claim_timer);
+    pthread_mutex_unlock(&timers_mutex);
+    login->claiming = 0;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, login->socket, NULL);
+    close(login->socket);
+    login->socket = -1;
+    login->active = 0;
+    pending_count--;
+}
+
+// Runs on the main loop with timers_mutex held.
+void login_deadline_expired(Timer* timer, void* arg) {
+    (void)timer;
+    PendingLogin* login = (PendingLogin*)arg;
+    timer_cancel(&timer_wheel, &login->claim_timer);
+    login->claiming = 0;
+    login_send(login, "[ERROR] Login timed out.\n");
+    log_message("[TIMEOUT] Connection closed: no username within %d ms", config.login_timeout_ms);
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, login->socket, NULL);
+    close(login->socket);
+    login->socket = -1;
+    login->active = 0;
+    pending_count--;
+}
+
+void* client_handler(void* arg) {
+    Client* client = (Client*)arg;
+    char buffer[BUFFER_SIZE];
+
+    // The username was registered by the main loop before this thread started
+    if (!server_running) {
         cleanup_client(client);
         return NULL;
     }
 
-    log_message("[LOGIN] user '%s' connected from %s", username, client_ip);
-    printf("[CONNECT] New client connected: %s from %s\n", username, client_ip); 
-    send_to_client(client->socket, "[SUCCESS] Connected to chat server!\n");
-    send_to_client(client->socket, "Commands: /join <room>, /leave, /broadcast <msg>, /whisper <user> <msg>, /sendfile <file> <user>, /exit\n");
+    // Sessions inherited through a hot restart are already greeted
+    if (client->reconnecting) {
+        session_restore(client);
+    } else if (!client->resumed) {
+        greet_client(client);
+    }
 
     // Main command loop
     while (server_running && client->active) {
-        int bytes = recv(client->socket, buffer, BUFFER_SIZE - 1, 0);
-        if (bytes <= 0) {
+        BinFrame frame;
+        int len = client->binary ? read_frame(client, &frame) : read_line(client, buffer, sizeof(buffer));
+        if (len == -2) {
+            // Handoff: leave the socket and session intact for the successor.
+            // The timers come off the wheel first; whoever restarts the
+            // session (successor or aborted handoff) arms them afresh.
+            pthread_mutex_lock(&timers_mutex);
+            timer_cancel(&timer_wheel, &client->idle_timer);
+            timer_cancel(&timer_wheel, &client->heartbeat_timer);
+            pthread_mutex_unlock(&timers_mutex);
+            __atomic_store_n(&client->parked, 1, __ATOMIC_RELEASE);
+            return NULL;
+        }
+        if (len < 0) {
+            break;
+        }
+        if (client->binary) {
+            // The fields point into inbuf until the request is done
+            int keep = handle_binary_command(client, &frame);
+            consume_input(client, len);
+            if (!keep) break;
+        } else if (!handle_command(client, buffer)) {
             break;
         }
-        buffer[bytes] = '\0';
+    }
+
+    cleanup_client(client);
+    return NULL;
+}
 
-        // Remove newline
-        char* newline = strchr(buffer, '\n');
-        if (newline) *newline = '\0';
+// Welcome message for a new session, plus the room it had before a restart.
+void greet_client(Client* client) {
+    char client_ip[ADDRESS_STRLEN];
+    format_address(&client->addr, client_ip, sizeof(client_ip));
+
+    log_message("[LOGIN] user '%s' connected from %s", client->username, client_ip);
+    printf("[CONNECT] New client connected: %s from %s\n", client->username, client_ip); 
+    client_send(client, "[SUCCESS] Connected to chat server!\n");
+    client_send(client, "Commands: /join <room>, /leave [room], /broadcast <msg>, /whisper <user> <msg>, /sendfile <file> <user>, /who [room], /rooms, /stats, /compress, /sequenced, /resume <room> <n>, /presence [off], /typing, /exit\n");
+    if (address_family(&client->addr) == ADDR_FAMILY_LOCAL) {
+        client_send(client, "Operator: /announce <msg> reaches every connected user\n");
+    }
 
-        if (strlen(buffer) == 0) continue;
+    // A new login under the name: a session the old holder dropped is not theirs
+    session_discard(client->username);
+    if (!client->binary && !client->websocket && !client->gateway) {
+        session_issue(client);
+    }
 
-        // Parse commands
-        if (strncmp(buffer, "/join ", 6) == 0) {
-            char room_name[MAX_ROOM_NAME_LEN + 1];
-            sscanf(buffer + 6, "%32s", room_name);
-            handle_join_room(client, room_name);
+    // Back after a restart: put the user where the last snapshot had them,
+    // talking in the same room as before
+    char names[MAX_ROOMS][MAX_ROOM_NAME_LEN + 1];
+    char current[MAX_ROOM_NAME_LEN + 1];
+    int count = snapshot_claim_rooms(client->username, names, current);
+    if (count > 0) {
+        client_send(client, "[INFO] Restoring your rooms from before the restart.\n");
+        for (int i = 0; i < count; i++) {
+            handle_join_room(client, names[i]);
         }
-        else if (strcmp(buffer, "/leave") == 0) {
-            handle_leave_room(client);
+        if (current[0] != '\0') {
+            add_room_member(client, current, 0);
         }
-        else if (strncmp(buffer, "/broadcast ", 11) == 0) {
-            handle_broadcast(client, buffer + 11);
+    }
+}
+
+// Runs one command line for a session, on whichever thread reads its input
+// (its own client thread, or a gateway link's). Returns 0 once the session
+// should end.
+int handle_command(Client* client, char* buffer) {
+    if (strlen(buffer) == 0) return 1;
+
+    // Heartbeat reply: activity is already recorded
+    if (strcmp(buffer, "/pong") == 0) return 1;
+
+    // Parse commands
+    if (strncmp(buffer, "/join ", 6) == 0) {
+        char room_name[MAX_ROOM_NAME_LEN + 1];
+        sscanf(buffer + 6, "%32s", room_name);
+        handle_join_room(client, room_name);
+    }
+    else if (strcmp(buffer, "/leave") == 0) {
+        handle_leave_room(client, NULL);
+    }
+    else if (strncmp(buffer, "/leave ", 7) == 0) {
+        char room_name[MAX_ROOM_NAME_LEN + 1] = "";
+        if (sscanf(buffer + 7, "%32s", room_name) == 1) {
+            handle_leave_room(client, room_name);
+        } else {
+            client_send(client, "[ERROR] Usage: /leave [room]\n");
         }
-        else if (strncmp(buffer, "/whisper ", 9) == 0) {
-            char target[MAX_USERNAME_LEN + 1];
-            char* message = strchr(buffer + 9, ' ');
-            if (message) {
-                *message = '\0';
-                message++;
-                strcpy(target, buffer + 9);
-                handle_whisper(client, target, message);
-            } else {
-                send_to_client(client->socket, "[ERROR] Usage: /whisper <username> <message>\n");
-            }
+    }
+    else if (strncmp(buffer, "/broadcast ", 11) == 0) {
+        handle_broadcast(client, buffer + 11);
+    }
+    else if (strncmp(buffer, "/whisper ", 9) == 0) {
+        char target[MAX_USERNAME_LEN + 1];
+        char* message = strchr(buffer + 9, ' ');
+        if (message) {
+            *message = '\0';
+            message++;
+            strcpy(target, buffer + 9);
+            handle_whisper(client, target, message);
+        } else {
+            client_send(client, "[ERROR] Usage: /whisper <username> <message>\n");
         }
-        else if (strncmp(buffer, "/sendfile ", 10) == 0) {
-            char filename[256], target[MAX_USERNAME_LEN + 1];
-            if (sscanf(buffer + 10, "%255s %16s", filename, target) == 2) {
-                handle_file_send(client, filename, target);
-            } else {
-                send_to_client(client->socket, "[ERROR] Usage: /sendfile <filename> <username>\n");
-            }
+    }
+    else if (strncmp(buffer, "/sendfile ", 10) == 0) {
+        char filename[256], target[MAX_USERNAME_LEN + 1];
+        if (sscanf(buffer + 10, "%255s %16s", filename, target) == 2) {
+            handle_file_send(client, filename, target);
+        } else {
+            client_send(client, "[ERROR] Usage: /sendfile <filename> <username>\n");
         }
-        else if (strcmp(buffer, "/exit") == 0) {
-            send_to_client(client->socket, "[INFO] Goodbye!\n");
-            break;
+    }
+    else if (strcmp(buffer, "/stats") == 0) {
+        handle_stats(client);
+    }
+    else if (strcmp(buffer, "/compress") == 0) {
+        handle_compress(client);
+    }
+    else if (strncmp(buffer, "/announce", 9) == 0 && (buffer[9] == ' ' || buffer[9] == '\0')) {
+        handle_announce(client, buffer[9] ? buffer + 10 : "");
+    }
+    else if (strncmp(buffer, "/ack ", 5) == 0) {
+        handle_ack(client, buffer + 5);
+    }
+    else if (strcmp(buffer, "/sequenced") == 0) {
+        handle_sequenced(client);
+    }
+    else if (strcmp(buffer, "/who") == 0 || strncmp(buffer, "/who ", 5) == 0) {
+        handle_who(client, buffer[4] ? buffer + 5 : "");
+    }
+    else if (strcmp(buffer, "/rooms") == 0) {
+        handle_rooms(client);
+    }
+    else if (strcmp(buffer, "/typing") == 0) {
+        handle_typing(client);
+    }
+    else if (strcmp(buffer, "/presence") == 0 || strncmp(buffer, "/presence ", 10) == 0) {
+        handle_presence(client, buffer[9] ? buffer + 10 : "");
+    }
+    else if (strncmp(buffer, "/resume ", 8) == 0) {
+        char room_name[MAX_ROOM_NAME_LEN + 1];
+        unsigned long long seq;
+        if (sscanf(buffer + 8, "%32s %llu", room_name, &seq) == 2) {
+            handle_resume(client, room_name, seq);
+        } else {
+            client_send(client, "[ERROR] Usage: /resume <room> <n>\n");
         }
-        else {
-            send_to_client(client->socket, "[ERROR] Unknown command. Type a valid command.\n");
+    }
+    else if (strcmp(buffer, "/exit") == 0) {
+        // Leaving on purpose: nothing to come back to
+        client->session_token[0] = '\0';
+        client_send(client, "[INFO] Goodbye!\n");
+        return 0;
+    }
+    else {
+        client_send(client, "[ERROR] Unknown command. Type a valid command.\n");
+    }
+    return 1;
+}
+
+static void add_compress_stats(CompressStats* total, const CompressStats* add) {
+    total->messages_out += add->messages_out;
+    total->raw_out += add->raw_out;
+    total->wire_out += add->wire_out;
+    total->deflate_ns += add->deflate_ns;
+    total->messages_in += add->messages_in;
+    total->raw_in += add->raw_in;
+    total->wire_in += add->wire_in;
+    total->inflate_ns += add->inflate_ns;
+}
+
+// Wire bytes as a share of the raw ones, and CPU time per message, for each
+// direction as the server sees it.
+static void format_compress_stats(char* line, size_t size, const char* label, const CompressStats* stats) {
+    snprintf(line, size,
+        "[STATS] compression (%s): out %llu -> %llu bytes (%.2f), %.1f us/msg deflate; "
+        "in %llu -> %llu bytes (%.2f), %.1f us/msg inflate\n",
+        label,
+        (unsigned long long)stats->raw_out, (unsigned long long)stats->wire_out,
+        stats->raw_out ? (double)stats->wire_out / stats->raw_out : 0.0,
+        stats->messages_out ? stats->deflate_ns / 1000.0 / stats->messages_out : 0.0,
+        (unsigned long long)stats->raw_in, (unsigned long long)stats->wire_in,
+        stats->raw_in ? (double)stats->wire_in / stats->raw_in : 0.0,
+        stats->messages_in ? stats->inflate_ns / 1000.0 / stats->messages_in : 0.0);
+}
+
+// Connections per address family on this node: sessions now, logins and
+// accepted connections since start. Gateway sessions count by their
+// client's address; the gateway's own links are not counted. Then stream
+// compression, for the asking session and for all of them.
+void handle_stats(Client* client) {
+    int connected[ADDR_FAMILY_COUNT] = { 0 };
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (clients[i].active) connected[address_family(&clients[i].addr)]++;
+    }
+    pthread_mutex_unlock(&clients_mutex);
+
+    for (int family = 0; family < ADDR_FAMILY_COUNT; family++) {
+        char line[128];
+        snprintf(line, sizeof(line), "[STATS] %s: %d connected, %llu logins, %llu accepted\n",
+            family_names[family], connected[family],
+            (unsigned long long)__atomic_load_n(&logins_by_family[family], __ATOMIC_RELAXED),
+            (unsigned long long)__atomic_load_n(&accepted_by_family[family], __ATOMIC_RELAXED));
+        client_send(client, line);
+    }
+
+    // Compression: this session, then every session since start
+    CompressStats own, all;
+    int own_enabled = 0, open_sessions = 0;
+    memset(&own, 0, sizeof(own));
+    pthread_mutex_lock(&compress_totals_mutex);
+    all = compress_totals;
+    uint64_t sessions = compress_sessions;
+    pthread_mutex_unlock(&compress_totals_mutex);
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        pthread_mutex_lock(&clients[i].compress_mutex);
+        if (clients[i].compressor) {
+            add_compress_stats(&all, &clients[i].compressor->stats);
+            open_sessions++;
+            if (&clients[i] == client) {
+                own = clients[i].compressor->stats;
+                own_enabled = 1;
+            }
         }
+        pthread_mutex_unlock(&clients[i].compress_mutex);
     }
+    pthread_mutex_unlock(&clients_mutex);
 
-    cleanup_client(client);
-    return NULL;
+    char line[256];
+    if (own_enabled) {
+        format_compress_stats(line, sizeof(line), "this session", &own);
+        client_send(client, line);
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "%llu sessions, %d open", (unsigned long long)sessions, open_sessions);
+    format_compress_stats(line, sizeof(line), label, &all);
+    client_send(client, line);
+
+    seq_format_stats(line, sizeof(line));
+    client_send(client, line);
+    session_format_stats(line, sizeof(line));
+    client_send(client, line);
+    presence_format_stats(line, sizeof(line));
+    client_send(client, line);
+    listing_format_stats(line, sizeof(line));
+    client_send(client, line);
+    if (config.filter_path) {
+        moderation_format_stats(line, sizeof(line));
+        client_send(client, line);
+    }
+
+    if (config.batch_window_us) {
+        uint64_t held = __atomic_load_n(&batched_messages, __ATOMIC_RELAXED);
+        uint64_t writes = __atomic_load_n(&batch_writes, __ATOMIC_RELAXED);
+        snprintf(line, sizeof(line), "[STATS] batching: %llu held messages in %llu writes (%.1f per write), window %d us\n",
+            (unsigned long long)held, (unsigned long long)writes, writes ? (double)held / writes : 0.0,
+            config.batch_window_us);
+        client_send(client, line);
+    }
+    if (config.fanout_workers) {
+        pthread_mutex_lock(&fanout_pool.mutex);
+        uint64_t runs = fanout_pool.parallel_runs;
+        uint64_t items = fanout_pool.parallel_items;
+        uint64_t shards = fanout_pool.parallel_shards;
+        pthread_mutex_unlock(&fanout_pool.mutex);
+        snprintf(line, sizeof(line), "[STATS] fan-out: %llu broadcasts split across threads (%.1f shards, %.0f members each), %d workers, shard %d\n",
+            (unsigned long long)runs, runs ? (double)shards / runs : 0.0, runs ? (double)items / runs : 0.0,
+            config.fanout_workers, config.fanout_shard);
+        client_send(client, line);
+    }
+}
+
+// Switches a text session to stream compression (compress.h). The answer
+// goes out in clear; everything after it, both ways, is deflated. Not
+// offered where the connection is not this process's own socket to frame,
+// nor with hot restart, whose handoff cannot carry zlib state.
+void handle_compress(Client* client) {
+    if (client->gateway || client->binary || client->websocket) {
+        client_send(client, "[ERROR] Compression is only available on direct text connections.\n");
+        return;
+    }
+    if (config.handoff_path) {
+        client_send(client, "[ERROR] Compression is not available with hot restart enabled.\n");
+        return;
+    }
+    if (client->compressor) {
+        client_send(client, "[ERROR] Compression is already enabled.\n");
+        return;
+    }
+    Compressor* compressor = malloc(sizeof(Compressor));
+    if (!compressor || compressor_init(compressor) == -1) {
+        free(compressor);
+        client_send(client, "[ERROR] Compression is unavailable right now.\n");
+        return;
+    }
+
+    // Whatever the client sent after the command is already deflated
+    memcpy(compressor->pending, client->inbuf, client->inbuf_len);
+    compressor->pending_len = client->inbuf_len;
+    client->inbuf_len = 0;
+
+    // Other threads deflate under compress_mutex, so nothing of theirs can
+    // land between the answer and the first compressed byte
+    pthread_mutex_lock(&client->compress_mutex);
+    client_send_raw(client, COMPRESS_ENABLED, strlen(COMPRESS_ENABLED));
+    client->compressor = compressor;
+    pthread_mutex_unlock(&client->compress_mutex);
+
+    pthread_mutex_lock(&compress_totals_mutex);
+    compress_sessions++;
+    pthread_mutex_unlock(&compress_totals_mutex);
+    log_message("[COMPRESS] user '%s' enabled stream compression", client->username);
+}
+
+// Binary counterpart of handle_command(): the opcode picks the handler and
+// the fields arrive already split, so nothing is scanned or copied.
+int handle_binary_command(Client* client, BinFrame* frame) {
+    char** field = frame->field;
+    int keep = 1;
+    int malformed = 0;
+
+    command_client = client;
+    command_id = frame->id;
+    switch (frame->op) {
+        case BIN_JOIN:
+            malformed = frame->count != 1;
+            if (!malformed) handle_join_room(client, field[0]);
+            break;
+        case BIN_LEAVE:
+            malformed = frame->count > 1 || (frame->count == 1 && frame->field_len[0] > MAX_ROOM_NAME_LEN);
+            if (!malformed) handle_leave_room(client, frame->count == 1 ? field[0] : NULL);
+            break;
+        case BIN_BROADCAST:
+            malformed = frame->count != 1;
+            if (!malformed) handle_broadcast(client, field[0]);
+            break;
+        case BIN_WHISPER:
+            malformed = frame->count != 2 || frame->field_len[0] > MAX_USERNAME_LEN;
+            if (!malformed) handle_whisper(client, field[0], field[1]);
+            break;
+        case BIN_SENDFILE:
+            malformed = frame->count != 2 || frame->field_len[0] > 255 || frame->field_len[1] > MAX_USERNAME_LEN;
+            if (!malformed) handle_file_send(client, field[0], field[1]);
+            break;
+        case BIN_FILE_CHUNK:
+            malformed = frame->count != 4 || frame->field_len[0] > MAX_USERNAME_LEN ||
+                frame->field_len[1] > 255 || frame->field_len[2] > BIN_CHUNK_BYTES ||
+                frame->field_len[3] == 0 || frame->field_len[3] > BIN_TRANSFER_LEN;
+            if (!malformed) handle_file_chunk(client, field[0], field[1], field[2], frame->field_len[2], field[3]);
+            break;
+        case BIN_PONG:
+            break;
+        case BIN_EXIT:
+            client_send(client, "[INFO] Goodbye!\n");
+            keep = 0;
+            break;
+        default:
+            client_send(client, "[ERROR] Unknown command. Type a valid command.\n");
+    }
+    if (malformed) {
+        client_send(client, "[ERROR] Malformed request.\n");
+    }
+    command_client = NULL;
+    return keep;
 }
 
 void* file_transfer_handler(void* arg) {
@@ -344,7 +1292,7 @@ void* file_transfer_handler(void* arg) {
             snprintf(notification, sizeof(notification), 
                 "[FILE] Received '%s' from %s (%zu bytes)\n", 
                 transfer.filename, transfer.sender, transfer.file_size);
-            send_to_client(receiver->socket, notification);
+            client_send(receiver, notification);
             
             log_message("[SEND FILE] '%s' sent from %s to %s (success)", 
                 transfer.filename, transfer.sender, transfer.receiver);
@@ -364,6 +1312,11 @@ void* file_transfer_handler(void* arg) {
 
 void log_message(const char* format, ...) {
     pthread_mutex_lock(&log_mutex);
+    if (!log_file) {
+        // Already closed by shutdown_server()
+        pthread_mutex_unlock(&log_mutex);
+        return;
+    }
     
     time_t now = time(NULL);
     struct tm* tm_info = localtime(&now);
@@ -384,139 +1337,627 @@ void log_message(const char* format, ...) {
 }
 
 void send_to_client(int socket, const char* message) {
-    send(socket, message, strlen(message), 0);
+    send(socket, message, strlen(message), MSG_NOSIGNAL);
+}
+
+void client_send(Client* client, const char* message) {
+    client_send_bytes(client, message, strlen(message));
+}
+
+// Output as the text protocol prints it, whatever the session speaks.
+static void queue_output(Client* client, const char* data, size_t len, SharedBuffer* shared);
+
+// Every kind of session frames its output differently; only plain byte
+// streams (text, uncompressed) can queue `shared` itself.
+static void send_output(Client* client, const char* data, size_t len, SharedBuffer* shared) {
+    // Gateway sessions share their link's queue
+    GatewayLink* gateway = client->gateway;
+    if (gateway) {
+        gateway_send(gateway, client->session, GATEWAY_DATA, data, len);
+        return;
+    }
+
+    // Binary sessions get it as TEXT frames, tagged with the request they answer
+    if (client->binary) {
+        uint32_t id = command_client == client ? command_id : 0;
+        size_t room = BIN_MAX_FRAME - BIN_HEADER_BYTES - 3;
+        do {
+            size_t part = len < room ? len : room;
+            client_send_frame(client, BIN_TEXT, id, 1, &data, &part);
+            data += part;
+            len -= part;
+        } while (len > 0);
+        return;
+    }
+
+    // WebSocket sessions get one text frame per call (split if very long)
+    if (client->websocket) {
+        if (client->ws.closed) return;
+        char frame[WS_MAX_HEADER + BUFFER_SIZE];
+        do {
+            size_t part = len < BUFFER_SIZE ? len : BUFFER_SIZE;
+            size_t header = ws_frame_header(frame, WS_TEXT, part);
+            memcpy(frame + header, data, part);
+            client_send_raw(client, frame, header + part);
+            data += part;
+            len -= part;
+        } while (len > 0);
+        return;
+    }
+
+    // Compressed sessions: deflate and queue under compress_mutex, so the
+    // stream enters the queue in the order it was produced
+    pthread_mutex_lock(&client->compress_mutex);
+    if (client->compressor) {
+        char wire[COMPRESS_BOUND(BUFFER_SIZE)];
+        do {
+            size_t part = len < BUFFER_SIZE ? len : BUFFER_SIZE;
+            ssize_t n = compressor_deflate(client->compressor, data, part, wire, sizeof(wire));
+            if (n > 0) client_send_raw(client, wire, n);
+            data += part;
+            len -= part;
+        } while (len > 0);
+    } else {
+        queue_output(client, data, len, shared);
+    }
+    pthread_mutex_unlock(&client->compress_mutex);
+}
+
+void client_send_bytes(Client* client, const char* data, size_t len) {
+    send_output(client, data, len, NULL);
+}
+
+void client_send_shared(Client* client, SharedBuffer* buffer) {
+    send_output(client, buffer->data, buffer->len, buffer);
+}
+
+void client_send_frame(Client* client, int op, uint32_t id, int count, const char* const fields[], const size_t lens[]) {
+    char frame[BIN_MAX_FRAME];
+    size_t len = bin_frame_encode(frame, sizeof(frame), op, id, count, fields, lens);
+    if (len > 0) {
+        client_send_raw(client, frame, len);
+    }
+}
+
+// Caller holds out_mutex.
+static void watch_client_output(Client* client) {
+    if (!client->out_watched) {
+        struct epoll_event ev;
+        ev.events = EPOLLOUT;
+        ev.data.ptr = client;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->socket, &ev);
+        client->out_watched = 1;
+    }
+}
+
+// First message held by any client starts the window; when the timer fires
+// the main loop writes every held batch. Mirrors the cluster link batches.
+static void arm_batch_flush(void) {
+    if (__atomic_exchange_n(&batch_armed, 1, __ATOMIC_ACQ_REL)) return;
+    struct itimerspec when;
+    memset(&when, 0, sizeof(when));
+    when.it_value.tv_sec = config.batch_window_us / 1000000;
+    when.it_value.tv_nsec = (long)(config.batch_window_us % 1000000) * 1000;
+    timerfd_settime(batch_fd, 0, &when, NULL);
+}
+
+// Writes a client's held batch. Caller holds out_mutex.
+static void flush_batch_locked(Client* client) {
+    __atomic_fetch_add(&batched_messages, client->batch_held, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&batch_writes, 1, __ATOMIC_RELAXED);
+    client->batch_held = 0;
+    client->last_write_us = now_us();
+    if (!flush_client_output(client)) {
+        watch_client_output(client);
+    }
+}
+
+SharedBuffer* shared_buffer_create(const char* data, size_t len) {
+    SharedBuffer* buffer = malloc(sizeof(SharedBuffer) + len);
+    if (!buffer) return NULL;
+    buffer->refs = 1;
+    buffer->len = len;
+    memcpy(buffer->data, data, len);
+    return buffer;
+}
+
+void shared_buffer_release(SharedBuffer* buffer) {
+    if (__atomic_sub_fetch(&buffer->refs, 1, __ATOMIC_ACQ_REL) == 0) free(buffer);
+}
+
+const char* out_chunk_bytes(const OutChunk* chunk) {
+    return chunk->shared ? chunk->shared->data : chunk->data;
+}
+
+void out_chunk_free(OutChunk* chunk) {
+    if (chunk->shared) shared_buffer_release(chunk->shared);
+    free(chunk);
+}
+
+// Never blocks the caller: whatever the socket does not accept right away is
+// queued and the main loop finishes the write when the socket drains. With
+// `shared`, data is shared->data: if none of it went out at once, the queue
+// takes a reference instead of a copy.
+static void queue_output(Client* client, const char* data, size_t len, SharedBuffer* shared) {
+    pthread_mutex_lock(&client->out_mutex);
+    // cleanup_client closes the socket under out_mutex: nothing is queued
+    // on a session past that point, even by a sender that found it active
+    if (client->socket == -1 || !client->active || client->out_overflow) {
+        pthread_mutex_unlock(&client->out_mutex);
+        return;
+    }
+
+    // --batch-window: output following an unheld write within the window is
+    // held, so a burst goes out in one write when the window closes. A
+    // client that has had nothing for a while still gets it at once.
+    int hold = client->batch_held > 0;
+    if (!client->out_head && config.batch_window_us && server_running) {
+        uint64_t now = now_us();
+        if (now - client->last_write_us < (uint64_t)config.batch_window_us) {
+            hold = 1;
+        } else {
+            client->last_write_us = now;
+        }
+    }
+
+    size_t sent = 0;
+    if (!client->out_head && !hold) {
+        ssize_t n = send(client->socket, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            sent = n;
+        } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            // Broken connection; the client thread notices on its next recv()
+            pthread_mutex_unlock(&client->out_mutex);
+            return;
+        }
+    }
+
+    if (sent < len) {
+        if (client->out_bytes + (len - sent) > MAX_OUTBOUND_BYTES) {
+            log_message("[SLOW] user '%s' has %zu bytes queued. Disconnecting.", client->username, client->out_bytes);
+            client->out_overflow = 1;
+            shutdown(client->socket, SHUT_RDWR);
+        } else {
+            int by_reference = shared && sent == 0;
+            OutChunk* chunk = malloc(sizeof(OutChunk) + (by_reference ? 0 : len - sent));
+            if (chunk) {
+                chunk->next = NULL;
+                chunk->len = len - sent;
+                chunk->offset = 0;
+                chunk->shared = NULL;
+                if (by_reference) {
+                    __atomic_add_fetch(&shared->refs, 1, __ATOMIC_RELAXED);
+                    chunk->shared = shared;
+                } else {
+                    memcpy(chunk->data, data + sent, len - sent);
+                }
+                if (client->out_tail) {
+                    client->out_tail->next = chunk;
+                } else {
+                    client->out_head = chunk;
+                }
+                client->out_tail = chunk;
+                client->out_bytes += chunk->len;
+
+                if (hold) {
+                    if (client->batch_held++ == 0) arm_batch_flush();
+                    if (client->batch_held >= config.batch_messages) flush_batch_locked(client);
+                } else {
+                    watch_client_output(client);
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&client->out_mutex);
+}
+
+void client_send_raw(Client* client, const char* data, size_t len) {
+    queue_output(client, data, len, NULL);
+}
+
+static void flush_held_output(void) {
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        Client* client = &clients[i];
+        pthread_mutex_lock(&client->out_mutex);
+        if (client->batch_held > 0 && client->socket != -1) {
+            flush_batch_locked(client);
+        }
+        pthread_mutex_unlock(&client->out_mutex);
+    }
+}
+
+void flush_batched_output(void) {
+    uint64_t expirations;
+    if (read(batch_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) return;
+    // Cleared first: output held from here on arms a fresh timer
+    __atomic_store_n(&batch_armed, 0, __ATOMIC_RELEASE);
+    flush_held_output();
+}
+
+// Writes as much of the outbound queue as the socket takes. Caller holds
+// out_mutex. Returns 1 once the queue is empty, 0 if bytes remain.
+int flush_client_output(Client* client) {
+    while (client->out_head) {
+        // Several queued chunks (a held batch) leave in one system call
+        struct iovec iov[FLUSH_IOV_MAX];
+        int count = 0;
+        for (OutChunk* chunk = client->out_head; chunk && count < FLUSH_IOV_MAX; chunk = chunk->next) {
+            iov[count].iov_base = (char*)out_chunk_bytes(chunk) + chunk->offset;
+            iov[count].iov_len = chunk->len - chunk->offset;
+            count++;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t n = sendmsg(client->socket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+            // Peer is gone: nothing left to deliver
+            while (client->out_head) {
+                OutChunk* chunk = client->out_head;
+                client->out_head = chunk->next;
+                out_chunk_free(chunk);
+            }
+            client->out_tail = NULL;
+            client->out_bytes = 0;
+            break;
+        }
+        client->out_bytes -= n;
+        while (n > 0) {
+            OutChunk* chunk = client->out_head;
+            size_t part = chunk->len - chunk->offset;
+            if ((size_t)n < part) {
+                chunk->offset += n;
+                break;
+            }
+            n -= part;
+            client->out_head = chunk->next;
+            if (!client->out_head) client->out_tail = NULL;
+            out_chunk_free(chunk);
+        }
+    }
+
+    if (client->out_watched) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->socket, NULL);
+        client->out_watched = 0;
+    }
+    return 1;
+}
+
+void handle_client_output(Client* client) {
+    pthread_mutex_lock(&client->out_mutex);
+    if (client->socket != -1) {
+        flush_client_output(client);
+    }
+    pthread_mutex_unlock(&client->out_mutex);
+}
+
+// One fan-out of a room line. Built on the broadcasting thread's stack and
+// read by every shard, so the message is formatted once for all members.
+typedef struct {
+    Room* room;
+    const char* sender;
+    const char* numbered;
+    const char* formatted;
+} RoomFanout;
+
+// Caller holds rooms_mutex, so the member list stays put while the fan-out
+// workers walk their shards of it.
+static void deliver_room_shard(void* arg, int begin, int end) {
+    RoomFanout* fanout = arg;
+    for (int j = begin; j < end; j++) {
+        Client* member = fanout->room->members[j];
+        if (member && member->active && strcmp(member->username, fanout->sender) != 0) {
+            client_send(member, member->sequenced ? fanout->numbered : fanout->formatted);
+        }
+    }
 }
 
 void broadcast_to_room(const char* room_name, const char* message, const char* sender) {
     pthread_mutex_lock(&rooms_mutex);
     
+    history_append(room_name, sender, message);
     for (int i = 0; i < MAX_ROOMS; i++) {
         if (rooms[i].active && strcmp(rooms[i].name, room_name) == 0) {
-            for (int j = 0; j < rooms[i].member_count; j++) {
-                if (rooms[i].members[j] && rooms[i].members[j]->active &&
-                    strcmp(rooms[i].members[j]->username, sender) != 0) {
-                    char formatted_msg[BUFFER_SIZE];
-                    snprintf(formatted_msg, sizeof(formatted_msg), "[%s] %s: %s\n", room_name, sender, message);
-                    send_to_client(rooms[i].members[j]->socket, formatted_msg);
-                }
-            }
+            char numbered_msg[BUFFER_SIZE];
+            char formatted_msg[BUFFER_SIZE];
+            seq_append(&rooms[i], sender, message, numbered_msg, sizeof(numbered_msg));
+            snprintf(formatted_msg, sizeof(formatted_msg), "[%s] %s: %s\n", room_name, sender, message);
+            RoomFanout fanout = { &rooms[i], sender, numbered_msg, formatted_msg };
+            fanout_run(&fanout_pool, rooms[i].member_count, config.fanout_shard, deliver_room_shard, &fanout);
             break;
         }
     }
-    
-    pthread_mutex_unlock(&rooms_mutex);
+    
+    pthread_mutex_unlock(&rooms_mutex);
+}
+
+// One line for every session on this node, formatted once. Plain text
+// sessions queue the buffer itself; the rest frame or deflate their own
+// copy. The live sessions are pinned under clients_mutex and reached
+// without it, so logins and lookups never wait for the walk; a pinned slot
+// is not released (and handed to a new login) until it has been sent to.
+// A session already being cleaned up has closed its socket, which
+// queue_output checks under out_mutex. Returns the sessions reached.
+static int deliver_to_all(const char* line) {
+    SharedBuffer* buffer = shared_buffer_create(line, strlen(line));
+    if (!buffer) return 0;
+    Client* targets[MAX_SESSIONS];
+    int count = 0;
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        Client* client = &clients[i];
+        if (!client->active || client->username[0] == '\0') continue;
+        client->pins++;
+        targets[count++] = client;
+    }
+    pthread_mutex_unlock(&clients_mutex);
+
+    for (int i = 0; i < count; i++) {
+        client_send_shared(targets[i], buffer);
+        pthread_mutex_lock(&clients_mutex);
+        if (--targets[i]->pins == 0) pthread_cond_broadcast(&clients_unpinned);
+        pthread_mutex_unlock(&clients_mutex);
+    }
+    shared_buffer_release(buffer);
+    return count;
+}
+
+// An announcement from `sender` (here, or relayed by another cluster node).
+int announce_local(const char* sender, const char* text) {
+    char line[BUFFER_SIZE];
+    snprintf(line, sizeof(line), "[ANNOUNCE] %s: %s\n", sender, text);
+    uint64_t start = now_us();
+    int reached = deliver_to_all(line);
+    log_message("[ANNOUNCE] %s to %d sessions in %llu us: %s", sender, reached,
+        (unsigned long long)(now_us() - start), text);
+    return reached;
+}
+
+// /announce <msg>: operators only, i.e. sessions on the --unix listener,
+// which the socket's file permissions already restrict. Reaches every
+// session on every node.
+void handle_announce(Client* client, const char* text) {
+    if (address_family(&client->addr) != ADDR_FAMILY_LOCAL) {
+        client_send(client, "[ERROR] Only operators (local socket sessions) can announce.\n");
+        return;
+    }
+    if (text[0] == '\0') {
+        client_send(client, "[ERROR] Usage: /announce <message>\n");
+        return;
+    }
+    int reached = announce_local(client->username, text);
+    int nodes = cluster_announce(client->username, text);
+    char reply[128];
+    if (nodes > 0) {
+        snprintf(reply, sizeof(reply), "[SUCCESS] Announced to %d sessions here and to %d other nodes.\n", reached, nodes);
+    } else {
+        snprintf(reply, sizeof(reply), "[SUCCESS] Announced to %d sessions.\n", reached);
+    }
+    client_send(client, reply);
 }
 
+// Joins a room on top of the ones the client is already in, and makes it
+// the room /broadcast goes to. Joining a room it is already in only does
+// the latter.
 void handle_join_room(Client* client, const char* room_name) {
     if (!validate_room_name(room_name)) {
-        send_to_client(client->socket, "[ERROR] Invalid room name. Use alphanumeric characters only.\n");
+        client_send(client, "[ERROR] Invalid room name. Use alphanumeric characters only.\n");
         return;
     }
 
-    // Leave current room if any
-    if (strlen(client->current_room) > 0) {
-        handle_leave_room(client);
+    int result = add_room_member(client, room_name, 1);
+    if (result == -1) {
+        client_send(client, "[ERROR] Unable to join room.\n");
+        return;
+    }
+    if (result == -2) {
+        client_send(client, "[ERROR] Room is full.\n");
+        return;
     }
 
-    Room* room = find_or_create_room(room_name);
-    if (!room) {
-        send_to_client(client->socket, "[ERROR] Unable to join room.\n");
+    char msg[256];
+    if (result == 1) {
+        snprintf(msg, sizeof(msg), "[SUCCESS] Now talking in room '%s'\n", room_name);
+        client_send(client, msg);
         return;
     }
+    snprintf(msg, sizeof(msg), "[SUCCESS] Joined room '%s'\n", room_name);
+    client_send(client, msg);
+    presence_note(room_name, client->username, 1);
+    presence_joined_room(client, room_name);
+    
+    log_message("[JOIN] user '%s' joined room '%s'", client->username, room_name);
+    printf("[COMMAND] %s joined room '%s'\n", client->username, room_name); 
+}
 
+// Adds the client to a room's member list and makes it the current room.
+// Returns 0, 1 if it was a member already (now current), -1 if no room
+// slot is free, or -2 if the room is full.
+int add_room_member(Client* client, const char* room_name, int replay_history) {
+    // One critical section from finding the slot to setting the client's
+    // bit: a slot claimed or released meanwhile would leave the bit
+    // pointing at a room of another name
     pthread_mutex_lock(&rooms_mutex);
-    if (room->member_count >= MAX_CLIENTS) {
+    Room* room = find_or_create_room_locked(room_name);
+    if (!room) {
         pthread_mutex_unlock(&rooms_mutex);
-        send_to_client(client->socket, "[ERROR] Room is full.\n");
-        return;
+        return -1;
+    }
+
+    uint64_t bit = 1ULL << (room - rooms);
+    if (client->room_mask & bit) {
+        strcpy(client->current_room, room_name);
+        pthread_mutex_unlock(&rooms_mutex);
+        return 1;
+    }
+    if (room->member_count >= MAX_SESSIONS) {
+        pthread_mutex_unlock(&rooms_mutex);
+        return -2;
     }
 
     room->members[room->member_count++] = client;
+    client->room_mask |= bit;
+    listing_invalidate(room);
     strcpy(client->current_room, room_name);
+    if (room->member_count == 1) {
+        cluster_room_membership(room_name, 1);
+    }
+    if (replay_history) {
+        history_replay(client, room_name);
+    }
+    if (client->sequenced || client->resuming) {
+        seq_member_joined(client, room);
+    }
     pthread_mutex_unlock(&rooms_mutex);
+    return 0;
+}
 
-    char msg[256];
-    snprintf(msg, sizeof(msg), "[SUCCESS] Joined room '%s'\n", room_name);
-    send_to_client(client->socket, msg);
-    
-    log_message("[JOIN] user '%s' joined room '%s'", client->username, room_name);
-    printf("[COMMAND] %s joined room '%s'\n", client->username, room_name); 
+// Caller holds rooms_mutex. Takes the client off the room's member list;
+// if that was its current room, /broadcast moves to the lowest slot it is
+// still in.
+static void remove_room_member(Client* client, Room* room) {
+    for (int j = 0; j < room->member_count; j++) {
+        if (room->members[j] == client) {
+            room->members[j] = room->members[--room->member_count];
+            break;
+        }
+    }
+    client->room_mask &= ~(1ULL << (room - rooms));
+    listing_invalidate(room);
+
+    // Deactivate room if empty
+    if (room->member_count == 0) {
+        room->active = 0;
+        cluster_room_membership(room->name, 0);
+    }
+
+    if (strcmp(client->current_room, room->name) == 0) {
+        client->current_room[0] = '\0';
+        if (client->room_mask) {
+            strcpy(client->current_room, rooms[__builtin_ctzll(client->room_mask)].name);
+        }
+    }
 }
 
-void handle_leave_room(Client* client) {
+// Leaves `room_name`, or the current room when it is NULL.
+void handle_leave_room(Client* client, const char* room_name) {
+    if (!room_name) room_name = client->current_room;
     if (strlen(client->current_room) == 0) {
-        send_to_client(client->socket, "[ERROR] You are not in any room.\n");
+        client_send(client, "[ERROR] You are not in any room.\n");
         return;
     }
 
+    char name[MAX_ROOM_NAME_LEN + 1];
+    char current[MAX_ROOM_NAME_LEN + 1];
+    snprintf(name, sizeof(name), "%s", room_name);
+    int was_current = strcmp(name, client->current_room) == 0;
     pthread_mutex_lock(&rooms_mutex);
-    for (int i = 0; i < MAX_ROOMS; i++) {
-        if (rooms[i].active && strcmp(rooms[i].name, client->current_room) == 0) {
-            // Remove client from room
-            for (int j = 0; j < rooms[i].member_count; j++) {
-                if (rooms[i].members[j] == client) {
-                    for (int k = j; k < rooms[i].member_count - 1; k++) {
-                        rooms[i].members[k] = rooms[i].members[k + 1];
-                    }
-                    rooms[i].member_count--;
-                    break;
-                }
-            }
-            
-            // Deactivate room if empty
-            if (rooms[i].member_count == 0) {
-                rooms[i].active = 0;
-            }
-            break;
-        }
+    Room* room = find_room(name);
+    int member = room && (client->room_mask & (1ULL << (room - rooms)));
+    if (member) {
+        remove_room_member(client, room);
     }
+    strcpy(current, client->current_room);
     pthread_mutex_unlock(&rooms_mutex);
 
     char msg[256];
-    snprintf(msg, sizeof(msg), "[SUCCESS] Left room '%s'\n", client->current_room);
-    send_to_client(client->socket, msg);
+    if (!member) {
+        snprintf(msg, sizeof(msg), "[ERROR] You are not in room '%s'.\n", name);
+        client_send(client, msg);
+        return;
+    }
+    snprintf(msg, sizeof(msg), "[SUCCESS] Left room '%s'\n", name);
+    client_send(client, msg);
+    presence_note(name, client->username, 0);
+    if (was_current && current[0] != '\0') {
+        snprintf(msg, sizeof(msg), "[INFO] Now talking in room '%s'\n", current);
+        client_send(client, msg);
+    }
     
-    log_message("[LEAVE] user '%s' left room '%s'", client->username, client->current_room);
+    log_message("[LEAVE] user '%s' left room '%s'", client->username, name);
+}
+
+// A session going away: out of every room, quietly. Sequenced readers and
+// resumable sessions keep their place in each (seq_remember()).
+void leave_all_rooms(Client* client) {
+    pthread_mutex_lock(&rooms_mutex);
+    uint64_t mask = client->room_mask;
+    pthread_mutex_unlock(&rooms_mutex);
+
+    while (mask) {
+        Room* room = &rooms[__builtin_ctzll(mask)];
+        mask &= mask - 1;
+        seq_remember(client, room);
+        // Once its last member is out the room can be released and reused
+        char name[MAX_ROOM_NAME_LEN + 1];
+        pthread_mutex_lock(&rooms_mutex);
+        strcpy(name, room->name);
+        remove_room_member(client, room);
+        pthread_mutex_unlock(&rooms_mutex);
+        presence_note(name, client->username, 0);
+        log_message("[LEAVE] user '%s' left room '%s'", client->username, name);
+    }
     client->current_room[0] = '\0';
 }
 
 void handle_whisper(Client* client, const char* target, const char* message) {
-    Client* target_client = find_client_by_username(target);
-    if (!target_client || !target_client->active) {
-        send_to_client(client->socket, "[ERROR] User not found or offline.\n");
+    if (moderation_blocks(message)) {
+        client_send(client, "[ERROR] Message blocked by the moderation filter.\n");
+        log_message("[FILTER] blocked whisper from '%s' to '%s'", client->username, target);
         return;
     }
 
+    Client* target_client = find_client_by_username(target);
     char whisper_msg[BUFFER_SIZE];
     snprintf(whisper_msg, sizeof(whisper_msg), "[WHISPER from %s]: %s\n", client->username, message);
-    send_to_client(target_client->socket, whisper_msg);
-    
-    send_to_client(client->socket, "[SUCCESS] Whisper sent.\n");
+    if (target_client && target_client->active) {
+        client_send(target_client, whisper_msg);
+    } else if (session_hold_output(target, whisper_msg, strlen(whisper_msg))) {
+        // Dropped here moments ago; delivered when the session reconnects
+    } else if (!cluster_enabled() || !validate_username(target) ||
+               cluster_whisper(client->username, target, message) == -1) {
+        // Maybe logged in on another node: the directory knows where
+        client_send(client, "[ERROR] User not found or offline.\n");
+        return;
+    }
+
+    client_send(client, "[SUCCESS] Whisper sent.\n");
     log_message("[WHISPER] %s to %s: %s", client->username, target, message);
     printf("[COMMAND] %s sent whisper to %s\n", client->username, target); 
 }
 
 void handle_broadcast(Client* client, const char* message) {
     if (strlen(client->current_room) == 0) {
-        send_to_client(client->socket, "[ERROR] Join a room first.\n");
+        client_send(client, "[ERROR] Join a room first.\n");
+        return;
+    }
+
+    if (moderation_blocks(message)) {
+        client_send(client, "[ERROR] Message blocked by the moderation filter.\n");
+        log_message("[FILTER] blocked broadcast from '%s'", client->username);
         return;
     }
 
-    broadcast_to_room(client->current_room, message, client->username);
-    send_to_client(client->socket, "[SUCCESS] Message broadcasted.\n");
+    if (cluster_broadcast(client->current_room, client->username, message) == -1) {
+        client_send(client, "[ERROR] Room is temporarily unavailable. Try again.\n");
+        return;
+    }
+    client_send(client, "[SUCCESS] Message broadcasted.\n");
     log_message("[BROADCAST] user '%s': %s", client->username, message);
     printf("[COMMAND] %s broadcasted to '%s'\n", client->username, client->current_room);
 }
 
 void handle_file_send(Client* client, const char* filename, const char* target) {
     if (!validate_filename(filename)) {
-        send_to_client(client->socket, "[ERROR] Invalid file type. Allowed: .txt, .pdf, .jpg, .png\n");
+        client_send(client, "[ERROR] Invalid file type. Allowed: .txt, .pdf, .jpg, .png\n");
         return;
     }
 
     Client* target_client = find_client_by_username(target);
     if (!target_client || !target_client->active) {
-        send_to_client(client->socket, "[ERROR] Target user not found or offline.\n");
+        client_send(client, "[ERROR] Target user not found or offline.\n");
         return;
     }
 
@@ -524,7 +1965,7 @@ void handle_file_send(Client* client, const char* filename, const char* target)
     struct stat st;
     if (stat(filename, &st) == 0) {
         if (st.st_size > MAX_FILE_SIZE) {
-            send_to_client(client->socket, "[ERROR] File exceeds size limit (3MB).\n");
+            client_send(client, "[ERROR] File exceeds size limit (3MB).\n");
             log_message("[ERROR] File '%s' from user '%s' exceeds size limit", filename, client->username);
             return;
         }
@@ -548,12 +1989,12 @@ void handle_file_send(Client* client, const char* filename, const char* target)
         pthread_mutex_unlock(&upload_queue.mutex);
         sem_post(&upload_queue.items);
         
-        send_to_client(client->socket, "[SUCCESS] File added to upload queue.\n");
+        client_send(client, "[SUCCESS] File added to upload queue.\n");
         log_message("[FILE-QUEUE] Upload '%s' from %s added to queue. Queue size: %d", 
             filename, client->username, upload_queue.count);
         printf("[COMMAND] %s initiated file transfer to %s\n", client->username, target);
     } else {
-        send_to_client(client->socket, "[INFO] Upload queue full. Waiting...\n");
+        client_send(client, "[INFO] Upload queue full. Waiting...\n");
         
         sem_wait(&upload_queue.slots);
         
@@ -573,18 +2014,76 @@ void handle_file_send(Client* client, const char* filename, const char* target)
         pthread_mutex_unlock(&upload_queue.mutex);
         sem_post(&upload_queue.items);
         
-        send_to_client(client->socket, "[SUCCESS] File queued for upload.\n");
+        client_send(client, "[SUCCESS] File queued for upload.\n");
         log_message("[FILE-QUEUE] Upload '%s' from %s added to queue after wait. Queue size: %d", 
             filename, client->username, upload_queue.count);
     }
 }
 
+// Relays one chunk of a file sent over the binary protocol. The sender waits
+// for FILE_ACK before the next chunk, so a transfer never has more than one
+// chunk queued here; a receiver that still falls behind aborts it.
+void handle_file_chunk(Client* client, const char* target, const char* filename, const char* data, size_t len,
+                       const char* transfer) {
+    if (!validate_filename(filename)) {
+        client_send(client, "[ERROR] Invalid file type. Allowed: .txt, .pdf, .jpg, .png\n");
+        return;
+    }
+
+    Client* target_client = find_client_by_username(target);
+    if (!target_client || !target_client->active) {
+        client_send(client, "[ERROR] Target user not found or offline.\n");
+        return;
+    }
+    if (!target_client->binary) {
+        client_send(client, "[ERROR] Target user's client cannot receive files.\n");
+        return;
+    }
+
+    pthread_mutex_lock(&target_client->out_mutex);
+    size_t queued = target_client->out_bytes;
+    pthread_mutex_unlock(&target_client->out_mutex);
+    if (queued > MAX_OUTBOUND_BYTES / 2) {
+        client_send(client, "[ERROR] Receiver is not keeping up. File transfer aborted.\n");
+        return;
+    }
+
+    const char* fields[] = { client->username, filename, data, transfer };
+    size_t lens[] = { strlen(client->username), strlen(filename), len, strlen(transfer) };
+    client_send_frame(target_client, BIN_FILE_DATA, 0, 4, fields, lens);
+    client_send_frame(client, BIN_FILE_ACK, command_id, 0, NULL, NULL);
+    if (len == 0) {
+        log_message("[FILE] user '%s' sent '%s' to '%s'", client->username, filename, target);
+    }
+}
+
 void cleanup_client(Client* client) {
     if (!client->active) return;
 
-    // Leave current room
-    if (strlen(client->current_room) > 0) {
-        handle_leave_room(client);
+    // Disarm timers before the socket goes away
+    pthread_mutex_lock(&timers_mutex);
+    timer_cancel(&timer_wheel, &client->idle_timer);
+    timer_cancel(&timer_wheel, &client->heartbeat_timer);
+    pthread_mutex_unlock(&timers_mutex);
+
+    // A dropped session waits for /reconnect with its queued output
+    if (client->session_token[0] != '\0' && server_running) {
+        session_keep(client);
+    }
+
+    // Leave every room, keeping the place of a sequenced reader (/resume)
+    // or a resumable session (/reconnect)
+    leave_all_rooms(client);
+
+    // Free the name cluster-wide
+    if (cluster_enabled() && client->username[0] != '\0') {
+        cluster_release_username(client->username);
+    }
+
+    // No socket here for gateway sessions: the gateway hangs up
+    if (client->gateway) {
+        gateway_send(client->gateway, client->session, GATEWAY_CLOSE, NULL, 0);
+        client->gateway = NULL;
     }
 
     // Log disconnection
@@ -593,40 +2092,168 @@ void cleanup_client(Client* client) {
         printf("[DISCONNECT] Client %s disconnected.\n", client->username);
     }
 
-    // Close socket and mark inactive
+    // Drop undelivered output, close socket and release the slot
+    pthread_mutex_lock(&client->out_mutex);
+    while (client->out_head) {
+        OutChunk* chunk = client->out_head;
+        client->out_head = chunk->next;
+        out_chunk_free(chunk);
+    }
+    client->out_tail = NULL;
+    client->out_bytes = 0;
+    client->out_overflow = 0;
+    client->batch_held = 0;
+    client->last_write_us = 0;
+    client->sequenced = 0;
+    client->presence = 0;
+    client->last_typing_ms = 0;
+    client->resuming = 0;
+    memset(client->acked_seq, 0, sizeof(client->acked_seq));
+    client->session_token[0] = '\0';
+    client->reconnecting = 0;
     if (client->socket != -1) {
+        if (client->out_watched) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->socket, NULL);
+            client->out_watched = 0;
+        }
         close(client->socket);
         client->socket = -1;
     }
-    
+    pthread_mutex_unlock(&client->out_mutex);
+
+    // Keep the session's compression totals for /stats
+    pthread_mutex_lock(&client->compress_mutex);
+    if (client->compressor) {
+        pthread_mutex_lock(&compress_totals_mutex);
+        add_compress_stats(&compress_totals, &client->compressor->stats);
+        pthread_mutex_unlock(&compress_totals_mutex);
+        compressor_free(client->compressor);
+        free(client->compressor);
+        client->compressor = NULL;
+    }
+    pthread_mutex_unlock(&client->compress_mutex);
+
+    // Walkers of the table holding clients_mutex never see a half-released
+    // slot, and deliver_to_all() is done with it before it can be reused
+    pthread_mutex_lock(&clients_mutex);
+    while (client->pins > 0) {
+        pthread_cond_wait(&clients_unpinned, &clients_mutex);
+    }
     client->active = 0;
     client->username[0] = '\0';
     client->current_room[0] = '\0';
+    pthread_mutex_unlock(&clients_mutex);
 }
 
-void signal_handler(int sig) {
-    if (sig == SIGINT) {
-        printf("\n[SHUTDOWN] SIGINT received. Shutting down server...\n");
-        server_running = 0;
-        
-        // Count active clients
-        int active_count = 0;
-        pthread_mutex_lock(&clients_mutex);
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (clients[i].active) {
-                send_to_client(clients[i].socket, "[SERVER] Server shutting down. Goodbye!\n");
-                active_count++;
+// Runs on the main loop: the signal itself only wakes the signalfd.
+void handle_signal(void) {
+    struct signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGINT || info.ssi_signo == SIGTERM) {
+            shutdown_signal = info.ssi_signo;
+        } else if (info.ssi_signo == SIGHUP && config.filter_path) {
+            // Compiled off the loop; messages keep being checked against
+            // the old list meanwhile
+            moderation_reload();
+        }
+    }
+}
+
+size_t outbound_bytes_pending(void) {
+    size_t total = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        pthread_mutex_lock(&clients[i].out_mutex);
+        total += clients[i].out_bytes;
+        pthread_mutex_unlock(&clients[i].out_mutex);
+    }
+    return total + gateway_bytes_pending();
+}
+
+// Graceful shutdown: stop accepting, notify clients, flush their outbound
+// queues for at most drain_timeout_ms, then close the log.
+void shutdown_server(void) {
+    const char* signal_name = shutdown_signal == SIGTERM ? "SIGTERM" : "SIGINT";
+    printf("\n[SHUTDOWN] %s received. Shutting down server...\n", signal_name);
+    uint64_t start = now_ms();
+    server_running = 0;
+
+    // Stop accepting and abandon unfinished handshakes
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, server_socket, NULL);
+    close(server_socket);
+    if (unix_socket != -1) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, unix_socket, NULL);
+        close(unix_socket);
+        unlink(config.unix_path);
+    }
+    ws_stop();
+    for (int i = 0; i < config.max_pending_logins; i++) {
+        close_pending_login(&pending_logins[i]);
+    }
+
+    // Notify active clients, through the /announce path
+    int active_count = deliver_to_all("[SERVER] Server shutting down. Goodbye!\n");
+
+    log_message("[SHUTDOWN] %s received. Disconnecting %d clients, saving logs.", signal_name, active_count);
+    // Nothing is held from here on (server_running is 0); write what was
+    if (config.batch_window_us) {
+        flush_held_output();
+    }
+
+    // Bounded drain of everything still queued
+    uint64_t deadline = start + config.drain_timeout_ms;
+    while (outbound_bytes_pending() > 0) {
+        uint64_t now = now_ms();
+        if (now >= deadline) break;
+
+        struct epoll_event events[16];
+        int n = epoll_wait(epoll_fd, events, 16, (int)(deadline - now));
+        for (int i = 0; i < n; i++) {
+            EventSource* source = events[i].data.ptr;
+            if (source->kind == SOURCE_CLIENT_OUTPUT) {
+                handle_client_output((Client*)source);
+            } else if (source->kind == SOURCE_GATEWAY_OUTPUT) {
+                handle_gateway_output((GatewayLink*)source);
             }
         }
-        pthread_mutex_unlock(&clients_mutex);
-        
-        log_message("[SHUTDOWN] SIGINT received. Disconnecting %d clients, saving logs.", active_count);
-        
-        // Clean up
-        close(server_socket);
-        fclose(log_file);
-        exit(0);
     }
+    size_t undelivered = outbound_bytes_pending();
+    uint64_t elapsed = now_ms() - start;
+
+    // Final checkpoint while the sessions are still registered
+    snapshot_close();
+    cluster_stop();
+
+    // Close every connection; client threads see EOF and exit
+    gateway_stop();
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        pthread_mutex_lock(&clients[i].out_mutex);
+        if (clients[i].socket != -1) {
+            shutdown(clients[i].socket, SHUT_RDWR);
+        }
+        pthread_mutex_unlock(&clients[i].out_mutex);
+    }
+
+    for (int family = 0; family < ADDR_FAMILY_COUNT; family++) {
+        log_message("[SHUTDOWN] %s: %llu connections accepted, %llu logins", family_names[family],
+            (unsigned long long)accepted_by_family[family], (unsigned long long)logins_by_family[family]);
+    }
+    log_message("[SHUTDOWN] Drain finished in %llu ms (limit %d ms), %zu bytes undelivered.",
+        (unsigned long long)elapsed, config.drain_timeout_ms, undelivered);
+    printf("[SHUTDOWN] Drain finished in %llu ms, %zu bytes undelivered.\n",
+        (unsigned long long)elapsed, undelivered);
+
+    pthread_mutex_lock(&log_mutex);
+    fflush(log_file);
+    fsync(fileno(log_file));
+    fclose(log_file);
+    log_file = NULL;
+    pthread_mutex_unlock(&log_mutex);
+
+    if (config.handoff_path) {
+        unlink(config.handoff_path);
+    }
+    close(epoll_fd);
+    close(signal_fd);
 }
 
 int validate_username(const char* username) {
@@ -673,7 +2300,7 @@ int validate_filename(const char* filename) {
 }
 
 Client* find_client_by_username(const char* username) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
+    for (int i = 0; i < MAX_SESSIONS; i++) {
         if (clients[i].active && strcmp(clients[i].username, username) == 0) {
             return &clients[i];
         }
@@ -681,7 +2308,18 @@ Client* find_client_by_username(const char* username) {
     return NULL;
 }
 
-Room* find_or_create_room(const char* room_name) {
+// Caller holds rooms_mutex.
+Room* find_room(const char* room_name) {
+    for (int i = 0; i < MAX_ROOMS; i++) {
+        if (rooms[i].active && strcmp(rooms[i].name, room_name) == 0) {
+            return &rooms[i];
+        }
+    }
+    return NULL;
+}
+
+// Caller holds rooms_mutex.
+Room* find_or_create_room_locked(const char* room_name) {
     // First, try to find existing room
     for (int i = 0; i < MAX_ROOMS; i++) {
         if (rooms[i].active && strcmp(rooms[i].name, room_name) == 0) {
@@ -689,9 +2327,20 @@ Room* find_or_create_room(const char* room_name) {
         }
     }
     
+    // Reopen the room's old slot if it is still free: its numbering and the
+    // lines retained for dropped sequenced readers carry on
+    for (int i = 0; i < MAX_ROOMS; i++) {
+        if (!rooms[i].active && strcmp(rooms[i].name, room_name) == 0) {
+            rooms[i].active = 1;
+            rooms[i].member_count = 0;
+            return &rooms[i];
+        }
+    }
+
     // Create new room
     for (int i = 0; i < MAX_ROOMS; i++) {
         if (!rooms[i].active) {
+            seq_room_reset(&rooms[i]);
             strcpy(rooms[i].name, room_name);
             rooms[i].active = 1;
             rooms[i].member_count = 0;
@@ -700,4 +2349,372 @@ Room* find_or_create_room(const char* room_name) {
     }
     
     return NULL; // No available room slots
-}
\ No newline at end of file
+}
+
+uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Waits for more input on the client's socket. Returns 0 once bytes were
+// added to inbuf, -1 on disconnect, or -2 when a hot-restart handoff asks
+// the thread to park.
+static int fill_inbuf(Client* client) {
+    while (1) {
+        if (__atomic_load_n(&handoff_in_progress, __ATOMIC_ACQUIRE)) {
+            return -2;
+        }
+
+        // WebSocket bytes land in ws.raw and reach inbuf as whole frames
+        if (client->websocket) {
+            int decoded = ws_decode_input(&client->ws, client->inbuf, &client->inbuf_len,
+                                          sizeof(client->inbuf), client, client->socket);
+            if (decoded < 0) return -1;
+            if (decoded > 0) return 0;
+        }
+
+        // Only this thread sets or clears the compressor; no lock to read it
+        if (client->compressor && client->inbuf_len < sizeof(client->inbuf)) {
+            ssize_t inflated = compressor_inflate(client->compressor, client->inbuf + client->inbuf_len,
+                                                  sizeof(client->inbuf) - client->inbuf_len);
+            if (inflated < 0) {
+                log_message("[ERROR] Corrupt compressed stream from user '%s'", client->username);
+                return -1;
+            }
+            if (inflated > 0) {
+                client->inbuf_len += inflated;
+                return 0;
+            }
+        }
+
+        // Wait on the socket and the wakeup eventfd so a handoff can stop the
+        // thread between reads without touching the connection
+        struct pollfd fds[2];
+        fds[0].fd = client->socket;
+        fds[0].events = POLLIN;
+        fds[1].fd = wakeup_fd;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+
+        // Compressed input waits in the compressor until it inflates
+        Compressor* compressor = client->compressor;
+        if (compressor) {
+            if (compressor->pending_len == sizeof(compressor->pending)) {
+                return -1;
+            }
+            int bytes = recv(client->socket, compressor->pending + compressor->pending_len,
+                             sizeof(compressor->pending) - compressor->pending_len, 0);
+            if (bytes <= 0) {
+                return -1;
+            }
+            compressor->pending_len += bytes;
+            touch_client(client);
+            continue;
+        }
+
+        if (client->websocket) {
+            int bytes = recv(client->socket, client->ws.raw + client->ws.raw_len,
+                             sizeof(client->ws.raw) - client->ws.raw_len, 0);
+            if (bytes <= 0) {
+                return -1;
+            }
+            client->ws.raw_len += bytes;
+            touch_client(client);
+            continue;
+        }
+
+        int bytes = recv(client->socket, client->inbuf + client->inbuf_len,
+                         sizeof(client->inbuf) - client->inbuf_len, 0);
+        if (bytes <= 0) {
+            return -1;
+        }
+        client->inbuf_len += bytes;
+        touch_client(client);
+        return 0;
+    }
+}
+
+// Reads the next newline-terminated line into `line` (without the newline),
+// buffering any extra bytes for the next call. Returns its length, -1 on
+// disconnect, or -2 when a hot-restart handoff asks the thread to park.
+int read_line(Client* client, char* line, size_t size) {
+    while (1) {
+        if (__atomic_load_n(&handoff_in_progress, __ATOMIC_ACQUIRE)) {
+            return -2;
+        }
+
+        char* newline = memchr(client->inbuf, '\n', client->inbuf_len);
+        if (newline || client->inbuf_len == sizeof(client->inbuf)) {
+            size_t len = newline ? (size_t)(newline - client->inbuf) : client->inbuf_len;
+            size_t consumed = newline ? len + 1 : len;
+            if (len >= size) len = size - 1;
+            memcpy(line, client->inbuf, len);
+            line[len] = '\0';
+            if (len > 0 && line[len - 1] == '\r') line[len - 1] = '\0';
+            consume_input(client, consumed);
+            return (int)strlen(line);
+        }
+
+        int result = fill_inbuf(client);
+        if (result < 0) return result;
+    }
+}
+
+// Binary counterpart of read_line(): parses the next complete frame where
+// it lies in inbuf. Returns its size, to be passed to consume_input() once
+// the request is handled; -1 on disconnect or a malformed frame; -2 for a
+// handoff.
+int read_frame(Client* client, BinFrame* frame) {
+    while (1) {
+        if (__atomic_load_n(&handoff_in_progress, __ATOMIC_ACQUIRE)) {
+            return -2;
+        }
+
+        int size = bin_frame_parse(client->inbuf, client->inbuf_len, frame);
+        if (size < 0) {
+            log_message("[ERROR] Malformed frame from user '%s'", client->username);
+            return -1;
+        }
+        if (size > 0) return size;
+
+        int result = fill_inbuf(client);
+        if (result < 0) return result;
+    }
+}
+
+void consume_input(Client* client, size_t len) {
+    memmove(client->inbuf, client->inbuf + len, client->inbuf_len - len);
+    client->inbuf_len -= len;
+}
+
+// Called on every received chunk. Only records the time; the idle timer
+// notices the newer timestamp when it fires and re-arms itself, so activity
+// never touches the wheel or its lock.
+void touch_client(Client* client) {
+    __atomic_store_n(&client->last_activity_ms, now_ms(), __ATOMIC_RELAXED);
+}
+
+// Runs on the main loop with timers_mutex held.
+void idle_timer_expired(Timer* timer, void* arg) {
+    Client* client = (Client*)arg;
+    uint64_t now = now_ms();
+
+    uint64_t last = __atomic_load_n(&client->last_activity_ms, __ATOMIC_RELAXED);
+    if (now - last >= (uint64_t)config.idle_timeout_ms) {
+        log_message("[TIMEOUT] user '%s' idle for %llu ms. Disconnecting.",
+            client->username, (unsigned long long)(now - last));
+        if (client->gateway) {
+            // Its worker ends the session and tells the gateway
+            gateway_end_session(client);
+        } else {
+            // Wakes the client thread's recv(), which then cleans up
+            shutdown(client->socket, SHUT_RDWR);
+        }
+        return;
+    }
+    timer_arm(&timer_wheel, timer, last + config.idle_timeout_ms - now, now);
+}
+
+// Runs on the main loop with timers_mutex held; the snapshot itself is
+// taken by the loop after the wheel has been advanced.
+void snapshot_timer_expired(Timer* timer, void* arg) {
+    (void)arg;
+    snapshot_due = 1;
+    timer_arm(&timer_wheel, timer, config.snapshot_interval_ms, now_ms());
+}
+
+void heartbeat_timer_expired(Timer* timer, void* arg) {
+    Client* client = (Client*)arg;
+    if (client->binary) {
+        client_send_frame(client, BIN_PING, 0, 0, NULL, NULL);
+    } else if (client->websocket) {
+        // Browsers answer a ping frame on their own; the pong counts as activity
+        char ping[2];
+        client_send_raw(client, ping, ws_frame_header(ping, WS_PING, 0));
+    } else {
+        client_send(client, HEARTBEAT_MESSAGE);
+    }
+    timer_arm(&timer_wheel, timer, config.heartbeat_interval_ms, now_ms());
+}
+
+void print_usage(const char* program) {
+    fprintf(stderr, "Usage: %s [options] <port>\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --login-timeout <ms>   Handshake deadline for the username prompt (default %d)\n", DEFAULT_LOGIN_TIMEOUT_MS);
+    fprintf(stderr, "  --login-attempts <n>   Username attempts before disconnect (default %d)\n", DEFAULT_LOGIN_ATTEMPTS);
+    fprintf(stderr, "  --max-pending <n>      Connections allowed in the handshake at once (default %d)\n", DEFAULT_MAX_PENDING);
+    fprintf(stderr, "  --idle-timeout <ms>    Disconnect clients silent for this long (default %d)\n", DEFAULT_IDLE_TIMEOUT_MS);
+    fprintf(stderr, "  --heartbeat <ms>       Heartbeat interval (default %d)\n", DEFAULT_HEARTBEAT_MS);
+    fprintf(stderr, "  --drain-timeout <ms>   Time allowed to flush clients on shutdown (default %d)\n", DEFAULT_DRAIN_TIMEOUT_MS);
+    fprintf(stderr, "  --handoff <path>       Accept hot-restart takeovers on this Unix socket\n");
+    fprintf(stderr, "  --takeover <path>      Hot restart: take the listener and clients from the server at <path>\n");
+    fprintf(stderr, "  --snapshot <file>      Checkpoint sessions and rooms to a memory-mapped file\n");
+    fprintf(stderr, "  --snapshot-interval <ms> Checkpoint period (default %d)\n", DEFAULT_SNAPSHOT_INTERVAL_MS);
+    fprintf(stderr, "  --cluster-size <n>     Run as one of n processes sharing the port (max %d)\n", CLUSTER_MAX_NODES);
+    fprintf(stderr, "  --cluster-id <id>      This node's id, 0 .. n-1\n");
+    fprintf(stderr, "  --cluster-dir <dir>    Directory for the nodes' link sockets (default %s)\n", DEFAULT_CLUSTER_DIR);
+    fprintf(stderr, "  --no-shm-bus           Send cluster frames over the sockets instead of shared memory\n");
+    fprintf(stderr, "  --link-coalesce <us>   Hold socket link frames this long to batch them (default %d)\n", DEFAULT_LINK_COALESCE_US);
+    fprintf(stderr, "  --gateway-port <port>  Accept chatgateway links on this port\n");
+    fprintf(stderr, "  --replicate <path>     Stream room history to a standby on this Unix socket\n");
+    fprintf(stderr, "  --standby <path>       Follow the leader at <path>; take over the port when it exits\n");
+    fprintf(stderr, "  --ws-port <port>       Accept WebSocket (browser) clients on this port\n");
+    fprintf(stderr, "  --unix <path>          Also accept clients on this Unix domain socket\n");
+    fprintf(stderr, "  --batch-window <us>    Hold a busy client's output this long to write it at once (default off)\n");
+    fprintf(stderr, "  --batch-messages <n>   ...or until this many messages are held (default %d)\n", DEFAULT_BATCH_MESSAGES);
+    fprintf(stderr, "  --fanout-workers <n>   Threads that help deliver to very large rooms (default off)\n");
+    fprintf(stderr, "  --fanout-shard <n>     Room members per fan-out thread (default %d)\n", DEFAULT_FANOUT_SHARD);
+    fprintf(stderr, "  --presence-window <ms> Collect joins, leaves and typing this long per room (default %d)\n", DEFAULT_PRESENCE_WINDOW_MS);
+    fprintf(stderr, "  --filter <file>        Refuse messages containing a phrase from <file> (SIGHUP reloads)\n");
+}
+
+void parse_arguments(int argc, char* argv[]) {
+    static const struct option options[] = {
+        { "login-timeout", required_argument, NULL, 'l' },
+        { "login-attempts", required_argument, NULL, 'a' },
+        { "max-pending", required_argument, NULL, 'p' },
+        { "idle-timeout", required_argument, NULL, 'i' },
+        { "heartbeat", required_argument, NULL, 'b' },
+        { "drain-timeout", required_argument, NULL, 'd' },
+        { "handoff", required_argument, NULL, 'H' },
+        { "takeover", required_argument, NULL, 'T' },
+        { "snapshot", required_argument, NULL, 'S' },
+        { "snapshot-interval", required_argument, NULL, 's' },
+        { "cluster-size", required_argument, NULL, 'n' },
+        { "cluster-id", required_argument, NULL, 'c' },
+        { "cluster-dir", required_argument, NULL, 'D' },
+        { "no-shm-bus", no_argument, NULL, 'B' },
+        { "link-coalesce", required_argument, NULL, 'C' },
+        { "gateway-port", required_argument, NULL, 'g' },
+        { "replicate", required_argument, NULL, 'R' },
+        { "standby", required_argument, NULL, 'F' },
+        { "ws-port", required_argument, NULL, 'W' },
+        { "unix", required_argument, NULL, 'U' },
+        { "batch-window", required_argument, NULL, 'w' },
+        { "batch-messages", required_argument, NULL, 'm' },
+        { "fanout-workers", required_argument, NULL, 'f' },
+        { "fanout-shard", required_argument, NULL, 'k' },
+        { "presence-window", required_argument, NULL, 'P' },
+        { "filter", required_argument, NULL, 'M' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        if (opt == 'H' || opt == 'T' || opt == 'S' || opt == 'D' || opt == 'R' || opt == 'F' || opt == 'U' || opt == 'M') {
+            if (opt == 'H') config.handoff_path = optarg;
+            else if (opt == 'T') config.takeover_path = optarg;
+            else if (opt == 'S') config.snapshot_path = optarg;
+            else if (opt == 'R') config.replicate_path = optarg;
+            else if (opt == 'F') config.standby_path = optarg;
+            else if (opt == 'U') config.unix_path = optarg;
+            else if (opt == 'M') config.filter_path = optarg;
+            else config.cluster_dir = optarg;
+            continue;
+        }
+        // Node ids start at 0, so this one skips the positive-value check
+        if (opt == 'c') {
+            char* end;
+            config.cluster_id = (int)strtol(optarg, &end, 10);
+            if (*end != '\0' || config.cluster_id < 0) {
+                fprintf(stderr, "Invalid value for option: %s\n", optarg);
+                exit(1);
+            }
+            continue;
+        }
+        int value = optarg ? atoi(optarg) : 0;
+        if (optarg && value <= 0) {
+            fprintf(stderr, "Invalid value for option: %s\n", optarg);
+            exit(1);
+        }
+        switch (opt) {
+            case 'l': config.login_timeout_ms = value; break;
+            case 'a': config.max_login_attempts = value; break;
+            case 'p': config.max_pending_logins = value; break;
+            case 'i': config.idle_timeout_ms = value; break;
+            case 'b': config.heartbeat_interval_ms = value; break;
+            case 'd': config.drain_timeout_ms = value; break;
+            case 's': config.snapshot_interval_ms = value; break;
+            case 'n': config.cluster_size = value; break;
+            case 'B': config.cluster_shm_bus = 0; break;
+            case 'C': config.link_coalesce_us = value; break;
+            case 'g': config.gateway_port = value; break;
+            case 'W': config.ws_port = value; break;
+            case 'w': config.batch_window_us = value; break;
+            case 'm': config.batch_messages = value; break;
+            case 'f': config.fanout_workers = value; break;
+            case 'k': config.fanout_shard = value; break;
+            case 'P': config.presence_window_ms = value; break;
+            case 'h':
+                print_usage(argv[0]);
+                exit(0);
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    // A successor keeps accepting handoffs on the same path
+    if (config.takeover_path && !config.handoff_path) {
+        config.handoff_path = config.takeover_path;
+    }
+    // ...and a standby that took over serves the next standby on its path
+    if (config.standby_path && !config.replicate_path) {
+        config.replicate_path = config.standby_path;
+    }
+
+    if (config.cluster_size > CLUSTER_MAX_NODES || config.cluster_id >= config.cluster_size) {
+        fprintf(stderr, "Cluster id must be below --cluster-size (at most %d nodes)\n", CLUSTER_MAX_NODES);
+        exit(1);
+    }
+    // Peer links are not part of the handoff stream
+    if (config.cluster_size > 1 && config.handoff_path) {
+        fprintf(stderr, "--handoff/--takeover cannot be combined with cluster mode\n");
+        exit(1);
+    }
+    // Gateway sessions have no socket to hand off, logins through a gateway
+    // do not go through the cluster directory yet, and snapshots hold the
+    // direct slots only
+    if (config.gateway_port && (config.handoff_path || config.cluster_size > 1 || config.snapshot_path)) {
+        fprintf(stderr, "--gateway-port cannot be combined with --handoff/--takeover, --snapshot or cluster mode\n");
+        exit(1);
+    }
+
+    // A WebSocket's undecoded frames are not part of the handoff stream
+    if (config.ws_port && config.handoff_path) {
+        fprintf(stderr, "--ws-port cannot be combined with --handoff/--takeover\n");
+        exit(1);
+    }
+
+    // Each node of a cluster holds only part of the history, and a takeover
+    // already inherits the listener from a live predecessor
+    if ((config.replicate_path || config.standby_path) && (config.cluster_size > 1 || config.takeover_path)) {
+        fprintf(stderr, "--replicate/--standby cannot be combined with --takeover or cluster mode\n");
+        exit(1);
+    }
+
+    if (argc - optind != 1) {
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+    config.port = atoi(argv[optind]);
+    if (config.port <= 0 || config.port > 10000) {
+        fprintf(stderr, "Invalid port number\n");
+        exit(1);
+    }
+}
@@ -0,0 +1,561 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <getopt.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+
+#include "timer_wheel.h"
+#include "bus.h"
+#include "directory.h"
+#include "gateway_proto.h"
+#include "link_proto.h"
+#include "client_proto.h"
+#include "websocket.h"
+#include "compress.h"
+#include "fanout.h"
+#include "filter.h"
+
+#define MAX_CLIENTS 15          // direct connections (TCP, Unix, WebSocket)
+#define MAX_ROOMS 64           // Client.room_mask has a bit per slot
+#define MAX_USERNAME_LEN 16
+#define MAX_ROOM_NAME_LEN 32
+#define MAX_MESSAGE_LEN 1024
+#define MAX_FILE_SIZE 3145728  // 3MB
+#define MAX_UPLOAD_QUEUE 5
+#define BUFFER_SIZE 4096
+
+// Connection timers (milliseconds) and handshake limits; defaults for ServerConfig
+#define TIMER_TICK_MS 100
+#define DEFAULT_LOGIN_TIMEOUT_MS 30000
+#define DEFAULT_LOGIN_ATTEMPTS 3
+#define DEFAULT_MAX_PENDING 64
+#define DEFAULT_IDLE_TIMEOUT_MS 120000
+#define DEFAULT_HEARTBEAT_MS 30000
+#define HEARTBEAT_MESSAGE "[PING]\n"
+#define LOGIN_LINE_LEN 64
+#define DEFAULT_DRAIN_TIMEOUT_MS 5000
+#define MAX_OUTBOUND_BYTES 262144  // per client; slower readers are dropped
+#define DEFAULT_BATCH_MESSAGES 32  // held for one client before the window closes early
+#define DEFAULT_FANOUT_SHARD 1024  // room members per parallel fan-out shard
+#define FLUSH_IOV_MAX 64           // queued chunks handed to one sendmsg()
+#define HANDOFF_PARK_TIMEOUT_MS 2000
+#define HANDOFF_ACK_TIMEOUT_MS 5000
+#define DEFAULT_SNAPSHOT_INTERVAL_MS 1000
+#define SNAPSHOT_RESTORE_GRACE_MS 300000  // remembered sessions expire after this
+
+// Cluster mode: processes sharing the port, rooms sharded by consistent hash
+#define CLUSTER_MAX_NODES 64       // node masks are 64-bit
+#define CLUSTER_VNODES 64          // ring points per node
+#define CLUSTER_MAX_ROOMS 256      // rooms one owner routes across nodes
+#define CLUSTER_RECONNECT_MS 1000
+#define CLUSTER_FRAME_LEN (BUFFER_SIZE + 128)
+#define MAX_LINK_BYTES 4194304     // per peer link; a slower peer is reset
+#define DEFAULT_CLUSTER_DIR "/tmp"
+#define BUS_RING_BYTES 1048576    // per direction between two nodes
+#define BUS_SPIN_ITERATIONS 20000  // reader polls this long before sleeping
+#define DIRECTORY_CAPACITY 1024    // usernames per node before the tables grow
+#define DIRECTORY_CLAIM_TIMEOUT_MS 2000
+#define DIRECTORY_LOOKUP_TIMEOUT_MS 500
+#define LINK_WINDOW_FRAMES 32       // batches a peer may have unacknowledged
+#define DEFAULT_LINK_COALESCE_US 200
+
+// Room history, kept warm on a hot standby
+#define HISTORY_LOG_ENTRIES 1024   // shared by all rooms, oldest dropped first
+#define HISTORY_REPLAY_LEN 20      // shown to a client joining a room
+#define STANDBY_RETRY_MS 100       // between attempts to reach the leader again
+#define STANDBY_TAKEOVER_MS 2000   // unreachable this long, the leader is gone
+
+// Sequenced delivery (/sequenced): numbered room lines kept until ACKed
+#define SEQ_RETAIN_BYTES 262144    // per room; the oldest unacknowledged go first
+#define SEQ_RESUME_SLOTS 64        // dropped sessions whose place is kept
+#define SEQ_RESUME_GRACE_MS 60000  // how long a dropped session's ACK holds lines
+
+// Session resumption: a dropped text session comes back with "/reconnect <token>"
+#define SESSION_TOKEN_BYTES 16
+#define SESSION_TOKEN_LEN (SESSION_TOKEN_BYTES * 2)  // as hex
+#define SESSION_SLOTS 64           // dropped sessions waiting for their client
+#define SESSION_GRACE_MS SEQ_RESUME_GRACE_MS  // the room keeps their lines as long
+#define SESSION_PENDING_BYTES 65536  // undelivered output kept per session
+
+// Presence (/presence, /typing): joins, leaves and typing, sent per room per window
+#define DEFAULT_PRESENCE_WINDOW_MS 500
+#define PRESENCE_MAX_CHANGES 32    // names in one room's line; the rest are counted
+#define PRESENCE_TYPING_INTERVAL_MS 2000  // /typing taken from a client this often
+
+// Peer address families, as counted by /stats. IPv4 clients reaching the
+// dual-stack listener are stored as plain AF_INET addresses.
+enum {
+    ADDR_FAMILY_IPV4,
+    ADDR_FAMILY_IPV6,
+    ADDR_FAMILY_LOCAL,
+    ADDR_FAMILY_COUNT
+};
+#define ADDRESS_STRLEN INET6_ADDRSTRLEN
+
+// Edge gateways (chatgateway) multiplexing client sessions over a few links
+#define MAX_GATEWAY_LINKS 16
+#define MAX_GATEWAY_SESSIONS 1024  // client slots past MAX_CLIENTS, for gateway sessions only
+#define MAX_SESSIONS (MAX_CLIENTS + MAX_GATEWAY_SESSIONS)
+#define GATEWAY_INBUF_SIZE 65536   // per link; many sessions' frames per read
+#define GATEWAY_WORKERS 8          // threads running gateway sessions' commands
+#define GATEWAY_BURST 16           // lines a worker runs for one session before the next
+
+// Structures
+typedef struct {
+    int port;
+    int login_timeout_ms;
+    int max_login_attempts;
+    int max_pending_logins;     // pre-auth connections, separate from MAX_CLIENTS
+    int idle_timeout_ms;
+    int heartbeat_interval_ms;
+    int drain_timeout_ms;       // shutdown flush budget
+    const char* handoff_path;   // Unix socket a successor connects to for hot restart
+    const char* takeover_path;  // predecessor to take the listener and clients from
+    const char* snapshot_path;  // memory-mapped state checkpoint
+    int snapshot_interval_ms;
+    int cluster_id;             // this node, 0 .. cluster_size - 1
+    int cluster_size;           // 1 = standalone
+    const char* cluster_dir;    // where the nodes' link sockets live
+    int cluster_shm_bus;        // frames over shared-memory rings, not sockets
+    int link_coalesce_us;       // how long a socket link batch stays open
+    int gateway_port;           // 0 = no gateway links
+    const char* replicate_path; // Unix socket a standby tails room history from
+    const char* standby_path;   // leader to follow until it goes away
+    int ws_port;                // 0 = no WebSocket listener
+    const char* unix_path;      // AF_UNIX listener for local bots and services
+    int batch_window_us;        // 0 = write client output at once, always
+    int batch_messages;         // a held batch this long is written without waiting
+    int fanout_workers;         // 0 = the broadcasting thread walks every room alone
+    int fanout_shard;           // members per shard; smaller rooms stay on one thread
+    int presence_window_ms;     // presence changes are collected this long per room
+    const char* filter_path;    // banned phrases for /broadcast and /whisper; SIGHUP reloads
+} ServerConfig;
+
+// Tag at the start of everything registered with the main loop's epoll
+typedef enum {
+    SOURCE_LISTENER,
+    SOURCE_PENDING_LOGIN,
+    SOURCE_SIGNAL,
+    SOURCE_CLIENT_OUTPUT,
+    SOURCE_HANDOFF,
+    SOURCE_CLUSTER_LISTENER,
+    SOURCE_PEER_INPUT,
+    SOURCE_PEER_OUTPUT,
+    SOURCE_LINK_FLUSH,
+    SOURCE_CLAIM_RESULTS,
+    SOURCE_GATEWAY_LISTENER,
+    SOURCE_GATEWAY_OUTPUT,
+    SOURCE_WS_LISTENER,
+    SOURCE_UNIX_LISTENER,
+    SOURCE_BATCH_FLUSH,
+    SOURCE_PRESENCE_FLUSH,
+    SOURCE_FILTER_RELOADED,
+    SOURCE_TIMERS_CHANGED
+} EventSourceKind;
+
+typedef struct {
+    EventSourceKind kind;
+} EventSource;
+
+// Output formatted once and queued for many clients (/announce); freed
+// when the last queue lets go of it
+typedef struct {
+    int refs;
+    size_t len;
+    char data[];
+} SharedBuffer;
+
+// Bytes a client could not take yet; drained by the main loop on EPOLLOUT
+typedef struct OutChunk {
+    struct OutChunk* next;
+    size_t len;
+    size_t offset;
+    SharedBuffer* shared;       // if set, the bytes are shared->data, not data[]
+    char data[];
+} OutChunk;
+
+// Link from a chatgateway process. One reader thread splits incoming frames
+// into the sessions' input queues, and a small pool of workers shared by
+// every link runs the sessions' commands. Output from any thread goes
+// through the same queue as a client's, drained by the main loop.
+typedef struct {
+    EventSource source;
+    int socket;
+    int active;
+    int sessions;               // sessions not ended yet; guarded by out_mutex
+    pthread_cond_t sessions_done; // the closing link waits for its last session
+    pthread_mutex_t out_mutex;
+    OutChunk* out_head;
+    OutChunk* out_tail;
+    size_t out_bytes;
+    int out_watched;
+    char inbuf[GATEWAY_INBUF_SIZE];
+    size_t inbuf_len;
+} GatewayLink;
+
+typedef struct {
+    EventSource source;
+    int socket;
+    char username[MAX_USERNAME_LEN + 1];
+    char current_room[MAX_ROOM_NAME_LEN + 1];  // where /broadcast goes; "" if in no room
+    uint64_t room_mask;         // rooms[] slots it is a member of; guarded by rooms_mutex
+    struct sockaddr_storage addr;
+    int active;
+    int pins;                   // deliver_to_all() walkers still using the slot; guarded by clients_mutex
+    char inbuf[BUFFER_SIZE];    // received bytes not yet consumed as a line
+    size_t inbuf_len;
+    uint64_t last_activity_ms;  // updated lock-free by the client thread
+    Timer idle_timer;
+    Timer heartbeat_timer;
+    pthread_mutex_t out_mutex;  // guards the outbound queue and socket close
+    OutChunk* out_head;
+    OutChunk* out_tail;
+    size_t out_bytes;
+    int out_watched;            // registered for EPOLLOUT
+    int out_overflow;           // queue limit hit; connection is being dropped
+    uint64_t last_write_us;     // --batch-window: when output last went out unheld
+    int batch_held;             // messages queued for the batch timer, not on EPOLLOUT
+    int resumed;                // session carried over from a previous process
+    int parked;                 // thread stopped for a hot-restart handoff
+    GatewayLink* gateway;       // session arrived through a gateway; no socket
+    uint32_t session;           // the gateway's id for it
+    pthread_mutex_t input_mutex; // gateway sessions: inbuf is filled by the link's reader
+    int input_queued;           // on a gateway worker's run queue, or being run
+    int input_closed;           // the gateway or its link ended the session
+    int binary;                 // speaks the binary protocol (client_proto.h)
+    int websocket;              // input arrives as frames in ws, output leaves as text frames
+    WsStream ws;
+    int sequenced;              // gets numbered room lines and sends /ack
+    int resuming;               // next join replays what follows resume_from
+    uint64_t resume_from;
+    uint64_t acked_seq[MAX_ROOMS];  // per rooms[] slot; guarded by rooms_mutex
+    char session_token[SESSION_TOKEN_LEN + 1];  // empty: not resumable (/exit, binary, ...)
+    int reconnecting;           // registered by /reconnect; the thread restores the session
+    int presence;               // subscribed to presence lines (/presence)
+    uint64_t last_typing_ms;    // last /typing taken, for the rate cap
+    pthread_mutex_t compress_mutex; // orders deflate output into the queue
+    Compressor* compressor;     // set by /compress; both directions are deflated
+} Client;
+
+// Connection that has not registered a username yet. Owned entirely by the
+// main loop: no thread and no client slot until the handshake succeeds.
+typedef struct {
+    EventSource source;
+    int socket;
+    struct sockaddr_storage addr;
+    char buffer[LOGIN_LINE_LEN];
+    size_t buffer_len;
+    int attempts;
+    int active;
+    int binary;                 // sent BIN_MAGIC; attempts are LOGIN frames
+    uint32_t request_id;        // of the LOGIN frame being handled
+    int websocket;              // accepted on --ws-port
+    int ws_upgraded;            // HTTP upgrade done; input is frames
+    WsStream ws;
+    Timer deadline;
+    char reconnect_token[SESSION_TOKEN_LEN + 1];  // this attempt is a /reconnect
+    // Cluster mode: waiting for the directory owner to grant the username
+    int claiming;
+    int claim_granted;
+    uint32_t claim_seq;         // tells a stale answer from the current one
+    char claim_name[MAX_USERNAME_LEN + 1];
+    size_t claim_consumed;
+    Timer claim_timer;
+} PendingLogin;
+
+// Sending half of the link to another cluster node
+typedef struct {
+    EventSource source;
+    int node;
+    int socket;
+    pthread_mutex_t out_mutex;
+    OutChunk* out_head;
+    OutChunk* out_tail;
+    size_t out_bytes;
+    int out_watched;
+    BusRing* ring;              // when set, frames go here instead of the socket
+    int resync;                 // frames were dropped; resend memberships
+    LinkBatch batch;            // frames not sealed into a batch yet
+    uint32_t next_seq;
+    uint32_t acked_seq;         // last batch the peer has processed
+    uint16_t window;            // batches past acked_seq it will take
+    char ackbuf[LINK_HEADER_BYTES];
+    size_t ackbuf_len;
+} PeerLink;
+
+// Receiving half of a link from another cluster node; main loop only
+typedef struct {
+    EventSource source;
+    int socket;
+    int node;                   // -1 until the peer says HELLO
+    char inbuf[LINK_MAX_FRAME * 2];
+    size_t inbuf_len;
+    uint32_t expected_seq;      // next batch number from the peer
+    int ack_pending;            // the last ACK did not fit in the socket
+    int active;
+    int ring_fd;                // received with HELLO, until it is mapped
+    BusRing* ring;
+    pthread_t reader;           // consumes `ring`
+} PeerInbound;
+
+// Numbered room line kept for sequenced readers that have not ACKed it
+typedef struct RetainedLine {
+    struct RetainedLine* next;
+    uint64_t seq;
+    size_t len;
+    char data[];
+} RetainedLine;
+
+typedef struct {
+    char name[MAX_ROOM_NAME_LEN + 1];
+    Client* members[MAX_SESSIONS];
+    int member_count;
+    int active;
+    uint64_t seq;               // number of the last broadcast
+    uint64_t version;           // membership stamp for cached listings (listing.c)
+    RetainedLine* retained_head;
+    RetainedLine* retained_tail;
+    size_t retained_bytes;
+} Room;
+
+typedef struct {
+    uint64_t seq;
+    char room[MAX_ROOM_NAME_LEN + 1];
+    char sender[MAX_USERNAME_LEN + 1];
+    char text[MAX_MESSAGE_LEN + 1];
+} HistoryEntry;
+
+typedef struct {
+    char filename[256];
+    char sender[MAX_USERNAME_LEN + 1];
+    char receiver[MAX_USERNAME_LEN + 1];
+    size_t file_size;
+    char* file_data;
+    time_t timestamp;
+} FileTransfer;
+
+typedef struct {
+    FileTransfer queue[MAX_UPLOAD_QUEUE];
+    int front, rear, count;
+    pthread_mutex_t mutex;
+    sem_t slots;
+    sem_t items;
+} UploadQueue;
+
+// Global variables (defined in server.c)
+extern Client clients[MAX_SESSIONS];
+extern Room rooms[MAX_ROOMS];
+extern UploadQueue upload_queue;
+extern pthread_mutex_t clients_mutex;
+extern pthread_mutex_t rooms_mutex;
+extern pthread_mutex_t log_mutex;
+extern pthread_mutex_t timers_mutex;
+extern TimerWheel timer_wheel;
+extern FanoutPool fanout_pool;
+extern ServerConfig config;
+extern PendingLogin* pending_logins;
+extern int pending_count;
+extern int epoll_fd;
+extern EventSource listener_source;
+extern int signal_fd;
+extern int server_socket;
+extern int server_running;
+extern int shutdown_signal;
+extern int wakeup_fd;
+extern int handoff_in_progress;
+extern FILE* log_file;
+
+// Function prototypes
+void* client_handler(void* arg);
+void* file_transfer_handler(void* arg);
+void log_message(const char* format, ...);
+void send_to_client(int socket, const char* message);
+void client_send(Client* client, const char* message);
+void client_send_bytes(Client* client, const char* data, size_t len);
+void client_send_raw(Client* client, const char* data, size_t len);
+void client_send_shared(Client* client, SharedBuffer* buffer);
+SharedBuffer* shared_buffer_create(const char* data, size_t len);
+void shared_buffer_release(SharedBuffer* buffer);
+const char* out_chunk_bytes(const OutChunk* chunk);
+void out_chunk_free(OutChunk* chunk);
+void client_send_frame(Client* client, int op, uint32_t id, int count, const char* const fields[], const size_t lens[]);
+int flush_client_output(Client* client);
+void handle_client_output(Client* client);
+void flush_batched_output(void);
+void broadcast_to_room(const char* room_name, const char* message, const char* sender);
+void handle_join_room(Client* client, const char* room_name);
+void handle_leave_room(Client* client, const char* room_name);
+void leave_all_rooms(Client* client);
+void handle_whisper(Client* client, const char* target, const char* message);
+void handle_broadcast(Client* client, const char* message);
+void handle_file_send(Client* client, const char* filename, const char* target);
+void handle_stats(Client* client);
+void handle_compress(Client* client);
+void handle_announce(Client* client, const char* text);
+int announce_local(const char* sender, const char* text);
+void cleanup_client(Client* client);
+void handle_signal(void);
+void shutdown_server(void);
+size_t outbound_bytes_pending(void);
+int validate_username(const char* username);
+int validate_room_name(const char* room_name);
+int validate_filename(const char* filename);
+Client* find_client_by_username(const char* username);
+Room* find_or_create_room_locked(const char* room_name);
+Room* find_room(const char* room_name);
+uint64_t now_ms(void);
+uint64_t now_us(void);
+void touch_client(Client* client);
+void idle_timer_expired(Timer* timer, void* arg);
+void heartbeat_timer_expired(Timer* timer, void* arg);
+int open_tcp_listener(int port, int backlog, int flags);
+int open_unix_listener(const char* path);
+int address_family(const struct sockaddr_storage* addr);
+void format_address(const struct sockaddr_storage* addr, char* out, size_t size);
+int parse_address(const char* text, struct sockaddr_storage* addr);
+void count_login(const struct sockaddr_storage* addr);
+void accept_clients(int listener, int websocket);
+void handle_pending_login(PendingLogin* login);
+void close_pending_login(PendingLogin* login);
+int register_pending_login(PendingLogin* login, const char* username, size_t consumed);
+void process_login_lines(PendingLogin* login);
+int login_attempt_failed(PendingLogin* login, const char* username, size_t consumed, int result);
+void claim_timer_expired(Timer* timer, void* arg);
+void finish_username_claim(uint64_t token, const char* username, int result);
+void login_deadline_expired(Timer* timer, void* arg);
+int read_line(Client* client, char* line, size_t size);
+int read_frame(Client* client, BinFrame* frame);
+void consume_input(Client* client, size_t len);
+void start_client_session(Client* client);
+void arm_client_timers(Client* client);
+void greet_client(Client* client);
+int handle_command(Client* client, char* buffer);
+int handle_binary_command(Client* client, BinFrame* frame);
+void handle_file_chunk(Client* client, const char* target, const char* filename, const char* data, size_t len,
+                       const char* transfer);
+void snapshot_timer_expired(Timer* timer, void* arg);
+int add_room_member(Client* client, const char* room_name, int replay_history);
+void parse_arguments(int argc, char* argv[]);
+void print_usage(const char* program);
+
+// handoff.c
+int send_all(int sock, const void* data, size_t len);
+int recv_all(int sock, void* data, size_t len);
+int send_with_fd(int sock, const void* data, size_t len, int fd);
+int open_handoff_listener(const char* path);
+int handle_handoff_request(int handoff_socket);
+int adopt_from_predecessor(const char* path);
+void exit_after_handoff(void);
+
+// cluster.c
+extern int cluster_reconnect_due;
+int cluster_start(void);
+void cluster_stop(void);
+int cluster_enabled(void);
+int cluster_room_owner(const char* room_name);
+int cluster_broadcast(const char* room_name, const char* sender, const char* message);
+int cluster_whisper(const char* sender, const char* target, const char* message);
+int cluster_announce(const char* sender, const char* text);
+int cluster_claim_username(const char* username, uint64_t token);
+void cluster_release_username(const char* username);
+void cluster_post_claim_result(uint64_t token, const char* username, int result);
+void cluster_handle_claim_results(void);
+void cluster_room_membership(const char* room_name, int present);
+void cluster_connect_peers(void);
+void cluster_accept_links(void);
+void handle_peer_input(PeerInbound* in);
+void handle_peer_output(PeerLink* link);
+void cluster_flush_links(void);
+
+// gateway_link.c
+int gateway_listen(int port);
+void gateway_accept_links(void);
+void gateway_send(GatewayLink* link, uint32_t session, int type, const char* data, size_t len);
+void handle_gateway_output(GatewayLink* link);
+size_t gateway_bytes_pending(void);
+void gateway_stop(void);
+void gateway_end_session(Client* client);
+
+// history.c
+void history_append(const char* room_name, const char* sender, const char* message);
+void history_replay(Client* client, const char* room_name);
+int replica_listen(const char* path);
+void standby_follow(const char* path);
+
+// ws_session.c
+int ws_listen(int port);
+void ws_accept_clients(void);
+void ws_stop(void);
+void ws_send_text(int socket, const char* message);
+int ws_decode_input(WsStream* stream, char* out, size_t* out_len, size_t out_size, Client* client, int socket);
+void ws_handle_pending_login(PendingLogin* login);
+
+// sequence.c
+void seq_append(Room* room, const char* sender, const char* message, char* line, size_t size);
+void seq_room_reset(Room* room);
+void seq_member_joined(Client* client, Room* room);
+void seq_remember(Client* client, Room* room);
+void handle_sequenced(Client* client);
+void handle_ack(Client* client, char* arg);
+void handle_resume(Client* client, const char* room_name, uint64_t seq);
+int seq_rejoin(Client* client, const char* room_name, uint64_t seq);
+void seq_adopt(Client* client, const char* room_name, uint64_t acked, uint64_t room_seq);
+void seq_format_stats(char* line, size_t size);
+
+// listing.c
+void listing_invalidate(Room* room);
+void handle_who(Client* client, const char* arg);
+void handle_rooms(Client* client);
+void listing_format_stats(char* line, size_t size);
+
+// moderation.c
+int moderation_load(const char* path);
+void moderation_reload(void);
+void moderation_handle_reload(void);
+int moderation_blocks(const char* text);
+void moderation_format_stats(char* line, size_t size);
+
+// presence.c
+int presence_start(void);
+void presence_note(const char* room_name, const char* username, int joined);
+void presence_joined_room(Client* client, const char* room_name);
+void presence_flush(void);
+void handle_presence(Client* client, const char* arg);
+void handle_typing(Client* client);
+void presence_format_stats(char* line, size_t size);
+
+// session.c
+void session_issue(Client* client);
+void session_keep(Client* client);
+void session_discard(const char* username);
+int session_reconnect(PendingLogin* login, const char* token, char* username, size_t consumed);
+void session_restore(Client* client);
+int session_hold_output(const char* username, const char* data, size_t len);
+void session_format_stats(char* line, size_t size);
+
+// snapshot.c
+int snapshot_open(const char* path);
+void snapshot_take(void);
+int snapshot_claim_rooms(const char* username, char names[][MAX_ROOM_NAME_LEN + 1], char* current);
+void snapshot_close(void);
+
+#endif
@@ -0,0 +1,303 @@
+#include "server.h"
+
+#include <sys/random.h>
+
+// Session resumption. Every plain text session is given a token after it
+// logs in, "[SESSION] Token <hex>". If the connection drops without /exit,
+// the server keeps a ticket under that token for SESSION_GRACE_MS. The
+// ticket holds the username, the rooms and its place in each, and the
+// output that was queued but never written. A client that reconnects sends
+// "/reconnect <token>" instead of a username. In that one round trip it is
+// back in its rooms with what it missed, and gets a new token. Whispers to a
+// user whose ticket is waiting are held for it.
+//
+// The room lines broadcast while the session was away come from the room's
+// retention for sequenced readers (sequence.c): cleanup_client() keeps a
+// resume slot there for the dropped session, as for a dropped /sequenced
+// reader.
+//
+// Tickets live in this process only. A hot restart carries the tokens of
+// live sessions, but not the tickets of sessions that were already gone.
+
+typedef struct {
+    char token[SESSION_TOKEN_LEN + 1];
+    char username[MAX_USERNAME_LEN + 1];
+    char current_room[MAX_ROOM_NAME_LEN + 1];
+    int room_count;
+    char rooms[MAX_ROOMS][MAX_ROOM_NAME_LEN + 1];
+    uint64_t acked[MAX_ROOMS];  // last line read (sequenced) or queued, per room
+    int sequenced;
+    int presence;
+    OutChunk* out_head;         // undelivered output, oldest first
+    OutChunk* out_tail;
+    size_t out_bytes;
+    size_t lost_bytes;          // output that did not fit or could not be kept
+    uint64_t expires_ms;
+    int active;
+} SessionTicket;
+
+static pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SessionTicket tickets[SESSION_SLOTS];
+static uint64_t sessions_kept;
+static uint64_t sessions_resumed;
+static uint64_t sessions_expired;
+
+static void ticket_clear(SessionTicket* ticket) {
+    while (ticket->out_head) {
+        OutChunk* chunk = ticket->out_head;
+        ticket->out_head = chunk->next;
+        free(chunk);
+    }
+    ticket->out_tail = NULL;
+    ticket->out_bytes = 0;
+    ticket->lost_bytes = 0;
+    ticket->active = 0;
+}
+
+// Caller holds sessions_mutex.
+static void expire_tickets(void) {
+    uint64_t now = now_ms();
+    for (int i = 0; i < SESSION_SLOTS; i++) {
+        if (tickets[i].active && now >= tickets[i].expires_ms) {
+            ticket_clear(&tickets[i]);
+            sessions_expired++;
+        }
+    }
+}
+
+// Caller holds sessions_mutex.
+static SessionTicket* find_ticket(const char* token, const char* username) {
+    expire_tickets();
+    for (int i = 0; i < SESSION_SLOTS; i++) {
+        SessionTicket* ticket = &tickets[i];
+        if (!ticket->active) continue;
+        if (token && strcmp(ticket->token, token) == 0) return ticket;
+        if (username && strcmp(ticket->username, username) == 0) return ticket;
+    }
+    return NULL;
+}
+
+static void append_output(SessionTicket* ticket, const char* data, size_t len) {
+    if (ticket->out_bytes + len > SESSION_PENDING_BYTES) {
+        ticket->lost_bytes += len;
+        return;
+    }
+    OutChunk* chunk = malloc(sizeof(OutChunk) + len);
+    if (!chunk) {
+        ticket->lost_bytes += len;
+        return;
+    }
+    chunk->next = NULL;
+    chunk->len = len;
+    chunk->offset = 0;
+    chunk->shared = NULL;
+    memcpy(chunk->data, data, len);
+    if (ticket->out_tail) {
+        ticket->out_tail->next = chunk;
+    } else {
+        ticket->out_head = chunk;
+    }
+    ticket->out_tail = chunk;
+    ticket->out_bytes += len;
+}
+
+// Gives the session a fresh token and tells the client.
+void session_issue(Client* client) {
+    unsigned char random[SESSION_TOKEN_BYTES];
+    if (getrandom(random, sizeof(random), 0) != (ssize_t)sizeof(random)) {
+        // No token: the session still works, it just cannot be resumed
+        client->session_token[0] = '\0';
+        return;
+    }
+    for (int i = 0; i < SESSION_TOKEN_BYTES; i++) {
+        snprintf(client->session_token + i * 2, 3, "%02x", random[i]);
+    }
+    char line[64];
+    snprintf(line, sizeof(line), "[SESSION] Token %s\n", client->session_token);
+    client_send(client, line);
+}
+
+// Called from cleanup_client() for a session that dropped with a token,
+// before it leaves its rooms. Output still queued moves into the ticket,
+// except for sequenced sessions, whose room lines are replayed from their
+// last ACK instead, and compressed ones, whose queue is deflated for a
+// stream the next connection will not have.
+void session_keep(Client* client) {
+    SessionTicket ticket;
+    memset(&ticket, 0, sizeof(ticket));
+    strcpy(ticket.token, client->session_token);
+    strcpy(ticket.username, client->username);
+    strcpy(ticket.current_room, client->current_room);
+    ticket.sequenced = client->sequenced;
+    ticket.presence = client->presence;
+    pthread_mutex_lock(&rooms_mutex);
+    for (uint64_t mask = client->room_mask; mask; mask &= mask - 1) {
+        int index = __builtin_ctzll(mask);
+        strcpy(ticket.rooms[ticket.room_count], rooms[index].name);
+        ticket.acked[ticket.room_count] = client->sequenced ? client->acked_seq[index] : rooms[index].seq;
+        ticket.room_count++;
+    }
+    pthread_mutex_unlock(&rooms_mutex);
+
+    pthread_mutex_lock(&client->out_mutex);
+    int keep_output = !client->sequenced && !client->compressor;
+    for (OutChunk* chunk = client->out_head; chunk; chunk = chunk->next) {
+        if (keep_output) {
+            append_output(&ticket, out_chunk_bytes(chunk) + chunk->offset, chunk->len - chunk->offset);
+        } else {
+            ticket.lost_bytes += chunk->len - chunk->offset;
+        }
+    }
+    pthread_mutex_unlock(&client->out_mutex);
+
+    pthread_mutex_lock(&sessions_mutex);
+    expire_tickets();
+    SessionTicket* slot = NULL;
+    for (int i = 0; i < SESSION_SLOTS && !slot; i++) {
+        if (!tickets[i].active) slot = &tickets[i];
+    }
+    // Full: the ticket closest to expiring goes
+    if (!slot) {
+        slot = &tickets[0];
+        for (int i = 1; i < SESSION_SLOTS; i++) {
+            if (tickets[i].expires_ms < slot->expires_ms) slot = &tickets[i];
+        }
+        ticket_clear(slot);
+        sessions_expired++;
+    }
+    *slot = ticket;
+    slot->expires_ms = now_ms() + SESSION_GRACE_MS;
+    slot->active = 1;
+    sessions_kept++;
+    pthread_mutex_unlock(&sessions_mutex);
+
+    log_message("[SESSION] user '%s' dropped; resumable for %d ms (%zu bytes held)",
+        client->username, SESSION_GRACE_MS, ticket.out_bytes);
+}
+
+// A fresh login took the name: what its previous holder left is dropped.
+void session_discard(const char* username) {
+    pthread_mutex_lock(&sessions_mutex);
+    SessionTicket* ticket = find_ticket(NULL, username);
+    if (ticket) ticket_clear(ticket);
+    pthread_mutex_unlock(&sessions_mutex);
+}
+
+// Main loop: a pending login sent "/reconnect <token>". Registers it under
+// the ticket's username (copied to `username` for the caller's log) and
+// returns register_pending_login()'s result, -4 if there is no such ticket,
+// or -5 if the token's session has not noticed its connection is gone yet.
+// That one is shut down, so the client's next try finds the ticket.
+int session_reconnect(PendingLogin* login, const char* token, char* username, size_t consumed) {
+    char wanted[SESSION_TOKEN_LEN + 1];
+    snprintf(wanted, sizeof(wanted), "%s", token);
+    username[0] = '\0';
+
+    pthread_mutex_lock(&sessions_mutex);
+    SessionTicket* ticket = strlen(token) == SESSION_TOKEN_LEN ? find_ticket(wanted, NULL) : NULL;
+    if (ticket) strcpy(username, ticket->username);
+    pthread_mutex_unlock(&sessions_mutex);
+
+    if (username[0] == '\0') {
+        int live = 0;
+        pthread_mutex_lock(&clients_mutex);
+        for (int i = 0; i < MAX_CLIENTS && strlen(token) == SESSION_TOKEN_LEN; i++) {
+            Client* client = &clients[i];
+            if (!client->active || strcmp(client->session_token, wanted) != 0) continue;
+            pthread_mutex_lock(&client->out_mutex);
+            if (client->socket != -1) shutdown(client->socket, SHUT_RDWR);
+            pthread_mutex_unlock(&client->out_mutex);
+            live = 1;
+        }
+        pthread_mutex_unlock(&clients_mutex);
+        return live ? -5 : -4;
+    }
+
+    strcpy(login->reconnect_token, wanted);
+    return register_pending_login(login, username, consumed);
+}
+
+// Client thread of a session registered through /reconnect: instead of the
+// greeting, the session as it was. If the ticket expired in the meantime
+// this is an ordinary new login.
+void session_restore(Client* client) {
+    client->reconnecting = 0;
+    SessionTicket ticket;
+    pthread_mutex_lock(&sessions_mutex);
+    SessionTicket* found = find_ticket(client->session_token, NULL);
+    if (found) {
+        ticket = *found;
+        // The chunks now belong to `ticket`
+        found->out_head = found->out_tail = NULL;
+        ticket_clear(found);
+        sessions_resumed++;
+    }
+    pthread_mutex_unlock(&sessions_mutex);
+    if (!found) {
+        greet_client(client);
+        return;
+    }
+
+    char client_ip[ADDRESS_STRLEN];
+    format_address(&client->addr, client_ip, sizeof(client_ip));
+    log_message("[LOGIN] user '%s' reconnected from %s", client->username, client_ip);
+    printf("[CONNECT] Client %s reconnected from %s\n", client->username, client_ip);
+
+    char line[256];
+    snprintf(line, sizeof(line), "[SESSION] Resumed as '%s'\n", client->username);
+    client_send(client, line);
+    if (ticket.lost_bytes > 0 && !ticket.sequenced) {
+        snprintf(line, sizeof(line), "[SESSION] %zu bytes of output could not be kept\n", ticket.lost_bytes);
+        client_send(client, line);
+    }
+    while (ticket.out_head) {
+        OutChunk* chunk = ticket.out_head;
+        ticket.out_head = chunk->next;
+        client_send_bytes(client, chunk->data, chunk->len);
+        free(chunk);
+    }
+
+    client->sequenced = ticket.sequenced;
+    client->presence = ticket.presence;
+    for (int i = 0; i < ticket.room_count; i++) {
+        int result = seq_rejoin(client, ticket.rooms[i], ticket.acked[i]);
+        if (result < 0) {
+            snprintf(line, sizeof(line), "[ERROR] Could not rejoin room '%s'.\n", ticket.rooms[i]);
+            client_send(client, line);
+        } else if (result == 0) {
+            // Cancels the leave the drop noted, if still in the same window
+            presence_note(ticket.rooms[i], client->username, 1);
+            presence_joined_room(client, ticket.rooms[i]);
+        }
+    }
+    if (ticket.current_room[0] != '\0') {
+        add_room_member(client, ticket.current_room, 0);
+    }
+    session_issue(client);
+}
+
+// Whisper for a user that dropped moments ago: held in the ticket. Returns
+// 0 if the user has no ticket waiting.
+int session_hold_output(const char* username, const char* data, size_t len) {
+    pthread_mutex_lock(&sessions_mutex);
+    SessionTicket* ticket = find_ticket(NULL, username);
+    if (ticket) append_output(ticket, data, len);
+    pthread_mutex_unlock(&sessions_mutex);
+    return ticket != NULL;
+}
+
+void session_format_stats(char* line, size_t size) {
+    int waiting = 0;
+    size_t held = 0;
+    pthread_mutex_lock(&sessions_mutex);
+    expire_tickets();
+    for (int i = 0; i < SESSION_SLOTS; i++) {
+        if (!tickets[i].active) continue;
+        waiting++;
+        held += tickets[i].out_bytes;
+    }
+    snprintf(line, size, "[STATS] sessions: %d waiting to resume (%zu bytes held), %llu kept, %llu resumed, %llu expired\n",
+        waiting, held, (unsigned long long)sessions_kept, (unsigned long long)sessions_resumed,
+        (unsigned long long)sessions_expired);
+    pthread_mutex_unlock(&sessions_mutex);
+}
@@ -0,0 +1,226 @@
+#include "server.h"
+
+#include <sys/mman.h>
+
+// State checkpoints in a memory-mapped file. The file holds two slots; each
+// snapshot copies the registry into a private buffer while holding the locks
+// (a few microseconds), then writes the inactive slot outside the locks and
+// flips the header to it. A crash at any point leaves the previous slot
+// intact. On startup the active slot is mapped back in and remembered
+// sessions are restored to their rooms when their users log in again.
+
+#define SNAPSHOT_MAGIC 0x43485350  // "CHSP"
+#define SNAPSHOT_VERSION 2
+
+typedef struct {
+    char username[MAX_USERNAME_LEN + 1];
+    char room[MAX_ROOM_NAME_LEN + 1];   // current room
+    uint32_t room_count;
+    char rooms[MAX_ROOMS][MAX_ROOM_NAME_LEN + 1];
+} SnapshotClient;
+
+typedef struct {
+    char name[MAX_ROOM_NAME_LEN + 1];
+    uint32_t member_count;
+} SnapshotRoom;
+
+typedef struct {
+    uint64_t generation;
+    int64_t taken_at;           // wall clock, survives restarts
+    uint32_t client_count;
+    uint32_t room_count;
+    SnapshotClient clients[MAX_CLIENTS * 2];  // live clients + unclaimed restored ones
+    SnapshotRoom rooms[MAX_ROOMS];
+    uint32_t checksum;
+} SnapshotState;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t active;            // slot holding the latest complete snapshot
+    uint32_t reserved;
+    SnapshotState slots[2];
+} SnapshotFile;
+
+static SnapshotFile* snapshot_map = NULL;
+static SnapshotState staging;
+static SnapshotState restored;           // sessions waiting to be reclaimed
+static pthread_mutex_t restored_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t snapshots_taken = 0;
+static uint64_t max_pause_us = 0;
+
+// FNV-1a over everything before the checksum field
+static uint32_t snapshot_checksum(const SnapshotState* state) {
+    const unsigned char* p = (const unsigned char*)state;
+    size_t len = offsetof(SnapshotState, checksum);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void load_restored_sessions(void) {
+    if (snapshot_map->magic != SNAPSHOT_MAGIC || snapshot_map->version != SNAPSHOT_VERSION ||
+        snapshot_map->active > 1) {
+        return;
+    }
+    const SnapshotState* state = &snapshot_map->slots[snapshot_map->active];
+    if (state->checksum != snapshot_checksum(state)) {
+        log_message("[SNAPSHOT] Active slot failed its checksum; starting empty");
+        return;
+    }
+
+    int64_t age = (int64_t)time(NULL) - state->taken_at;
+    if (age * 1000 > SNAPSHOT_RESTORE_GRACE_MS) {
+        log_message("[SNAPSHOT] Snapshot is %lld s old; not restoring sessions", (long long)age);
+        return;
+    }
+
+    restored = *state;
+    log_message("[SNAPSHOT] Restored generation %llu: %u sessions, %u rooms (%lld s old)",
+        (unsigned long long)state->generation, state->client_count, state->room_count, (long long)age);
+}
+
+int snapshot_open(const char* path) {
+    uint64_t start = now_us();
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("Failed to open snapshot file");
+        return -1;
+    }
+
+    struct stat st;
+    int existing = fstat(fd, &st) == 0 && st.st_size == (off_t)sizeof(SnapshotFile);
+    if (!existing && ftruncate(fd, sizeof(SnapshotFile)) == -1) {
+        perror("Failed to size snapshot file");
+        close(fd);
+        return -1;
+    }
+
+    snapshot_map = mmap(NULL, sizeof(SnapshotFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (snapshot_map == MAP_FAILED) {
+        perror("Failed to map snapshot file");
+        snapshot_map = NULL;
+        return -1;
+    }
+
+    if (existing) {
+        load_restored_sessions();
+    } else {
+        memset(snapshot_map, 0, sizeof(SnapshotFile));
+    }
+    staging.generation = restored.generation;
+    log_message("[SNAPSHOT] Mapped %s in %llu us", path, (unsigned long long)(now_us() - start));
+    return 0;
+}
+
+void snapshot_take(void) {
+    if (!snapshot_map) return;
+
+    // Critical section: copy the registry into the staging buffer only
+    uint64_t start = now_us();
+    SnapshotState* next = &staging;
+    uint32_t n = 0;
+    pthread_mutex_lock(&clients_mutex);
+    pthread_mutex_lock(&rooms_mutex);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].active && clients[i].username[0] != '\0') {
+            SnapshotClient* entry = &next->clients[n++];
+            memcpy(entry->username, clients[i].username, sizeof(entry->username));
+            memcpy(entry->room, clients[i].current_room, sizeof(entry->room));
+            entry->room_count = 0;
+            for (uint64_t mask = clients[i].room_mask; mask; mask &= mask - 1) {
+                memcpy(entry->rooms[entry->room_count++], rooms[__builtin_ctzll(mask)].name, MAX_ROOM_NAME_LEN + 1);
+            }
+            memset(entry->rooms[entry->room_count], 0,
+                   sizeof(entry->rooms[0]) * (MAX_ROOMS - entry->room_count));
+        }
+    }
+    uint32_t r = 0;
+    for (int i = 0; i < MAX_ROOMS; i++) {
+        if (rooms[i].active) {
+            memcpy(next->rooms[r].name, rooms[i].name, sizeof(next->rooms[r].name));
+            next->rooms[r].member_count = rooms[i].member_count;
+            r++;
+        }
+    }
+    pthread_mutex_unlock(&rooms_mutex);
+    pthread_mutex_unlock(&clients_mutex);
+    uint64_t pause = now_us() - start;
+
+    // Carry forward restored sessions nobody has reclaimed yet, so a second
+    // crash before they return does not lose them
+    pthread_mutex_lock(&restored_mutex);
+    for (uint32_t i = 0; i < restored.client_count && n < MAX_CLIENTS * 2; i++) {
+        if (restored.clients[i].username[0] != '\0') {
+            next->clients[n++] = restored.clients[i];
+        }
+    }
+    pthread_mutex_unlock(&restored_mutex);
+
+    next->client_count = n;
+    next->room_count = r;
+    memset(&next->clients[n], 0, sizeof(SnapshotClient) * (MAX_CLIENTS * 2 - n));
+    memset(&next->rooms[r], 0, sizeof(SnapshotRoom) * (MAX_ROOMS - r));
+
+    // Nothing changed since the active slot: skip the write
+    uint32_t active = snapshot_map->active;
+    const SnapshotState* current = &snapshot_map->slots[active];
+    if (snapshot_map->magic == SNAPSHOT_MAGIC && current->client_count == n && current->room_count == r &&
+        memcmp(current->clients, next->clients, sizeof(next->clients)) == 0 &&
+        memcmp(current->rooms, next->rooms, sizeof(next->rooms)) == 0) {
+        return;
+    }
+
+    next->generation++;
+    next->taken_at = time(NULL);
+    next->checksum = snapshot_checksum(next);
+
+    uint32_t target = snapshot_map->magic == SNAPSHOT_MAGIC ? 1 - active : 0;
+    snapshot_map->slots[target] = *next;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    snapshot_map->magic = SNAPSHOT_MAGIC;
+    snapshot_map->version = SNAPSHOT_VERSION;
+    __atomic_store_n(&snapshot_map->active, target, __ATOMIC_RELEASE);
+    msync(snapshot_map, sizeof(SnapshotFile), MS_ASYNC);
+
+    snapshots_taken++;
+    if (pause > max_pause_us) max_pause_us = pause;
+    if (pause > 1000) {
+        log_message("[SNAPSHOT] Capture held the registry locks for %llu us", (unsigned long long)pause);
+    }
+}
+
+// Fills `names` with the rooms `username` was in before the restart and
+// `current` with the one it talked in, and returns how many there were.
+// Each remembered session is handed out once.
+int snapshot_claim_rooms(const char* username, char names[][MAX_ROOM_NAME_LEN + 1], char* current) {
+    int count = 0;
+    current[0] = '\0';
+    pthread_mutex_lock(&restored_mutex);
+    for (uint32_t i = 0; i < restored.client_count; i++) {
+        SnapshotClient* entry = &restored.clients[i];
+        if (entry->username[0] != '\0' && strcmp(entry->username, username) == 0) {
+            for (uint32_t r = 0; r < entry->room_count && r < MAX_ROOMS; r++) {
+                memcpy(names[count++], entry->rooms[r], MAX_ROOM_NAME_LEN + 1);
+            }
+            memcpy(current, entry->room, MAX_ROOM_NAME_LEN + 1);
+            entry->username[0] = '\0';
+            break;
+        }
+    }
+    pthread_mutex_unlock(&restored_mutex);
+    return count;
+}
+
+void snapshot_close(void) {
+    if (!snapshot_map) return;
+    snapshot_take();
+    msync(snapshot_map, sizeof(SnapshotFile), MS_SYNC);
+    munmap(snapshot_map, sizeof(SnapshotFile));
+    snapshot_map = NULL;
+    log_message("[SNAPSHOT] %llu snapshots written, longest registry pause %llu us",
+        (unsigned long long)snapshots_taken, (unsigned long long)max_pause_us);
+}
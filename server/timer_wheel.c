@@ -0,0 +1,165 @@
+#include "timer_wheel.h"
+
+#define TW_MAX_DELTA ((1ULL << (TW_LEVELS * TW_SLOT_BITS)) - 1)
+
+static void list_init(Timer* head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_unlink(Timer* timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+}
+
+static void list_append(Timer* head, Timer* timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+// Move every timer of a slot onto a private list so callbacks and re-arms
+// can modify the wheel while we walk it.
+static void list_take(Timer* head, Timer* out) {
+    list_init(out);
+    if (head->next == head) return;
+    out->next = head->next;
+    out->prev = head->prev;
+    out->next->prev = out;
+    out->prev->next = out;
+    list_init(head);
+}
+
+static void wheel_insert(TimerWheel* wheel, Timer* timer) {
+    if (timer->expires < wheel->current_tick) {
+        timer->expires = wheel->current_tick;
+    }
+    uint64_t delta = timer->expires - wheel->current_tick;
+    if (delta > TW_MAX_DELTA) {
+        delta = TW_MAX_DELTA;
+        timer->expires = wheel->current_tick + delta;
+    }
+
+    int level = 0;
+    while (level < TW_LEVELS - 1 && delta >= (1ULL << ((level + 1) * TW_SLOT_BITS))) {
+        level++;
+    }
+    int slot = (int)((timer->expires >> (level * TW_SLOT_BITS)) & TW_SLOT_MASK);
+    list_append(&wheel->slots[level][slot], timer);
+}
+
+// Redistribute a higher-level slot into the levels below it.
+static int wheel_cascade(TimerWheel* wheel, int level) {
+    int slot = (int)((wheel->current_tick >> (level * TW_SLOT_BITS)) & TW_SLOT_MASK);
+    Timer pending;
+    list_take(&wheel->slots[level][slot], &pending);
+    while (pending.next != &pending) {
+        Timer* timer = pending.next;
+        list_unlink(timer);
+        wheel_insert(wheel, timer);
+    }
+    return slot;
+}
+
+void timer_wheel_init(TimerWheel* wheel, unsigned int tick_ms, uint64_t now_ms) {
+    for (int level = 0; level < TW_LEVELS; level++) {
+        for (int slot = 0; slot < TW_SLOTS; slot++) {
+            list_init(&wheel->slots[level][slot]);
+        }
+    }
+    wheel->current_tick = 0;
+    wheel->start_ms = now_ms;
+    wheel->tick_ms = tick_ms ? tick_ms : 1;
+    wheel->armed_count = 0;
+}
+
+void timer_init(Timer* timer, timer_callback callback, void* arg) {
+    timer->next = timer->prev = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->armed = 0;
+}
+
+void timer_arm(TimerWheel* wheel, Timer* timer, uint64_t delay_ms, uint64_t now_ms) {
+    if (timer->armed) {
+        list_unlink(timer);
+        wheel->armed_count--;
+    }
+    // The wheel may lag real time while its loop sleeps with nothing armed,
+    // so measure the deadline from now, rounded up so it never fires early.
+    uint64_t now_tick = now_ms > wheel->start_ms ? (now_ms - wheel->start_ms) / wheel->tick_ms : 0;
+    if (now_tick < wheel->current_tick) now_tick = wheel->current_tick;
+    uint64_t ticks = (delay_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+    timer->expires = now_tick + ticks;
+    timer->armed = 1;
+    wheel_insert(wheel, timer);
+    wheel->armed_count++;
+}
+
+void timer_cancel(TimerWheel* wheel, Timer* timer) {
+    if (!timer->armed) return;
+    list_unlink(timer);
+    timer->armed = 0;
+    wheel->armed_count--;
+}
+
+void timer_wheel_advance(TimerWheel* wheel, uint64_t now_ms) {
+    if (now_ms < wheel->start_ms) return;
+    uint64_t target = (now_ms - wheel->start_ms) / wheel->tick_ms;
+
+    // Nothing to fire: skip the empty ticks instead of walking them.
+    if (wheel->armed_count == 0) {
+        if (target >= wheel->current_tick) {
+            wheel->current_tick = target + 1;
+        }
+        return;
+    }
+
+    while (wheel->current_tick <= target) {
+        int slot = (int)(wheel->current_tick & TW_SLOT_MASK);
+        if (slot == 0) {
+            for (int level = 1; level < TW_LEVELS; level++) {
+                if (wheel_cascade(wheel, level) != 0) break;
+            }
+        }
+        wheel->current_tick++;
+
+        Timer expired;
+        list_take(&wheel->slots[0][slot], &expired);
+        while (expired.next != &expired) {
+            Timer* timer = expired.next;
+            list_unlink(timer);
+            timer->armed = 0;
+            wheel->armed_count--;
+            timer->callback(timer, timer->arg);
+        }
+
+        if (wheel->armed_count == 0 && wheel->current_tick <= target) {
+            wheel->current_tick = target + 1;
+        }
+    }
+}
+
+// Milliseconds until the wheel next needs servicing, or -1 if nothing is armed.
+int timer_wheel_next_timeout(const TimerWheel* wheel, uint64_t now_ms) {
+    if (wheel->armed_count == 0) return -1;
+
+    uint64_t ticks = TW_SLOTS - (wheel->current_tick & TW_SLOT_MASK);
+    if ((wheel->current_tick & TW_SLOT_MASK) == 0) ticks = 0;
+    for (uint64_t offset = 0; offset < TW_SLOTS; offset++) {
+        int slot = (int)((wheel->current_tick + offset) & TW_SLOT_MASK);
+        const Timer* head = &wheel->slots[0][slot];
+        if (head->next != head) {
+            if (offset < ticks) ticks = offset;
+            break;
+        }
+    }
+
+    uint64_t due_ms = wheel->start_ms + (wheel->current_tick + ticks) * wheel->tick_ms;
+    if (due_ms <= now_ms) return 0;
+    uint64_t wait = due_ms - now_ms;
+    return wait > 60000 ? 60000 : (int)wait;
+}
@@ -0,0 +1,45 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Hierarchical timer wheel: 4 levels of 64 slots. Level 0 holds timers due
+// within the next 64 ticks, each higher level covers 64x the range of the one
+// below and is cascaded down when the lower level wraps. Arm, cancel and
+// per-tick expiry are all O(1). The wheel is not locked internally; it is
+// owned by one loop and callers serialize access themselves.
+
+#define TW_LEVELS 4
+#define TW_SLOT_BITS 6
+#define TW_SLOTS (1 << TW_SLOT_BITS)
+#define TW_SLOT_MASK (TW_SLOTS - 1)
+
+typedef struct Timer Timer;
+typedef void (*timer_callback)(Timer* timer, void* arg);
+
+struct Timer {
+    Timer* next;
+    Timer* prev;
+    uint64_t expires;       // absolute tick
+    timer_callback callback;
+    void* arg;
+    int armed;
+};
+
+typedef struct {
+    Timer slots[TW_LEVELS][TW_SLOTS];  // list heads (sentinels)
+    uint64_t current_tick;             // next tick to be processed
+    uint64_t start_ms;
+    unsigned int tick_ms;
+    size_t armed_count;
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel* wheel, unsigned int tick_ms, uint64_t now_ms);
+void timer_init(Timer* timer, timer_callback callback, void* arg);
+void timer_arm(TimerWheel* wheel, Timer* timer, uint64_t delay_ms, uint64_t now_ms);
+void timer_cancel(TimerWheel* wheel, Timer* timer);
+void timer_wheel_advance(TimerWheel* wheel, uint64_t now_ms);
+int timer_wheel_next_timeout(const TimerWheel* wheel, uint64_t now_ms);
+
+#endif
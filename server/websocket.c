@@ -0,0 +1,264 @@
+#include "websocket.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <arpa/inet.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+// Page served to a plain GET on the WebSocket port, so a browser needs
+// nothing else: it connects back to the same host and port.
+static const char ws_client_page[] =
+    "<!doctype html><meta charset=utf-8><title>chat</title>\n"
+    "<pre id=log style=\"height:80vh;overflow:auto\"></pre>\n"
+    "<form id=f><input id=i autofocus style=\"width:80%\"></form>\n"
+    "<script>\n"
+    "var ws = new WebSocket('ws://' + location.host + '/');\n"
+    "ws.onmessage = function (e) { log.textContent += e.data; log.scrollTop = log.scrollHeight; };\n"
+    "ws.onclose = function () { log.textContent += '[disconnected]\\n'; };\n"
+    "f.onsubmit = function (e) { e.preventDefault(); ws.send(i.value); i.value = ''; };\n"
+    "</script>\n";
+
+// SHA-1 is only needed for Sec-WebSocket-Accept, over a 60-byte input.
+static uint32_t rol(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_block(uint32_t h[5], const uint8_t block[64]) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+        else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+        else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+        else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+        uint32_t t = rol(a, 5) + f + e + k + w[i];
+        e = d; d = c; c = rol(b, 30); b = a; a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+static void sha1(const uint8_t* data, size_t len, uint8_t digest[20]) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    uint8_t block[64];
+    size_t done = 0;
+    for (; len - done >= 64; done += 64) sha1_block(h, data + done);
+
+    size_t rest = len - done;
+    memset(block, 0, sizeof(block));
+    memcpy(block, data + done, rest);
+    block[rest] = 0x80;
+    if (rest >= 56) {
+        sha1_block(h, block);
+        memset(block, 0, sizeof(block));
+    }
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) block[63 - i] = (uint8_t)(bits >> (i * 8));
+    sha1_block(h, block);
+
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = h[i] >> 24;
+        digest[i * 4 + 1] = h[i] >> 16;
+        digest[i * 4 + 2] = h[i] >> 8;
+        digest[i * 4 + 3] = h[i];
+    }
+}
+
+static void base64(const uint8_t* data, size_t len, char* out) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t o = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < len) v |= data[i + 2];
+        out[o++] = alphabet[v >> 18];
+        out[o++] = alphabet[(v >> 12) & 63];
+        out[o++] = i + 1 < len ? alphabet[(v >> 6) & 63] : '=';
+        out[o++] = i + 2 < len ? alphabet[v & 63] : '=';
+    }
+    out[o] = '\0';
+}
+
+// Value of header `name` in the request head, trimmed; NULL if absent.
+static const char* header_value(const char* head, const char* name, size_t* value_len) {
+    size_t name_len = strlen(name);
+    const char* line = strstr(head, "\r\n");
+    while (line && line[2] != '\r') {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char* value = line + name_len + 1;
+            while (*value == ' ' || *value == '\t') value++;
+            const char* end = strstr(value, "\r\n");
+            while (end > value && (end[-1] == ' ' || end[-1] == '\t')) end--;
+            *value_len = end - value;
+            return value;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return NULL;
+}
+
+static int contains_token(const char* value, size_t len, const char* token) {
+    size_t token_len = strlen(token);
+    for (size_t i = 0; i + token_len <= len; i++) {
+        if (strncasecmp(value + i, token, token_len) == 0) return 1;
+    }
+    return 0;
+}
+
+int ws_handshake(const char* request, size_t len, char* response, size_t size, size_t* consumed) {
+    char head[WS_RAW_BYTES + 1];
+    if (len > WS_RAW_BYTES) len = WS_RAW_BYTES;
+    memcpy(head, request, len);
+    head[len] = '\0';
+    char* end = strstr(head, "\r\n\r\n");
+    if (!end) {
+        if (len < WS_RAW_BYTES) return 0;
+        snprintf(response, size, "HTTP/1.1 431 Request Header Fields Too Large\r\nConnection: close\r\n\r\n");
+        return -1;
+    }
+    end[2] = '\0';   // keep the last header's CRLF for header_value
+
+    size_t upgrade_len = 0, key_len = 0, version_len = 0;
+    const char* upgrade = header_value(head, "Upgrade", &upgrade_len);
+    const char* key = header_value(head, "Sec-WebSocket-Key", &key_len);
+    const char* version = header_value(head, "Sec-WebSocket-Version", &version_len);
+
+    if (strncmp(head, "GET ", 4) != 0) {
+        snprintf(response, size, "HTTP/1.1 405 Method Not Allowed\r\nConnection: close\r\n\r\n");
+        return -1;
+    }
+    if (!upgrade || !contains_token(upgrade, upgrade_len, "websocket")) {
+        snprintf(response, size,
+            "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s",
+            sizeof(ws_client_page) - 1, ws_client_page);
+        return -1;
+    }
+    if (!key || key_len == 0 || key_len > 64 || !version || version_len != 2 || strncmp(version, "13", 2) != 0) {
+        snprintf(response, size, "HTTP/1.1 400 Bad Request\r\nSec-WebSocket-Version: 13\r\nConnection: close\r\n\r\n");
+        return -1;
+    }
+
+    uint8_t input[64 + sizeof(WS_GUID)];
+    memcpy(input, key, key_len);
+    memcpy(input + key_len, WS_GUID, sizeof(WS_GUID) - 1);
+    uint8_t digest[20];
+    sha1(input, key_len + sizeof(WS_GUID) - 1, digest);
+    char accept[29];
+    base64(digest, sizeof(digest), accept);
+
+    *consumed = (size_t)(end - head) + 4;
+    return snprintf(response, size,
+        "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+}
+
+int ws_frame_parse(char* data, size_t avail, WsFrame* frame) {
+    if (avail < 2) return 0;
+    uint8_t b0 = (uint8_t)data[0], b1 = (uint8_t)data[1];
+    // Client frames are always masked; no extensions are negotiated
+    if ((b0 & 0x70) || !(b1 & 0x80)) return -1;
+
+    size_t len = b1 & 0x7F;
+    size_t header = 2;
+    if (len == 126) {
+        if (avail < 4) return 0;
+        uint16_t len_n;
+        memcpy(&len_n, data + 2, 2);
+        len = ntohs(len_n);
+        header = 4;
+    } else if (len == 127) {
+        if (avail < 10) return 0;
+        uint32_t high_n, low_n;
+        memcpy(&high_n, data + 2, 4);
+        memcpy(&low_n, data + 6, 4);
+        // Nothing we accept comes close to needing the high half
+        if (high_n != 0 || ntohl(low_n) > WS_RAW_BYTES) return -1;
+        len = ntohl(low_n);
+        header = 10;
+    }
+    frame->opcode = b0 & 0x0F;
+    frame->fin = (b0 & 0x80) != 0;
+    if (frame->opcode >= WS_CLOSE && (len > 125 || !frame->fin)) return -1;
+    if (len > WS_RAW_BYTES - WS_MAX_HEADER) return -1;
+    if (avail < header + 4 + len) return 0;
+
+    memcpy(frame->key, data + header, 4);
+    frame->payload = data + header + 4;
+    frame->len = len;
+    return (int)(header + 4 + len);
+}
+
+size_t ws_frame_header(char* out, int opcode, size_t len) {
+    out[0] = (char)(0x80 | opcode);
+    if (len < 126) {
+        out[1] = (char)len;
+        return 2;
+    }
+    if (len <= 0xFFFF) {
+        uint16_t len_n = htons((uint16_t)len);
+        out[1] = 126;
+        memcpy(out + 2, &len_n, 2);
+        return 4;
+    }
+    uint32_t high_n = htonl((uint32_t)((uint64_t)len >> 32));
+    uint32_t low_n = htonl((uint32_t)len);
+    out[1] = 127;
+    memcpy(out + 2, &high_n, 4);
+    memcpy(out + 6, &low_n, 4);
+    return 10;
+}
+
+// The key repeats every 4 bytes, so a 16-byte register holding it four
+// times covers a whole vector per XOR. Every step consumes a multiple of 4
+// bytes, which keeps the tail loop aligned with the key.
+void ws_mask(char* data, size_t len, const uint8_t key[4]) {
+    size_t i = 0;
+    uint32_t key32;
+    memcpy(&key32, key, 4);
+#if defined(__SSE2__)
+    __m128i key128 = _mm_set1_epi32((int)key32);
+    for (; i + 64 <= len; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(data + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(data + i + 48));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(a, key128));
+        _mm_storeu_si128((__m128i*)(data + i + 16), _mm_xor_si128(b, key128));
+        _mm_storeu_si128((__m128i*)(data + i + 32), _mm_xor_si128(c, key128));
+        _mm_storeu_si128((__m128i*)(data + i + 48), _mm_xor_si128(d, key128));
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(v, key128));
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t key128 = vreinterpretq_u8_u32(vdupq_n_u32(key32));
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)data + i);
+        vst1q_u8((uint8_t*)data + i, veorq_u8(v, key128));
+    }
+#endif
+    uint64_t key64 = (uint64_t)key32 << 32 | key32;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, data + i, 8);
+        v ^= key64;
+        memcpy(data + i, &v, 8);
+    }
+    for (; i < len; i++) data[i] ^= key[i & 3];
+}
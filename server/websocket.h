@@ -0,0 +1,58 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// WebSocket (RFC 6455) pieces for the --ws-port listener: the HTTP upgrade,
+// parsing of client frames and the masking XOR. Each text message a browser
+// sends is one command line; server output goes back as text frames.
+
+#define WS_MAX_HEADER 14           // largest frame header, mask key included
+#define WS_RAW_BYTES 8192          // handshake request / undecoded frames
+
+enum {
+    WS_CONTINUATION = 0x0,
+    WS_TEXT = 0x1,
+    WS_BINARY = 0x2,
+    WS_CLOSE = 0x8,
+    WS_PING = 0x9,
+    WS_PONG = 0xA
+};
+
+typedef struct {
+    int opcode;
+    int fin;
+    char* payload;                 // still masked: ws_mask(payload, len, key)
+    size_t len;
+    uint8_t key[4];
+} WsFrame;
+
+// Bytes received from one connection that are not decoded yet: first the
+// HTTP request, then frames.
+typedef struct {
+    char raw[WS_RAW_BYTES];
+    size_t raw_len;
+    int closed;                    // close echoed; nothing may follow it
+} WsStream;
+
+// Answers an upgrade request. Returns the response length written to
+// `response`, 0 if the request is not complete yet, or -1 if it is not a
+// WebSocket upgrade (`response` then holds an HTTP reply to send instead,
+// and `*consumed` is left alone). On success `*consumed` is the size of the
+// request, so bytes sent right after it stay in the stream.
+int ws_handshake(const char* request, size_t len, char* response, size_t size, size_t* consumed);
+
+// Parses one client frame, leaving the payload masked so the caller can
+// still decide not to take it. Returns its size, 0 if incomplete, -1 if it
+// is malformed (unmasked, oversized control frame, reserved bits).
+int ws_frame_parse(char* data, size_t avail, WsFrame* frame);
+
+// Header of an unmasked server frame; returns its size (at most 10).
+size_t ws_frame_header(char* out, int opcode, size_t len);
+
+// XORs `len` bytes with the 4-byte masking key. Runs 16 bytes at a time
+// with SSE2/NEON where available.
+void ws_mask(char* data, size_t len, const uint8_t key[4]);
+
+#endif
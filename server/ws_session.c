@@ -0,0 +1,159 @@
+#include "server.h"
+
+#include <netinet/tcp.h>
+
+// Browser clients on --ws-port (see websocket.h). The connection goes
+// through the same pending-login stage as a TCP client, with the HTTP
+// upgrade in front of it, and then gets a client slot and thread of its
+// own. Frames are decoded into the ordinary line buffers, so the login and
+// command handlers never see the framing; output goes back as text frames.
+
+static EventSource ws_listener_source = { SOURCE_WS_LISTENER };
+static int ws_socket = -1;
+
+int ws_listen(int port) {
+    // Like the main port: dual-stack, and bound by every cluster node
+    ws_socket = open_tcp_listener(port, MAX_CLIENTS, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (ws_socket == -1) {
+        perror("WebSocket bind failed");
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &ws_listener_source;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ws_socket, &ev);
+
+    log_message("[WEBSOCKET] Accepting browser clients on port %d", port);
+    printf("[INFO] WebSocket clients on port %d\n", port);
+    return 0;
+}
+
+void ws_accept_clients(void) {
+    accept_clients(ws_socket, 1);
+}
+
+void ws_stop(void) {
+    if (ws_socket == -1) return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ws_socket, NULL);
+    close(ws_socket);
+    ws_socket = -1;
+}
+
+// Login output for a WebSocket that has been upgraded. Small enough to go
+// out in one send, like send_to_client().
+void ws_send_text(int socket, const char* message) {
+    char frame[WS_MAX_HEADER + LOGIN_LINE_LEN * 2];
+    size_t len = strlen(message);
+    if (len > sizeof(frame) - WS_MAX_HEADER) len = sizeof(frame) - WS_MAX_HEADER;
+    size_t header = ws_frame_header(frame, WS_TEXT, len);
+    memcpy(frame + header, message, len);
+    send(socket, frame, header + len, MSG_NOSIGNAL);
+}
+
+// Control frame back to the peer: through the client's queue once it has
+// one, so it never lands in the middle of a queued frame.
+static void ws_send_control(Client* client, int socket, int opcode, const char* data, size_t len) {
+    char frame[WS_MAX_HEADER + 125];
+    size_t header = ws_frame_header(frame, opcode, len);
+    memcpy(frame + header, data, len);
+    if (client) {
+        client_send_raw(client, frame, header + len);
+    } else {
+        send(socket, frame, header + len, MSG_NOSIGNAL);
+    }
+}
+
+// Decodes the complete frames in `stream` into `out`, ending each message
+// with a newline so it reads as one command line. A message that does not
+// fit waits until the lines before it are consumed; one longer than the
+// whole buffer is cut, as an overlong text line would be. Pings are
+// answered and a close is echoed. Returns the bytes added to `out`, or -1
+// once the peer closed or sent a malformed frame.
+int ws_decode_input(WsStream* stream, char* out, size_t* out_len, size_t out_size, Client* client, int socket) {
+    size_t start = 0;
+    size_t added = 0;
+    int result = 0;
+    while (*out_len < out_size) {
+        WsFrame frame;
+        int size = ws_frame_parse(stream->raw + start, stream->raw_len - start, &frame);
+        if (size == 0) break;
+        if (size < 0) {
+            result = -1;
+            break;
+        }
+
+        size_t room = out_size - *out_len - 1;   // the newline
+        if (frame.opcode < WS_CLOSE && frame.len > room && memchr(out, '\n', *out_len)) break;
+        start += size;
+        ws_mask(frame.payload, frame.len, frame.key);
+
+        if (frame.opcode == WS_CLOSE) {
+            ws_send_control(client, socket, WS_CLOSE, frame.payload, frame.len < 2 ? 0 : 2);
+            stream->closed = 1;
+            result = -1;
+            break;
+        }
+        if (frame.opcode == WS_PING) {
+            ws_send_control(client, socket, WS_PONG, frame.payload, frame.len);
+            continue;
+        }
+        if (frame.opcode == WS_PONG) continue;
+
+        size_t len = frame.len < room ? frame.len : room;
+        memcpy(out + *out_len, frame.payload, len);
+        *out_len += len;
+        added += len;
+        if (frame.fin) {
+            out[(*out_len)++] = '\n';
+            added++;
+        }
+    }
+    memmove(stream->raw, stream->raw + start, stream->raw_len - start);
+    stream->raw_len -= start;
+    return result < 0 ? -1 : (int)added;
+}
+
+// Main loop, on a readable pending WebSocket: the upgrade request first,
+// then frames carrying username attempts.
+void ws_handle_pending_login(PendingLogin* login) {
+    WsStream* stream = &login->ws;
+    int bytes = recv(login->socket, stream->raw + stream->raw_len, sizeof(stream->raw) - stream->raw_len, 0);
+    if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        close_pending_login(login);
+        return;
+    }
+    if (bytes < 0) return;
+    stream->raw_len += bytes;
+
+    if (!login->ws_upgraded) {
+        char response[2048];
+        size_t consumed = 0;
+        int len = ws_handshake(stream->raw, stream->raw_len, response, sizeof(response), &consumed);
+        if (len == 0) return;
+        send(login->socket, response, strlen(response), MSG_NOSIGNAL);
+        if (len < 0) {
+            close_pending_login(login);
+            return;
+        }
+
+        // Browsers wait for messages; frames are small and interactive
+        int opt = 1;
+        setsockopt(login->socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        memmove(stream->raw, stream->raw + consumed, stream->raw_len - consumed);
+        stream->raw_len -= consumed;
+        login->ws_upgraded = 1;
+        ws_send_text(login->socket, "Enter username (max 16 chars, alphanumeric): ");
+    }
+
+    while (login->active && !login->claiming && stream->raw_len > 0) {
+        if (ws_decode_input(stream, login->buffer, &login->buffer_len, sizeof(login->buffer), NULL, login->socket) < 0) {
+            close_pending_login(login);
+            return;
+        }
+        size_t before = stream->raw_len + login->buffer_len;
+        process_login_lines(login);
+        // Stop once neither the frames nor the attempts made progress
+        if (stream->raw_len + login->buffer_len == before) break;
+    }
+}
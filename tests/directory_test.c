@@ -0,0 +1,192 @@
+// Unit tests for the cluster username directory. Several Directory
+// instances run in one process over a stand-in transport that hands each
+// frame straight to the addressed instance, and the checks cover the
+// cluster-wide rules: a name is granted once, every node finds every user,
+// repeat lookups are answered from the cache, a logout invalidates the cached
+// answers, and a node leaving takes its users with it.
+// run: $ make check   (or: $ ./tests/directory_test)
+
+#include <stdio.h>
+#include <string.h>
+
+#include "directory.h"
+
+#define NODES 4
+#define USERS 200
+
+static int checks, failures;
+
+#define CHECK(cond) do { \
+    checks++; \
+    if (!(cond)) { \
+        failures++; \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+    } \
+} while (0)
+
+static Directory dirs[NODES];
+static int node_ids[NODES];
+static int node_up[NODES];
+static int last_claim_result;
+static uint64_t last_claim_token;
+static unsigned long frames_sent;
+
+// Delivered synchronously; replies recurse back into the sender
+static int stand_in_send(void* ctx, int node, const char* frame) {
+    char copy[DIR_FRAME_LEN];
+    if (!node_up[node]) return -1;
+    snprintf(copy, sizeof(copy), "%s", frame);
+    frames_sent++;
+    return directory_handle_frame(&dirs[node], *(int*)ctx, copy) ? 0 : -1;
+}
+
+static int stand_in_owner(void* ctx, const char* name) {
+    (void)ctx;
+    uint32_t hash = 2166136261u;
+    for (; *name; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash % NODES;
+}
+
+static void stand_in_claim_done(void* ctx, uint64_t token, const char* name, int result) {
+    (void)ctx;
+    (void)name;
+    last_claim_token = token;
+    last_claim_result = result;
+}
+
+static int claim(int node, const char* name) {
+    last_claim_token = 0;
+    int result = directory_claim(&dirs[node], name, 77);
+    if (result != DIR_PENDING) return result;
+    CHECK(last_claim_token == 77);
+    return last_claim_result;
+}
+
+static void user_name(char* name, int i) {
+    snprintf(name, DIR_NAME_LEN + 1, "user%d", i);
+}
+
+static void test_claims(void) {
+    char name[DIR_NAME_LEN + 1];
+    int granted = 0, denied = 0;
+
+    // Every user logs in on node (i % NODES); a second login anywhere,
+    // including the same node, is refused
+    for (int i = 0; i < USERS; i++) {
+        user_name(name, i);
+        if (claim(i % NODES, name) == DIR_GRANTED) granted++;
+        if (claim((i + 1) % NODES, name) == DIR_DENIED) denied++;
+        if (claim(i % NODES, name) == DIR_DENIED) denied++;
+    }
+    CHECK(granted == USERS);
+    CHECK(denied == 2 * USERS);
+
+    CHECK(directory_claim(&dirs[0], "", 1) == DIR_DENIED);
+    CHECK(directory_claim(&dirs[0], "much_too_long_a_username", 1) == DIR_DENIED);
+}
+
+static void test_lookups(void) {
+    char name[DIR_NAME_LEN + 1];
+
+    // The first sweep asks the owners, the second is answered from the cache
+    for (int pass = 0; pass < 2; pass++) {
+        unsigned long before = frames_sent;
+        int wrong = 0;
+        for (int node = 0; node < NODES; node++) {
+            for (int i = 0; i < USERS; i++) {
+                user_name(name, i);
+                if (directory_lookup(&dirs[node], name, 100) != i % NODES) wrong++;
+            }
+        }
+        CHECK(wrong == 0);
+        if (pass == 0) {
+            CHECK(frames_sent > before);
+        } else {
+            CHECK(frames_sent == before);
+        }
+    }
+    CHECK(directory_lookup(&dirs[1], "nobody", 100) == -1);
+}
+
+static void test_release(void) {
+    char name[DIR_NAME_LEN + 1];
+    int stale = 0, kept = 0, reclaimed = 0;
+
+    // Logout: every node that cached the answer must forget it
+    for (int i = 0; i < USERS; i += 2) {
+        user_name(name, i);
+        directory_release(&dirs[i % NODES], name);
+    }
+    for (int node = 0; node < NODES; node++) {
+        for (int i = 0; i < USERS; i++) {
+            user_name(name, i);
+            int found = directory_lookup(&dirs[node], name, 100);
+            if (i % 2 == 0 && found != -1) stale++;
+            if (i % 2 == 1 && found == i % NODES) kept++;
+        }
+    }
+    CHECK(stale == 0);
+    CHECK(kept == NODES * USERS / 2);
+
+    // ...and the name is free again, for another node this time
+    for (int i = 0; i < USERS; i += 2) {
+        user_name(name, i);
+        if (claim((i + 1) % NODES, name) == DIR_GRANTED) reclaimed++;
+    }
+    CHECK(reclaimed == USERS / 2);
+    user_name(name, 0);
+    CHECK(directory_lookup(&dirs[2], name, 100) == 1);
+
+    // Only the node holding a name can release it
+    directory_release(&dirs[3], name);
+    CHECK(directory_lookup(&dirs[2], name, 100) == 1);
+}
+
+static void test_node_down(void) {
+    char name[DIR_NAME_LEN + 1];
+    int gone = 0, kept = 0;
+
+    // Node 3 leaves: its users vanish from the owners and from the caches
+    node_up[3] = 0;
+    for (int node = 0; node < 3; node++) directory_node_down(&dirs[node], 3);
+    for (int i = 1; i < USERS; i += 2) {
+        user_name(name, i);
+        if (stand_in_owner(NULL, name) == 3) continue;
+        int found = directory_lookup(&dirs[(i + 1) % 3], name, 100);
+        if (i % NODES == 3 && found == -1) gone++;
+        if (i % NODES != 3 && found == i % NODES) kept++;
+    }
+    CHECK(gone > 0);
+    CHECK(kept > 0);
+
+    // Names it owned cannot be claimed until it is back
+    for (int i = 0; i < USERS; i++) {
+        user_name(name, i);
+        if (stand_in_owner(NULL, name) == 3) break;
+    }
+    CHECK(stand_in_owner(NULL, name) == 3);
+    CHECK(directory_claim(&dirs[0], name, 1) == DIR_UNREACHABLE);
+}
+
+int main(void) {
+    for (int i = 0; i < NODES; i++) {
+        node_ids[i] = i;
+        node_up[i] = 1;
+        DirectoryTransport transport = { stand_in_send, stand_in_owner, stand_in_claim_done, &node_ids[i] };
+        if (directory_init(&dirs[i], i, USERS, &transport) == -1) {
+            perror("directory_init");
+            return 1;
+        }
+    }
+
+    test_claims();
+    test_lookups();
+    test_release();
+    test_node_down();
+
+    for (int i = 0; i < NODES; i++) directory_destroy(&dirs[i]);
+    printf("directory_test: %d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
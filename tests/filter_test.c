@@ -0,0 +1,79 @@
+// Unit tests for the moderation filter: compiling the Aho-Corasick
+// automaton, matching, and loading a phrase list from a file. Each check
+// prints nothing unless it fails, and any failure makes the exit status
+// non-zero, so `make check` can just run it.
+// run: $ make check   (or: $ ./tests/filter_test)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "filter.h"
+
+static int checks, failures;
+
+#define CHECK(cond) do { \
+    checks++; \
+    if (!(cond)) { \
+        failures++; \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+    } \
+} while (0)
+
+static void test_filter(void) {
+    const char* phrases[] = { "bad word", "evil", "she", "hers" };
+    FilterAutomaton* filter = filter_compile(phrases, 4);
+    CHECK(filter != NULL);
+    if (!filter) return;
+    CHECK(filter->phrase_count == 4);
+
+    struct { const char* text; int match; } cases[] = {
+        { "a bad word today", 1 },
+        { "a BAD Word today", 1 },
+        { "a bad  word today", 0 },
+        { "devilish", 1 },              // anywhere, not only whole words
+        { "ushers", 1 },                // "she" and "hers" overlap
+        { "xhxexrxs", 0 },
+        { "bad wor", 0 },
+        { "", 0 },
+        { "EVI", 0 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        int match = filter_match(filter, cases[i].text, strlen(cases[i].text));
+        if (match != cases[i].match) fprintf(stderr, "  filter case \"%s\"\n", cases[i].text);
+        CHECK(match == cases[i].match);
+    }
+    // Only the first `len` bytes count
+    CHECK(filter_match(filter, "evil", 3) == 0);
+    filter_free(filter);
+
+    // No phrases: nothing matches
+    filter = filter_compile(NULL, 0);
+    CHECK(filter && !filter_match(filter, "anything at all", 15));
+    filter_free(filter);
+
+    // A file: blank lines and comments skipped, whitespace trimmed
+    char path[] = "/tmp/filter_testXXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd != -1);
+    if (fd == -1) return;
+    const char* contents = "# moderation list\n\n  spam  \nscam\n";
+    CHECK(write(fd, contents, strlen(contents)) == (ssize_t)strlen(contents));
+    close(fd);
+    filter = filter_load(path);
+    unlink(path);
+    CHECK(filter && filter->phrase_count == 2);
+    if (filter) {
+        CHECK(filter_match(filter, "no SPAM please", 14));
+        CHECK(!filter_match(filter, "moderation list", 15));
+        filter_free(filter);
+    }
+    CHECK(filter_load("/nonexistent/filter") == NULL);
+}
+
+int main(void) {
+    test_filter();
+    printf("filter_test: %d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+// Unit tests for the wire formats: link_proto (cluster and replication
+// links), client_proto (binary client protocol) and websocket (upgrade and
+// client frames). Each check prints nothing unless it fails, and any
+// failure makes the exit status non-zero, so `make check` can just run it.
+// run: $ make check   (or: $ ./tests/proto_test)
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "link_proto.h"
+#include "client_proto.h"
+#include "websocket.h"
+
+static int checks, failures;
+
+#define CHECK(cond) do { \
+    checks++; \
+    if (!(cond)) { \
+        failures++; \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+    } \
+} while (0)
+
+static void add_record(LinkBatch* batch, const char* text) {
+    char* record = link_batch_reserve(batch, strlen(text) + 1);
+    CHECK(record != NULL);
+    if (!record) return;
+    memcpy(record, text, strlen(text) + 1);
+    link_batch_commit(batch, record, strlen(text) + 1);
+}
+
+static void test_link_batch(void) {
+    static LinkBatch batch;
+    const char* sent[] = { "JOIN lobby 1", "MSG lobby alice hi", "DELIVER lobby bob hello there" };
+    link_batch_reset(&batch);
+    for (int i = 0; i < 3; i++) add_record(&batch, sent[i]);
+    size_t len = link_batch_seal(&batch, 7);
+
+    LinkHeader header;
+    CHECK(link_frame_parse(batch.data, len, &header) == (int)len);
+    CHECK(header.type == LINK_BATCH);
+    CHECK(header.seq == 7);
+    CHECK(header.count == 3);
+    CHECK(header.len == len - LINK_HEADER_BYTES);
+
+    // Every shorter prefix asks for more bytes
+    int incomplete = 0;
+    for (size_t avail = 0; avail < len; avail++) {
+        if (link_frame_parse(batch.data, avail, &header) != 0) incomplete++;
+    }
+    CHECK(incomplete == 0);
+
+    char* cursor = batch.data + LINK_HEADER_BYTES;
+    char* end = batch.data + len;
+    size_t record_len;
+    for (int i = 0; i < 3; i++) {
+        char* record = link_batch_next(&cursor, end, &record_len);
+        CHECK(record && strcmp(record, sent[i]) == 0 && record_len == strlen(sent[i]) + 1);
+    }
+    CHECK(link_batch_next(&cursor, end, &record_len) == NULL);
+
+    // A batch fills up instead of overflowing its buffer
+    link_batch_reset(&batch);
+    int added = 0;
+    while (link_batch_reserve(&batch, 1000)) {
+        char* record = link_batch_reserve(&batch, 1000);
+        memset(record, 'x', 999);
+        record[999] = '\0';
+        link_batch_commit(&batch, record, 1000);
+        added++;
+    }
+    CHECK(added > 0 && batch.len <= LINK_MAX_FRAME);
+    CHECK(link_frame_parse(batch.data, link_batch_seal(&batch, 1), &header) > 0 && header.count == added);
+}
+
+static void test_link_malformed(void) {
+    char frame[LINK_HEADER_BYTES + 8];
+    LinkHeader header;
+
+    link_ack_encode(frame, 42, 16);
+    CHECK(link_frame_parse(frame, LINK_HEADER_BYTES, &header) == LINK_HEADER_BYTES);
+    CHECK(header.type == LINK_ACK && header.seq == 42 && header.count == 16);
+
+    // An ACK with a body, an unknown type and an oversized body
+    uint32_t len_n = htonl(4);
+    memcpy(frame, &len_n, 4);
+    CHECK(link_frame_parse(frame, sizeof(frame), &header) == -1);
+    link_ack_encode(frame, 1, 1);
+    frame[9] = 9;
+    CHECK(link_frame_parse(frame, sizeof(frame), &header) == -1);
+    static LinkBatch batch;
+    link_batch_reset(&batch);
+    link_batch_seal(&batch, 1);
+    len_n = htonl(LINK_BATCH_BYTES + 1);
+    memcpy(batch.data, &len_n, 4);
+    CHECK(link_frame_parse(batch.data, LINK_HEADER_BYTES, &header) == -1);
+
+    // Records that overrun the body or lack their NUL end the walk
+    char body[8] = { 0, 20, 'a', 'b', 'c', 0, 0, 0 };
+    char* cursor = body;
+    size_t record_len;
+    CHECK(link_batch_next(&cursor, body + sizeof(body), &record_len) == NULL && cursor == body + sizeof(body));
+    char unterminated[5] = { 0, 3, 'a', 'b', 'c' };
+    cursor = unterminated;
+    CHECK(link_batch_next(&cursor, unterminated + sizeof(unterminated), &record_len) == NULL);
+}
+
+static void test_bin_frames(void) {
+    char out[BIN_MAX_FRAME];
+    const char* login[] = { "alice" };
+    size_t login_len[] = { 5 };
+    size_t size = bin_frame_encode(out, sizeof(out), BIN_LOGIN, 5, 1, login, login_len);
+    CHECK(size == BIN_HEADER_BYTES + 2 + 6);
+
+    BinFrame frame;
+    CHECK(bin_frame_parse(out, size, &frame) == (int)size);
+    CHECK(frame.op == BIN_LOGIN && frame.id == 5 && frame.count == 1);
+    CHECK(frame.field_len[0] == 5 && strcmp(frame.field[0], "alice") == 0);
+    int incomplete = 0;
+    for (size_t avail = 0; avail < size; avail++) {
+        if (bin_frame_parse(out, avail, &frame) != 0) incomplete++;
+    }
+    CHECK(incomplete == 0);
+
+    // File chunks are binary: NULs inside a field survive
+    char chunk[BIN_CHUNK_BYTES];
+    for (size_t i = 0; i < sizeof(chunk); i++) chunk[i] = (char)(i * 7);
+    const char* fields[] = { "bob", "notes.txt", chunk, "3" };
+    size_t lens[] = { 3, 9, sizeof(chunk), 1 };
+    size = bin_frame_encode(out, sizeof(out), BIN_FILE_CHUNK, 9, 4, fields, lens);
+    CHECK(size > 0);
+    CHECK(bin_frame_parse(out, size, &frame) == (int)size);
+    CHECK(frame.count == 4 && frame.field_len[2] == sizeof(chunk) &&
+          memcmp(frame.field[2], chunk, sizeof(chunk)) == 0 && strcmp(frame.field[3], "3") == 0);
+
+    // Too big to encode, and a header that claims more than BIN_MAX_FRAME
+    char big[BIN_MAX_FRAME];
+    const char* big_field[] = { big };
+    size_t big_len[] = { sizeof(big) };
+    CHECK(bin_frame_encode(out, sizeof(out), BIN_BROADCAST, 1, 1, big_field, big_len) == 0);
+    CHECK(bin_frame_encode(out, 8, BIN_LOGIN, 1, 1, login, login_len) == 0);
+    size = bin_frame_encode(out, sizeof(out), BIN_LOGIN, 5, 1, login, login_len);
+    uint32_t len_n = htonl(BIN_MAX_FRAME);
+    memcpy(out, &len_n, 4);
+    CHECK(bin_frame_parse(out, size, &frame) == -1);
+}
+
+static void test_ws_handshake(void) {
+    // The example from RFC 6455, section 1.3
+    const char* request =
+        "GET /chat HTTP/1.1\r\nHost: server.example.com\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    char response[4096];
+    char stream[1024];
+    size_t consumed = 0;
+    snprintf(stream, sizeof(stream), "%s%s", request, "\x81");
+    CHECK(ws_handshake(stream, strlen(stream), response, sizeof(response), &consumed) > 0);
+    CHECK(strstr(response, "101 Switching Protocols") != NULL);
+    CHECK(strstr(response, "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != NULL);
+    CHECK(consumed == strlen(request));
+
+    CHECK(ws_handshake(request, strlen(request) - 2, response, sizeof(response), &consumed) == 0);
+    const char* plain = "GET / HTTP/1.1\r\nHost: x\r\n\r\n";
+    CHECK(ws_handshake(plain, strlen(plain), response, sizeof(response), &consumed) == -1);
+    CHECK(strncmp(response, "HTTP/1.1 200", 12) == 0);
+    const char* old = "GET / HTTP/1.1\r\nUpgrade: websocket\r\nSec-WebSocket-Key: abc\r\nSec-WebSocket-Version: 8\r\n\r\n";
+    CHECK(ws_handshake(old, strlen(old), response, sizeof(response), &consumed) == -1);
+    CHECK(strncmp(response, "HTTP/1.1 400", 12) == 0);
+}
+
+static void test_ws_frames(void) {
+    // RFC 6455, section 5.7: a masked "Hello"
+    char masked[] = { (char)0x81, (char)0x85, 0x37, (char)0xfa, 0x21, 0x3d, 0x7f, (char)0x9f, 0x4d, 0x51, 0x58 };
+    WsFrame frame;
+    CHECK(ws_frame_parse(masked, sizeof(masked), &frame) == (int)sizeof(masked));
+    CHECK(frame.opcode == WS_TEXT && frame.fin && frame.len == 5);
+    ws_mask(frame.payload, frame.len, frame.key);
+    CHECK(memcmp(frame.payload, "Hello", 5) == 0);
+    int incomplete = 0;
+    for (size_t avail = 0; avail < sizeof(masked); avail++) {
+        if (ws_frame_parse(masked, avail, &frame) != 0) incomplete++;
+    }
+    CHECK(incomplete == 0);
+
+    // Client frames must be masked; control frames stay short
+    char unmasked[] = { (char)0x81, 0x05, 'H', 'e', 'l', 'l', 'o' };
+    CHECK(ws_frame_parse(unmasked, sizeof(unmasked), &frame) == -1);
+    char long_ping[4 + 4 + 126] = { (char)0x89, (char)(0x80 | 126), 0, 126 };
+    CHECK(ws_frame_parse(long_ping, sizeof(long_ping), &frame) == -1);
+    char reserved[] = { (char)0xC1, (char)0x80, 1, 2, 3, 4 };
+    CHECK(ws_frame_parse(reserved, sizeof(reserved), &frame) == -1);
+
+    char header[WS_MAX_HEADER];
+    CHECK(ws_frame_header(header, WS_TEXT, 5) == 2 && (uint8_t)header[0] == 0x81 && header[1] == 5);
+    CHECK(ws_frame_header(header, WS_TEXT, 200) == 4 && (uint8_t)header[1] == 126 &&
+          (uint8_t)header[2] == 0 && (uint8_t)header[3] == 200);
+    CHECK(ws_frame_header(header, WS_BINARY, 70000) == 10 && (uint8_t)header[1] == 127);
+
+    // The vector path agrees with the byte-at-a-time definition, at any
+    // length and alignment
+    uint8_t key[4] = { 0x12, 0x34, 0x56, 0x78 };
+    char data[300], expect[300];
+    int mismatches = 0;
+    for (size_t offset = 0; offset < 4; offset++) {
+        for (size_t len = 0; len + offset <= sizeof(data); len += 37) {
+            for (size_t i = 0; i < sizeof(data); i++) data[i] = expect[i] = (char)(i * 13 + 5);
+            for (size_t i = 0; i < len; i++) expect[offset + i] ^= key[i % 4];
+            ws_mask(data + offset, len, key);
+            if (memcmp(data, expect, sizeof(data)) != 0) mismatches++;
+        }
+    }
+    CHECK(mismatches == 0);
+}
+
+int main(void) {
+    test_link_batch();
+    test_link_malformed();
+    test_bin_frames();
+    test_ws_handshake();
+    test_ws_frames();
+    printf("proto_test: %d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+// Unit tests for the hierarchical timer wheel: timers fire on their tick
+// whichever level they were filed in and however far the wheel jumps,
+// cancelled timers stay quiet, and re-arming (from outside or from the
+// callback itself) moves the deadline instead of adding a second one.
+// run: $ make check   (or: $ ./tests/timer_test)
+
+#include <stdio.h>
+#include <string.h>
+
+#include "timer_wheel.h"
+
+static int checks, failures;
+
+#define CHECK(cond) do { \
+    checks++; \
+    if (!(cond)) { \
+        failures++; \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+    } \
+} while (0)
+
+typedef struct {
+    Timer timer;
+    uint64_t fired_at;
+    int fired;
+    uint64_t period;               // re-arm from the callback when non-zero
+    int limit;
+    Timer* cancel;                 // cancelled from the callback when set
+} TestTimer;
+
+static TimerWheel wheel;
+static uint64_t now;
+
+static void on_fire(Timer* timer, void* arg) {
+    TestTimer* t = arg;
+    (void)timer;
+    t->fired++;
+    t->fired_at = now;
+    if (t->cancel) timer_cancel(&wheel, t->cancel);
+    if (t->period && t->fired < t->limit) timer_arm(&wheel, &t->timer, t->period, now);
+}
+
+static void setup(TestTimer* timers, int count, unsigned int tick_ms) {
+    memset(timers, 0, sizeof(*timers) * count);
+    now = 1000;
+    timer_wheel_init(&wheel, tick_ms, now);
+    for (int i = 0; i < count; i++) timer_init(&timers[i].timer, on_fire, &timers[i]);
+}
+
+// Fired once more than `before`, not early and at most a tick late: a timer
+// armed after its tick was processed counts from the next one
+static int fired_on_time(const TestTimer* t, int before, uint64_t due) {
+    return t->fired == before + 1 && t->fired_at >= due && t->fired_at <= due + wheel.tick_ms;
+}
+
+static void run_until(uint64_t end, uint64_t step) {
+    while (now < end) {
+        now = now + step < end ? now + step : end;
+        timer_wheel_advance(&wheel, now);
+    }
+}
+
+static void test_cascade(void) {
+    // Delays on and around every level boundary, in 1 ms ticks
+    static const uint64_t delays[] = {
+        1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 8191, 70000,
+        262143, 262144, 262145, 300000
+    };
+    enum { COUNT = sizeof(delays) / sizeof(delays[0]) };
+    static TestTimer timers[COUNT];
+    setup(timers, COUNT, 1);
+    uint64_t start = now;
+    for (int i = 0; i < COUNT; i++) timer_arm(&wheel, &timers[i].timer, delays[i], now);
+    CHECK(wheel.armed_count == COUNT);
+
+    run_until(start + 310000, 1);
+    int on_time = 0;
+    for (int i = 0; i < COUNT; i++) {
+        if (timers[i].fired == 1 && timers[i].fired_at == start + delays[i]) on_time++;
+        else fprintf(stderr, "  delay %llu fired %d times at +%llu\n", (unsigned long long)delays[i],
+            timers[i].fired, (unsigned long long)(timers[i].fired_at - start));
+    }
+    CHECK(on_time == COUNT);
+    CHECK(wheel.armed_count == 0);
+    CHECK(timer_wheel_next_timeout(&wheel, now) == -1);
+
+    // The same delays, but the loop only wakes every 997 ms: nothing fires
+    // early, and nothing is late by more than the gap between wakeups
+    setup(timers, COUNT, 1);
+    start = now;
+    for (int i = 0; i < COUNT; i++) timer_arm(&wheel, &timers[i].timer, delays[i], now);
+    run_until(start + 310000, 997);
+    int in_window = 0;
+    for (int i = 0; i < COUNT; i++) {
+        uint64_t due = start + delays[i];
+        if (timers[i].fired == 1 && timers[i].fired_at >= due && timers[i].fired_at < due + 997) in_window++;
+    }
+    CHECK(in_window == COUNT);
+}
+
+static void test_rounding(void) {
+    // With 100 ms ticks a deadline is rounded up, never down
+    static TestTimer timers[2];
+    setup(timers, 2, 100);
+    timer_arm(&wheel, &timers[0].timer, 250, now);
+    timer_arm(&wheel, &timers[1].timer, 300, now);
+    int wait = timer_wheel_next_timeout(&wheel, now);
+    CHECK(wait >= 0 && wait <= 300);
+    run_until(1000 + 299, 1);
+    CHECK(!timers[0].fired && !timers[1].fired);
+    run_until(1000 + 300, 1);
+    CHECK(timers[0].fired && timers[1].fired);
+
+    // A wheel that slept with nothing armed measures the next deadline from now
+    run_until(1000 + 60000, 60000);
+    timer_arm(&wheel, &timers[0].timer, 200, now);
+    uint64_t armed_at = now;
+    run_until(armed_at + 199, 1);
+    CHECK(timers[0].fired == 1);
+    run_until(armed_at + 400, 1);
+    CHECK(fired_on_time(&timers[0], 1, armed_at + 200));
+}
+
+static void test_cancel(void) {
+    static TestTimer timers[4];
+    setup(timers, 4, 1);
+
+    // Three timers share a slot; the middle one is cancelled
+    for (int i = 0; i < 3; i++) timer_arm(&wheel, &timers[i].timer, 5000, now);
+    timer_cancel(&wheel, &timers[1].timer);
+    timer_cancel(&wheel, &timers[1].timer);
+    CHECK(wheel.armed_count == 2);
+    run_until(now + 6000, 7);
+    CHECK(timers[0].fired == 1 && timers[1].fired == 0 && timers[2].fired == 1);
+
+    // Cancelling a timer that already fired is a no-op
+    timer_cancel(&wheel, &timers[0].timer);
+    CHECK(wheel.armed_count == 0);
+
+    // A callback cancels a sibling due on the same tick: the sibling stays quiet
+    setup(timers, 4, 1);
+    timers[0].cancel = &timers[1].timer;
+    timer_arm(&wheel, &timers[0].timer, 70, now);
+    timer_arm(&wheel, &timers[1].timer, 70, now);
+    timer_arm(&wheel, &timers[2].timer, 70, now);
+    run_until(now + 100, 1);
+    CHECK(timers[0].fired == 1 && timers[1].fired == 0 && timers[2].fired == 1);
+    CHECK(wheel.armed_count == 0);
+
+    // A higher-level timer cancelled before its slot cascades
+    timer_arm(&wheel, &timers[3].timer, 100000, now);
+    run_until(now + 50000, 1000);
+    timer_cancel(&wheel, &timers[3].timer);
+    run_until(now + 60000, 1000);
+    CHECK(timers[3].fired == 0);
+    CHECK(timer_wheel_next_timeout(&wheel, now) == -1);
+}
+
+static void test_rearm(void) {
+    static TestTimer timers[2];
+    setup(timers, 2, 1);
+    uint64_t start = now;
+
+    // Re-arming moves the deadline, as an idle timer does on activity
+    timer_arm(&wheel, &timers[0].timer, 100, now);
+    run_until(start + 50, 1);
+    timer_arm(&wheel, &timers[0].timer, 100, now);
+    CHECK(wheel.armed_count == 1);
+    run_until(start + 149, 1);
+    CHECK(timers[0].fired == 0);
+    run_until(start + 200, 1);
+    CHECK(fired_on_time(&timers[0], 0, start + 150));
+
+    // Re-arming from a lower level to a higher one and back
+    timer_arm(&wheel, &timers[0].timer, 10, now);
+    timer_arm(&wheel, &timers[0].timer, 20000, now);
+    timer_arm(&wheel, &timers[0].timer, 30, now);
+    uint64_t armed_at = now;
+    run_until(armed_at + 25000, 1);
+    CHECK(fired_on_time(&timers[0], 1, armed_at + 30));
+
+    // A heartbeat re-arms itself from its callback
+    timers[1].period = 30;
+    timers[1].limit = 200;
+    armed_at = now;
+    timer_arm(&wheel, &timers[1].timer, 30, now);
+    run_until(armed_at + 31 * 200 + 100, 1);
+    CHECK(timers[1].fired == 200);
+    CHECK(timers[1].fired_at >= armed_at + 30 * 200 && timers[1].fired_at <= armed_at + 31 * 200);
+    CHECK(wheel.armed_count == 0);
+}
+
+int main(void) {
+    test_cascade();
+    test_rounding();
+    test_cancel();
+    test_rearm();
+    printf("timer_test: %d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
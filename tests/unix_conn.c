@@ -0,0 +1,69 @@
+// Test helper: a line-oriented client for the --unix listener, like
+// `nc -U`. Copies stdin to the socket and the socket to stdout; at the end
+// of stdin it shuts down its sending side and keeps printing until the
+// server closes the connection.
+// run: $ ./tests/unix_conn <path>   (used by protocol_tests.sh)
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Writes all of `len` bytes; returns -1 once the peer is gone
+static int write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <path>\n", argv[0]);
+        return 1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", argv[1]);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("connect");
+        return 1;
+    }
+
+    char buf[4096];
+    struct pollfd fds[2] = { { sock, POLLIN, 0 }, { STDIN_FILENO, POLLIN, 0 } };
+    int nfds = 2;
+    while (1) {
+        if (poll(fds, nfds, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return 1;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = read(sock, buf, sizeof(buf));
+            if (n <= 0) break;
+            if (write_all(STDOUT_FILENO, buf, n) == -1) break;
+        }
+        if (nfds == 2 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n <= 0) {
+                shutdown(sock, SHUT_WR);
+                nfds = 1;
+            } else if (write_all(sock, buf, n) == -1) {
+                break;
+            }
+        }
+    }
+    close(sock);
+    return 0;
+}